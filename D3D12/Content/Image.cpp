@@ -9,6 +9,7 @@
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "Core/Paths.h"
+#include "Core/MappedFile.h"
 
 Image::Image(ResourceFormat format)
 	: m_Format(format)
@@ -26,9 +27,22 @@ Image::Image(uint32 width, uint32 height, uint32 depth, ResourceFormat format, u
 }
 
 bool Image::Load(const char* inputStream)
+{
+	return Load(inputStream, 0, 0xFFFFFFFF);
+}
+
+bool Image::Load(const char* inputStream, uint32 firstMip, uint32 numMips)
 {
 	const std::string extension = Paths::GetFileExtenstion(inputStream);
-	bool success = false;
+
+	// Read the requested mips straight out of the mapped file
+	if (extension == "dds")
+	{
+		MappedFile file;
+		if (!file.Open(inputStream))
+			return false;
+		return LoadDDS(file.GetData(), file.GetSize(), firstMip, numMips);
+	}
 
 	FILE* pFile = nullptr;
 	fopen_s(&pFile, inputStream, "rb");
@@ -39,24 +53,17 @@ bool Image::Load(const char* inputStream)
 	std::vector<char> data((size_t)ftell(pFile));
 	fseek(pFile, 0, SEEK_SET);
 	fread(data.data(), data.size(), 1, pFile);
+	fclose(pFile);
 
-	if (extension == "dds")
-	{
-		success = LoadDDS(data.data(), (uint32)data.size());
-	}
 	//If not one of the above, load with Stbi by default (jpg, png, tga, bmp, ...)
-	else
-	{
-		success = LoadSTB(data.data(), (uint32)data.size());
-	}
-	return success;
+	return LoadSTB(data.data(), (uint32)data.size());
 }
 
 bool Image::Load(const void* pData, size_t dataSize, const char* pFormatHint)
 {
 	if (std::string(pFormatHint).find("dds") != std::string::npos)
 	{
-		return LoadDDS(pData, (uint32)dataSize);
+		return LoadDDS(pData, dataSize);
 	}
 	return LoadSTB(pData, (uint32)dataSize);
 }
@@ -204,10 +211,8 @@ bool Image::LoadSTB(const void* pBytes, uint32 numBytes)
 	}
 }
 
-bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
+namespace DDS
 {
-	char* pBytes = (char*)pData;
-
 	// .DDS subheader.
 #pragma pack(push,1)
 	struct PixelFormatHeader
@@ -265,22 +270,32 @@ bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
 		DDSCAPS2_CUBEMAP = 0x00000200U,
 	};
 
-	auto MakeFourCC = [](uint32 a, uint32 b, uint32 c, uint32 d) { return a | (b << 8u) | (c << 16u) | (d << 24u); };
+	constexpr uint32 MaxHeaderSize = 4 + sizeof(FileHeader) + sizeof(DX10FileHeader);
+
+	constexpr uint32 MakeFourCC(uint32 a, uint32 b, uint32 c, uint32 d) { return a | (b << 8u) | (c << 16u) | (d << 24u); }
 
-	constexpr const char pMagic[] = "DDS ";
-	if (memcmp(pMagic, pBytes, 4) != 0)
+	// Parses the magic and headers. outHeaderSize is the offset of the first pixel
+	bool ParseHeader(const void* pData, uint64 numBytes, ImageInfo& outInfo, uint32& outHeaderSize)
 	{
-		return false;
-	}
-	pBytes += 4;
+		const char* pBytes = (const char*)pData;
+
+		constexpr const char pMagic[] = "DDS ";
+		if (numBytes < 4 + sizeof(FileHeader) || memcmp(pMagic, pBytes, 4) != 0)
+		{
+			return false;
+		}
+		pBytes += 4;
 
-	const FileHeader* pHeader = (FileHeader*)pBytes;
-	pBytes += sizeof(FileHeader);
+		const FileHeader* pHeader = (const FileHeader*)pBytes;
+		pBytes += sizeof(FileHeader);
 
-	if (pHeader->dwSize == sizeof(FileHeader) &&
-		pHeader->ddpf.dwSize == sizeof(PixelFormatHeader))
-	{
-		m_sRgb = false;
+		if (pHeader->dwSize != sizeof(FileHeader) ||
+			pHeader->ddpf.dwSize != sizeof(PixelFormatHeader))
+		{
+			return false;
+		}
+
+		outInfo = ImageInfo();
 		uint32 bpp = pHeader->ddpf.dwRGBBitCount;
 
 		uint32 fourCC = pHeader->ddpf.dwFourCC;
@@ -289,7 +304,11 @@ bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
 
 		if (hasDxgi)
 		{
-			pDx10Header = (DX10FileHeader*)pBytes;
+			if (numBytes < MaxHeaderSize)
+			{
+				return false;
+			}
+			pDx10Header = (const DX10FileHeader*)pBytes;
 			pBytes += sizeof(DX10FileHeader);
 
 			auto ConvertDX10Format = [](DXGI_FORMAT format, ResourceFormat& outFormat, bool& outSRGB)
@@ -307,18 +326,18 @@ bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
 				if (format == DXGI_FORMAT_R32G32B32A32_FLOAT)	{ outFormat = ResourceFormat::RGBA32_FLOAT;			outSRGB = false;	return;		}
 				if (format == DXGI_FORMAT_R32G32_FLOAT)			{ outFormat = ResourceFormat::RG32_FLOAT;			outSRGB = false;	return;		}
 			};
-			ConvertDX10Format((DXGI_FORMAT)pDx10Header->dxgiFormat, m_Format, m_sRgb);
+			ConvertDX10Format((DXGI_FORMAT)pDx10Header->dxgiFormat, outInfo.Format, outInfo.IsSRGB);
 		}
 		else
 		{
 			switch (fourCC)
 			{
-			case MakeFourCC('B', 'C', '4', 'U'):	m_Format = ResourceFormat::BC4_UNORM;		break;
-			case MakeFourCC('D', 'X', 'T', '1'):	m_Format = ResourceFormat::BC1_UNORM;		break;
-			case MakeFourCC('D', 'X', 'T', '3'):	m_Format = ResourceFormat::BC2_UNORM;		break;
-			case MakeFourCC('D', 'X', 'T', '5'):	m_Format = ResourceFormat::BC3_UNORM;		break;
-			case MakeFourCC('B', 'C', '5', 'U'):	m_Format = ResourceFormat::BC5_UNORM;		break;
-			case MakeFourCC('A', 'T', 'I', '2'):	m_Format = ResourceFormat::BC5_UNORM;		break;
+			case MakeFourCC('B', 'C', '4', 'U'):	outInfo.Format = ResourceFormat::BC4_UNORM;		break;
+			case MakeFourCC('D', 'X', 'T', '1'):	outInfo.Format = ResourceFormat::BC1_UNORM;		break;
+			case MakeFourCC('D', 'X', 'T', '3'):	outInfo.Format = ResourceFormat::BC2_UNORM;		break;
+			case MakeFourCC('D', 'X', 'T', '5'):	outInfo.Format = ResourceFormat::BC3_UNORM;		break;
+			case MakeFourCC('B', 'C', '5', 'U'):	outInfo.Format = ResourceFormat::BC5_UNORM;		break;
+			case MakeFourCC('A', 'T', 'I', '2'):	outInfo.Format = ResourceFormat::BC5_UNORM;		break;
 			case 0:
 				if (bpp == 32)
 				{
@@ -332,11 +351,11 @@ bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
 
 					if (TestMask(0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000))
 					{
-						m_Format = ResourceFormat::RGBA8_UNORM;
+						outInfo.Format = ResourceFormat::RGBA8_UNORM;
 					}
 					else if (TestMask(0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000))
 					{
-						m_Format = ResourceFormat::BGRA8_UNORM;
+						outInfo.Format = ResourceFormat::BGRA8_UNORM;
 					}
 					else
 					{
@@ -349,36 +368,100 @@ bool Image::LoadDDS(const void* pData, uint32 /*numBytes*/)
 			}
 		}
 
+		outInfo.Width = Math::Max(1u, pHeader->dwWidth);
+		outInfo.Height = Math::Max(1u, pHeader->dwHeight);
+		outInfo.Depth = Math::Max(1u, pHeader->dwDepth);
+		outInfo.MipLevels = Math::Max(1u, pHeader->dwMipMapCount);
+		outInfo.IsHDR = outInfo.Format == ResourceFormat::BC6H_UFLOAT || outInfo.Format == ResourceFormat::RGBA32_FLOAT || outInfo.Format == ResourceFormat::RG32_FLOAT;
+
 		bool isCubemap = (pHeader->dwCaps2 & 0x0000FC00U) != 0 || (hasDxgi && (pDx10Header->miscFlag & 0x4) != 0);
-		uint32 imageChainCount = 1;
 		if (isCubemap)
 		{
-			imageChainCount = 6;
-			m_IsCubemap = true;
+			outInfo.ArraySize = 6;
+			outInfo.IsCubemap = true;
 		}
 		else if (hasDxgi && pDx10Header->arraySize > 1)
 		{
-			imageChainCount = pDx10Header->arraySize;
-			m_IsArray = true;
+			outInfo.ArraySize = pDx10Header->arraySize;
+			outInfo.IsArray = true;
 		}
 
-		Image* pCurrentImage = this;
-		for (uint32 imageIdx = 0; imageIdx < imageChainCount; ++imageIdx)
-		{
-			pCurrentImage->SetSize(pHeader->dwWidth, pHeader->dwHeight, pHeader->dwDepth, pHeader->dwMipMapCount);
-			pCurrentImage->SetData(pBytes);
+		outHeaderSize = (uint32)(pBytes - (const char*)pData);
+		return true;
+	}
+}
 
-			if (imageIdx < imageChainCount - 1)
-			{
-				pCurrentImage->m_pNextImage = std::make_unique<Image>(m_Format);
-				pCurrentImage = pCurrentImage->m_pNextImage.get();
-			}
-		}
+bool Image::GetInfo(const char* pFilePath, ImageInfo& outInfo)
+{
+	const std::string extension = Paths::GetFileExtenstion(pFilePath);
+	if (extension == "dds")
+	{
+		FILE* pFile = nullptr;
+		fopen_s(&pFile, pFilePath, "rb");
+		if (!pFile)
+			return false;
+
+		char header[DDS::MaxHeaderSize];
+		size_t numBytes = fread(header, 1, sizeof(header), pFile);
+		fclose(pFile);
+
+		uint32 headerSize = 0;
+		return DDS::ParseHeader(header, numBytes, outInfo, headerSize);
 	}
-	else
+
+	// Stbi always decodes to 4 components
+	int width, height, components;
+	if (!stbi_info(pFilePath, &width, &height, &components))
+		return false;
+
+	outInfo = ImageInfo();
+	outInfo.Width = (uint32)width;
+	outInfo.Height = (uint32)height;
+	outInfo.IsHDR = stbi_is_hdr(pFilePath);
+	outInfo.Format = outInfo.IsHDR ? ResourceFormat::RGBA32_FLOAT : ResourceFormat::RGBA8_UNORM;
+	return true;
+}
+
+bool Image::LoadDDS(const void* pData, uint64 numBytes, uint32 firstMip, uint32 numMips)
+{
+	ImageInfo info;
+	uint32 headerSize = 0;
+	if (!DDS::ParseHeader(pData, numBytes, info, headerSize))
+	{
+		return false;
+	}
+
+	firstMip = Math::Min(firstMip, info.MipLevels - 1);
+	numMips = Math::Min(numMips, info.MipLevels - firstMip);
+
+	// Every slice stores its full mip chain contiguously
+	const uint64 sliceSize = RHI::GetTextureByteSize(info.Format, info.Width, info.Height, info.Depth, info.MipLevels);
+	const uint64 mipOffset = RHI::GetTextureByteSize(info.Format, info.Width, info.Height, info.Depth, firstMip);
+	if (headerSize + sliceSize * info.ArraySize > numBytes)
 	{
+		E_LOG(Warning, "DDS file is truncated. Expected %llu bytes but got %llu", headerSize + sliceSize * info.ArraySize, numBytes);
 		return false;
 	}
+
+	m_Format = info.Format;
+	m_sRgb = info.IsSRGB;
+	m_IsHdr = info.IsHDR;
+	m_IsCubemap = info.IsCubemap;
+	m_IsArray = info.IsArray;
+
+	const uint8* pBytes = (const uint8*)pData + headerSize;
+	Image* pCurrentImage = this;
+	for (uint32 imageIdx = 0; imageIdx < info.ArraySize; ++imageIdx)
+	{
+		pCurrentImage->SetSize(info.Width >> firstMip, info.Height >> firstMip, info.Depth >> firstMip, numMips);
+		pCurrentImage->SetData(pBytes + imageIdx * sliceSize + mipOffset);
+
+		if (imageIdx < info.ArraySize - 1)
+		{
+			pCurrentImage->m_pNextImage = std::make_unique<Image>(m_Format);
+			pCurrentImage = pCurrentImage->m_pNextImage.get();
+		}
+	}
 	return true;
 }
 
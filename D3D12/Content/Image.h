@@ -1,15 +1,34 @@
 #pragma once
 #include "Graphics/RHI/RHI.h"
 
+struct ImageInfo
+{
+	uint32 Width = 0;
+	uint32 Height = 0;
+	uint32 Depth = 1;
+	uint32 MipLevels = 1;
+	uint32 ArraySize = 1;
+	ResourceFormat Format = ResourceFormat::Unknown;
+	bool IsSRGB = false;
+	bool IsHDR = false;
+	bool IsCubemap = false;
+	bool IsArray = false;
+};
+
 class Image final
 {
 public:
 	Image(ResourceFormat format = ResourceFormat::Unknown);
 	Image(uint32 width, uint32 height, uint32 depth, ResourceFormat format, uint32 numMips = 1, const void* pInitialData = nullptr);
 	bool Load(const char* filePath);
+	// Loads mips [firstMip, firstMip + numMips) of every slice. Only DDS stores mips, other formats always load the full image.
+	bool Load(const char* filePath, uint32 firstMip, uint32 numMips);
 	bool Load(const void* pData, size_t dataSize, const char* pFormatHint);
 	void Save(const char* pFilePath);
 
+	// Reads only the file header. Doesn't decode or allocate any pixel data.
+	static bool GetInfo(const char* pFilePath, ImageInfo& outInfo);
+
 	bool SetSize(uint32 x, uint32 y, uint32 depth, uint32 numMips);
 	bool SetData(const void* pPixels);
 	bool SetData(const void* pData, uint32 offsetInBytes, uint32 sizeInBytes);
@@ -33,7 +52,7 @@ public:
 	const Image* GetNextImage() const { return m_pNextImage.get(); }
 
 private:
-	bool LoadDDS(const void* pBytes, uint32 numBytes);
+	bool LoadDDS(const void* pBytes, uint64 numBytes, uint32 firstMip = 0, uint32 numMips = 0xFFFFFFFF);
 	bool LoadSTB(const void* pBytes, uint32 numBytes);
 
 	uint32 m_Width = 0;
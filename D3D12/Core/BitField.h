@@ -392,6 +392,14 @@ public:
 		return Bits;
 	}
 
+	static constexpr uint32 NumStorageElements()
+	{
+		return Elements();
+	}
+
+	Storage* GetData() { return Data; }
+	const Storage* GetData() const { return Data; }
+
 private:
 
 	static constexpr uint32 StorageIndexOfBit(uint32 bit)
@@ -0,0 +1,208 @@
+#pragma once
+#include <vector>
+#include <intrin.h>
+#include <immintrin.h>
+
+/*
+	Bit field with a size defined at runtime.
+	Storage is padded to whole blocks of 128 bits so bulk operations work on a block at a time without a tail loop.
+	Bits past Size() are always 0, so counting and iterating can work on whole words.
+*/
+class DynamicBitField
+{
+public:
+	static constexpr uint32 BitsPerWord = 32;
+	static constexpr uint32 WordsPerBlock = 4;
+
+	DynamicBitField() = default;
+
+	explicit DynamicBitField(uint32 numBits)
+	{
+		Resize(numBits);
+	}
+
+	// Bits added by growing are cleared
+	void Resize(uint32 numBits)
+	{
+		uint32 numWords = (numBits + BitsPerWord - 1) / BitsPerWord;
+		numWords = (numWords + WordsPerBlock - 1) / WordsPerBlock * WordsPerBlock;
+		m_Words.resize(numWords, 0);
+		m_Size = numBits;
+		ClearPadding();
+	}
+
+	void ClearAll()
+	{
+		Fill(0);
+	}
+
+	void SetAll()
+	{
+		Fill(~0u);
+		ClearPadding();
+	}
+
+	inline void SetBit(uint32 bit)
+	{
+		check(bit < Size(), "Bit %d out of range (%d)", bit, Size());
+		m_Words[bit / BitsPerWord] |= 1u << (bit % BitsPerWord);
+	}
+
+	inline void ClearBit(uint32 bit)
+	{
+		check(bit < Size(), "Bit %d out of range (%d)", bit, Size());
+		m_Words[bit / BitsPerWord] &= ~(1u << (bit % BitsPerWord));
+	}
+
+	inline bool GetBit(uint32 bit) const
+	{
+		check(bit < Size(), "Bit %d out of range (%d)", bit, Size());
+		return (m_Words[bit / BitsPerWord] >> (bit % BitsPerWord)) & 1;
+	}
+
+	void AssignBit(uint32 bit, bool set)
+	{
+		set ? SetBit(bit) : ClearBit(bit);
+	}
+
+	// Counts the bits of each byte with SSE2 bit tricks, then sums the bytes of a block with _mm_sad_epu8.
+	// This doesn't need the POPCNT instruction.
+	uint32 CountSetBits() const
+	{
+		const __m128i mask1 = _mm_set1_epi8(0x55);
+		const __m128i mask2 = _mm_set1_epi8(0x33);
+		const __m128i mask4 = _mm_set1_epi8(0x0F);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i total = zero;
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+		{
+			__m128i bits = LoadBlock(i);
+			bits = _mm_sub_epi8(bits, _mm_and_si128(_mm_srli_epi16(bits, 1), mask1));
+			bits = _mm_add_epi8(_mm_and_si128(bits, mask2), _mm_and_si128(_mm_srli_epi16(bits, 2), mask2));
+			bits = _mm_and_si128(_mm_add_epi8(bits, _mm_srli_epi16(bits, 4)), mask4);
+			total = _mm_add_epi64(total, _mm_sad_epu8(bits, zero));
+		}
+		return (uint32)(_mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total)));
+	}
+
+	bool HasAnyBitSet() const
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+		{
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(LoadBlock(i), zero)) != 0xFFFF)
+				return true;
+		}
+		return false;
+	}
+
+	bool HasNoBitSet() const
+	{
+		return !HasAnyBitSet();
+	}
+
+	// Calls 'callback(uint32 bit)' for each set bit, in increasing order. Empty blocks are skipped at once.
+	template<typename Callback>
+	void ForEachSetBit(Callback&& callback) const
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (uint32 block = 0; block < (uint32)m_Words.size(); block += WordsPerBlock)
+		{
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(LoadBlock(block), zero)) == 0xFFFF)
+				continue;
+
+			for (uint32 wordIndex = block; wordIndex < block + WordsPerBlock; ++wordIndex)
+			{
+				uint32 word = m_Words[wordIndex];
+				unsigned long bitIndex;
+				while (_BitScanForward(&bitIndex, word))
+				{
+					callback(wordIndex * BitsPerWord + bitIndex);
+					word &= word - 1;
+				}
+			}
+		}
+	}
+
+	// Appends the index of each set bit to 'outIndices', in increasing order
+	void Compact(std::vector<uint32>& outIndices) const
+	{
+		outIndices.reserve(outIndices.size() + CountSetBits());
+		ForEachSetBit([&](uint32 bit) { outIndices.push_back(bit); });
+	}
+
+	DynamicBitField& operator&=(const DynamicBitField& other)
+	{
+		check(other.Size() == Size(), "Bit field sizes don't match (%d vs %d)", other.Size(), Size());
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+			StoreBlock(i, _mm_and_si128(LoadBlock(i), other.LoadBlock(i)));
+		return *this;
+	}
+
+	DynamicBitField& operator|=(const DynamicBitField& other)
+	{
+		check(other.Size() == Size(), "Bit field sizes don't match (%d vs %d)", other.Size(), Size());
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+			StoreBlock(i, _mm_or_si128(LoadBlock(i), other.LoadBlock(i)));
+		return *this;
+	}
+
+	// Clears all bits which are set in 'other'
+	void ClearBits(const DynamicBitField& other)
+	{
+		check(other.Size() == Size(), "Bit field sizes don't match (%d vs %d)", other.Size(), Size());
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+			StoreBlock(i, _mm_andnot_si128(other.LoadBlock(i), LoadBlock(i)));
+	}
+
+	bool operator[](uint32 index) const
+	{
+		return GetBit(index);
+	}
+
+	uint32 Size() const
+	{
+		return m_Size;
+	}
+
+	uint32 GetNumWords() const
+	{
+		return (uint32)m_Words.size();
+	}
+
+	uint32* GetData() { return m_Words.data(); }
+	const uint32* GetData() const { return m_Words.data(); }
+
+private:
+	__m128i LoadBlock(uint32 wordIndex) const
+	{
+		return _mm_loadu_si128((const __m128i*)&m_Words[wordIndex]);
+	}
+
+	void StoreBlock(uint32 wordIndex, __m128i value)
+	{
+		_mm_storeu_si128((__m128i*)&m_Words[wordIndex], value);
+	}
+
+	void Fill(uint32 value)
+	{
+		const __m128i block = _mm_set1_epi32((int)value);
+		for (uint32 i = 0; i < (uint32)m_Words.size(); i += WordsPerBlock)
+			StoreBlock(i, block);
+	}
+
+	void ClearPadding()
+	{
+		uint32 firstPaddingWord = m_Size / BitsPerWord;
+		if (m_Size % BitsPerWord != 0)
+		{
+			m_Words[firstPaddingWord] &= (1u << (m_Size % BitsPerWord)) - 1;
+			++firstPaddingWord;
+		}
+		for (uint32 i = firstPaddingWord; i < (uint32)m_Words.size(); ++i)
+			m_Words[i] = 0;
+	}
+
+	std::vector<uint32> m_Words;
+	uint32 m_Size = 0;
+};
@@ -0,0 +1,77 @@
+#include "stdafx.h"
+#include "Hash.h"
+
+namespace
+{
+	inline uint64 Rotl64(uint64 x, uint32 r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64 FMix64(uint64 k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdull;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ull;
+		k ^= k >> 33;
+		return k;
+	}
+
+	constexpr uint64 C1 = 0x87c37b91114253d5ull;
+	constexpr uint64 C2 = 0x4cf5ad432745937full;
+}
+
+namespace Hash
+{
+	Hash128 Murmur3_128(const void* pData, uint64 size, uint64 seed)
+	{
+		const uint8* pBytes = (const uint8*)pData;
+		const uint64 numBlocks = size / 16;
+
+		uint64 h1 = seed;
+		uint64 h2 = seed;
+
+		for (uint64 i = 0; i < numBlocks; ++i)
+		{
+			uint64 k1, k2;
+			memcpy(&k1, pBytes + i * 16, sizeof(uint64));
+			memcpy(&k2, pBytes + i * 16 + 8, sizeof(uint64));
+
+			k1 *= C1; k1 = Rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+			h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+			k2 *= C2; k2 = Rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+			h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+		}
+
+		// Remaining 0-15 bytes
+		const uint8* pTail = pBytes + numBlocks * 16;
+		const uint32 tailSize = (uint32)(size & 15);
+		uint64 k1 = 0;
+		uint64 k2 = 0;
+		for (uint32 i = tailSize; i > 8; --i)
+			k2 ^= (uint64)pTail[i - 1] << ((i - 9) * 8);
+		if (tailSize > 8)
+		{
+			k2 *= C2; k2 = Rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+		}
+		for (uint32 i = Math::Min(tailSize, 8u); i > 0; --i)
+			k1 ^= (uint64)pTail[i - 1] << ((i - 1) * 8);
+		if (tailSize > 0)
+		{
+			k1 *= C1; k1 = Rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+		}
+
+		h1 ^= size;
+		h2 ^= size;
+		h1 += h2;
+		h2 += h1;
+		h1 = FMix64(h1);
+		h2 = FMix64(h2);
+		h1 += h2;
+		h2 += h1;
+
+		return Hash128{ h1, h2 };
+	}
+}
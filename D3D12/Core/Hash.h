@@ -0,0 +1,34 @@
+#pragma once
+
+// 128-bit hash, used where collisions must be practically impossible, like content addressing.
+struct Hash128
+{
+	uint64 Low = 0;
+	uint64 High = 0;
+
+	bool operator==(const Hash128& other) const { return Low == other.Low && High == other.High; }
+	bool operator!=(const Hash128& other) const { return !operator==(other); }
+};
+
+namespace std
+{
+	template<>
+	struct hash<Hash128>
+	{
+		size_t operator()(const Hash128& hash) const
+		{
+			return (size_t)(hash.Low ^ (hash.High * 0x9E3779B97F4A7C15ull));
+		}
+	};
+}
+
+namespace Hash
+{
+	// MurmurHash3 x64 128-bit variant
+	Hash128 Murmur3_128(const void* pData, uint64 size, uint64 seed = 0);
+
+	inline Hash128 Murmur3_128(const std::string& str, uint64 seed = 0)
+	{
+		return Murmur3_128(str.data(), str.size(), seed);
+	}
+}
@@ -0,0 +1,53 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* pFilePath, bool allowWrites)
+{
+	check(!IsOpen());
+
+	m_File = ::CreateFileA(pFilePath, GENERIC_READ, allowWrites ? FILE_SHARE_READ | FILE_SHARE_WRITE : FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!::GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	m_Size = (uint64)size.QuadPart;
+
+	m_Mapping = ::CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_Mapping)
+	{
+		Close();
+		return false;
+	}
+
+	m_pData = (const uint8*)::MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData)
+		::UnmapViewOfFile(m_pData);
+	if (m_Mapping)
+		::CloseHandle(m_Mapping);
+	if (m_File != INVALID_HANDLE_VALUE)
+		::CloseHandle(m_File);
+	m_pData = nullptr;
+	m_Mapping = nullptr;
+	m_File = INVALID_HANDLE_VALUE;
+	m_Size = 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Read-only view of a file mapped into the address space.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// 'allowWrites' lets other handles write to the file while it is mapped, eg. to append to it
+	bool Open(const char* pFilePath, bool allowWrites = false);
+	void Close();
+
+	bool IsOpen() const { return m_pData != nullptr; }
+	const uint8* GetData() const { return m_pData; }
+	uint64 GetSize() const { return m_Size; }
+
+private:
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+	HANDLE m_Mapping = nullptr;
+	const uint8* m_pData = nullptr;
+	uint64 m_Size = 0;
+};
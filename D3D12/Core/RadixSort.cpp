@@ -0,0 +1,87 @@
+#include "stdafx.h"
+#include "RadixSort.h"
+#include "Profiler.h"
+#include "TaskQueue.h"
+
+namespace RadixSort
+{
+	static constexpr uint32 BitsPerPass = 8;
+	static constexpr uint32 NumPasses = 64 / BitsPerPass;
+	static constexpr uint32 NumBuckets = 1 << BitsPerPass;
+
+	void Sort(std::vector<uint64>& keys, std::vector<uint32>& values, bool parallel)
+	{
+		PROFILE_CPU_SCOPE();
+
+		check(keys.size() == values.size());
+		const uint32 count = (uint32)keys.size();
+		if (count <= 1)
+			return;
+
+		// A pass can be skipped if no key differs from the first in its digit
+		uint64 differingBits = 0;
+		for (uint64 key : keys)
+			differingBits |= key ^ keys[0];
+
+		const uint32 elementsPerJob = parallel ? ElementsPerJob : count;
+		const uint32 numJobs = Math::DivideAndRoundUp(count, elementsPerJob);
+		auto RunJobs = [numJobs](auto&& job)
+		{
+			if (numJobs == 1)
+			{
+				job(0);
+				return;
+			}
+			TaskContext context;
+			TaskQueue::ExecuteMany([&](TaskDistributeArgs args) { job((uint32)args.JobIndex); }, context, numJobs, 1);
+			TaskQueue::Join(context);
+		};
+
+		std::vector<std::array<uint32, NumBuckets>> histograms(numJobs);
+		std::vector<uint64> tempKeys(count);
+		std::vector<uint32> tempValues(count);
+
+		for (uint32 pass = 0; pass < NumPasses; ++pass)
+		{
+			const uint32 shift = pass * BitsPerPass;
+			if (((differingBits >> shift) & (NumBuckets - 1)) == 0)
+				continue;
+
+			RunJobs([&](uint32 job)
+				{
+					std::array<uint32, NumBuckets>& histogram = histograms[job];
+					histogram.fill(0);
+					const uint32 last = Math::Min(count, (job + 1) * elementsPerJob);
+					for (uint32 i = job * elementsPerJob; i < last; ++i)
+						histogram[(keys[i] >> shift) & (NumBuckets - 1)]++;
+				});
+
+			// Exclusive prefix sum over digits, then over jobs, so each job writes its elements after those of the previous jobs
+			uint32 offset = 0;
+			for (uint32 digit = 0; digit < NumBuckets; ++digit)
+			{
+				for (std::array<uint32, NumBuckets>& histogram : histograms)
+				{
+					uint32 digitCount = histogram[digit];
+					histogram[digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			RunJobs([&](uint32 job)
+				{
+					std::array<uint32, NumBuckets>& offsets = histograms[job];
+					const uint32 last = Math::Min(count, (job + 1) * elementsPerJob);
+					for (uint32 i = job * elementsPerJob; i < last; ++i)
+					{
+						uint32 target = offsets[(keys[i] >> shift) & (NumBuckets - 1)]++;
+						tempKeys[target] = keys[i];
+						tempValues[target] = values[i];
+					}
+				});
+
+			keys.swap(tempKeys);
+			values.swap(tempValues);
+		}
+	}
+}
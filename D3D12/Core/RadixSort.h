@@ -0,0 +1,16 @@
+#pragma once
+
+/*
+	LSD radix sort of 64-bit keys, each with a 32-bit value.
+	Keys are sorted 8 bits per pass. Passes where all keys have the same digit are skipped,
+	which is common when only part of the key bits are used.
+	Large inputs are split in blocks which are counted and scattered in parallel on the TaskQueue.
+*/
+namespace RadixSort
+{
+	// Number of elements counted and scattered by a single job
+	constexpr uint32 ElementsPerJob = 16 * 1024;
+
+	// Sorts 'keys' and 'values' by key. The sort is stable.
+	void Sort(std::vector<uint64>& keys, std::vector<uint32>& values, bool parallel = true);
+}
@@ -0,0 +1,329 @@
+#include "stdafx.h"
+#include "TLSFAllocator.h"
+
+TLSFAllocator::TLSFAllocator(uint64 size, uint32 granularity)
+	: m_Size(size / granularity * granularity), m_Granularity(granularity)
+{
+	check(granularity > 0 && (granularity & (granularity - 1)) == 0);
+	check(m_Size > 0);
+	for (std::array<uint32, SecondLevelCount>& lists : m_FreeLists)
+		lists.fill(InvalidBlock);
+
+	m_FirstBlock = CreateBlock();
+	m_Blocks[m_FirstBlock].Size = m_Size;
+	InsertFreeBlock(m_FirstBlock);
+}
+
+TLSFAllocator::Allocation TLSFAllocator::Allocate(uint64 size, uint32 alignment)
+{
+	check(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	alignment = Math::Max(alignment, m_Granularity);
+	const uint64 allocationSize = Math::Max<uint64>((size + m_Granularity - 1) / m_Granularity, 1) * m_Granularity;
+
+	// Any block of the searched size can fit the allocation at the worst alignment
+	uint32 block = FindFreeBlock(allocationSize + alignment - m_Granularity);
+	if (block == InvalidBlock)
+		return Allocation();
+	RemoveFreeBlock(block);
+
+	const uint64 padding = Math::AlignUp<uint64>(m_Blocks[block].Offset, alignment) - m_Blocks[block].Offset;
+	if (padding > 0)
+	{
+		// The previous block is never free, so the padding becomes a free block of its own
+		uint32 front = CreateBlock();
+		Block& frontBlock = m_Blocks[front];
+		Block& allocatedBlock = m_Blocks[block];
+		frontBlock.Offset = allocatedBlock.Offset;
+		frontBlock.Size = padding;
+		frontBlock.PrevPhysical = allocatedBlock.PrevPhysical;
+		frontBlock.NextPhysical = block;
+		if (frontBlock.PrevPhysical != InvalidBlock)
+			m_Blocks[frontBlock.PrevPhysical].NextPhysical = front;
+		else
+			m_FirstBlock = front;
+		allocatedBlock.PrevPhysical = front;
+		allocatedBlock.Offset += padding;
+		allocatedBlock.Size -= padding;
+		InsertFreeBlock(front);
+	}
+	SplitFreeTail(block, allocationSize);
+
+	Allocation allocation;
+	allocation.Offset = m_Blocks[block].Offset;
+	allocation.Size = allocationSize;
+	allocation.Block = block;
+	return allocation;
+}
+
+void TLSFAllocator::Free(const Allocation& allocation)
+{
+	uint32 block = allocation.Block;
+	check(block < m_Blocks.size());
+	check(!m_Blocks[block].IsFree && m_Blocks[block].Offset == allocation.Offset, "Allocation at offset %llu is not allocated", allocation.Offset);
+
+	uint32 prev = m_Blocks[block].PrevPhysical;
+	if (prev != InvalidBlock && m_Blocks[prev].IsFree)
+	{
+		RemoveFreeBlock(prev);
+		Block& prevBlock = m_Blocks[prev];
+		prevBlock.Size += m_Blocks[block].Size;
+		prevBlock.NextPhysical = m_Blocks[block].NextPhysical;
+		if (prevBlock.NextPhysical != InvalidBlock)
+			m_Blocks[prevBlock.NextPhysical].PrevPhysical = prev;
+		DestroyBlock(block);
+		block = prev;
+	}
+
+	uint32 next = m_Blocks[block].NextPhysical;
+	if (next != InvalidBlock && m_Blocks[next].IsFree)
+	{
+		RemoveFreeBlock(next);
+		Block& freeBlock = m_Blocks[block];
+		freeBlock.Size += m_Blocks[next].Size;
+		freeBlock.NextPhysical = m_Blocks[next].NextPhysical;
+		if (freeBlock.NextPhysical != InvalidBlock)
+			m_Blocks[freeBlock.NextPhysical].PrevPhysical = block;
+		DestroyBlock(next);
+	}
+
+	InsertFreeBlock(block);
+}
+
+void TLSFAllocator::Free(const Allocation& allocation, uint64 fenceValue)
+{
+	check(allocation.IsValid());
+	m_PendingFrees.push({ fenceValue, allocation });
+}
+
+void TLSFAllocator::Recycle(uint64 completedFenceValue)
+{
+	while (!m_PendingFrees.empty() && m_PendingFrees.front().FenceValue <= completedFenceValue)
+	{
+		Free(m_PendingFrees.front().Range);
+		m_PendingFrees.pop();
+	}
+}
+
+void TLSFAllocator::GetDefragmentationHints(uint32 maxHints, std::vector<Allocation>& outHints) const
+{
+	std::vector<std::pair<uint64, Allocation>> candidates;
+	for (uint32 block = m_FirstBlock; block != InvalidBlock; block = m_Blocks[block].NextPhysical)
+	{
+		const Block& current = m_Blocks[block];
+		if (current.IsFree || current.PrevPhysical == InvalidBlock || current.NextPhysical == InvalidBlock)
+			continue;
+		const Block& prev = m_Blocks[current.PrevPhysical];
+		const Block& next = m_Blocks[current.NextPhysical];
+		if (prev.IsFree && next.IsFree)
+		{
+			Allocation allocation;
+			allocation.Offset = current.Offset;
+			allocation.Size = current.Size;
+			allocation.Block = block;
+			candidates.emplace_back(prev.Size + current.Size + next.Size, allocation);
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+	for (uint32 i = 0; i < Math::Min(maxHints, (uint32)candidates.size()); ++i)
+		outHints.push_back(candidates[i].second);
+}
+
+TLSFAllocator::Stats TLSFAllocator::GetStats() const
+{
+	Stats stats;
+	stats.Size = m_Size;
+	stats.NumPendingFrees = (uint32)m_PendingFrees.size();
+	for (uint32 block = m_FirstBlock; block != InvalidBlock; block = m_Blocks[block].NextPhysical)
+	{
+		const Block& current = m_Blocks[block];
+		if (current.IsFree)
+		{
+			++stats.NumFreeBlocks;
+			stats.LargestFreeBlock = Math::Max(stats.LargestFreeBlock, current.Size);
+		}
+		else
+		{
+			++stats.NumAllocations;
+			stats.UsedSize += current.Size;
+		}
+	}
+	return stats;
+}
+
+bool TLSFAllocator::Validate() const
+{
+	uint64 offset = 0;
+	uint32 prev = InvalidBlock;
+	uint32 numFreeBlocks = 0;
+	for (uint32 block = m_FirstBlock; block != InvalidBlock; block = m_Blocks[block].NextPhysical)
+	{
+		const Block& current = m_Blocks[block];
+		if (current.Offset != offset || current.Size == 0 || current.PrevPhysical != prev)
+			return false;
+		if (current.IsFree && prev != InvalidBlock && m_Blocks[prev].IsFree)
+			return false;
+		numFreeBlocks += current.IsFree;
+		offset += current.Size;
+		prev = block;
+	}
+	if (offset != m_Size)
+		return false;
+
+	uint32 numListedBlocks = 0;
+	for (uint32 firstLevel = 0; firstLevel < FirstLevelCount; ++firstLevel)
+	{
+		bool hasFreeBlocks = false;
+		for (uint32 secondLevel = 0; secondLevel < SecondLevelCount; ++secondLevel)
+		{
+			uint32 head = m_FreeLists[firstLevel][secondLevel];
+			bool isListed = (m_SecondLevelMasks[firstLevel] & (1u << secondLevel)) != 0;
+			if (isListed != (head != InvalidBlock))
+				return false;
+			hasFreeBlocks |= isListed;
+
+			uint32 prevFree = InvalidBlock;
+			for (uint32 block = head; block != InvalidBlock; block = m_Blocks[block].NextFree)
+			{
+				const Block& current = m_Blocks[block];
+				uint32 blockFirstLevel, blockSecondLevel;
+				GetSizeClass(current.Size / m_Granularity, blockFirstLevel, blockSecondLevel);
+				if (!current.IsFree || current.PrevFree != prevFree || blockFirstLevel != firstLevel || blockSecondLevel != secondLevel)
+					return false;
+				++numListedBlocks;
+				prevFree = block;
+			}
+		}
+		if (hasFreeBlocks != ((m_FirstLevelMask & (1ull << firstLevel)) != 0))
+			return false;
+	}
+	return numListedBlocks == numFreeBlocks;
+}
+
+void TLSFAllocator::GetSizeClass(uint64 units, uint32& firstLevel, uint32& secondLevel)
+{
+	if (units < SecondLevelCount)
+	{
+		firstLevel = 0;
+		secondLevel = (uint32)units;
+		return;
+	}
+	unsigned long msb;
+	_BitScanReverse64(&msb, units);
+	firstLevel = msb - SecondLevelBits + 1;
+	secondLevel = (uint32)(units >> (msb - SecondLevelBits)) - SecondLevelCount;
+}
+
+uint32 TLSFAllocator::CreateBlock()
+{
+	if (!m_UnusedBlocks.empty())
+	{
+		uint32 block = m_UnusedBlocks.back();
+		m_UnusedBlocks.pop_back();
+		return block;
+	}
+	m_Blocks.emplace_back();
+	return (uint32)m_Blocks.size() - 1;
+}
+
+void TLSFAllocator::DestroyBlock(uint32 block)
+{
+	m_Blocks[block] = Block();
+	m_UnusedBlocks.push_back(block);
+}
+
+void TLSFAllocator::InsertFreeBlock(uint32 block)
+{
+	Block& freeBlock = m_Blocks[block];
+	uint32 firstLevel, secondLevel;
+	GetSizeClass(freeBlock.Size / m_Granularity, firstLevel, secondLevel);
+
+	uint32& head = m_FreeLists[firstLevel][secondLevel];
+	freeBlock.IsFree = true;
+	freeBlock.PrevFree = InvalidBlock;
+	freeBlock.NextFree = head;
+	if (head != InvalidBlock)
+		m_Blocks[head].PrevFree = block;
+	head = block;
+
+	m_SecondLevelMasks[firstLevel] |= 1u << secondLevel;
+	m_FirstLevelMask |= 1ull << firstLevel;
+}
+
+void TLSFAllocator::RemoveFreeBlock(uint32 block)
+{
+	Block& freeBlock = m_Blocks[block];
+	check(freeBlock.IsFree);
+	uint32 firstLevel, secondLevel;
+	GetSizeClass(freeBlock.Size / m_Granularity, firstLevel, secondLevel);
+
+	if (freeBlock.PrevFree != InvalidBlock)
+		m_Blocks[freeBlock.PrevFree].NextFree = freeBlock.NextFree;
+	if (freeBlock.NextFree != InvalidBlock)
+		m_Blocks[freeBlock.NextFree].PrevFree = freeBlock.PrevFree;
+
+	uint32& head = m_FreeLists[firstLevel][secondLevel];
+	if (head == block)
+	{
+		head = freeBlock.NextFree;
+		if (head == InvalidBlock)
+		{
+			m_SecondLevelMasks[firstLevel] &= ~(1u << secondLevel);
+			if (m_SecondLevelMasks[firstLevel] == 0)
+				m_FirstLevelMask &= ~(1ull << firstLevel);
+		}
+	}
+
+	freeBlock.IsFree = false;
+	freeBlock.PrevFree = InvalidBlock;
+	freeBlock.NextFree = InvalidBlock;
+}
+
+uint32 TLSFAllocator::FindFreeBlock(uint64 size) const
+{
+	// Round up to the next size class, so every block in the list is large enough
+	uint64 units = size / m_Granularity;
+	if (units >= SecondLevelCount)
+	{
+		unsigned long msb;
+		_BitScanReverse64(&msb, units);
+		units += (1ull << (msb - SecondLevelBits)) - 1;
+	}
+	uint32 firstLevel, secondLevel;
+	GetSizeClass(units, firstLevel, secondLevel);
+	if (firstLevel >= FirstLevelCount)
+		return InvalidBlock;
+
+	unsigned long index;
+	uint32 secondLevelMask = m_SecondLevelMasks[firstLevel] & (~0u << secondLevel);
+	if (secondLevelMask == 0)
+	{
+		uint64 firstLevelMask = firstLevel + 1 < 64 ? m_FirstLevelMask & (~0ull << (firstLevel + 1)) : 0;
+		if (!_BitScanForward64(&index, firstLevelMask))
+			return InvalidBlock;
+		firstLevel = index;
+		secondLevelMask = m_SecondLevelMasks[firstLevel];
+	}
+	_BitScanForward(&index, secondLevelMask);
+	return m_FreeLists[firstLevel][index];
+}
+
+void TLSFAllocator::SplitFreeTail(uint32 block, uint64 size)
+{
+	if (m_Blocks[block].Size <= size)
+		return;
+
+	// The next block is never free, so the tail becomes a free block of its own
+	uint32 tail = CreateBlock();
+	Block& tailBlock = m_Blocks[tail];
+	Block& headBlock = m_Blocks[block];
+	tailBlock.Offset = headBlock.Offset + size;
+	tailBlock.Size = headBlock.Size - size;
+	tailBlock.PrevPhysical = block;
+	tailBlock.NextPhysical = headBlock.NextPhysical;
+	if (tailBlock.NextPhysical != InvalidBlock)
+		m_Blocks[tailBlock.NextPhysical].PrevPhysical = tail;
+	headBlock.NextPhysical = tail;
+	headBlock.Size = size;
+	InsertFreeBlock(tail);
+}
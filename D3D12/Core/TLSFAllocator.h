@@ -0,0 +1,111 @@
+#pragma once
+
+/*
+	Two-level segregated fit allocator of ranges [Offset, Offset + Size).
+	Only deals with offsets, so it can manage any kind of memory, like ranges of a large GPU buffer.
+
+	- Free blocks are kept in lists by size class. The first level is the power of two of the size,
+	  the second level splits it in 'SecondLevelCount' linear classes.
+	  A bitmask of non-empty lists per level makes finding a free block O(1).
+	- Allocate() takes a block of the next size class up, so any block in that list fits ("good fit").
+	  The remainder of the block, and the padding for alignment, go back to the free lists.
+	- Free() merges the block with its free neighbours, so two adjacent blocks are never both free.
+	- Free() with a fence value keeps the range in use until Recycle() is called with a completed fence value.
+	- Sizes are rounded up to the granularity, which is the smallest alignment.
+*/
+class TLSFAllocator
+{
+public:
+	static constexpr uint32 InvalidBlock = 0xFFFFFFFF;
+
+	struct Allocation
+	{
+		uint64 Offset = 0;
+		uint64 Size = 0;
+		uint32 Block = InvalidBlock;
+
+		bool IsValid() const { return Block != InvalidBlock; }
+	};
+
+	struct Stats
+	{
+		uint64 Size = 0;
+		uint64 UsedSize = 0;
+		uint64 LargestFreeBlock = 0;
+		uint32 NumAllocations = 0;
+		uint32 NumFreeBlocks = 0;
+		uint32 NumPendingFrees = 0;
+
+		// 0 when all free space is a single block, close to 1 when it is scattered in small blocks
+		float GetFragmentation() const
+		{
+			uint64 freeSize = Size - UsedSize;
+			return freeSize > 0 ? 1.0f - (float)LargestFreeBlock / freeSize : 0.0f;
+		}
+	};
+
+	TLSFAllocator(uint64 size, uint32 granularity = 16);
+
+	// Returns an invalid allocation if there is no free block large enough. 'alignment' must be a power of two.
+	Allocation Allocate(uint64 size, uint32 alignment = 1);
+	void Free(const Allocation& allocation);
+	// The range stays in use until Recycle() is called with a fence value of at least 'fenceValue'
+	void Free(const Allocation& allocation, uint64 fenceValue);
+	void Recycle(uint64 completedFenceValue);
+
+	// Allocations between two free blocks. Moving them elsewhere merges the three blocks in one.
+	// Sorted by the size of the merged block, largest first.
+	void GetDefragmentationHints(uint32 maxHints, std::vector<Allocation>& outHints) const;
+
+	Stats GetStats() const;
+	// Checks that the blocks and free lists are consistent
+	bool Validate() const;
+
+	uint64 GetSize() const { return m_Size; }
+
+private:
+	static constexpr uint32 SecondLevelBits = 4;
+	static constexpr uint32 SecondLevelCount = 1u << SecondLevelBits;
+	static constexpr uint32 FirstLevelCount = 64 - SecondLevelBits + 1;
+
+	struct Block
+	{
+		uint64 Offset = 0;
+		uint64 Size = 0;
+		uint32 PrevPhysical = InvalidBlock;
+		uint32 NextPhysical = InvalidBlock;
+		uint32 PrevFree = InvalidBlock;
+		uint32 NextFree = InvalidBlock;
+		bool IsFree = false;
+	};
+
+	struct PendingFree
+	{
+		uint64 FenceValue;
+		Allocation Range;
+	};
+
+	// Size class of a block of 'units' granularity units
+	static void GetSizeClass(uint64 units, uint32& firstLevel, uint32& secondLevel);
+
+	uint32 CreateBlock();
+	void DestroyBlock(uint32 block);
+	void InsertFreeBlock(uint32 block);
+	void RemoveFreeBlock(uint32 block);
+	uint32 FindFreeBlock(uint64 size) const;
+	// Splits the end of 'block' off in a new free block, if 'block' is larger than 'size'
+	void SplitFreeTail(uint32 block, uint64 size);
+
+	uint64 m_Size;
+	uint32 m_Granularity;
+	uint32 m_FirstBlock = InvalidBlock;
+
+	std::vector<Block> m_Blocks;
+	std::vector<uint32> m_UnusedBlocks;
+
+	uint64 m_FirstLevelMask = 0;
+	std::array<uint32, FirstLevelCount> m_SecondLevelMasks{};
+	std::array<std::array<uint32, SecondLevelCount>, FirstLevelCount> m_FreeLists;
+
+	std::queue<PendingFree> m_PendingFrees;
+};
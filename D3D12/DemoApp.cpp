@@ -26,7 +26,10 @@
 #include "Graphics/Techniques/MeshletRasterizer.h"
 #include "Graphics/Techniques/VisualizeTexture.h"
 #include "Graphics/Techniques/LightCulling.h"
+#include "Graphics/Techniques/Skinning.h"
 #include "Graphics/ImGuiRenderer.h"
+#include "Graphics/TextureStreaming.h"
+#include "Graphics/MeshletCulling.h"
 #include "Core/TaskQueue.h"
 #include "Core/CommandLine.h"
 #include "Core/Paths.h"
@@ -56,6 +59,11 @@ namespace Tweakables
 	ConsoleVariable g_ShadowsGPUCull("r.Shadows.GPUCull", true);
 	ConsoleVariable g_ShadowsOcclusionCulling("r.Shadows.OcclusionCull", true);
 	ConsoleVariable g_CullShadowsDebugStats("r.Shadows.CullingStats", -1);
+	ConsoleVariable g_ShadowCaching("r.Shadows.Cache", true);
+	ConsoleVariable g_ShadowStaticDepthCache("r.Shadows.Cache.StaticDepth", true);
+	ConsoleVariable g_ShadowFullRateCascades("r.Shadows.Cache.FullRateCascades", 2);
+	ConsoleVariable g_ShadowDistantCascadeInterval("r.Shadows.Cache.DistantCascadeInterval", 2);
+	ConsoleVariable g_ShadowLocalViewBudget("r.Shadows.Cache.LocalViewBudget", 4);
 
 	// Bloom
 	ConsoleVariable g_Bloom("r.Bloom", true);
@@ -79,6 +87,7 @@ namespace Tweakables
 	ConsoleVariable g_SsrSamples("r.SSRSamples", 8);
 	ConsoleVariable g_RenderTerrain("r.Terrain", true);
 	ConsoleVariable g_OcclusionCulling("r.OcclusionCulling", true);
+	ConsoleVariable g_CullWithBVH("r.Culling.BVH", false);
 
 	// Misc
 	ConsoleVariable CullDebugStats("r.CullingStats", false);
@@ -89,6 +98,8 @@ namespace Tweakables
 	ConsoleCommand<> gDumpRenderGraph("DumpRenderGraph", []() { g_DumpRenderGraph = true; });
 	bool g_Screenshot = false;
 	ConsoleCommand<> gScreenshot("Screenshot", []() { g_Screenshot = true; });
+	bool g_MeasureMeshletCulling = false;
+	ConsoleCommand<> gMeasureMeshletCulling("MeasureMeshletCulling", []() { g_MeasureMeshletCulling = true; });
 
 	std::string VisualizeTextureName = "";
 	ConsoleCommand<const char*> gVisualizeTexture("vis", [](const char* pName) { VisualizeTextureName = pName; });
@@ -132,8 +143,12 @@ void DemoApp::Init()
 	m_pPathTracing			= std::make_unique<PathTracing>(m_pDevice);
 	m_pCBTTessellation		= std::make_unique<CBTTessellation>(m_pDevice);
 	m_pVisualizeTexture		= std::make_unique<VisualizeTexture>(m_pDevice);
+	m_pTextureStreamer		= std::make_unique<TextureStreamer>(m_pDevice);
+	m_pSkinning				= std::make_unique<Skinning>(m_pDevice);
 
 	InitializePipelines();
+	// Create all pipelines up front, instead of on first use
+	m_pDevice->PrecompilePipelines();
 
 	SetupScene();
 
@@ -245,9 +260,15 @@ void DemoApp::Update()
 		}
 
 		Light& sun = m_World.Lights.front();
-		sun.Rotation = Quaternion::CreateFromYawPitchRoll(-Tweakables::g_SunOrientation, Tweakables::g_SunInclination * Math::PI_DIV_2, 0);
-		sun.Colour = Math::MakeFromColorTemperature(Tweakables::g_SunTemperature);
-		sun.Intensity = Tweakables::g_SunIntensity;
+		const Quaternion sunRotation = Quaternion::CreateFromYawPitchRoll(-Tweakables::g_SunOrientation, Tweakables::g_SunInclination * Math::PI_DIV_2, 0);
+		const Color sunColor = Math::MakeFromColorTemperature(Tweakables::g_SunTemperature);
+		if (sunRotation != sun.Rotation || sunColor != sun.Colour || sun.Intensity != Tweakables::g_SunIntensity)
+		{
+			sun.Rotation = sunRotation;
+			sun.Colour = sunColor;
+			sun.Intensity = Tweakables::g_SunIntensity;
+			sun.IsDirty = true;
+		}
 
 		if (Tweakables::g_VisualizeLights)
 		{
@@ -318,9 +339,12 @@ void DemoApp::Update()
 		SceneView* pViewMut = &m_SceneData;
 		World* pWorldMut = &m_World;
 
+		Renderer::UpdateAnimations(pWorldMut, Time::DeltaTime());
+
 		{
 			PROFILE_CPU_SCOPE("Update GPU Scene");
 			CommandContext* pContext = m_pDevice->AllocateCommandContext();
+			m_pSkinning->Execute(*pContext, pWorldMut);
 			Renderer::UploadSceneData(*pContext, pViewMut, pWorldMut);
 			pViewMut->AccelerationStructure.Build(*pContext, *pView);
 			pContext->Execute();
@@ -329,65 +353,104 @@ void DemoApp::Update()
 		{
 			PROFILE_CPU_SCOPE("Frustum Culling");
 
-			// Sort
-			auto CompareSort = [this](const Batch& a, const Batch& b)
-			{
-				float aDist = Vector3::DistanceSquared(a.Bounds.Center, m_SceneData.MainView.Position);
-				float bDist = Vector3::DistanceSquared(b.Bounds.Center, m_SceneData.MainView.Position);
-				if (a.BlendMode != b.BlendMode)
-					return (int)a.BlendMode < (int)b.BlendMode;
-				return EnumHasAnyFlags(a.BlendMode, Batch::Blending::AlphaBlend) ? bDist < aDist : aDist < bDist;
-			};
-			std::sort(m_SceneData.Batches.begin(), m_SceneData.Batches.end(), CompareSort);
+			Renderer::SortBatches(m_SceneData.Batches, m_SceneData.MainView.Position);
+			m_SceneData.InstanceToBatch.resize(m_SceneData.Batches.size());
+			for (uint32 i = 0; i < (uint32)m_SceneData.Batches.size(); ++i)
+				m_SceneData.InstanceToBatch[m_SceneData.Batches[i].InstanceID] = i;
 
-			TaskContext taskContext;
+			// Gather all views culled on the CPU, so the instance bounds are only read once for all of them.
 			// In Visibility Buffer mode, culling is done on the GPU.
+			std::vector<FrustumCulling::Planes> cullViews;
+			std::vector<uint32*> cullResults;
+			const uint32 numInstances = m_SceneData.InstanceBounds.Count;
 			if (m_RenderPath != RenderPath::Visibility)
 			{
-				TaskQueue::Execute([&](int)
-					{
-						PROFILE_CPU_SCOPE("Frustum Cull Main");
-						m_SceneData.VisibilityMask.SetAll();
-						BoundingFrustum frustum = m_pCamera->GetViewTransform().PerspectiveFrustum;
-						for (const Batch& b : m_SceneData.Batches)
-						{
-							m_SceneData.VisibilityMask.AssignBit(b.InstanceID, frustum.Contains(b.Bounds));
-						}
-					}, taskContext);
+				m_SceneData.VisibilityMask.Resize(numInstances);
+				m_SceneData.VisibilityMask.ClearAll();
+				cullViews.push_back(FrustumCulling::GetPlanes(m_pCamera->GetViewTransform().PerspectiveFrustum));
+				cullResults.push_back(m_SceneData.VisibilityMask.GetData());
 			}
 			if (!Tweakables::g_ShadowsGPUCull)
 			{
-				TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
-					{
-						PROFILE_CPU_SCOPE("Frustum Cull Shadows");
-						ShadowView& shadowView = m_SceneData.ShadowViews[args.JobIndex];
-						shadowView.Visibility.SetAll();
-						for (const Batch& b : m_SceneData.Batches)
-						{
-							shadowView.Visibility.AssignBit(b.InstanceID, shadowView.View.IsInFrustum(b.Bounds));
-						}
-					}, taskContext, (uint32)m_SceneData.ShadowViews.size(), 1);
+				for (ShadowView& shadowView : m_SceneData.ShadowViews)
+				{
+					shadowView.Visibility.Resize(numInstances);
+					shadowView.Visibility.ClearAll();
+					cullViews.push_back(FrustumCulling::GetPlanes(shadowView.View));
+					cullResults.push_back(shadowView.Visibility.GetData());
+				}
+			}
+
+			if (Tweakables::g_CullWithBVH)
+			{
+				for (uint32 i = 0; i < (uint32)cullViews.size(); ++i)
+					m_SceneData.InstanceBVH.Cull(cullViews[i], cullResults[i]);
+			}
+			else
+			{
+				FrustumCulling::CullViews(m_SceneData.InstanceBounds, cullViews, cullResults);
+			}
+
+			// Draws only go through the visible batches
+			if (m_RenderPath != RenderPath::Visibility)
+				Renderer::GetVisibleBatches(pView, m_SceneData.VisibilityMask, m_SceneData.VisibleBatches);
+			if (!Tweakables::g_ShadowsGPUCull)
+			{
+				for (ShadowView& shadowView : m_SceneData.ShadowViews)
+					Renderer::GetVisibleBatches(pView, shadowView.Visibility, shadowView.VisibleBatches);
 			}
 
-			TaskQueue::Execute([&](int)
+			// Shadow views only need to be drawn if they changed or dynamic casters are in view
+			{
+				const bool staticCastersChanged = m_SceneData.StaticInstancesChanged;
+				if (staticCastersChanged)
+					m_ShadowScheduler.InvalidateStaticDepth();
+
+				std::vector<uint32> dynamicInstances;
+				m_SceneData.DynamicInstances.Compact(dynamicInstances);
+				for (uint32 i = 0; i < (uint32)m_SceneData.ShadowViews.size(); ++i)
 				{
-					PROFILE_CPU_SCOPE("Compute Bounds");
-					bool boundsSet = false;
-					for (const Batch& b : m_SceneData.Batches)
+					ShadowView& shadowView = m_SceneData.ShadowViews[i];
+					bool hasDynamicCasters = false;
+					for (uint32 instance : dynamicInstances)
 					{
-						if (boundsSet)
+						if (shadowView.View.IsInFrustum(m_SceneData.Batches[m_SceneData.InstanceToBatch[instance]].Bounds))
 						{
-							BoundingBox::CreateMerged(m_SceneData.SceneAABB, m_SceneData.SceneAABB, b.Bounds);
+							hasDynamicCasters = true;
+							break;
 						}
-						else
+					}
+					shadowView.UpdateMode = m_ShadowScheduler.GetUpdateMode(m_ShadowSchedule[i], hasDynamicCasters, staticCastersChanged);
+
+					shadowView.StaticBatches.clear();
+					shadowView.DynamicBatches.clear();
+					if (shadowView.pStaticDepthTexture)
+					{
+						for (uint32 batchIndex : shadowView.VisibleBatches)
 						{
-							m_SceneData.SceneAABB = b.Bounds;
-							boundsSet = true;
+							const bool isDynamic = m_SceneData.DynamicInstances.GetBit(m_SceneData.Batches[batchIndex].InstanceID);
+							(isDynamic ? shadowView.DynamicBatches : shadowView.StaticBatches).push_back(batchIndex);
 						}
 					}
-				}, taskContext);
+				}
+			}
+
+			m_SceneData.SceneAABB = m_SceneData.InstanceBVH.GetBounds();
+		}
 
-			TaskQueue::Join(taskContext);
+		{
+			PROFILE_CPU_SCOPE("Texture Streaming");
+			m_pTextureStreamer->RequestMips(*pView, m_RenderPath != RenderPath::Visibility);
+			m_pTextureStreamer->Update(m_Frame);
+		}
+
+		if (Tweakables::g_MeasureMeshletCulling)
+		{
+			Tweakables::g_MeasureMeshletCulling = false;
+			MeshletCulling::Stats stats = MeshletCulling::Measure(m_SceneData, m_pCamera->GetViewTransform());
+			float numMeshlets = (float)Math::Max(stats.NumMeshlets, 1u);
+			E_LOG(Info, "Meshlet culling: %d meshlets - Frustum culled: %.1f%% (%.1f%% by the sphere pre-test) - Backface culled: %.1f%%",
+				stats.NumMeshlets, 100.0f * stats.NumFrustumCulled / numMeshlets, 100.0f * stats.NumSphereCulled / numMeshlets, 100.0f * stats.NumBackfaceCulled / numMeshlets);
 		}
 
 		{
@@ -439,6 +502,8 @@ void DemoApp::Update()
 					for (uint32 i = 0; i < (uint32)pView->ShadowViews.size(); ++i)
 					{
 						const ShadowView& shadowView = pView->ShadowViews[i];
+						if (shadowView.UpdateMode == ShadowUpdateMode::None)
+							continue;
 
 						auto LightTypeToString = [](LightType type) -> const char* {
 							switch (type)
@@ -456,7 +521,7 @@ void DemoApp::Update()
 						RG_GRAPH_SCOPE(passName.c_str(), graph);
 						if (Tweakables::g_ShadowsGPUCull)
 						{
-							RasterContext context(graph, pShadowmap, RasterMode::Shadows, &m_ShadowHZBs[i]);
+							RasterContext context(graph, pShadowmap, RasterMode::Shadows, &m_ShadowHZBs[shadowView.CacheSlot]);
 							context.EnableOcclusionCulling = Tweakables::g_ShadowsOcclusionCulling;
 							RasterResult result;
 							m_pMeshletRasterizer->Render(graph, pView, &shadowView.View, context, result);
@@ -465,27 +530,45 @@ void DemoApp::Update()
 						}
 						else
 						{
-							graph.AddPass("Raster", RGPassFlag::Raster)
-								.DepthStencil(pShadowmap, RenderTargetLoadAction::Clear, true)
-								.Bind([=](CommandContext& context)
-									{
-										context.SetGraphicsRootSignature(m_pCommonRS);
-										context.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-										const ShadowView& view = pView->ShadowViews[i];
-										context.BindRootCBV(1, Renderer::GetViewUniforms(pView, &view.View, pShadowmap->Get()));
-
-										{
-											PROFILE_GPU_SCOPE(context.GetCommandList(), "Opaque");
-											context.SetPipelineState(m_pShadowsOpaquePSO);
-											Renderer::DrawScene(context, pView->Batches, view.Visibility, Batch::Blending::Opaque);
-										}
+							auto AddRasterPass = [&](const char* pName, RGTexture* pTarget, RenderTargetLoadAction depthAccess, const std::vector<uint32>* pBatches)
+							{
+								graph.AddPass(pName, RGPassFlag::Raster)
+									.DepthStencil(pTarget, depthAccess, true)
+									.Bind([=](CommandContext& context)
 										{
-											PROFILE_GPU_SCOPE(context.GetCommandList(), "Masked");
-											context.SetPipelineState(m_pShadowsAlphaMaskPSO);
-											Renderer::DrawScene(context, pView->Batches, view.Visibility, Batch::Blending::AlphaMask | Batch::Blending::AlphaBlend);
-										}
-									});
+											context.SetGraphicsRootSignature(m_pCommonRS);
+											context.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+											const ShadowView& view = pView->ShadowViews[i];
+											context.BindRootCBV(1, Renderer::GetViewUniforms(pView, &view.View, pTarget->Get()));
+
+											{
+												PROFILE_GPU_SCOPE(context.GetCommandList(), "Opaque");
+												context.SetPipelineState(m_pShadowsOpaquePSO);
+												Renderer::DrawScene(context, pView->Batches, *pBatches, Batch::Blending::Opaque);
+											}
+											{
+												PROFILE_GPU_SCOPE(context.GetCommandList(), "Masked");
+												context.SetPipelineState(m_pShadowsAlphaMaskPSO);
+												Renderer::DrawScene(context, pView->Batches, *pBatches, Batch::Blending::AlphaMask | Batch::Blending::AlphaBlend);
+											}
+										});
+							};
+
+							if (shadowView.pStaticDepthTexture)
+							{
+								// Dynamic casters are drawn over a copy of the cached static casters
+								RGTexture* pStaticDepth = graph.Import(shadowView.pStaticDepthTexture);
+								if (shadowView.UpdateMode == ShadowUpdateMode::Full)
+									AddRasterPass("Raster Static", pStaticDepth, RenderTargetLoadAction::Clear, &shadowView.StaticBatches);
+								RGUtils::AddCopyPass(graph, pStaticDepth, pShadowmap);
+								if (!shadowView.DynamicBatches.empty())
+									AddRasterPass("Raster Dynamic", pShadowmap, RenderTargetLoadAction::Load, &shadowView.DynamicBatches);
+							}
+							else
+							{
+								AddRasterPass("Raster", pShadowmap, RenderTargetLoadAction::Clear, &shadowView.VisibleBatches);
+							}
 						}
 					}
 				}
@@ -600,19 +683,28 @@ void DemoApp::Update()
 					m_pDDGI->Execute(graph, pView, pWorldMut);
 				}
 
+				// The visibility buffer gives the surface of each pixel, so moving and skinned objects get their own motion
 				graph.AddPass("Camera Motion", RGPassFlag::Compute)
 					.Read(sceneTextures.pDepth)
+					.Read({ rasterResult.pVisibilityBuffer, rasterResult.pVisibleMeshlets })
 					.Write(sceneTextures.pVelocity)
 					.Bind([=](CommandContext& context)
 						{
 							Texture* pVelocity = sceneTextures.pVelocity->Get();
 
 							context.SetComputeRootSignature(m_pCommonRS);
-							context.SetPipelineState(m_pCameraMotionPSO);
+							context.SetPipelineState(needVisibilityBuffer ? m_pCameraObjectMotionPSO : m_pCameraMotionPSO);
 
 							context.BindRootCBV(1, Renderer::GetViewUniforms(pView, pVelocity));
 							context.BindResources(2, pVelocity->GetUAV());
 							context.BindResources(3, sceneTextures.pDepth->Get()->GetSRV());
+							if (needVisibilityBuffer)
+							{
+								context.BindResources(3, {
+									rasterResult.pVisibilityBuffer->Get()->GetSRV(),
+									rasterResult.pVisibleMeshlets->Get()->GetSRV(),
+									}, 1);
+							}
 
 							context.Dispatch(ComputeUtils::GetNumThreadGroups(pVelocity->GetWidth(), 8, pVelocity->GetHeight(), 8));
 						});
@@ -1180,6 +1272,7 @@ void DemoApp::InitializePipelines()
 	m_pReduceDepthPSO				= m_pDevice->CreateComputePipeline(m_pCommonRS, "ReduceDepth.hlsl", "ReduceDepth");
 
 	m_pCameraMotionPSO				= m_pDevice->CreateComputePipeline(m_pCommonRS, "CameraMotionVectors.hlsl", "CSMain");
+	m_pCameraObjectMotionPSO		= m_pDevice->CreateComputePipeline(m_pCommonRS, "CameraMotionVectors.hlsl", "CSMain", { "OBJECT_MOTION" });
 	m_pTemporalResolvePSO			= m_pDevice->CreateComputePipeline(m_pCommonRS, "PostProcessing/TemporalResolve.hlsl", "CSMain");
 
 
@@ -1515,6 +1608,7 @@ void DemoApp::UpdateImGui()
 			ImGui::Checkbox("SDSM", &Tweakables::g_SDSM.Get());
 			ImGui::SliderFloat("PSSM Factor", &Tweakables::g_PSSMFactor.Get(), 0, 1);
 			ImGui::Checkbox("Visualize Cascades", &Tweakables::g_VisualizeShadowCascades.Get());
+			ImGui::Checkbox("Cache", &Tweakables::g_ShadowCaching.Get());
 			ImGui::Checkbox("GPU Cull", &Tweakables::g_ShadowsGPUCull.Get());
 			if (Tweakables::g_ShadowsGPUCull)
 			{
@@ -1577,7 +1671,7 @@ void DemoApp::UpdateImGui()
 void DemoApp::LoadMesh(const std::string& filePath, World& world)
 {
 	std::unique_ptr<Mesh> pMesh = std::make_unique<Mesh>();
-	pMesh->Load(filePath.c_str(), m_pDevice, 1.0f);
+	pMesh->Load(filePath.c_str(), m_pDevice, 1.0f, m_pTextureStreamer.get());
 	world.Meshes.push_back(std::move(pMesh));
 }
 
@@ -1625,28 +1719,50 @@ void DemoApp::CreateShadowViews(SceneView& view, World& world)
 		cascadeSplits[i] = (d - nearPlane) / clipPlaneRange;
 	}
 
-	int32 shadowIndex = 0;
+	// Point lights have the most views
+	constexpr uint32 MaxShadowViewsPerLight = 6;
+
+	// The scene data of a light has its shadow matrix and first shadow map. The light is uploaded again when they change.
+	struct LightShadowState
+	{
+		uint32 MatrixIndex;
+		Texture* pShadowMap;
+		int ShadowMapSize;
+	};
+	auto GetShadowState = [](const Light& light)
+	{
+		return LightShadowState{ light.MatrixIndex, light.ShadowMaps.empty() ? nullptr : light.ShadowMaps[0], light.ShadowMapSize };
+	};
+	std::vector<LightShadowState> prevShadowStates;
+	prevShadowStates.reserve(world.Lights.size());
+	for (const Light& light : world.Lights)
+		prevShadowStates.push_back(GetShadowState(light));
+
 	view.ShadowViews.clear();
-	auto AddShadowView = [&](Light& light, ShadowView shadowView, uint32 resolution, uint32 shadowMapLightIndex)
+	std::vector<ShadowScheduler::ViewRequest> shadowRequests;
+	std::vector<Light*> shadowLights;
+	auto AddShadowView = [&](Light& light, uint32 lightIndex, ShadowView shadowView, uint32 resolution, uint32 shadowMapLightIndex)
 	{
 		if (shadowMapLightIndex == 0)
-			light.MatrixIndex = shadowIndex;
-		if (shadowIndex >= (int32)m_ShadowMaps.size())
-			m_ShadowMaps.push_back(m_pDevice->CreateTexture(TextureDesc::Create2D(resolution, resolution, GraphicsCommon::ShadowFormat, 1, TextureFlag::DepthStencil | TextureFlag::ShaderResource, ClearBinding(0.0f, 0)), Sprintf("Shadow Map %d", (uint32)m_ShadowMaps.size()).c_str()));
-		RefCountPtr<Texture> pTarget = m_ShadowMaps[shadowIndex];
+			light.MatrixIndex = (uint32)view.ShadowViews.size();
 
 		light.ShadowMaps.resize(Math::Max(shadowMapLightIndex + 1, (uint32)light.ShadowMaps.size()));
-		light.ShadowMaps[shadowMapLightIndex] = pTarget;
 		light.ShadowMapSize = resolution;
-		shadowView.pDepthTexture = pTarget;
 		shadowView.pLight = &light;
 		shadowView.ViewIndex = shadowMapLightIndex;
 		shadowView.View.Viewport = FloatRect(0, 0, (float)resolution, (float)resolution);
+
+		ShadowScheduler::ViewRequest& request = shadowRequests.emplace_back();
+		request.Key = lightIndex * MaxShadowViewsPerLight + shadowMapLightIndex;
+		request.Type = light.Type == LightType::Directional ? ShadowScheduler::ViewType::Cascade : ShadowScheduler::ViewType::Local;
+		request.CascadeIndex = shadowMapLightIndex;
+		request.ViewProjection = shadowView.View.ViewProjection;
+
 		view.ShadowViews.push_back(shadowView);
-		shadowIndex++;
+		shadowLights.push_back(&light);
 	};
 
-	for (size_t lightIndex = 0; lightIndex < world.Lights.size(); ++lightIndex)
+	for (uint32 lightIndex = 0; lightIndex < (uint32)world.Lights.size(); ++lightIndex)
 	{
 		Light& light = world.Lights[lightIndex];
 		light.ShadowMaps.clear();
@@ -1727,7 +1843,7 @@ void DemoApp::CreateShadowViews(SceneView& view, World& world)
 				shadowViewTransform.OrthographicFrustum.Extents.z *= 10;
 				shadowViewTransform.OrthographicFrustum.Orientation = Quaternion::CreateFromRotationMatrix(lightView.Invert());
 				(&view.ShadowCascadeDepths.x)[i] = nearPlane + currentCascadeSplit * (farPlane - nearPlane);
-				AddShadowView(light, shadowView, 2048, i);
+				AddShadowView(light, lightIndex, shadowView, 2048, i);
 			}
 		}
 		else if (light.Type == LightType::Spot)
@@ -1745,7 +1861,7 @@ void DemoApp::CreateShadowViews(SceneView& view, World& world)
 			shadowViewTransform.ViewProjection = lightView * projection;
 			shadowViewTransform.ViewProjectionPrev = shadowViewTransform.ViewProjection;
 			shadowViewTransform.PerspectiveFrustum = Math::CreateBoundingFrustum(projection, lightView);
-			AddShadowView(light, shadowView, 512, 0);
+			AddShadowView(light, lightIndex, shadowView, 512, 0);
 		}
 		else if (light.Type == LightType::Point)
 		{
@@ -1771,10 +1887,95 @@ void DemoApp::CreateShadowViews(SceneView& view, World& world)
 				shadowViewTransform.ViewProjection = viewMatrices[i] * projection;
 				shadowViewTransform.ViewProjectionPrev = shadowViewTransform.ViewProjection;
 				shadowViewTransform.PerspectiveFrustum = Math::CreateBoundingFrustum(projection, viewMatrices[i]);
-				AddShadowView(light, shadowView, 512, i);
+				AddShadowView(light, lightIndex, shadowView, 512, i);
 			}
 		}
 	}
 
-	m_ShadowHZBs.resize(shadowIndex);
+	// Static depth is cached only when the shadows are culled and drawn per batch on the CPU.
+	// The caches are not valid anymore when this changes.
+	const bool cacheStaticDepth = Tweakables::g_ShadowStaticDepthCache && !Tweakables::g_ShadowsGPUCull;
+	if (!Tweakables::g_ShadowCaching || cacheStaticDepth != m_ShadowCacheStaticDepth)
+		m_ShadowScheduler.InvalidateAll();
+	m_ShadowCacheStaticDepth = cacheStaticDepth;
+
+	ShadowScheduler::Settings& settings = m_ShadowScheduler.GetSettings();
+	settings.CacheStaticDepth = cacheStaticDepth;
+	settings.FullRateCascades = Tweakables::g_ShadowFullRateCascades;
+	settings.DistantCascadeInterval = Tweakables::g_ShadowDistantCascadeInterval;
+	settings.LocalViewBudget = Tweakables::g_ShadowLocalViewBudget;
+	m_ShadowScheduler.Schedule(shadowRequests, m_ShadowSchedule);
+
+	const uint32 numSlots = m_ShadowScheduler.GetNumSlots();
+	const uint32 numViews = (uint32)view.ShadowViews.size();
+	m_ShadowMaps.resize(numSlots);
+	m_ShadowStaticDepths.resize(numSlots);
+	m_ShadowHZBs.resize(numSlots);
+	m_ShadowViewTransforms.resize(numSlots);
+
+	auto GetShadowMapDesc = [](const ShadowView& shadowView)
+	{
+		const uint32 resolution = (uint32)shadowView.View.Viewport.GetWidth();
+		return TextureDesc::Create2D(resolution, resolution, GraphicsCommon::ShadowFormat, 1, TextureFlag::DepthStencil | TextureFlag::ShaderResource, ClearBinding(0.0f, 0));
+	};
+
+	// Shaders find the shadow maps of a light from the descriptor of the first one, so they need consecutive descriptors.
+	// The shadow maps of a light are created together, and created again if the light got more views.
+	for (uint32 first = 0; first < numViews;)
+	{
+		uint32 last = first + 1;
+		while (last < numViews && shadowLights[last] == shadowLights[first])
+			++last;
+
+		const Texture* pFirstTexture = m_ShadowMaps[m_ShadowSchedule[first].Slot];
+		bool isContiguous = pFirstTexture != nullptr;
+		for (uint32 i = first + 1; i < last && isContiguous; ++i)
+		{
+			const Texture* pTexture = m_ShadowMaps[m_ShadowSchedule[i].Slot];
+			isContiguous = pTexture && pTexture->GetSRVIndex() == pFirstTexture->GetSRVIndex() + (i - first);
+		}
+
+		if (!isContiguous)
+		{
+			for (uint32 i = first; i < last; ++i)
+				m_ShadowMaps[m_ShadowSchedule[i].Slot] = nullptr;
+			for (uint32 i = first; i < last; ++i)
+			{
+				const uint32 slot = m_ShadowSchedule[i].Slot;
+				m_ShadowMaps[slot] = m_pDevice->CreateTexture(GetShadowMapDesc(view.ShadowViews[i]), Sprintf("Shadow Map %d", slot).c_str());
+				m_ShadowSchedule[i].NeedsFullUpdate = true;
+			}
+		}
+		first = last;
+	}
+
+	for (uint32 i = 0; i < numViews; ++i)
+	{
+		ShadowView& shadowView = view.ShadowViews[i];
+		const ShadowScheduler::ScheduledView& scheduledView = m_ShadowSchedule[i];
+		const uint32 slot = scheduledView.Slot;
+
+		// A view that is not updated must be sampled with the transform its shadow map was drawn with
+		if (scheduledView.UsePreviousView)
+			shadowView.View = m_ShadowViewTransforms[slot];
+		else
+			m_ShadowViewTransforms[slot] = shadowView.View;
+
+		if (cacheStaticDepth && !m_ShadowStaticDepths[slot])
+			m_ShadowStaticDepths[slot] = m_pDevice->CreateTexture(GetShadowMapDesc(shadowView), Sprintf("Shadow Static Depth %d", slot).c_str());
+
+		shadowView.CacheSlot = slot;
+		shadowView.pDepthTexture = m_ShadowMaps[slot];
+		shadowView.pStaticDepthTexture = cacheStaticDepth ? m_ShadowStaticDepths[slot].Get() : nullptr;
+		shadowLights[i]->ShadowMaps[shadowView.ViewIndex] = m_ShadowMaps[slot];
+	}
+
+	for (uint32 lightIndex = 0; lightIndex < (uint32)world.Lights.size(); ++lightIndex)
+	{
+		Light& light = world.Lights[lightIndex];
+		const LightShadowState state = GetShadowState(light);
+		const LightShadowState& prevState = prevShadowStates[lightIndex];
+		if (state.MatrixIndex != prevState.MatrixIndex || state.pShadowMap != prevState.pShadowMap || state.ShadowMapSize != prevState.ShadowMapSize)
+			light.IsDirty = true;
+	}
 }
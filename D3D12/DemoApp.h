@@ -28,6 +28,8 @@ class VisualizeTexture;
 class VolumetricFog;
 class ForwardRenderer;
 class LightCulling;
+class TextureStreamer;
+class Skinning;
 struct SubMesh;
 struct Material;
 
@@ -69,8 +71,14 @@ private:
 	RefCountPtr<Texture> m_pColorHistory;
 	RefCountPtr<Texture> m_pHZB;
 	RefCountPtr<Texture> m_pColorOutput;
+	// Indexed by the slot of the shadow view in the shadow scheduler
 	std::vector<RefCountPtr<Texture>> m_ShadowMaps;
+	std::vector<RefCountPtr<Texture>> m_ShadowStaticDepths;
 	std::vector<RefCountPtr<Texture>> m_ShadowHZBs;
+	std::vector<ViewTransform> m_ShadowViewTransforms;
+	ShadowScheduler m_ShadowScheduler;
+	std::vector<ShadowScheduler::ScheduledView> m_ShadowSchedule;
+	bool m_ShadowCacheStaticDepth = false;
 
 	std::unique_ptr<VolumetricFog> m_pVolumetricFog;
 	std::unique_ptr<ForwardRenderer> m_pForwardRenderer;
@@ -86,6 +94,8 @@ private:
 	std::unique_ptr<MeshletRasterizer> m_pMeshletRasterizer;
 	std::unique_ptr<DDGI> m_pDDGI;
 	std::unique_ptr<VisualizeTexture> m_pVisualizeTexture;
+	std::unique_ptr<TextureStreamer> m_pTextureStreamer;
+	std::unique_ptr<Skinning> m_pSkinning;
 
 	VolumetricFogData m_FogData;
 
@@ -128,6 +138,7 @@ private:
 
 	//Camera motion
 	RefCountPtr<PipelineState> m_pCameraMotionPSO;
+	RefCountPtr<PipelineState> m_pCameraObjectMotionPSO;
 
 	RefCountPtr<PipelineState> m_pTemporalResolvePSO;
 
@@ -12,8 +12,9 @@
 
 namespace Tweakables
 {
-	static const uint32 gMaxNumBLASVerticesPerFrame = 100'000;
-	static const uint32 gMaxNumCompactionsPerFrame = 32;
+	// Estimated GPU time and scratch memory of the BLAS builds of a frame
+	ConsoleVariable g_BLASBuildBudget("r.Raytracing.BLASBuildBudget", 1.0f);
+	ConsoleVariable g_BLASScratchBudget("r.Raytracing.BLASScratchBudgetMB", 64);
 
 	extern ConsoleVariable<float> g_TLASBoundsThreshold;
 }
@@ -21,6 +22,36 @@ namespace Tweakables
 static GlobalResource<RootSignature> gCommonRS;
 static GlobalResource<PipelineState> gUpdateTLASPSO;
 
+static constexpr D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS BLASBuildFlags =
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE
+	| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+
+// Skinned meshes are refit after every skinning pass, and are not compacted
+static constexpr D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS SkinnedBLASBuildFlags =
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD
+	| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+
+static D3D12_RAYTRACING_GEOMETRY_DESC GetGeometryDesc(const SubMesh* pMesh)
+{
+	const Material& material = pMesh->pParent->GetMaterial(pMesh->MaterialId);
+	D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc{};
+	geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+	geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
+	if (material.AlphaMode == MaterialAlphaMode::Opaque)
+	{
+		geometryDesc.Flags |= D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+	}
+	geometryDesc.Triangles.IndexBuffer = pMesh->IndicesLocation.Location;
+	geometryDesc.Triangles.IndexCount = pMesh->IndicesLocation.Elements;
+	geometryDesc.Triangles.IndexFormat = D3D::ConvertFormat(pMesh->IndicesLocation.Format);
+	geometryDesc.Triangles.Transform3x4 = 0;
+	geometryDesc.Triangles.VertexBuffer.StartAddress = pMesh->PositionStreamLocation.Location;
+	geometryDesc.Triangles.VertexBuffer.StrideInBytes = pMesh->PositionStreamLocation.Stride;
+	geometryDesc.Triangles.VertexCount = pMesh->PositionStreamLocation.Elements;
+	geometryDesc.Triangles.VertexFormat = D3D::ConvertFormat(pMesh->PositionsFormat);
+	return geometryDesc;
+}
+
 void AccelerationStructure::Build(CommandContext& context, const SceneView& view)
 {
 	PROFILE_CPU_SCOPE();
@@ -45,8 +76,106 @@ void AccelerationStructure::Build(CommandContext& context, const SceneView& view
 
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
 
-		uint32 numBLASBuiltVertices = 0;
-		uint32 numBuiltBLAS = 0;
+		{
+			PROFILE_GPU_SCOPE(context.GetCommandList(), "BLAS Compaction");
+			ResolveCompaction(context);
+		}
+
+		{
+			PROFILE_GPU_SCOPE(context.GetCommandList(), "BLAS Refit");
+			RefitSkinnedBLAS(context, view);
+		}
+
+		// Gather the meshes without BLAS. A mesh drawn by several batches gets the priority of the largest on screen.
+		std::vector<BLASScheduler::BuildRequest> buildRequests;
+		std::vector<SubMesh*> buildMeshes;
+		std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> buildGeometries;
+		std::vector<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO> buildInfos;
+		std::unordered_map<const SubMesh*, uint32> meshToBuildRequest;
+
+		for (const Batch& batch : view.Batches)
+		{
+			SubMesh* pMesh = batch.pMesh;
+			if (pMesh->pBLAS)
+				continue;
+			// Skinned meshes are built from the skinned positions
+			if (pMesh->SkinSourceMesh >= 0 && !pMesh->IsSkinned)
+				continue;
+
+			// Screen coverage of the bounding sphere
+			float distance = Vector3::Distance(batch.Bounds.Center, view.MainView.Position);
+			float priority = distance > batch.Radius ? (batch.Radius * batch.Radius) / (distance * distance) : 1.0f;
+
+			auto it = meshToBuildRequest.find(pMesh);
+			if (it != meshToBuildRequest.end())
+			{
+				buildRequests[it->second].Priority = Math::Max(buildRequests[it->second].Priority, priority);
+				continue;
+			}
+			meshToBuildRequest[pMesh] = (uint32)buildRequests.size();
+
+			const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = pMesh->SkinSourceMesh >= 0 ? SkinnedBLASBuildFlags : BLASBuildFlags;
+			D3D12_RAYTRACING_GEOMETRY_DESC& geometryDesc = buildGeometries.emplace_back(GetGeometryDesc(pMesh));
+
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS prebuildInfo{};
+			prebuildInfo.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+			prebuildInfo.Flags = flags;
+			prebuildInfo.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+			prebuildInfo.NumDescs = 1;
+			prebuildInfo.pGeometryDescs = &geometryDesc;
+
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO& info = buildInfos.emplace_back();
+			pDevice->GetDevice()->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildInfo, &info);
+
+			BLASScheduler::BuildRequest& request = buildRequests.emplace_back();
+			request.NumTriangles = pMesh->IndicesLocation.Elements / 3;
+			request.ScratchSize = Math::AlignUp<uint64>(info.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+			request.Flags = flags;
+			request.Priority = priority;
+			buildMeshes.push_back(pMesh);
+		}
+
+		BLASScheduler::Settings& schedulerSettings = m_Scheduler.GetSettings();
+		schedulerSettings.BuildBudgetMs = Tweakables::g_BLASBuildBudget;
+		schedulerSettings.ScratchBudget = (uint64)Tweakables::g_BLASScratchBudget.GetInt() * Math::MegaBytesToBytes;
+		m_Scheduler.Update(buildRequests, m_QueuedCompactions, !m_ActiveRequests.empty(), m_Schedule);
+
+		{
+			PROFILE_GPU_SCOPE(context.GetCommandList(), "BLAS Compaction");
+			BeginCompaction(context, m_Schedule.Compactions);
+		}
+
+		for (uint32 requestIndex : m_Schedule.Builds)
+		{
+			SubMesh* pMesh = buildMeshes[requestIndex];
+			const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO& info = buildInfos[requestIndex];
+
+			RefCountPtr<Buffer> pBLASScratch = pDevice->CreateBuffer(BufferDesc::CreateByteAddress(buildRequests[requestIndex].ScratchSize, BufferFlag::UnorderedAccess | BufferFlag::NoBindless), "BLAS.ScratchBuffer");
+			RefCountPtr<Buffer> pBLAS = pDevice->CreateBuffer(BufferDesc::CreateBLAS(Math::AlignUp<uint64>(info.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT)), "BLAS.Buffer");
+
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc{};
+			asDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+			asDesc.Inputs.Flags = buildRequests[requestIndex].Flags;
+			asDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+			asDesc.Inputs.NumDescs = 1;
+			asDesc.Inputs.pGeometryDescs = &buildGeometries[requestIndex];
+			asDesc.DestAccelerationStructureData = pBLAS->GetGpuHandle();
+			asDesc.ScratchAccelerationStructureData = pBLASScratch->GetGpuHandle();
+			asDesc.SourceAccelerationStructureData = 0;
+
+			pCmd->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+
+			pMesh->pBLAS = pBLAS;
+			pMesh->NeedsBLASUpdate = false;
+			if (buildRequests[requestIndex].Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION)
+			{
+				m_QueuedRequests.push_back(&pMesh->pBLAS);
+				m_QueuedCompactions.push_back({ pBLAS->GetSize(), m_Scheduler.GetFrame() });
+			}
+		}
+
+		// The TLAS build reads the BLAS which were just built or refit
+		context.InsertUAVBarrier();
 
 		struct BLASInstance
 		{
@@ -60,56 +189,6 @@ void AccelerationStructure::Build(CommandContext& context, const SceneView& view
 		for (const Batch& batch : view.Batches)
 		{
 			SubMesh* pMesh = batch.pMesh;
-			Mesh* pParentMesh = pMesh->pParent;
-
-			if (!pMesh->pBLAS && numBLASBuiltVertices < Tweakables::gMaxNumBLASVerticesPerFrame)
-			{
-				numBLASBuiltVertices += pMesh->PositionStreamLocation.Elements;
-				++numBuiltBLAS;
-
-				const Material& material = pParentMesh->GetMaterial(pMesh->MaterialId);
-				D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc{};
-				geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-				geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
-				if (material.AlphaMode == MaterialAlphaMode::Opaque)
-				{
-					geometryDesc.Flags |= D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-				}
-				geometryDesc.Triangles.IndexBuffer = pMesh->IndicesLocation.Location;
-				geometryDesc.Triangles.IndexCount = pMesh->IndicesLocation.Elements;
-				geometryDesc.Triangles.IndexFormat = D3D::ConvertFormat(pMesh->IndicesLocation.Format);
-				geometryDesc.Triangles.Transform3x4 = 0;
-				geometryDesc.Triangles.VertexBuffer.StartAddress = pMesh->PositionStreamLocation.Location;
-				geometryDesc.Triangles.VertexBuffer.StrideInBytes = pMesh->PositionStreamLocation.Stride;
-				geometryDesc.Triangles.VertexCount = pMesh->PositionStreamLocation.Elements;
-				geometryDesc.Triangles.VertexFormat = D3D::ConvertFormat(pMesh->PositionsFormat);
-
-				D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS prebuildInfo{};
-				prebuildInfo.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-				prebuildInfo.Flags =
-					D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE
-					| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
-				prebuildInfo.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-				prebuildInfo.NumDescs = 1;
-				prebuildInfo.pGeometryDescs = &geometryDesc;
-
-				D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info{};
-				pDevice->GetDevice()->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildInfo, &info);
-
-				RefCountPtr<Buffer> pBLASScratch = pDevice->CreateBuffer(BufferDesc::CreateByteAddress(Math::AlignUp<uint64>(info.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT), BufferFlag::UnorderedAccess | BufferFlag::NoBindless), "BLAS.ScratchBuffer");
-				RefCountPtr<Buffer> pBLAS = pDevice->CreateBuffer(BufferDesc::CreateBLAS(Math::AlignUp<uint64>(info.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT)), "BLAS.Buffer");
-
-				D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc{};
-				asDesc.Inputs = prebuildInfo;
-				asDesc.DestAccelerationStructureData = pBLAS->GetGpuHandle();
-				asDesc.ScratchAccelerationStructureData = pBLASScratch->GetGpuHandle();
-				asDesc.SourceAccelerationStructureData = 0;
-
-				pCmd->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
-
-				pMesh->pBLAS = pBLAS;
-				m_QueuedRequests.push_back(&pMesh->pBLAS);
-			}
 
 			if (pMesh->pBLAS)
 			{
@@ -135,16 +214,6 @@ void AccelerationStructure::Build(CommandContext& context, const SceneView& view
 			}
 		}
 
-		if (numBuiltBLAS > 0)
-		{
-			//E_LOG(Info, "Built %d BLAS instances. %d vertices", numBuiltBLAS, numBLASBuiltVertices);
-		}
-
-		{
-			PROFILE_GPU_SCOPE(context.GetCommandList(), "BLAS Compaction");
-			ProcessCompaction(context);
-		}
-
 		if(!blasInstances.empty() || !m_pTLAS)
 		{
 			PROFILE_GPU_SCOPE(context.GetCommandList(), "TLAS Data Generation");
@@ -218,67 +287,125 @@ ShaderResourceView* AccelerationStructure::GetSRV() const
 	return nullptr;
 }
 
-void AccelerationStructure::ProcessCompaction(CommandContext& context)
+void AccelerationStructure::ResolveCompaction(CommandContext& context)
 {
-	if (!m_ActiveRequests.empty())
+	if (m_ActiveRequests.empty() || !m_PostBuildInfoFence.IsComplete())
 	{
-		if (!m_PostBuildInfoFence.IsComplete())
-		{
-			return;
-		}
+		return;
+	}
 
-		const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC* pPostCompactSizes = static_cast<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC*>(m_pPostBuildInfoReadbackBuffer->GetMappedData());
-		for (RefCountPtr<Buffer>* pSourceBLAS: m_ActiveRequests)
-		{
-			check(pPostCompactSizes->CompactedSizeInBytes > 0);
-			RefCountPtr<Buffer> pTargetBLAS = context.GetParent()->CreateBuffer(BufferDesc::CreateBLAS(pPostCompactSizes->CompactedSizeInBytes), "BLAS.Compacted");
-			context.GetCommandList()->CopyRaytracingAccelerationStructure(pTargetBLAS->GetGpuHandle(), (*pSourceBLAS)->GetGpuHandle(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
-			*pSourceBLAS = pTargetBLAS;
-			pPostCompactSizes++;
-		}
-		//E_LOG(Info, "Compacted %d BLAS instances", m_ActiveRequests.size());
-		m_ActiveRequests.clear();
+	const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC* pPostCompactSizes = static_cast<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC*>(m_pPostBuildInfoReadbackBuffer->GetMappedData());
+	for (RefCountPtr<Buffer>* pSourceBLAS: m_ActiveRequests)
+	{
+		check(pPostCompactSizes->CompactedSizeInBytes > 0);
+		RefCountPtr<Buffer> pTargetBLAS = m_pBLASAllocator->CreateBuffer(BufferDesc::CreateBLAS(pPostCompactSizes->CompactedSizeInBytes), "BLAS.Compacted", D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		context.GetCommandList()->CopyRaytracingAccelerationStructure(pTargetBLAS->GetGpuHandle(), (*pSourceBLAS)->GetGpuHandle(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+		*pSourceBLAS = pTargetBLAS;
+		pPostCompactSizes++;
 	}
+	//E_LOG(Info, "Compacted %d BLAS instances", m_ActiveRequests.size());
+	m_ActiveRequests.clear();
+}
 
-	for (RefCountPtr<Buffer>* pSourceBLAS : m_QueuedRequests)
+void AccelerationStructure::BeginCompaction(CommandContext& context, Span<uint32> requests)
+{
+	if (requests.GetSize() == 0)
 	{
-		m_ActiveRequests.push_back(pSourceBLAS);
-		if (m_ActiveRequests.size() >= Tweakables::gMaxNumCompactionsPerFrame)
-		{
-			break;
-		}
+		return;
 	}
 
-	if(!m_ActiveRequests.empty())
+	check(m_ActiveRequests.empty());
+	for (uint32 requestIndex : requests)
+		m_ActiveRequests.push_back(m_QueuedRequests[requestIndex]);
+
+	// Remove from the queue starting from the back, so the indices stay valid
+	std::vector<uint32> sortedRequests(requests.begin(), requests.end());
+	std::sort(sortedRequests.begin(), sortedRequests.end(), std::greater<uint32>());
+	for (uint32 requestIndex : sortedRequests)
 	{
-		m_QueuedRequests.erase(m_QueuedRequests.begin(), m_QueuedRequests.begin() + m_ActiveRequests.size());
+		m_QueuedRequests.erase(m_QueuedRequests.begin() + requestIndex);
+		m_QueuedCompactions.erase(m_QueuedCompactions.begin() + requestIndex);
+	}
 
-		if (!m_pPostBuildInfoBuffer)
-		{
-			uint32 requiredSize = Tweakables::gMaxNumCompactionsPerFrame * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
-			m_pPostBuildInfoBuffer = context.GetParent()->CreateBuffer(BufferDesc::CreateBuffer(requiredSize, BufferFlag::UnorderedAccess), "BLASCompaction.PostBuildInfo");
-			m_pPostBuildInfoReadbackBuffer = context.GetParent()->CreateBuffer(BufferDesc::CreateReadback(requiredSize), "BLASCompaction.PostBuildInfoReadback");
-		}
+	const uint32 maxBatchSize = m_Scheduler.GetSettings().MaxCompactionsPerBatch;
+	check(requests.GetSize() <= maxBatchSize);
+	if (!m_pPostBuildInfoBuffer)
+	{
+		m_pBLASAllocator = new BufferSubAllocator(context.GetParent(), BufferFlag::AccelerationStructure | BufferFlag::UnorderedAccess, 32 * 1024 * 1024, "BLAS.CompactedPool");
+		uint32 requiredSize = maxBatchSize * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+		m_pPostBuildInfoBuffer = context.GetParent()->CreateBuffer(BufferDesc::CreateBuffer(requiredSize, BufferFlag::UnorderedAccess), "BLASCompaction.PostBuildInfo");
+		m_pPostBuildInfoReadbackBuffer = context.GetParent()->CreateBuffer(BufferDesc::CreateReadback(requiredSize), "BLASCompaction.PostBuildInfoReadback");
+	}
 
-		std::vector<D3D12_GPU_VIRTUAL_ADDRESS> blasAddresses;
-		blasAddresses.reserve(m_ActiveRequests.size());
-		for (RefCountPtr<Buffer>* pSourceBLAS : m_ActiveRequests)
-			blasAddresses.push_back((*pSourceBLAS)->GetGpuHandle());
+	std::vector<D3D12_GPU_VIRTUAL_ADDRESS> blasAddresses;
+	blasAddresses.reserve(m_ActiveRequests.size());
+	for (RefCountPtr<Buffer>* pSourceBLAS : m_ActiveRequests)
+		blasAddresses.push_back((*pSourceBLAS)->GetGpuHandle());
 
-		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC desc;
-		desc.DestBuffer = m_pPostBuildInfoBuffer->GetGpuHandle();
-		desc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC desc;
+	desc.DestBuffer = m_pPostBuildInfoBuffer->GetGpuHandle();
+	desc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
 
-		// UAV barrier to ensure BLAS creation is finished
-		context.InsertUAVBarrier();
-		context.InsertResourceBarrier(m_pPostBuildInfoBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-		context.FlushResourceBarriers();
-		context.GetCommandList()->EmitRaytracingAccelerationStructurePostbuildInfo(&desc, (uint32)blasAddresses.size(), blasAddresses.data());
+	// UAV barrier to ensure BLAS creation is finished
+	context.InsertUAVBarrier();
+	context.InsertResourceBarrier(m_pPostBuildInfoBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	context.FlushResourceBarriers();
+	context.GetCommandList()->EmitRaytracingAccelerationStructurePostbuildInfo(&desc, (uint32)blasAddresses.size(), blasAddresses.data());
 
-		context.InsertResourceBarrier(m_pPostBuildInfoBuffer, D3D12_RESOURCE_STATE_COPY_SOURCE);
-		context.CopyResource(m_pPostBuildInfoBuffer, m_pPostBuildInfoReadbackBuffer);
+	context.InsertResourceBarrier(m_pPostBuildInfoBuffer, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	context.CopyResource(m_pPostBuildInfoBuffer, m_pPostBuildInfoReadbackBuffer);
 
-		m_PostBuildInfoFence = SyncPoint(context.GetParent()->GetFrameFence(), context.GetParent()->GetFrameFence()->GetCurrentValue());
-	}
+	m_PostBuildInfoFence = SyncPoint(context.GetParent()->GetFrameFence(), context.GetParent()->GetFrameFence()->GetCurrentValue());
 }
 
+void AccelerationStructure::RefitSkinnedBLAS(CommandContext& context, const SceneView& view)
+{
+	std::vector<SubMesh*> refitMeshes;
+	std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometries;
+	std::vector<uint64> scratchOffsets;
+	uint64 scratchSize = 0;
+	for (const Batch& batch : view.Batches)
+	{
+		SubMesh* pMesh = batch.pMesh;
+		if (!pMesh->pBLAS || !pMesh->NeedsBLASUpdate)
+			continue;
+
+		D3D12_RAYTRACING_GEOMETRY_DESC& geometryDesc = geometries.emplace_back(GetGeometryDesc(pMesh));
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS prebuildInfo{};
+		prebuildInfo.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		prebuildInfo.Flags = SkinnedBLASBuildFlags;
+		prebuildInfo.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		prebuildInfo.NumDescs = 1;
+		prebuildInfo.pGeometryDescs = &geometryDesc;
+
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info{};
+		context.GetParent()->GetDevice()->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildInfo, &info);
+
+		// All refits of the frame use a range of the same scratch buffer, so they don't wait for each other
+		scratchOffsets.push_back(scratchSize);
+		scratchSize += Math::AlignUp<uint64>(info.UpdateScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		refitMeshes.push_back(pMesh);
+		pMesh->NeedsBLASUpdate = false;
+	}
+
+	if (refitMeshes.empty())
+		return;
+
+	if (!m_pBLASUpdateScratch || m_pBLASUpdateScratch->GetSize() < scratchSize)
+		m_pBLASUpdateScratch = context.GetParent()->CreateBuffer(BufferDesc::CreateByteAddress(Math::Max<uint64>(scratchSize, m_pBLASUpdateScratch ? m_pBLASUpdateScratch->GetSize() * 2 : 0), BufferFlag::UnorderedAccess | BufferFlag::NoBindless), "BLAS.UpdateScratchBuffer");
+
+	context.FlushResourceBarriers();
+	for (uint32 i = 0; i < (uint32)refitMeshes.size(); ++i)
+	{
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc{};
+		asDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		asDesc.Inputs.Flags = SkinnedBLASBuildFlags | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		asDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		asDesc.Inputs.NumDescs = 1;
+		asDesc.Inputs.pGeometryDescs = &geometries[i];
+		asDesc.DestAccelerationStructureData = refitMeshes[i]->pBLAS->GetGpuHandle();
+		asDesc.SourceAccelerationStructureData = refitMeshes[i]->pBLAS->GetGpuHandle();
+		asDesc.ScratchAccelerationStructureData = m_pBLASUpdateScratch->GetGpuHandle() + scratchOffsets[i];
+		context.GetCommandList()->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+	}
+}
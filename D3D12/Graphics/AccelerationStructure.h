@@ -2,6 +2,8 @@
 
 #include "Graphics/RHI/RHI.h"
 #include "RHI/Fence.h"
+#include "RHI/BufferSubAllocator.h"
+#include "BLASScheduler.h"
 
 struct SceneView;
 struct SubMesh;
@@ -13,17 +15,30 @@ public:
 	ShaderResourceView* GetSRV() const;
 
 private:
-	void ProcessCompaction(CommandContext& context);
+	// Compacts the BLAS of the last batch once their compacted sizes are read back
+	void ResolveCompaction(CommandContext& context);
+	// Reads back the compacted sizes of the given queued requests
+	void BeginCompaction(CommandContext& context, Span<uint32> requests);
+	// Refits the BLAS of the skinned meshes which were skinned since their last build
+	void RefitSkinnedBLAS(CommandContext& context, const SceneView& view);
 
 	RefCountPtr<Buffer> m_pTLAS;
 	RefCountPtr<Buffer> m_pScratch;
 	RefCountPtr<Buffer> m_pBLASInstancesTargetBuffer;
 	RefCountPtr<Buffer> m_pBLASInstancesSourceBuffer;
 
+	BLASScheduler m_Scheduler;
+	BLASScheduler::Schedule m_Schedule;
+
 	// Compaction
+	// The compacted BLAS are small and live long, so they are ranges of large buffers
+	RefCountPtr<BufferSubAllocator> m_pBLASAllocator;
 	RefCountPtr<Buffer> m_pPostBuildInfoBuffer;
 	RefCountPtr<Buffer> m_pPostBuildInfoReadbackBuffer;
 	SyncPoint m_PostBuildInfoFence;
 	std::vector<RefCountPtr<Buffer>*> m_QueuedRequests;
+	std::vector<BLASScheduler::CompactionRequest> m_QueuedCompactions;
 	std::vector<RefCountPtr<Buffer>*> m_ActiveRequests;
+
+	RefCountPtr<Buffer> m_pBLASUpdateScratch;
 };
@@ -0,0 +1,385 @@
+#include "stdafx.h"
+#include "Animation.h"
+#include "TransformHierarchy.h"
+#include "Core/Profiler.h"
+
+#include <immintrin.h>
+
+namespace
+{
+	// Maximum error of a key removed by key reduction
+	constexpr float VectorTolerance = 0.0001f;
+	constexpr float RotationTolerance = 0.0005f;
+
+	// Rotations are stored as the 3 smallest components, each in 10 bits, and the index of the largest in 2 bits.
+	// The largest component is made positive, and reconstructed from the unit length.
+	constexpr float SmallestThreeRange = 0.70710678f;
+	constexpr uint32 SmallestThreeMask = (1u << 10) - 1;
+
+	uint32 PackQuaternion(const Vector4& q)
+	{
+		const float components[] = { q.x, q.y, q.z, q.w };
+		uint32 largest = 0;
+		for (uint32 i = 1; i < 4; ++i)
+		{
+			if (fabs(components[i]) > fabs(components[largest]))
+				largest = i;
+		}
+		const float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+		uint32 packed = largest << 30;
+		uint32 shift = 20;
+		for (uint32 i = 0; i < 4; ++i)
+		{
+			if (i == largest)
+				continue;
+			float normalized = Math::Clamp(sign * components[i] / SmallestThreeRange * 0.5f + 0.5f, 0.0f, 1.0f);
+			packed |= (uint32)(normalized * SmallestThreeMask + 0.5f) << shift;
+			shift -= 10;
+		}
+		return packed;
+	}
+
+	// 4 quaternions with each component in its own register
+	struct QuaternionSoA
+	{
+		__m128 X, Y, Z, W;
+	};
+
+	// Picks 'b' where 'mask' is set
+	__m128 Select(__m128 a, __m128 b, __m128 mask)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+	}
+
+	void Normalize(QuaternionSoA& q)
+	{
+		__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q.X, q.X), _mm_mul_ps(q.Y, q.Y)), _mm_add_ps(_mm_mul_ps(q.Z, q.Z), _mm_mul_ps(q.W, q.W)));
+		__m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSq));
+		q.X = _mm_mul_ps(q.X, invLength);
+		q.Y = _mm_mul_ps(q.Y, invLength);
+		q.Z = _mm_mul_ps(q.Z, invLength);
+		q.W = _mm_mul_ps(q.W, invLength);
+	}
+
+	// Unpacks 4 rotations at once. The largest component is reconstructed from the unit length.
+	QuaternionSoA UnpackQuaternions(__m128i packed)
+	{
+		const __m128i mask = _mm_set1_epi32(SmallestThreeMask);
+		const __m128 scale = _mm_set1_ps(2.0f * SmallestThreeRange / SmallestThreeMask);
+		const __m128 bias = _mm_set1_ps(-SmallestThreeRange);
+		auto Decode = [&](__m128i value) { return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(value, mask)), scale), bias); };
+
+		// The 3 smallest components, in order, skipping the largest
+		__m128 a = Decode(_mm_srli_epi32(packed, 20));
+		__m128 b = Decode(_mm_srli_epi32(packed, 10));
+		__m128 c = Decode(packed);
+		__m128 sumSquares = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c));
+		__m128 d = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), sumSquares)));
+
+		__m128i largest = _mm_srli_epi32(packed, 30);
+		__m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(0)));
+		__m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(1)));
+		__m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(2)));
+		__m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(3)));
+
+		QuaternionSoA q;
+		q.X = Select(a, d, is0);
+		q.Y = Select(Select(b, a, is0), d, is1);
+		q.Z = Select(Select(c, b, _mm_or_ps(is0, is1)), d, is2);
+		q.W = Select(c, d, is3);
+		Normalize(q);
+		return q;
+	}
+
+	// Decodes and interpolates up to 4 rotation keys at once and writes the results to 'pOutRotations'.
+	// Rotations dominate the cost of sampling, and their tracks are independent, so they are processed in SoA form.
+	void SampleRotations(const uint32* pPacked0, const uint32* pPacked1, const float* pT, Quaternion* const* pOutRotations, uint32 count)
+	{
+		QuaternionSoA a = UnpackQuaternions(_mm_loadu_si128((const __m128i*)pPacked0));
+		QuaternionSoA b = UnpackQuaternions(_mm_loadu_si128((const __m128i*)pPacked1));
+		__m128 t = _mm_loadu_ps(pT);
+
+		// Same as NLerp(): interpolate along the shortest path
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.X, b.X), _mm_mul_ps(a.Y, b.Y)), _mm_add_ps(_mm_mul_ps(a.Z, b.Z), _mm_mul_ps(a.W, b.W)));
+		__m128 flipSign = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+		auto Lerp = [&](__m128 from, __m128 to) { return _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(to, flipSign), from), t)); };
+
+		QuaternionSoA q;
+		q.X = Lerp(a.X, b.X);
+		q.Y = Lerp(a.Y, b.Y);
+		q.Z = Lerp(a.Z, b.Z);
+		q.W = Lerp(a.W, b.W);
+		Normalize(q);
+
+		_MM_TRANSPOSE4_PS(q.X, q.Y, q.Z, q.W);
+		const __m128 rotations[] = { q.X, q.Y, q.Z, q.W };
+		for (uint32 i = 0; i < count; ++i)
+			_mm_storeu_ps(&pOutRotations[i]->x, rotations[i]);
+	}
+
+	// Normalized linear interpolation, along the shortest path
+	DirectX::XMVECTOR XM_CALLCONV NLerp(DirectX::FXMVECTOR a, DirectX::FXMVECTOR b, float t)
+	{
+		using namespace DirectX;
+		XMVECTOR flip = XMVectorLess(XMVector4Dot(a, b), XMVectorZero());
+		XMVECTOR shortestB = XMVectorSelect(b, XMVectorNegate(b), flip);
+		return XMQuaternionNormalize(XMVectorLerp(a, shortestB, t));
+	}
+
+	Vector4 InterpolateKey(const Vector4& a, const Vector4& b, float t, bool isRotation)
+	{
+		DirectX::XMVECTOR va = DirectX::XMLoadFloat4(&a);
+		DirectX::XMVECTOR vb = DirectX::XMLoadFloat4(&b);
+		return isRotation ? Vector4(NLerp(va, vb, t)) : Vector4(DirectX::XMVectorLerp(va, vb, t));
+	}
+
+	float KeyDistance(const Vector4& a, const Vector4& b, bool isRotation)
+	{
+		// q and -q are the same rotation
+		Vector4 diff = isRotation && a.Dot(b) < 0.0f ? a + b : a - b;
+		return Math::Max(Math::Max(fabs(diff.x), fabs(diff.y)), Math::Max(fabs(diff.z), fabs(diff.w)));
+	}
+}
+
+void AnimationPose::Initialize(const TransformHierarchy& hierarchy)
+{
+	const uint32 numNodes = hierarchy.GetNumNodes();
+	Translations.resize(numNodes);
+	Rotations.resize(numNodes);
+	Scales.resize(numNodes);
+	for (uint32 node = 0; node < numNodes; ++node)
+	{
+		Translations[node] = hierarchy.GetTranslation(node);
+		Rotations[node] = hierarchy.GetRotation(node);
+		Scales[node] = hierarchy.GetScale(node);
+	}
+}
+
+void AnimationPose::CopyNodes(const AnimationPose& other, Span<uint32> nodes)
+{
+	for (uint32 node : nodes)
+	{
+		Translations[node] = other.Translations[node];
+		Rotations[node] = other.Rotations[node];
+		Scales[node] = other.Scales[node];
+	}
+}
+
+void AnimationPose::Apply(TransformHierarchy& hierarchy, Span<uint32> nodes) const
+{
+	for (uint32 node : nodes)
+	{
+		hierarchy.SetTranslation(node, Translations[node]);
+		hierarchy.SetRotation(node, Rotations[node]);
+		hierarchy.SetScale(node, Scales[node]);
+	}
+}
+
+void BlendPoses(const AnimationPose& a, const AnimationPose& b, float weight, Span<uint32> nodes, AnimationPose& out)
+{
+	using namespace DirectX;
+	for (uint32 node : nodes)
+	{
+		XMStoreFloat3(&out.Translations[node], XMVectorLerp(XMLoadFloat3(&a.Translations[node]), XMLoadFloat3(&b.Translations[node]), weight));
+		XMStoreFloat4(&out.Rotations[node], NLerp(XMLoadFloat4(&a.Rotations[node]), XMLoadFloat4(&b.Rotations[node]), weight));
+		XMStoreFloat3(&out.Scales[node], XMVectorLerp(XMLoadFloat3(&a.Scales[node]), XMLoadFloat3(&b.Scales[node]), weight));
+	}
+}
+
+void AnimationClip::AddTrack(uint32 node, TrackType type, bool step, Span<float> times, const float* pValues)
+{
+	const uint32 numKeys = times.GetSize();
+	if (numKeys == 0)
+		return;
+
+	const bool isRotation = type == TrackType::Rotation;
+	std::vector<Vector4> values(numKeys);
+	for (uint32 i = 0; i < numKeys; ++i)
+	{
+		if (isRotation)
+		{
+			values[i] = Vector4(&pValues[i * 4]);
+			values[i].Normalize();
+		}
+		else
+		{
+			values[i] = Vector4(pValues[i * 3 + 0], pValues[i * 3 + 1], pValues[i * 3 + 2], 0.0f);
+		}
+	}
+
+	// Remove keys which the interpolation between the remaining keys reproduces within the tolerance
+	const float tolerance = isRotation ? RotationTolerance : VectorTolerance;
+	std::vector<uint32> keptKeys = { 0 };
+	uint32 anchor = 0;
+	for (uint32 i = 1; i + 1 < numKeys; ++i)
+	{
+		bool canRemove = true;
+		for (uint32 j = anchor + 1; j <= i && canRemove; ++j)
+		{
+			float t = step ? 0.0f : (times[j] - times[anchor]) / Math::Max(times[i + 1] - times[anchor], FLT_EPSILON);
+			canRemove = KeyDistance(InterpolateKey(values[anchor], values[i + 1], t, isRotation), values[j], isRotation) <= tolerance;
+		}
+		if (!canRemove)
+		{
+			keptKeys.push_back(i);
+			anchor = i;
+		}
+	}
+	if (numKeys > 1)
+		keptKeys.push_back(numKeys - 1);
+
+	// A track which holds a single value only needs a single key
+	bool isConstant = true;
+	for (uint32 key : keptKeys)
+		isConstant &= KeyDistance(values[key], values[0], isRotation) <= tolerance;
+	if (isConstant)
+		keptKeys.resize(1);
+
+	Track& track = Tracks.emplace_back();
+	track.Node = node;
+	track.Type = type;
+	track.Step = step;
+	track.FirstKey = (uint32)KeyTimes.size();
+	track.NumKeys = (uint32)keptKeys.size();
+	track.FirstValue = isRotation ? (uint32)Rotations.size() : (uint32)Vectors.size();
+	for (uint32 key : keptKeys)
+	{
+		KeyTimes.push_back(times[key]);
+		if (isRotation)
+			Rotations.push_back(PackQuaternion(values[key]));
+		else
+			Vectors.push_back(Vector3(values[key].x, values[key].y, values[key].z));
+	}
+	Duration = Math::Max(Duration, times[numKeys - 1]);
+}
+
+void AnimationClip::Sample(float time, AnimationPose& pose) const
+{
+	using namespace DirectX;
+
+	// Rotation keys are gathered and sampled 4 at a time
+	uint32 packed0[4]{};
+	uint32 packed1[4]{};
+	float rotationT[4]{};
+	Quaternion* pRotations[4]{};
+	uint32 numRotations = 0;
+
+	for (const Track& track : Tracks)
+	{
+		// Find the keys around 'time'
+		const float* pTimes = &KeyTimes[track.FirstKey];
+		uint32 key1 = (uint32)(std::upper_bound(pTimes, pTimes + track.NumKeys, time) - pTimes);
+		uint32 key0 = key1 > 0 ? key1 - 1 : 0;
+		key1 = Math::Min(key1, track.NumKeys - 1);
+		float t = 0.0f;
+		if (!track.Step && key1 != key0)
+			t = Math::Clamp((time - pTimes[key0]) / (pTimes[key1] - pTimes[key0]), 0.0f, 1.0f);
+
+		switch (track.Type)
+		{
+		case TrackType::Translation:
+		case TrackType::Scale:
+		{
+			const Vector3* pValues = &Vectors[track.FirstValue];
+			XMVECTOR value = XMVectorLerp(XMLoadFloat3(&pValues[key0]), XMLoadFloat3(&pValues[key1]), t);
+			XMStoreFloat3(track.Type == TrackType::Translation ? &pose.Translations[track.Node] : &pose.Scales[track.Node], value);
+			break;
+		}
+		case TrackType::Rotation:
+		{
+			const uint32* pValues = &Rotations[track.FirstValue];
+			packed0[numRotations] = pValues[key0];
+			packed1[numRotations] = pValues[key1];
+			rotationT[numRotations] = t;
+			pRotations[numRotations] = &pose.Rotations[track.Node];
+			if (++numRotations == 4)
+			{
+				SampleRotations(packed0, packed1, rotationT, pRotations, numRotations);
+				numRotations = 0;
+			}
+			break;
+		}
+		}
+	}
+
+	if (numRotations > 0)
+		SampleRotations(packed0, packed1, rotationT, pRotations, numRotations);
+}
+
+void AnimationClip::GetAnimatedNodes(std::vector<uint32>& outNodes) const
+{
+	for (const Track& track : Tracks)
+	{
+		if (std::find(outNodes.begin(), outNodes.end(), track.Node) == outNodes.end())
+			outNodes.push_back(track.Node);
+	}
+}
+
+void Skin::ComputeJointMatrices(const TransformHierarchy& hierarchy, Matrix* pOutMatrices) const
+{
+	for (uint32 i = 0; i < (uint32)Joints.size(); ++i)
+		pOutMatrices[i] = InverseBindMatrices[i] * hierarchy.GetWorldMatrix(Joints[i]);
+}
+
+void Animator::Initialize(Span<AnimationClip> clips, const TransformHierarchy& hierarchy)
+{
+	m_Clips = clips;
+	m_AnimatedNodes.clear();
+	for (const AnimationClip& clip : clips)
+		clip.GetAnimatedNodes(m_AnimatedNodes);
+	m_RestPose.Initialize(hierarchy);
+	m_Pose = m_RestPose;
+	m_BlendPose = m_RestPose;
+	m_Clip = InvalidClip;
+	m_PreviousClip = InvalidClip;
+}
+
+void Animator::Play(uint32 clip, float blendTime)
+{
+	check(clip < m_Clips.GetSize());
+	if (clip == m_Clip)
+		return;
+
+	m_PreviousClip = blendTime > 0.0f ? m_Clip : InvalidClip;
+	m_PreviousTime = m_Time;
+	m_BlendTime = 0.0f;
+	m_BlendDuration = blendTime;
+	m_Clip = clip;
+	m_Time = 0.0f;
+}
+
+float Animator::AdvanceTime(uint32 clip, float time, float deltaTime) const
+{
+	const float duration = m_Clips[clip].Duration;
+	return duration > 0.0f ? fmodf(time + deltaTime * PlaybackSpeed, duration) : 0.0f;
+}
+
+void Animator::Update(float deltaTime, TransformHierarchy& hierarchy)
+{
+	if (m_Clip == InvalidClip)
+		return;
+
+	// Nodes not animated by a clip stay in the rest pose
+	m_Time = AdvanceTime(m_Clip, m_Time, deltaTime);
+	m_Pose.CopyNodes(m_RestPose, m_AnimatedNodes);
+	m_Clips[m_Clip].Sample(m_Time, m_Pose);
+
+	if (m_PreviousClip != InvalidClip)
+	{
+		m_BlendTime += deltaTime;
+		if (m_BlendTime < m_BlendDuration)
+		{
+			m_PreviousTime = AdvanceTime(m_PreviousClip, m_PreviousTime, deltaTime);
+			m_BlendPose.CopyNodes(m_RestPose, m_AnimatedNodes);
+			m_Clips[m_PreviousClip].Sample(m_PreviousTime, m_BlendPose);
+			BlendPoses(m_BlendPose, m_Pose, m_BlendTime / m_BlendDuration, m_AnimatedNodes, m_Pose);
+		}
+		else
+		{
+			m_PreviousClip = InvalidClip;
+		}
+	}
+
+	m_Pose.Apply(hierarchy, m_AnimatedNodes);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+class TransformHierarchy;
+
+/*
+	Local transforms of the nodes of a transform hierarchy, indexed by node.
+*/
+struct AnimationPose
+{
+	std::vector<Vector3> Translations;
+	std::vector<Quaternion> Rotations;
+	std::vector<Vector3> Scales;
+
+	// Initializes the pose from the current local transforms of 'hierarchy'
+	void Initialize(const TransformHierarchy& hierarchy);
+	void CopyNodes(const AnimationPose& other, Span<uint32> nodes);
+	void Apply(TransformHierarchy& hierarchy, Span<uint32> nodes) const;
+};
+
+// Blends the given nodes of two poses. A 'weight' of 0 results in 'a', 1 results in 'b'. 'out' can alias 'a' or 'b'.
+void BlendPoses(const AnimationPose& a, const AnimationPose& b, float weight, Span<uint32> nodes, AnimationPose& out);
+
+/*
+	Keyframed animation of the nodes of a transform hierarchy.
+	Keys are compressed at import: keys which can be reconstructed by interpolating their neighbours are removed
+	and rotations are quantized to 32 bits.
+*/
+struct AnimationClip
+{
+	enum class TrackType : uint8
+	{
+		Translation,
+		Rotation,
+		Scale,
+	};
+
+	struct Track
+	{
+		uint32 Node;
+		TrackType Type;
+		// Keys are held until the next key instead of interpolated
+		bool Step;
+		// Range in 'KeyTimes'
+		uint32 FirstKey;
+		uint32 NumKeys;
+		// First value in 'Vectors' or 'Rotations', depending on the type
+		uint32 FirstValue;
+	};
+
+	// Adds a track and compresses its keys. 'values' holds one Vector3 or Quaternion per key, depending on the type.
+	void AddTrack(uint32 node, TrackType type, bool step, Span<float> times, const float* pValues);
+
+	// Writes the local transform of each animated node at 'time' to 'pose'
+	void Sample(float time, AnimationPose& pose) const;
+
+	// Appends the nodes animated by the clip to 'outNodes', without duplicates
+	void GetAnimatedNodes(std::vector<uint32>& outNodes) const;
+
+	uint32 GetNumKeys() const { return (uint32)KeyTimes.size(); }
+
+	std::string Name;
+	float Duration = 0.0f;
+	std::vector<Track> Tracks;
+	std::vector<float> KeyTimes;
+	std::vector<Vector3> Vectors;
+	std::vector<uint32> Rotations;
+};
+
+/*
+	Joints of a skinned mesh.
+	A joint matrix transforms a vertex from the bind pose to its animated world position.
+*/
+struct Skin
+{
+	static constexpr uint32 InvalidSkin = 0xFFFFFFFF;
+
+	std::vector<uint32> Joints;
+	std::vector<Matrix> InverseBindMatrices;
+	// First matrix of the skin in the joint matrices of its mesh
+	uint32 JointMatricesOffset = 0;
+
+	void ComputeJointMatrices(const TransformHierarchy& hierarchy, Matrix* pOutMatrices) const;
+};
+
+/*
+	Plays animation clips on a transform hierarchy. When switching clips, the previous clip keeps playing
+	and is blended out over the given time.
+*/
+class Animator
+{
+public:
+	static constexpr uint32 InvalidClip = 0xFFFFFFFF;
+
+	// 'clips' must outlive the animator. The rest pose is taken from the current state of 'hierarchy'.
+	void Initialize(Span<AnimationClip> clips, const TransformHierarchy& hierarchy);
+
+	void Play(uint32 clip, float blendTime = 0.0f);
+
+	// Advances time and writes the pose of the animated nodes to 'hierarchy'. Does not update the world matrices.
+	void Update(float deltaTime, TransformHierarchy& hierarchy);
+
+	bool IsPlaying() const { return m_Clip != InvalidClip; }
+	uint32 GetClip() const { return m_Clip; }
+	float GetTime() const { return m_Time; }
+	float PlaybackSpeed = 1.0f;
+
+private:
+	float AdvanceTime(uint32 clip, float time, float deltaTime) const;
+
+	Span<AnimationClip> m_Clips;
+	// Nodes animated by any of the clips
+	std::vector<uint32> m_AnimatedNodes;
+	AnimationPose m_RestPose;
+	AnimationPose m_Pose;
+	AnimationPose m_BlendPose;
+
+	uint32 m_Clip = InvalidClip;
+	float m_Time = 0.0f;
+	uint32 m_PreviousClip = InvalidClip;
+	float m_PreviousTime = 0.0f;
+	float m_BlendTime = 0.0f;
+	float m_BlendDuration = 0.0f;
+};
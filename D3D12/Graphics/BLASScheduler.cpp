@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include "BLASScheduler.h"
+
+void BLASScheduler::Update(Span<BuildRequest> builds, Span<CompactionRequest> compactions, bool compactionInFlight, Schedule& outSchedule)
+{
+	++m_Frame;
+	outSchedule.Builds.clear();
+	outSchedule.Compactions.clear();
+	outSchedule.BuildTimeMs = 0.0f;
+	outSchedule.ScratchSize = 0;
+
+	m_SortedRequests.resize(builds.GetSize());
+	for (uint32 i = 0; i < builds.GetSize(); ++i)
+		m_SortedRequests[i] = i;
+	std::stable_sort(m_SortedRequests.begin(), m_SortedRequests.end(), [&](uint32 a, uint32 b)
+		{
+			return builds[a].Priority > builds[b].Priority;
+		});
+
+	// Smaller builds further down can still fill up what is left of the budgets
+	for (uint32 requestIndex : m_SortedRequests)
+	{
+		const BuildRequest& request = builds[requestIndex];
+		const float buildTime = EstimateBuildTime(request);
+		if (!outSchedule.Builds.empty())
+		{
+			if (outSchedule.BuildTimeMs + buildTime > m_Settings.BuildBudgetMs || outSchedule.ScratchSize + request.ScratchSize > m_Settings.ScratchBudget)
+				continue;
+		}
+		outSchedule.Builds.push_back(requestIndex);
+		outSchedule.BuildTimeMs += buildTime;
+		outSchedule.ScratchSize += request.ScratchSize;
+	}
+
+	if (compactionInFlight || compactions.GetSize() == 0)
+		return;
+
+	const uint32 maxBatchSize = Math::Max(m_Settings.MaxCompactionsPerBatch, 1u);
+	if (compactions.GetSize() < maxBatchSize)
+	{
+		uint32 oldestFrame = m_Frame;
+		for (const CompactionRequest& request : compactions)
+			oldestFrame = Math::Min(oldestFrame, request.QueueFrame);
+		if (m_Frame - oldestFrame < m_Settings.MaxCompactionDelay)
+			return;
+	}
+
+	m_SortedRequests.resize(compactions.GetSize());
+	for (uint32 i = 0; i < compactions.GetSize(); ++i)
+		m_SortedRequests[i] = i;
+	std::stable_sort(m_SortedRequests.begin(), m_SortedRequests.end(), [&](uint32 a, uint32 b)
+		{
+			return compactions[a].Size > compactions[b].Size;
+		});
+	const uint32 batchSize = Math::Min(compactions.GetSize(), maxBatchSize);
+	outSchedule.Compactions.assign(m_SortedRequests.begin(), m_SortedRequests.begin() + batchSize);
+}
+
+float BLASScheduler::EstimateBuildTime(const BuildRequest& request) const
+{
+	float nsPerTriangle = EnumHasAnyFlags(request.Flags, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD) ? m_Settings.FastBuildNsPerTriangle : m_Settings.FastTraceNsPerTriangle;
+	if (EnumHasAnyFlags(request.Flags, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION))
+		nsPerTriangle *= m_Settings.AllowCompactionCostFactor;
+	return m_Settings.BuildBaseCostUs / 1000.0f + request.NumTriangles * nsPerTriangle / 1'000'000.0f;
+}
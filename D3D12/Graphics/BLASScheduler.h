@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+	Decides which BLAS are built and which compactions are started each frame.
+	Only works on sizes, flags and priorities, so it can run without a device.
+
+	- Pending builds are ordered by priority, such as the screen coverage of the mesh. Ties keep the order of the requests.
+	- The GPU time of a build is estimated from its triangle count and build flags.
+	  Builds are added in priority order as long as they fit in the time and scratch memory budgets of the frame.
+	  The first build always goes, so a build larger than the budgets doesn't wait forever.
+	- The compacted sizes are read back in batches of at most 'MaxCompactionsPerBatch', with one batch in flight.
+	  A batch which isn't full waits up to 'MaxCompactionDelay' frames for more requests, so readbacks are not issued every frame.
+	  The largest BLAS are compacted first, as they free the most memory.
+*/
+class BLASScheduler
+{
+public:
+	struct Settings
+	{
+		// Estimated GPU time of the builds of a frame
+		float BuildBudgetMs = 1.0f;
+		// Scratch memory of the builds of a frame
+		uint64 ScratchBudget = 64 * Math::MegaBytesToBytes;
+
+		// Cost model of a build
+		float BuildBaseCostUs = 5.0f;
+		float FastTraceNsPerTriangle = 4.0f;
+		float FastBuildNsPerTriangle = 1.5f;
+		// Extra cost of writing the data needed to compact the BLAS later
+		float AllowCompactionCostFactor = 1.1f;
+
+		uint32 MaxCompactionsPerBatch = 32;
+		uint32 MaxCompactionDelay = 4;
+	};
+
+	struct BuildRequest
+	{
+		uint32 NumTriangles;
+		uint64 ScratchSize;
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS Flags;
+		float Priority;
+	};
+
+	struct CompactionRequest
+	{
+		// Size of the BLAS before compaction
+		uint64 Size;
+		// Frame returned by GetFrame() when the BLAS was built
+		uint32 QueueFrame;
+	};
+
+	struct Schedule
+	{
+		// Indices of the build requests to build this frame, highest priority first
+		std::vector<uint32> Builds;
+		// Indices of the compaction requests to read back the compacted size of this frame
+		std::vector<uint32> Compactions;
+		float BuildTimeMs = 0.0f;
+		uint64 ScratchSize = 0;
+	};
+
+	// Schedules this frame's work. 'compactionInFlight' tells if the previous batch of compactions is not done yet.
+	void Update(Span<BuildRequest> builds, Span<CompactionRequest> compactions, bool compactionInFlight, Schedule& outSchedule);
+
+	// Estimated GPU time of a build, in ms
+	float EstimateBuildTime(const BuildRequest& request) const;
+
+	uint32 GetFrame() const { return m_Frame; }
+	Settings& GetSettings() { return m_Settings; }
+	const Settings& GetSettings() const { return m_Settings; }
+
+private:
+	Settings m_Settings;
+	uint32 m_Frame = 0;
+	std::vector<uint32> m_SortedRequests;
+};
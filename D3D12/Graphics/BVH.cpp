@@ -0,0 +1,395 @@
+#include "stdafx.h"
+#include "BVH.h"
+#include "Core/Profiler.h"
+
+static constexpr uint32 NumBins = 12;
+
+static uint32 GetBin(float center, float minCenter, float binScale)
+{
+	return Math::Min((uint32)((center - minCenter) * binScale), NumBins - 1);
+}
+
+void BVH::Build(Span<BoundingBox> bounds)
+{
+	PROFILE_CPU_SCOPE();
+
+	const uint32 numElements = bounds.GetSize();
+	m_Bounds.resize(numElements);
+	m_Elements.resize(numElements);
+	m_ElementToLeaf.resize(numElements);
+	std::vector<Vector3> centers(numElements);
+	for (uint32 i = 0; i < numElements; ++i)
+	{
+		const BoundingBox& box = bounds[i];
+		m_Bounds[i].Min = Vector3(box.Center) - Vector3(box.Extents);
+		m_Bounds[i].Max = Vector3(box.Center) + Vector3(box.Extents);
+		centers[i] = box.Center;
+		m_Elements[i] = i;
+	}
+
+	m_Nodes.clear();
+	m_Parents.clear();
+	if (numElements == 0)
+		return;
+
+	m_Nodes.reserve(2 * numElements);
+	m_Parents.reserve(2 * numElements);
+	m_Nodes.push_back(Node{ AABB(), 0, numElements, 0 });
+	m_Parents.push_back(0);
+
+	struct StackEntry
+	{
+		uint32 Node;
+		uint32 Depth;
+	};
+	std::vector<StackEntry> stack;
+	stack.push_back({ 0, 0 });
+
+	while (!stack.empty())
+	{
+		const StackEntry entry = stack.back();
+		stack.pop_back();
+
+		const uint32 first = m_Nodes[entry.Node].First;
+		const uint32 count = m_Nodes[entry.Node].Count;
+
+		AABB nodeBounds, centerBounds;
+		for (uint32 i = first; i < first + count; ++i)
+		{
+			nodeBounds.Grow(m_Bounds[m_Elements[i]]);
+			centerBounds.Grow(centers[m_Elements[i]]);
+		}
+		m_Nodes[entry.Node].Bounds = nodeBounds;
+
+		if (count <= MaxLeafSize || entry.Depth + 1 >= MaxDepth)
+		{
+			for (uint32 i = first; i < first + count; ++i)
+				m_ElementToLeaf[m_Elements[i]] = entry.Node;
+			continue;
+		}
+
+		// Bin the element centers along each axis and pick the split with the lowest SAH cost
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		uint32 bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float minCenter = (&centerBounds.Min.x)[axis];
+			const float maxCenter = (&centerBounds.Max.x)[axis];
+			if (maxCenter <= minCenter)
+				continue;
+
+			struct Bin
+			{
+				AABB Bounds;
+				uint32 Count = 0;
+			};
+			Bin bins[NumBins];
+			const float binScale = NumBins / (maxCenter - minCenter);
+			for (uint32 i = first; i < first + count; ++i)
+			{
+				uint32 element = m_Elements[i];
+				Bin& bin = bins[GetBin((&centers[element].x)[axis], minCenter, binScale)];
+				bin.Bounds.Grow(m_Bounds[element]);
+				bin.Count++;
+			}
+
+			// Sweep from the left to get the cost of the left side of each split, then from the right
+			float leftCosts[NumBins - 1];
+			AABB leftBounds;
+			uint32 leftCount = 0;
+			for (uint32 i = 0; i < NumBins - 1; ++i)
+			{
+				leftBounds.Grow(bins[i].Bounds);
+				leftCount += bins[i].Count;
+				leftCosts[i] = leftCount > 0 ? leftCount * leftBounds.GetSurfaceArea() : FLT_MAX;
+			}
+
+			AABB rightBounds;
+			uint32 rightCount = 0;
+			for (uint32 i = NumBins - 1; i > 0; --i)
+			{
+				rightBounds.Grow(bins[i].Bounds);
+				rightCount += bins[i].Count;
+				if (rightCount == 0 || leftCosts[i - 1] == FLT_MAX)
+					continue;
+				float cost = leftCosts[i - 1] + rightCount * rightBounds.GetSurfaceArea();
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+
+		uint32 middle = first + count / 2;
+		if (bestAxis >= 0)
+		{
+			const float minCenter = (&centerBounds.Min.x)[bestAxis];
+			const float binScale = NumBins / ((&centerBounds.Max.x)[bestAxis] - minCenter);
+			auto it = std::partition(m_Elements.begin() + first, m_Elements.begin() + first + count, [&](uint32 element)
+				{
+					return GetBin((&centers[element].x)[bestAxis], minCenter, binScale) < bestSplit;
+				});
+			middle = (uint32)(it - m_Elements.begin());
+		}
+		// else all centers are equal, so any split is as good as another
+
+		const uint32 left = (uint32)m_Nodes.size();
+		m_Nodes[entry.Node].Left = left;
+		m_Nodes.push_back(Node{ AABB(), first, middle - first, 0 });
+		m_Nodes.push_back(Node{ AABB(), middle, first + count - middle, 0 });
+		m_Parents.push_back(entry.Node);
+		m_Parents.push_back(entry.Node);
+		stack.push_back({ left + 1, entry.Depth + 1 });
+		stack.push_back({ left, entry.Depth + 1 });
+	}
+}
+
+void BVH::RefitNode(uint32 nodeIndex)
+{
+	Node& node = m_Nodes[nodeIndex];
+	node.Bounds = AABB();
+	if (node.IsLeaf())
+	{
+		for (uint32 i = node.First; i < node.First + node.Count; ++i)
+			node.Bounds.Grow(m_Bounds[m_Elements[i]]);
+	}
+	else
+	{
+		node.Bounds.Grow(m_Nodes[node.Left].Bounds);
+		node.Bounds.Grow(m_Nodes[node.Left + 1].Bounds);
+	}
+}
+
+void BVH::Refit(Span<BoundingBox> bounds)
+{
+	PROFILE_CPU_SCOPE();
+	check(bounds.GetSize() == m_Bounds.size());
+
+	for (uint32 i = 0; i < bounds.GetSize(); ++i)
+	{
+		m_Bounds[i].Min = Vector3(bounds[i].Center) - Vector3(bounds[i].Extents);
+		m_Bounds[i].Max = Vector3(bounds[i].Center) + Vector3(bounds[i].Extents);
+	}
+
+	// Children are always after their parent, so going backwards visits children first
+	for (uint32 i = (uint32)m_Nodes.size(); i > 0; --i)
+		RefitNode(i - 1);
+}
+
+void BVH::Refit(Span<BoundingBox> bounds, Span<uint32> changedElements)
+{
+	PROFILE_CPU_SCOPE();
+	check(bounds.GetSize() == m_Bounds.size());
+
+	for (uint32 element : changedElements)
+	{
+		m_Bounds[element].Min = Vector3(bounds[element].Center) - Vector3(bounds[element].Extents);
+		m_Bounds[element].Max = Vector3(bounds[element].Center) + Vector3(bounds[element].Extents);
+	}
+
+	// Walk up from each leaf. Once a node doesn't change, its ancestors don't either.
+	for (uint32 element : changedElements)
+	{
+		uint32 nodeIndex = m_ElementToLeaf[element];
+		while (true)
+		{
+			const AABB previous = m_Nodes[nodeIndex].Bounds;
+			RefitNode(nodeIndex);
+			const AABB& current = m_Nodes[nodeIndex].Bounds;
+			if (nodeIndex == 0 || (current.Min == previous.Min && current.Max == previous.Max))
+				break;
+			nodeIndex = m_Parents[nodeIndex];
+		}
+	}
+}
+
+void BVH::Cull(const FrustumCulling::Planes& planes, uint32* pOutWords) const
+{
+	PROFILE_CPU_SCOPE();
+
+	if (m_Nodes.empty())
+		return;
+
+	enum class Result { Outside, Intersects, Inside };
+	auto Classify = [&planes](const AABB& box)
+	{
+		const Vector3 center = (box.Min + box.Max) * 0.5f;
+		const Vector3 extents = (box.Max - box.Min) * 0.5f;
+		Result result = Result::Inside;
+		for (uint32 p = 0; p < planes.NumPlanes; ++p)
+		{
+			const Vector4& plane = planes.Values[p];
+			float distance = center.x * plane.x + center.y * plane.y + center.z * plane.z + plane.w;
+			float radius = extents.x * fabsf(plane.x) + extents.y * fabsf(plane.y) + extents.z * fabsf(plane.z);
+			if (distance > radius)
+				return Result::Outside;
+			if (distance > -radius)
+				result = Result::Intersects;
+		}
+		return result;
+	};
+
+	uint32 stack[MaxDepth + 1];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = m_Nodes[stack[--stackSize]];
+		Result result = Classify(node.Bounds);
+		if (result == Result::Outside)
+			continue;
+
+		// The whole subtree is visible without testing its elements
+		if (result == Result::Inside)
+		{
+			for (uint32 i = node.First; i < node.First + node.Count; ++i)
+				pOutWords[m_Elements[i] / 32] |= 1u << (m_Elements[i] % 32);
+		}
+		else if (node.IsLeaf())
+		{
+			for (uint32 i = node.First; i < node.First + node.Count; ++i)
+			{
+				uint32 element = m_Elements[i];
+				if (Classify(m_Bounds[element]) != Result::Outside)
+					pOutWords[element / 32] |= 1u << (element % 32);
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.Left + 1;
+			stack[stackSize++] = node.Left;
+		}
+	}
+}
+
+uint32 BVH::RayCast(const Ray& ray, float maxDistance, float& outDistance) const
+{
+	outDistance = maxDistance;
+	if (m_Nodes.empty())
+		return InvalidElement;
+
+	const Vector3 origin = ray.position;
+	const Vector3 inverseDirection = Vector3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+	auto Intersect = [&](const AABB& box, float closest, float& outBoxDistance)
+	{
+		const Vector3 t0 = (box.Min - origin) * inverseDirection;
+		const Vector3 t1 = (box.Max - origin) * inverseDirection;
+		const Vector3 tMin = Vector3::Min(t0, t1);
+		const Vector3 tMax = Vector3::Max(t0, t1);
+		float enter = Math::Max(Math::Max(tMin.x, tMin.y), Math::Max(tMin.z, 0.0f));
+		float exit = Math::Min(Math::Min(tMax.x, tMax.y), Math::Min(tMax.z, closest));
+		outBoxDistance = enter;
+		return enter <= exit;
+	};
+
+	uint32 closestElement = InvalidElement;
+	float closest = maxDistance;
+
+	uint32 stack[MaxDepth + 1];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = m_Nodes[stack[--stackSize]];
+		float distance;
+		if (!Intersect(node.Bounds, closest, distance))
+			continue;
+
+		if (node.IsLeaf())
+		{
+			for (uint32 i = node.First; i < node.First + node.Count; ++i)
+			{
+				uint32 element = m_Elements[i];
+				if (Intersect(m_Bounds[element], closest, distance) && distance < closest)
+				{
+					closest = distance;
+					closestElement = element;
+				}
+			}
+		}
+		else
+		{
+			// Visit the closest child first so the other can be rejected once a hit is found
+			float leftDistance, rightDistance;
+			bool hitLeft = Intersect(m_Nodes[node.Left].Bounds, closest, leftDistance);
+			bool hitRight = Intersect(m_Nodes[node.Left + 1].Bounds, closest, rightDistance);
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = leftDistance <= rightDistance;
+				stack[stackSize++] = leftFirst ? node.Left + 1 : node.Left;
+				stack[stackSize++] = leftFirst ? node.Left : node.Left + 1;
+			}
+			else if (hitLeft)
+			{
+				stack[stackSize++] = node.Left;
+			}
+			else if (hitRight)
+			{
+				stack[stackSize++] = node.Left + 1;
+			}
+		}
+	}
+
+	outDistance = closest;
+	return closestElement;
+}
+
+void BVH::QueryOverlap(const BoundingBox& bounds, std::vector<uint32>& outElements) const
+{
+	if (m_Nodes.empty())
+		return;
+
+	const Vector3 queryMin = Vector3(bounds.Center) - Vector3(bounds.Extents);
+	const Vector3 queryMax = Vector3(bounds.Center) + Vector3(bounds.Extents);
+	auto Overlaps = [&](const AABB& box)
+	{
+		return box.Min.x <= queryMax.x && box.Max.x >= queryMin.x &&
+			box.Min.y <= queryMax.y && box.Max.y >= queryMin.y &&
+			box.Min.z <= queryMax.z && box.Max.z >= queryMin.z;
+	};
+	auto Contains = [&](const AABB& box)
+	{
+		return box.Min.x >= queryMin.x && box.Max.x <= queryMax.x &&
+			box.Min.y >= queryMin.y && box.Max.y <= queryMax.y &&
+			box.Min.z >= queryMin.z && box.Max.z <= queryMax.z;
+	};
+
+	uint32 stack[MaxDepth + 1];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = m_Nodes[stack[--stackSize]];
+		if (!Overlaps(node.Bounds))
+			continue;
+
+		if (Contains(node.Bounds))
+		{
+			outElements.insert(outElements.end(), m_Elements.begin() + node.First, m_Elements.begin() + node.First + node.Count);
+		}
+		else if (node.IsLeaf())
+		{
+			for (uint32 i = node.First; i < node.First + node.Count; ++i)
+			{
+				if (Overlaps(m_Bounds[m_Elements[i]]))
+					outElements.push_back(m_Elements[i]);
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.Left + 1;
+			stack[stackSize++] = node.Left;
+		}
+	}
+}
+
+BoundingBox BVH::GetBounds() const
+{
+	BoundingBox bounds;
+	if (!m_Nodes.empty())
+		BoundingBox::CreateFromPoints(bounds, m_Nodes[0].Bounds.Min, m_Nodes[0].Bounds.Max);
+	return bounds;
+}
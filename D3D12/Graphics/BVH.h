@@ -0,0 +1,78 @@
+#pragma once
+
+#include "FrustumCulling.h"
+
+/*
+	Bounding volume hierarchy over a set of bounding boxes, used for CPU scene queries.
+	Built top-down with a binned surface area heuristic. Elements are referred to by their index in the input bounds,
+	which for the scene is the instance ID.
+
+	Each node references a contiguous range of the element list, so a subtree fully inside a frustum
+	is accepted without testing any of its elements.
+	When elements move, the hierarchy can be refit instead of rebuilt. Refitting keeps the topology
+	so the quality of the tree degrades as elements move far from where they were at build time.
+*/
+class BVH
+{
+public:
+	// Maximum number of elements in a leaf
+	static constexpr uint32 MaxLeafSize = 4;
+	static constexpr uint32 InvalidElement = 0xFFFFFFFF;
+
+	void Build(Span<BoundingBox> bounds);
+
+	// Recomputes the bounds of all nodes. 'bounds' must have the same number of elements as at build time.
+	void Refit(Span<BoundingBox> bounds);
+	// Only updates the nodes above the elements in 'changedElements'
+	void Refit(Span<BoundingBox> bounds, Span<uint32> changedElements);
+
+	// Sets a bit for each element intersecting the planes. Does not clear 'pOutWords'.
+	void Cull(const FrustumCulling::Planes& planes, uint32* pOutWords) const;
+
+	// Returns the element with the closest bounds hit by the ray, or InvalidElement. 'ray.direction' must be normalized.
+	uint32 RayCast(const Ray& ray, float maxDistance, float& outDistance) const;
+
+	// Outputs all elements intersecting 'bounds'
+	void QueryOverlap(const BoundingBox& bounds, std::vector<uint32>& outElements) const;
+
+	BoundingBox GetBounds() const;
+	uint32 GetNumElements() const { return (uint32)m_Bounds.size(); }
+	uint32 GetNumNodes() const { return (uint32)m_Nodes.size(); }
+
+private:
+	struct AABB
+	{
+		Vector3 Min = Vector3(FLT_MAX);
+		Vector3 Max = Vector3(-FLT_MAX);
+
+		void Grow(const Vector3& point) { Min = Vector3::Min(Min, point); Max = Vector3::Max(Max, point); }
+		void Grow(const AABB& other) { Min = Vector3::Min(Min, other.Min); Max = Vector3::Max(Max, other.Max); }
+		float GetSurfaceArea() const { Vector3 size = Max - Min; return size.x * size.y + size.y * size.z + size.z * size.x; }
+	};
+
+	// Deeper nodes are made leaves, which bounds the traversal stack
+	static constexpr uint32 MaxDepth = 64;
+
+	struct Node
+	{
+		AABB Bounds;
+		// Range in 'm_Elements' of all elements in the subtree
+		uint32 First;
+		uint32 Count;
+		// Index of the left child. The right child directly follows it. 0 for leaves.
+		uint32 Left;
+
+		bool IsLeaf() const { return Left == 0; }
+	};
+
+	void RefitNode(uint32 nodeIndex);
+
+	// Children always have a larger index than their parent
+	std::vector<Node> m_Nodes;
+	std::vector<uint32> m_Parents;
+	// Element indices, ordered so the elements of each node are contiguous
+	std::vector<uint32> m_Elements;
+	// Indexed by element
+	std::vector<AABB> m_Bounds;
+	std::vector<uint32> m_ElementToLeaf;
+};
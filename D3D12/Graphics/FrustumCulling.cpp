@@ -0,0 +1,213 @@
+#include "stdafx.h"
+#include "FrustumCulling.h"
+#include "SceneView.h"
+#include "Core/Profiler.h"
+#include "Core/TaskQueue.h"
+
+#include <immintrin.h>
+
+namespace FrustumCulling
+{
+	void BoundsStream::Resize(uint32 count)
+	{
+		// Padding is NaN so it never passes the plane tests
+		const uint32 paddedCount = Math::AlignUp(count, BatchSize);
+		for (std::vector<float>* pStream : { &CenterX, &CenterY, &CenterZ, &ExtentsX, &ExtentsY, &ExtentsZ })
+			pStream->resize(paddedCount, std::numeric_limits<float>::quiet_NaN());
+		Count = count;
+	}
+
+	bool BoundsStream::Set(uint32 index, const BoundingBox& bounds)
+	{
+		check(index < Count);
+		bool changed = CenterX[index] != bounds.Center.x || CenterY[index] != bounds.Center.y || CenterZ[index] != bounds.Center.z ||
+			ExtentsX[index] != bounds.Extents.x || ExtentsY[index] != bounds.Extents.y || ExtentsZ[index] != bounds.Extents.z;
+		CenterX[index] = bounds.Center.x;
+		CenterY[index] = bounds.Center.y;
+		CenterZ[index] = bounds.Center.z;
+		ExtentsX[index] = bounds.Extents.x;
+		ExtentsY[index] = bounds.Extents.y;
+		ExtentsZ[index] = bounds.Extents.z;
+		return changed;
+	}
+
+	Planes GetPlanes(const BoundingFrustum& frustum)
+	{
+		DirectX::XMVECTOR planes[6];
+		frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+		Planes result;
+		for (const DirectX::XMVECTOR& plane : planes)
+			result.Values[result.NumPlanes++] = plane;
+		return result;
+	}
+
+	Planes GetPlanes(const OrientedBoundingBox& box)
+	{
+		Planes result;
+		const Quaternion orientation(box.Orientation);
+		const Vector3 center(box.Center);
+		const float extents[] = { box.Extents.x, box.Extents.y, box.Extents.z };
+		const Vector3 axes[] = { Vector3::UnitX, Vector3::UnitY, Vector3::UnitZ };
+		for (uint32 i = 0; i < 3; ++i)
+		{
+			Vector3 normal = Vector3::Transform(axes[i], orientation);
+			float distance = normal.Dot(center);
+			result.Values[result.NumPlanes++] = Vector4(normal.x, normal.y, normal.z, -distance - extents[i]);
+			result.Values[result.NumPlanes++] = Vector4(-normal.x, -normal.y, -normal.z, distance - extents[i]);
+		}
+		return result;
+	}
+
+	Planes GetPlanes(const ViewTransform& view)
+	{
+		return view.IsPerspective ? GetPlanes(view.PerspectiveFrustum) : GetPlanes(view.OrthographicFrustum);
+	}
+
+#if defined(__AVX__)
+	using FloatN = __m256;
+	constexpr uint32 SimdWidth = 8;
+	static FloatN Load(const float* pData) { return _mm256_loadu_ps(pData); }
+	static FloatN Set1(float value) { return _mm256_set1_ps(value); }
+	static FloatN Add(FloatN a, FloatN b) { return _mm256_add_ps(a, b); }
+	static FloatN Mul(FloatN a, FloatN b) { return _mm256_mul_ps(a, b); }
+	static FloatN AndLessEqual(FloatN mask, FloatN a, FloatN b) { return _mm256_and_ps(mask, _mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+	static uint32 MoveMask(FloatN mask) { return (uint32)_mm256_movemask_ps(mask); }
+	static FloatN AllSet() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+#else
+	using FloatN = __m128;
+	constexpr uint32 SimdWidth = 4;
+	static FloatN Load(const float* pData) { return _mm_loadu_ps(pData); }
+	static FloatN Set1(float value) { return _mm_set1_ps(value); }
+	static FloatN Add(FloatN a, FloatN b) { return _mm_add_ps(a, b); }
+	static FloatN Mul(FloatN a, FloatN b) { return _mm_mul_ps(a, b); }
+	static FloatN AndLessEqual(FloatN mask, FloatN a, FloatN b) { return _mm_and_ps(mask, _mm_cmple_ps(a, b)); }
+	static uint32 MoveMask(FloatN mask) { return (uint32)_mm_movemask_ps(mask); }
+	static FloatN AllSet() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+#endif
+	static_assert(BatchSize % SimdWidth == 0 && 32 % BatchSize == 0);
+
+	// Plane components splat across all lanes. The absolute normal is used to project the extents on the plane normal.
+	struct SplatPlanes
+	{
+		SplatPlanes(const Planes& planes)
+			: NumPlanes(planes.NumPlanes)
+		{
+			for (uint32 p = 0; p < planes.NumPlanes; ++p)
+			{
+				const Vector4& plane = planes.Values[p];
+				X[p] = Set1(plane.x);
+				Y[p] = Set1(plane.y);
+				Z[p] = Set1(plane.z);
+				W[p] = Set1(plane.w);
+				AbsX[p] = Set1(fabsf(plane.x));
+				AbsY[p] = Set1(fabsf(plane.y));
+				AbsZ[p] = Set1(fabsf(plane.z));
+			}
+		}
+
+		FloatN X[Planes::MaxPlanes], Y[Planes::MaxPlanes], Z[Planes::MaxPlanes], W[Planes::MaxPlanes];
+		FloatN AbsX[Planes::MaxPlanes], AbsY[Planes::MaxPlanes], AbsZ[Planes::MaxPlanes];
+		uint32 NumPlanes;
+	};
+
+	// Culls the elements in [first, last) against each view. 'first' must be a multiple of 32 so ranges write whole words.
+	// The bounds of each batch are loaded once and tested against all views.
+	static void CullRange(const BoundsStream& bounds, const SplatPlanes* pViews, uint32* const* ppOutWords, uint32 numViews, uint32 first, uint32 last)
+	{
+		constexpr uint32 NumVectors = BatchSize / SimdWidth;
+		for (uint32 i = first; i < last; i += BatchSize)
+		{
+			FloatN centerX[NumVectors], centerY[NumVectors], centerZ[NumVectors];
+			FloatN extentsX[NumVectors], extentsY[NumVectors], extentsZ[NumVectors];
+			for (uint32 j = 0; j < NumVectors; ++j)
+			{
+				const uint32 index = i + j * SimdWidth;
+				centerX[j] = Load(&bounds.CenterX[index]);
+				centerY[j] = Load(&bounds.CenterY[index]);
+				centerZ[j] = Load(&bounds.CenterZ[index]);
+				extentsX[j] = Load(&bounds.ExtentsX[index]);
+				extentsY[j] = Load(&bounds.ExtentsY[index]);
+				extentsZ[j] = Load(&bounds.ExtentsZ[index]);
+			}
+
+			for (uint32 viewIndex = 0; viewIndex < numViews; ++viewIndex)
+			{
+				const SplatPlanes& planes = pViews[viewIndex];
+				uint32 bits = 0;
+				for (uint32 j = 0; j < NumVectors; ++j)
+				{
+					// A box is outside if its center is further in front of any plane than its projected extents
+					FloatN inside = AllSet();
+					for (uint32 p = 0; p < planes.NumPlanes; ++p)
+					{
+						FloatN distance = Add(Add(Mul(centerX[j], planes.X[p]), Mul(centerY[j], planes.Y[p])), Add(Mul(centerZ[j], planes.Z[p]), planes.W[p]));
+						FloatN radius = Add(Add(Mul(extentsX[j], planes.AbsX[p]), Mul(extentsY[j], planes.AbsY[p])), Mul(extentsZ[j], planes.AbsZ[p]));
+						inside = AndLessEqual(inside, distance, radius);
+					}
+					bits |= MoveMask(inside) << (j * SimdWidth);
+				}
+
+				uint32& word = ppOutWords[viewIndex][i / 32];
+				if (i % 32 == 0)
+					word = 0;
+				word |= bits << (i % 32);
+			}
+		}
+	}
+
+	void Cull(const BoundsStream& bounds, const Planes& planes, uint32* pOutWords)
+	{
+		PROFILE_CPU_SCOPE();
+
+		SplatPlanes splatPlanes(planes);
+		CullRange(bounds, &splatPlanes, &pOutWords, 1, 0, bounds.Count);
+	}
+
+	void CullViews(const BoundsStream& bounds, Span<Planes> views, Span<uint32*> outWords)
+	{
+		PROFILE_CPU_SCOPE();
+
+		check(views.GetSize() == outWords.GetSize());
+		if (views.GetSize() == 0 || bounds.Count == 0)
+			return;
+
+		std::vector<SplatPlanes> splatPlanes;
+		splatPlanes.reserve(views.GetSize());
+		for (const Planes& planes : views)
+			splatPlanes.emplace_back(planes);
+
+		const uint32 numRanges = Math::DivideAndRoundUp(bounds.Count, InstancesPerJob);
+		TaskContext context;
+		TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+			{
+				PROFILE_CPU_SCOPE("Cull Instance Range");
+				uint32 first = args.JobIndex * InstancesPerJob;
+				uint32 last = Math::Min(first + InstancesPerJob, bounds.Count);
+				CullRange(bounds, splatPlanes.data(), outWords.begin(), views.GetSize(), first, last);
+			}, context, numRanges, 1);
+		TaskQueue::Join(context);
+	}
+
+	void CullScalar(const BoundsStream& bounds, const Planes& planes, uint32* pOutWords)
+	{
+		PROFILE_CPU_SCOPE();
+
+		for (uint32 i = 0; i < bounds.Count; i += 32)
+			pOutWords[i / 32] = 0;
+
+		for (uint32 i = 0; i < bounds.Count; ++i)
+		{
+			bool inside = true;
+			for (uint32 p = 0; p < planes.NumPlanes && inside; ++p)
+			{
+				const Vector4& plane = planes.Values[p];
+				float distance = bounds.CenterX[i] * plane.x + bounds.CenterY[i] * plane.y + bounds.CenterZ[i] * plane.z + plane.w;
+				float radius = bounds.ExtentsX[i] * fabsf(plane.x) + bounds.ExtentsY[i] * fabsf(plane.y) + bounds.ExtentsZ[i] * fabsf(plane.z);
+				inside = distance <= radius;
+			}
+			if (inside)
+				pOutWords[i / 32] |= 1u << (i % 32);
+		}
+	}
+}
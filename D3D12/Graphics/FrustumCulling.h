@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Core/DynamicBitField.h"
+
+struct ViewTransform;
+
+/*
+	Frustum culling of instance bounds on the CPU.
+	Bounds are stored as a structure of arrays indexed by instance ID, so a SIMD kernel can test 8 boxes
+	against all planes at once and write the result directly into the words of a visibility mask.
+*/
+namespace FrustumCulling
+{
+	// Planes with normals pointing out of the frustum
+	struct Planes
+	{
+		static constexpr uint32 MaxPlanes = 6;
+		Vector4 Values[MaxPlanes];
+		uint32 NumPlanes = 0;
+	};
+
+	// Number of elements processed at once by the kernel. The stream is padded to a multiple of this.
+	constexpr uint32 BatchSize = 8;
+
+	struct BoundsStream
+	{
+		std::vector<float> CenterX, CenterY, CenterZ;
+		std::vector<float> ExtentsX, ExtentsY, ExtentsZ;
+		uint32 Count = 0;
+
+		void Resize(uint32 count);
+		// Returns true if the bounds at 'index' changed
+		bool Set(uint32 index, const BoundingBox& bounds);
+	};
+
+	Planes GetPlanes(const BoundingFrustum& frustum);
+	Planes GetPlanes(const OrientedBoundingBox& box);
+	Planes GetPlanes(const ViewTransform& view);
+
+	// Sets a bit for each box intersecting the planes. 'pOutWords' needs space for Count bits rounded up to 'BatchSize'.
+	void Cull(const BoundsStream& bounds, const Planes& planes, uint32* pOutWords);
+
+	// Number of instances culled by a single job in CullViews(). Multiple of 32 so jobs write whole words.
+	constexpr uint32 InstancesPerJob = 1024;
+
+	// Culls against multiple views in a single pass over the bounds. Instance ranges are distributed over the TaskQueue.
+	// Each element of 'outWords' is the output of the view at the same index.
+	void CullViews(const BoundsStream& bounds, Span<Planes> views, Span<uint32*> outWords);
+
+	// Reference implementation of Cull(), one box at a time.
+	void CullScalar(const BoundsStream& bounds, const Planes& planes, uint32* pOutWords);
+
+	inline void Cull(const BoundsStream& bounds, const Planes& planes, DynamicBitField& outMask)
+	{
+		check(Math::AlignUp(bounds.Count, BatchSize) <= outMask.GetNumWords() * DynamicBitField::BitsPerWord);
+		outMask.ClearAll();
+		Cull(bounds, planes, outMask.GetData());
+	}
+}
@@ -25,6 +25,8 @@ struct Light
 	RefCountPtr<Texture> pLightTexture = nullptr;
 	int ShadowMapSize = 512;
 	bool CastShadows = false;
+	// Set when the light is edited, so its scene data is uploaded again
+	bool IsDirty = true;
 
 	static Light Directional(const Vector3& position, const Vector3& direction, float intensity = 1.0f, const Color& color = Colors::White)
 	{
@@ -9,7 +9,13 @@
 #include "Core/Utils.h"
 #include "ShaderInterop.h"
 #include "Graphics/SceneView.h"
-#include "Graphics/RHI/RingBufferAllocator.h"
+#include "Graphics/RHI/StreamingUploader.h"
+#include "Graphics/TextureStreaming.h"
+#include "Graphics/MeshletLOD.h"
+#include "Core/MappedFile.h"
+#include "Core/TaskQueue.h"
+#include "Core/Profiler.h"
+#include "Core/ConsoleVariables.h"
 
 #pragma warning(push)
 #pragma warning(disable: 4996) //_CRT_SECURE_NO_WARNINGS
@@ -21,31 +27,434 @@
 
 #include "LDraw.h"
 
-Mesh::~Mesh()
+namespace Tweakables
 {
+	ConsoleVariable g_CookGeometry("r.Mesh.CookGeometry", true);
+	ConsoleVariable g_CompressCookedGeometry("r.Mesh.CompressCookedGeometry", true);
 }
 
-bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformScale /*= 1.0f*/)
+using TVertexPositionStream = Vector2u;
+using TVertexNormalStream = Vector2u;
+using TVertexColorStream = uint32;
+using TVertexUVStream = uint32;
+// 4 16-bit joint indices and 4 16-bit UNORM weights
+using TVertexSkinStream = Vector4u;
+
+struct MeshData
 {
-	struct MeshData
+	uint32 MaterialIndex = 0;
+	float ScaleFactor = 1;
+
+	std::vector<Vector3> PositionsStream;
+	std::vector<Vector3> NormalsStream;
+	std::vector<Vector4> TangentsStream;
+	std::vector<Vector2> UVsStream;
+	std::vector<Vector4> ColorsStream;
+	std::vector<Vector4> JointsStream;
+	std::vector<Vector4> WeightsStream;
+	std::vector<uint32> Indices;
+
+	std::vector<ShaderInterop::Meshlet> Meshlets;
+	std::vector<uint32> MeshletVertices;
+	std::vector<ShaderInterop::Meshlet::Triangle> MeshletTriangles;
+	std::vector<ShaderInterop::Meshlet::Bounds> MeshletBounds;
+	std::vector<ShaderInterop::Meshlet::LOD> MeshletLODs;
+	// Number of full detail meshlets. These come first, followed by the meshlets of the coarser LODs.
+	uint32 NumBaseMeshlets = 0;
+
+	// Streams in the GPU format
+	BoundingBox Bounds;
+	std::vector<TVertexPositionStream> PackedPositions;
+	std::vector<TVertexNormalStream> PackedNormals;
+	std::vector<TVertexColorStream> PackedColors;
+	std::vector<TVertexUVStream> PackedUVs;
+	std::vector<TVertexSkinStream> PackedSkin;
+};
+
+/*
+	Cooked geometry stores the processed meshes so optimization and meshlet generation only run once.
+	Streams are compressed with the meshoptimizer vertex/index codecs. Positions are already quantized to 16-bit SNORM
+	and normals/tangents are octahedral encoded before compression. Streams are decoded in parallel on load.
+*/
+namespace CookedGeometry
+{
+	constexpr uint32 Magic = 0x4D4F4547;
+	constexpr uint32 Version = 6;
+	constexpr int OctBits = 12;
+
+	enum Stream
+	{
+		Positions,
+		Normals,
+		Tangents,
+		Colors,
+		UVs,
+		Indices,
+		Meshlets,
+		MeshletVertices,
+		MeshletTriangles,
+		MeshletBounds,
+		MeshletLODs,
+		Skin,
+		NumStreams,
+	};
+
+	struct FileHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumMeshes;
+		uint32 IsCompressed;
+	};
+
+	struct MeshHeader
 	{
-		uint32 MaterialIndex = 0;
-		float ScaleFactor = 1;
-
-		std::vector<Vector3> PositionsStream;
-		std::vector<Vector3> NormalsStream;
-		std::vector<Vector4> TangentsStream;
-		std::vector<Vector2> UVsStream;
-		std::vector<Vector4> ColorsStream;
-		std::vector<uint32> Indices;
-
-		std::vector<ShaderInterop::Meshlet> Meshlets;
-		std::vector<uint32> MeshletVertices;
-		std::vector<ShaderInterop::Meshlet::Triangle> MeshletTriangles;
-		std::vector<ShaderInterop::Meshlet::Bounds> MeshletBounds;
+		uint32 MaterialIndex;
+		float ScaleFactor;
+		BoundingBox Bounds;
+		uint32 NumVertices;
+		uint32 NumNormals;
+		uint32 NumIndices;
+		uint32 NumColors;
+		uint32 NumUVs;
+		uint32 NumMeshlets;
+		uint32 NumBaseMeshlets;
+		uint32 NumMeshletVertices;
+		uint32 NumMeshletTriangles;
+		uint32 NumSkinVertices;
+		uint32 StreamSizes[NumStreams];
 	};
 
+	static std::string GetCookedGeometryPath(const char* pFilePath)
+	{
+		return Sprintf("%sCooked/%s_%x.geo", Paths::SavedDir().c_str(), Paths::GetFileNameWithoutExtension(pFilePath).c_str(), (uint32)StringHash(Paths::Normalize(pFilePath).c_str()));
+	}
+
+	static void EncodeOctStream(std::vector<uint8>& output, Span<Vector4> vectors)
+	{
+		if (vectors.GetSize() == 0)
+			return;
+		std::vector<Vector2u> octVectors(vectors.GetSize());
+		meshopt_encodeFilterOct(octVectors.data(), vectors.GetSize(), sizeof(Vector2u), OctBits, &vectors[0].x);
+		output.resize(meshopt_encodeVertexBufferBound(octVectors.size(), sizeof(Vector2u)));
+		output.resize(meshopt_encodeVertexBuffer(output.data(), output.size(), octVectors.data(), octVectors.size(), sizeof(Vector2u)));
+	}
+
+	static bool Save(const char* pCookedPath, Span<MeshData> meshDatas)
+	{
+		PROFILE_CPU_SCOPE();
+
+		const bool compress = Tweakables::g_CompressCookedGeometry;
+
+		FileHeader header{ Magic, Version, meshDatas.GetSize(), compress ? 1u : 0u };
+		std::vector<uint8> output((uint8*)&header, (uint8*)&header + sizeof(FileHeader));
+		uint64 rawSize = 0;
+
+		for (const MeshData& meshData : meshDatas)
+		{
+			std::array<std::vector<uint8>, NumStreams> streams;
+
+			auto EncodeVertexStream = [&](Stream stream, const auto& data)
+			{
+				using T = typename std::remove_reference_t<decltype(data)>::value_type;
+				static_assert(sizeof(T) % 4 == 0);
+				std::vector<uint8>& encoded = streams[stream];
+				rawSize += data.size() * sizeof(T);
+				if (data.empty())
+					return;
+				if (compress)
+				{
+					encoded.resize(meshopt_encodeVertexBufferBound(data.size(), sizeof(T)));
+					encoded.resize(meshopt_encodeVertexBuffer(encoded.data(), encoded.size(), data.data(), data.size(), sizeof(T)));
+				}
+				else
+				{
+					encoded.assign((const uint8*)data.data(), (const uint8*)(data.data() + data.size()));
+				}
+			};
+
+			EncodeVertexStream(Positions, meshData.PackedPositions);
+			EncodeVertexStream(Colors, meshData.PackedColors);
+			EncodeVertexStream(UVs, meshData.PackedUVs);
+			EncodeVertexStream(Meshlets, meshData.Meshlets);
+			EncodeVertexStream(MeshletTriangles, meshData.MeshletTriangles);
+			EncodeVertexStream(MeshletBounds, meshData.MeshletBounds);
+			EncodeVertexStream(MeshletLODs, meshData.MeshletLODs);
+			EncodeVertexStream(Skin, meshData.PackedSkin);
+
+			if (compress)
+			{
+				std::vector<Vector4> vectors(meshData.NormalsStream.size());
+				for (size_t i = 0; i < vectors.size(); ++i)
+					vectors[i] = Vector4(meshData.NormalsStream[i].x, meshData.NormalsStream[i].y, meshData.NormalsStream[i].z, 0.0f);
+				EncodeOctStream(streams[Normals], vectors);
+
+				for (size_t i = 0; i < vectors.size(); ++i)
+					vectors[i] = meshData.TangentsStream.empty() ? Vector4(1, 0, 0, 1) : meshData.TangentsStream[i];
+				EncodeOctStream(streams[Tangents], vectors);
+
+				streams[Indices].resize(meshopt_encodeIndexBufferBound(meshData.Indices.size(), meshData.PackedPositions.size()));
+				streams[Indices].resize(meshopt_encodeIndexBuffer(streams[Indices].data(), streams[Indices].size(), meshData.Indices.data(), meshData.Indices.size()));
+
+				streams[MeshletVertices].resize(meshopt_encodeIndexSequenceBound(meshData.MeshletVertices.size(), meshData.PackedPositions.size()));
+				streams[MeshletVertices].resize(meshopt_encodeIndexSequence(streams[MeshletVertices].data(), streams[MeshletVertices].size(), meshData.MeshletVertices.data(), meshData.MeshletVertices.size()));
+
+				rawSize += meshData.PackedNormals.size() * sizeof(TVertexNormalStream);
+				rawSize += meshData.Indices.size() * sizeof(uint32);
+				rawSize += meshData.MeshletVertices.size() * sizeof(uint32);
+			}
+			else
+			{
+				EncodeVertexStream(Normals, meshData.PackedNormals);
+				EncodeVertexStream(Indices, meshData.Indices);
+				EncodeVertexStream(MeshletVertices, meshData.MeshletVertices);
+			}
+
+			MeshHeader meshHeader{};
+			meshHeader.MaterialIndex = meshData.MaterialIndex;
+			meshHeader.ScaleFactor = meshData.ScaleFactor;
+			meshHeader.Bounds = meshData.Bounds;
+			meshHeader.NumVertices = (uint32)meshData.PackedPositions.size();
+			meshHeader.NumNormals = (uint32)meshData.PackedNormals.size();
+			meshHeader.NumIndices = (uint32)meshData.Indices.size();
+			meshHeader.NumColors = (uint32)meshData.PackedColors.size();
+			meshHeader.NumUVs = (uint32)meshData.PackedUVs.size();
+			meshHeader.NumMeshlets = (uint32)meshData.Meshlets.size();
+			meshHeader.NumBaseMeshlets = meshData.NumBaseMeshlets;
+			meshHeader.NumMeshletVertices = (uint32)meshData.MeshletVertices.size();
+			meshHeader.NumMeshletTriangles = (uint32)meshData.MeshletTriangles.size();
+			meshHeader.NumSkinVertices = (uint32)meshData.PackedSkin.size();
+			for (uint32 i = 0; i < NumStreams; ++i)
+				meshHeader.StreamSizes[i] = (uint32)streams[i].size();
+
+			output.insert(output.end(), (uint8*)&meshHeader, (uint8*)&meshHeader + sizeof(MeshHeader));
+			for (const std::vector<uint8>& stream : streams)
+				output.insert(output.end(), stream.begin(), stream.end());
+		}
+
+		Paths::CreateDirectoryTree(pCookedPath);
+		FILE* pFile = nullptr;
+		fopen_s(&pFile, pCookedPath, "wb");
+		if (!pFile)
+			return false;
+		fwrite(output.data(), 1, output.size(), pFile);
+		fclose(pFile);
+
+		E_LOG(Info, "Cooked geometry '%s' - Raw: %s - On disk: %s", pCookedPath, Math::PrettyPrintDataSize(rawSize).c_str(), Math::PrettyPrintDataSize(output.size()).c_str());
+		return true;
+	}
+
+	// 'sourcePaths' are all files the geometry is read from. The cooked file is stale if any of them is newer.
+	static bool Load(const char* pCookedPath, Span<std::string> sourcePaths, std::vector<MeshData>& outMeshDatas)
+	{
+		PROFILE_CPU_SCOPE();
+
+		if (!Paths::FileExists(pCookedPath))
+			return false;
+
+		uint64 temp, sourceTime, cookedTime;
+		Paths::GetFileTime(pCookedPath, temp, temp, cookedTime);
+		for (const std::string& sourcePath : sourcePaths)
+		{
+			if (!Paths::FileExists(sourcePath.c_str()))
+				return false;
+			Paths::GetFileTime(sourcePath.c_str(), temp, temp, sourceTime);
+			if (cookedTime < sourceTime)
+				return false;
+		}
+
+		MappedFile file;
+		if (!file.Open(pCookedPath))
+			return false;
+
+		const uint8* pData = file.GetData();
+		const uint8* pEnd = pData + file.GetSize();
+		if (file.GetSize() < sizeof(FileHeader))
+			return false;
+
+		const FileHeader& header = *(const FileHeader*)pData;
+		if (header.Magic != Magic || header.Version != Version)
+			return false;
+		pData += sizeof(FileHeader);
+
+		// Resolve all stream locations first so they can be decoded in parallel
+		struct MeshStreams
+		{
+			const MeshHeader* pHeader;
+			const uint8* pStreams[NumStreams];
+		};
+		std::vector<MeshStreams> meshStreams(header.NumMeshes);
+		std::vector<MeshData> meshDatas(header.NumMeshes);
+		for (uint32 meshIndex = 0; meshIndex < header.NumMeshes; ++meshIndex)
+		{
+			if (pData + sizeof(MeshHeader) > pEnd)
+				return false;
+
+			MeshStreams& streams = meshStreams[meshIndex];
+			streams.pHeader = (const MeshHeader*)pData;
+			pData += sizeof(MeshHeader);
+			for (uint32 i = 0; i < NumStreams; ++i)
+			{
+				streams.pStreams[i] = pData;
+				pData += streams.pHeader->StreamSizes[i];
+			}
+			if (pData > pEnd)
+				return false;
+
+			const MeshHeader& meshHeader = *streams.pHeader;
+			MeshData& meshData = meshDatas[meshIndex];
+			meshData.MaterialIndex = meshHeader.MaterialIndex;
+			meshData.ScaleFactor = meshHeader.ScaleFactor;
+			meshData.Bounds = meshHeader.Bounds;
+			meshData.PackedPositions.resize(meshHeader.NumVertices);
+			meshData.PackedNormals.resize(meshHeader.NumNormals);
+			meshData.PackedColors.resize(meshHeader.NumColors);
+			meshData.PackedUVs.resize(meshHeader.NumUVs);
+			meshData.Indices.resize(meshHeader.NumIndices);
+			meshData.Meshlets.resize(meshHeader.NumMeshlets);
+			meshData.MeshletVertices.resize(meshHeader.NumMeshletVertices);
+			meshData.MeshletTriangles.resize(meshHeader.NumMeshletTriangles);
+			meshData.MeshletBounds.resize(meshHeader.NumMeshlets);
+			meshData.MeshletLODs.resize(meshHeader.NumMeshlets);
+			meshData.PackedSkin.resize(meshHeader.NumSkinVertices);
+			meshData.NumBaseMeshlets = meshHeader.NumBaseMeshlets;
+		}
+
+		Utils::TimeScope timer;
+		std::atomic<bool> success = true;
+		const bool isCompressed = header.IsCompressed != 0;
+
+		// Tangents are decoded together with the normals
+		constexpr uint32 numJobsPerMesh = NumStreams;
+		TaskContext context;
+		TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+			{
+				uint32 meshIndex = args.JobIndex / numJobsPerMesh;
+				Stream stream = (Stream)(args.JobIndex % numJobsPerMesh);
+				if (stream == Tangents)
+					return;
+
+				const MeshStreams& streams = meshStreams[meshIndex];
+				MeshData& meshData = meshDatas[meshIndex];
+				const uint8* pSource = streams.pStreams[stream];
+				const uint32 sourceSize = streams.pHeader->StreamSizes[stream];
+
+				auto DecodeVertexStream = [&](auto& data)
+				{
+					using T = typename std::remove_reference_t<decltype(data)>::value_type;
+					if (data.empty())
+						return true;
+					if (isCompressed)
+						return meshopt_decodeVertexBuffer(data.data(), data.size(), sizeof(T), pSource, sourceSize) == 0;
+					if (sourceSize != data.size() * sizeof(T))
+						return false;
+					memcpy(data.data(), pSource, sourceSize);
+					return true;
+				};
+
+				bool result = true;
+				switch (stream)
+				{
+				case Positions:			result = DecodeVertexStream(meshData.PackedPositions);	break;
+				case Colors:			result = DecodeVertexStream(meshData.PackedColors);		break;
+				case UVs:				result = DecodeVertexStream(meshData.PackedUVs);		break;
+				case Meshlets:			result = DecodeVertexStream(meshData.Meshlets);			break;
+				case MeshletTriangles:	result = DecodeVertexStream(meshData.MeshletTriangles);	break;
+				case MeshletBounds:		result = DecodeVertexStream(meshData.MeshletBounds);	break;
+				case MeshletLODs:		result = DecodeVertexStream(meshData.MeshletLODs);		break;
+				case Skin:				result = DecodeVertexStream(meshData.PackedSkin);		break;
+				case Normals:
+					if (isCompressed && !meshData.PackedNormals.empty())
+					{
+						const uint32 numVertices = streams.pHeader->NumNormals;
+						std::vector<Vector2u> octNormals(numVertices);
+						std::vector<Vector2u> octTangents(numVertices);
+						result = meshopt_decodeVertexBuffer(octNormals.data(), numVertices, sizeof(Vector2u), pSource, sourceSize) == 0 &&
+							meshopt_decodeVertexBuffer(octTangents.data(), numVertices, sizeof(Vector2u), streams.pStreams[Tangents], streams.pHeader->StreamSizes[Tangents]) == 0;
+						if (result)
+						{
+							meshopt_decodeFilterOct(octNormals.data(), numVertices, sizeof(Vector2u));
+							meshopt_decodeFilterOct(octTangents.data(), numVertices, sizeof(Vector2u));
+
+							auto UnpackSnorm16 = [](const Vector2u& v)
+							{
+								const int16* pValues = (const int16*)&v;
+								return Vector4(pValues[0] / 32767.0f, pValues[1] / 32767.0f, pValues[2] / 32767.0f, pValues[3] / 32767.0f);
+							};
+							for (uint32 i = 0; i < numVertices; ++i)
+							{
+								meshData.PackedNormals[i] = {
+									Math::Pack_RGB10A2_SNORM(UnpackSnorm16(octNormals[i])),
+									Math::Pack_RGB10A2_SNORM(UnpackSnorm16(octTangents[i]))
+								};
+							}
+						}
+					}
+					else if (!isCompressed)
+					{
+						result = DecodeVertexStream(meshData.PackedNormals);
+					}
+					break;
+				case Indices:
+					if (isCompressed)
+						result = meshopt_decodeIndexBuffer(meshData.Indices.data(), meshData.Indices.size(), sizeof(uint32), pSource, sourceSize) == 0;
+					else
+						result = DecodeVertexStream(meshData.Indices);
+					break;
+				case MeshletVertices:
+					if (isCompressed)
+						result = meshopt_decodeIndexSequence(meshData.MeshletVertices.data(), meshData.MeshletVertices.size(), sizeof(uint32), pSource, sourceSize) == 0;
+					else
+						result = DecodeVertexStream(meshData.MeshletVertices);
+					break;
+				default:
+					noEntry();
+					break;
+				}
+
+				if (!result)
+					success = false;
+			}, context, header.NumMeshes * numJobsPerMesh, 1);
+		TaskQueue::Join(context);
+
+		if (!success)
+		{
+			E_LOG(Warning, "Failed to decode cooked geometry '%s'", pCookedPath);
+			return false;
+		}
+
+		float time = timer.Stop();
+		uint64 decodedSize = 0;
+		for (const MeshData& meshData : meshDatas)
+		{
+			decodedSize += meshData.PackedPositions.size() * sizeof(TVertexPositionStream) + meshData.PackedNormals.size() * sizeof(TVertexNormalStream);
+			decodedSize += meshData.PackedColors.size() * sizeof(TVertexColorStream) + meshData.PackedUVs.size() * sizeof(TVertexUVStream);
+			decodedSize += (meshData.Indices.size() + meshData.MeshletVertices.size()) * sizeof(uint32);
+			decodedSize += meshData.Meshlets.size() * sizeof(ShaderInterop::Meshlet) + meshData.MeshletTriangles.size() * sizeof(ShaderInterop::Meshlet::Triangle);
+			decodedSize += meshData.MeshletBounds.size() * sizeof(ShaderInterop::Meshlet::Bounds) + meshData.MeshletLODs.size() * sizeof(ShaderInterop::Meshlet::LOD);
+			decodedSize += meshData.PackedSkin.size() * sizeof(TVertexSkinStream);
+		}
+		E_LOG(Info, "Loaded cooked geometry '%s' - On disk: %s - Decoded: %s in %.2f ms (%.2f GB/s)",
+			pCookedPath, Math::PrettyPrintDataSize(file.GetSize()).c_str(), Math::PrettyPrintDataSize(decodedSize).c_str(), time * 1000.0f, (float)decodedSize * Math::BytesToGigaBytes / time);
+
+		outMeshDatas = std::move(meshDatas);
+		return true;
+	}
+}
+
+Mesh::~Mesh()
+{
+	if (m_pTextureStreamer)
+		m_pTextureStreamer->UnregisterOwner(this);
+}
+
+bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformScale /*= 1.0f*/, TextureStreamer* pTextureStreamer /*= nullptr*/)
+{
+	m_pTextureStreamer = pTextureStreamer;
+
 	std::vector<MeshData> meshDatas;
+	std::string cookedPath;
+	bool isCooked = false;
 
 	std::string extension = Paths::GetFileExtenstion(pFilePath);
 	if (extension == "dat" || extension == "ldr" || extension == "mpd")
@@ -239,7 +648,7 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 			m_Materials.push_back(Material());
 			Material& material = m_Materials.back();
 
-			auto RetrieveTexture = [this, &textureMap, pDevice, pFilePath](const cgltf_texture_view& texture, bool srgb) -> Texture*
+			auto RetrieveTexture = [this, &textureMap, pDevice, pFilePath, pTextureStreamer](const cgltf_texture_view& texture, bool srgb) -> Texture*
 			{
 				if (texture.texture)
 				{
@@ -249,15 +658,22 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 					RefCountPtr<Texture> pTex;
 					if (it == textureMap.end())
 					{
-						Image image;
-						bool validImage;
-						if (pImage->buffer_view)
-							validImage = image.Load((char*)pImage->buffer_view->buffer->data + pImage->buffer_view->offset, pImage->buffer_view->size, pImage->mime_type);
-						else
-							validImage =image.Load(Paths::Combine(Paths::GetDirectoryPath(pFilePath), pImage->uri).c_str());
+						// Only textures in separate files can be streamed
+						if (pTextureStreamer && !pImage->buffer_view)
+							pTex = pTextureStreamer->CreateTexture(Paths::Combine(Paths::GetDirectoryPath(pFilePath), pImage->uri).c_str(), srgb, this);
 
-						if(validImage)
-							pTex = GraphicsCommon::CreateTextureFromImage(pDevice, image, srgb, pName);
+						if (!pTex)
+						{
+							Image image;
+							bool validImage;
+							if (pImage->buffer_view)
+								validImage = image.Load((char*)pImage->buffer_view->buffer->data + pImage->buffer_view->offset, pImage->buffer_view->size, pImage->mime_type);
+							else
+								validImage =image.Load(Paths::Combine(Paths::GetDirectoryPath(pFilePath), pImage->uri).c_str());
+
+							if(validImage)
+								pTex = GraphicsCommon::CreateTextureFromImage(pDevice, image, srgb, pName);
+						}
 
 						if (!pTex.Get())
 						{
@@ -321,6 +737,22 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 		std::unordered_map<const cgltf_mesh*, std::vector<int>> meshToPrimitives;
 		int primitiveIndex = 0;
 
+		// The geometry can be in external buffer files, which may change without the .gltf changing
+		std::vector<std::string> geometrySources = { pFilePath };
+		for (size_t i = 0; i < pGltfData->buffers_count; ++i)
+		{
+			const char* pUri = pGltfData->buffers[i].uri;
+			if (pUri && strncmp(pUri, "data:", 5) != 0)
+			{
+				std::string bufferPath = pUri;
+				bufferPath.resize(cgltf_decode_uri(bufferPath.data()));
+				geometrySources.push_back(Paths::Combine(Paths::GetDirectoryPath(pFilePath), bufferPath));
+			}
+		}
+
+		cookedPath = CookedGeometry::GetCookedGeometryPath(pFilePath);
+		isCooked = Tweakables::g_CookGeometry && CookedGeometry::Load(cookedPath.c_str(), geometrySources, meshDatas);
+
 		for (size_t meshIdx = 0; meshIdx < pGltfData->meshes_count; ++meshIdx)
 		{
 			const cgltf_mesh& mesh = pGltfData->meshes[meshIdx];
@@ -329,6 +761,9 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 			{
 				const cgltf_primitive& primitive = mesh.primitives[primIdx];
 				primitives.push_back(primitiveIndex++);
+				if (isCooked)
+					continue;
+
 				MeshData meshData;
 
 				meshData.MaterialIndex = MaterialIndex(primitive.material);
@@ -363,6 +798,8 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 					ReadAttributeData("TANGENT", meshData.TangentsStream, 4);
 					ReadAttributeData("TEXCOORD_0", meshData.UVsStream, 2);
 					ReadAttributeData("COLOR_0", meshData.ColorsStream, 4);
+					ReadAttributeData("JOINTS_0", meshData.JointsStream, 4);
+					ReadAttributeData("WEIGHTS_0", meshData.WeightsStream, 4);
 				}
 
 				for (const Vector3& position : meshData.PositionsStream)
@@ -381,21 +818,106 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 			meshToPrimitives[&mesh] = primitives;
 		}
 
+		// The node hierarchy is kept so nodes can be moved after loading. Node 0 is the root which applies the import scale.
+		std::vector<TransformHierarchy::NodeDesc> transformNodes(pGltfData->nodes_count + 1);
+		transformNodes[0].Scale = Vector3(uniformScale, uniformScale, -uniformScale);
 		for (size_t i = 0; i < pGltfData->nodes_count; i++)
 		{
 			const cgltf_node& node = pGltfData->nodes[i];
+			TransformHierarchy::NodeDesc& transformNode = transformNodes[i + 1];
+			transformNode.Parent = node.parent ? (uint32)(node.parent - pGltfData->nodes) + 1 : 0;
+			if (node.has_matrix)
+			{
+				Matrix localToParent;
+				cgltf_node_transform_local(&node, &localToParent.m[0][0]);
+				localToParent.Decompose(transformNode.Scale, transformNode.Rotation, transformNode.Translation);
+			}
+			else
+			{
+				if (node.has_translation)
+					transformNode.Translation = Vector3(node.translation);
+				if (node.has_rotation)
+					transformNode.Rotation = Quaternion(node.rotation);
+				if (node.has_scale)
+					transformNode.Scale = Vector3(node.scale);
+			}
+		}
+		m_Transforms.Build(transformNodes);
 
-			if (node.mesh)
+		auto GetTransformNode = [&](const cgltf_node* pNode) { return (uint32)(pNode - pGltfData->nodes) + 1; };
+
+		uint32 numJoints = 0;
+		for (size_t i = 0; i < pGltfData->skins_count; ++i)
+		{
+			const cgltf_skin& gltfSkin = pGltfData->skins[i];
+			Skin& skin = m_Skins.emplace_back();
+			skin.JointMatricesOffset = numJoints;
+			skin.Joints.resize(gltfSkin.joints_count);
+			skin.InverseBindMatrices.resize(gltfSkin.joints_count);
+			for (size_t joint = 0; joint < gltfSkin.joints_count; ++joint)
+			{
+				skin.Joints[joint] = GetTransformNode(gltfSkin.joints[joint]);
+				if (gltfSkin.inverse_bind_matrices)
+					check(cgltf_accessor_read_float(gltfSkin.inverse_bind_matrices, joint, &skin.InverseBindMatrices[joint].m[0][0], 16));
+			}
+			numJoints += (uint32)gltfSkin.joints_count;
+		}
+		m_JointMatrices.resize(numJoints);
+
+		for (size_t i = 0; i < pGltfData->animations_count; ++i)
+		{
+			const cgltf_animation& gltfAnimation = pGltfData->animations[i];
+			AnimationClip& clip = m_Animations.emplace_back();
+			clip.Name = gltfAnimation.name ? gltfAnimation.name : Sprintf("Animation %d", (int)i);
+
+			std::vector<float> times;
+			std::vector<float> values;
+			for (size_t channelIndex = 0; channelIndex < gltfAnimation.channels_count; ++channelIndex)
 			{
-				Matrix localToWorld;
-				cgltf_node_transform_world(&node, &localToWorld.m[0][0]);
+				const cgltf_animation_channel& channel = gltfAnimation.channels[channelIndex];
+				const cgltf_animation_sampler& sampler = *channel.sampler;
+
+				// Morph target weights are not supported
+				AnimationClip::TrackType type;
+				switch (channel.target_path)
+				{
+				case cgltf_animation_path_type_translation: type = AnimationClip::TrackType::Translation; break;
+				case cgltf_animation_path_type_rotation:	type = AnimationClip::TrackType::Rotation; break;
+				case cgltf_animation_path_type_scale:		type = AnimationClip::TrackType::Scale; break;
+				default:									continue;
+				}
+				if (!channel.target_node)
+					continue;
+
+				const uint32 numComponents = type == AnimationClip::TrackType::Rotation ? 4 : 3;
+				const size_t numKeys = sampler.input->count;
+				times.resize(numKeys);
+				values.resize(numKeys * numComponents);
+				for (size_t key = 0; key < numKeys; ++key)
+					check(cgltf_accessor_read_float(sampler.input, key, &times[key], 1));
+
+				// Cubic spline keys store an in-tangent, value and out-tangent. Only the values are kept and interpolated linearly.
+				const bool isCubic = sampler.interpolation == cgltf_interpolation_type_cubic_spline;
+				for (size_t key = 0; key < numKeys; ++key)
+					check(cgltf_accessor_read_float(sampler.output, isCubic ? key * 3 + 1 : key, &values[key * numComponents], numComponents));
+
+				clip.AddTrack(GetTransformNode(channel.target_node), type, sampler.interpolation == cgltf_interpolation_type_step, times, values.data());
+			}
+		}
+
+		for (size_t i = 0; i < pGltfData->nodes_count; i++)
+		{
+			const cgltf_node& node = pGltfData->nodes[i];
 
+			if (node.mesh)
+			{
 				for (int primitive : meshToPrimitives[node.mesh])
 				{
-					const MeshData& meshData = meshDatas[primitive];
 					SubMeshInstance& newNode = m_MeshInstances.emplace_back();
 					newNode.MeshIndex = primitive;
-					newNode.Transform = Matrix::CreateScale(meshData.ScaleFactor) * localToWorld * Matrix::CreateScale(uniformScale, uniformScale, -uniformScale);
+					newNode.TransformNode = (uint32)i + 1;
+					if (node.skin && node.skin->joints_count > 0 && !meshDatas[primitive].PackedSkin.empty())
+						newNode.SkinIndex = (uint32)(node.skin - pGltfData->skins);
 				}
 			}
 		}
@@ -405,181 +927,233 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 
 	constexpr uint64 bufferAlignment = 16;
 	uint64 bufferSize = 0;
-	using TVertexPositionStream = Vector2u;
-	using TVertexNormalStream = Vector2u;
-	using TVertexColorStream = uint32;
-	using TVertexUVStream = uint32;
 
-	for (MeshData& meshData : meshDatas)
+	if (!isCooked)
 	{
-		meshopt_optimizeVertexCache(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), meshData.PositionsStream.size());
-
-		meshopt_optimizeOverdraw(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), &meshData.PositionsStream[0].x, meshData.PositionsStream.size(), sizeof(Vector3), 1.05f);
-
-		std::vector<uint32> remap(meshData.PositionsStream.size());
-		meshopt_optimizeVertexFetchRemap(&remap[0], meshData.Indices.data(), meshData.Indices.size(), meshData.PositionsStream.size());
-		meshopt_remapIndexBuffer(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), &remap[0]);
-		meshopt_remapVertexBuffer(meshData.PositionsStream.data(), meshData.PositionsStream.data(), meshData.PositionsStream.size(), sizeof(Vector3), &remap[0]);
-		meshopt_remapVertexBuffer(meshData.NormalsStream.data(), meshData.NormalsStream.data(), meshData.NormalsStream.size(), sizeof(Vector3), &remap[0]);
-		meshopt_remapVertexBuffer(meshData.TangentsStream.data(), meshData.TangentsStream.data(), meshData.TangentsStream.size(), sizeof(Vector4), &remap[0]);
-		meshopt_remapVertexBuffer(meshData.UVsStream.data(), meshData.UVsStream.data(), meshData.UVsStream.size(), sizeof(Vector2), &remap[0]);
-		if (!meshData.ColorsStream.empty())
-			meshopt_remapVertexBuffer(meshData.ColorsStream.data(), meshData.ColorsStream.data(), meshData.ColorsStream.size(), sizeof(Vector4), &remap[0]);
-
-		// Meshlet generation
-		const size_t maxVertices = ShaderInterop::MESHLET_MAX_VERTICES;
-		const size_t maxTriangles = ShaderInterop::MESHLET_MAX_TRIANGLES;
-		const size_t maxMeshlets = meshopt_buildMeshletsBound(meshData.Indices.size(), maxVertices, maxTriangles);
-
-		meshData.Meshlets.resize(maxMeshlets);
-		meshData.MeshletVertices.resize(maxMeshlets * maxVertices);
-
-		std::vector<unsigned char> meshletTriangles(maxMeshlets * maxTriangles * 3);
-		std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
-
-		size_t meshlet_count = meshopt_buildMeshlets(meshlets.data(), meshData.MeshletVertices.data(), meshletTriangles.data(),
-			meshData.Indices.data(), meshData.Indices.size(), &meshData.PositionsStream[0].x, meshData.PositionsStream.size(), sizeof(Vector3), maxVertices, maxTriangles, 0);
-
-		// Trimming
-		const meshopt_Meshlet& last = meshlets[meshlet_count - 1];
-		meshletTriangles.resize(last.triangle_offset + ((last.triangle_count * 3 + 3) & ~3));
-		meshlets.resize(meshlet_count);
-
-		meshData.MeshletVertices.resize(last.vertex_offset + last.vertex_count);
-		meshData.Meshlets.resize(meshlet_count);
-		meshData.MeshletBounds.resize(meshlet_count);
-		meshData.MeshletTriangles.resize(meshletTriangles.size() / 3);
-
-		uint32 triangleOffset = 0;
-		for (size_t i = 0; i < meshlet_count; ++i)
+		PROFILE_CPU_SCOPE("Process Geometry");
+		for (MeshData& meshData : meshDatas)
 		{
-			const meshopt_Meshlet& meshlet = meshlets[i];
+			meshopt_optimizeVertexCache(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), meshData.PositionsStream.size());
+
+			meshopt_optimizeOverdraw(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), &meshData.PositionsStream[0].x, meshData.PositionsStream.size(), sizeof(Vector3), 1.05f);
+
+			std::vector<uint32> remap(meshData.PositionsStream.size());
+			meshopt_optimizeVertexFetchRemap(&remap[0], meshData.Indices.data(), meshData.Indices.size(), meshData.PositionsStream.size());
+			meshopt_remapIndexBuffer(meshData.Indices.data(), meshData.Indices.data(), meshData.Indices.size(), &remap[0]);
+			meshopt_remapVertexBuffer(meshData.PositionsStream.data(), meshData.PositionsStream.data(), meshData.PositionsStream.size(), sizeof(Vector3), &remap[0]);
+			meshopt_remapVertexBuffer(meshData.NormalsStream.data(), meshData.NormalsStream.data(), meshData.NormalsStream.size(), sizeof(Vector3), &remap[0]);
+			meshopt_remapVertexBuffer(meshData.TangentsStream.data(), meshData.TangentsStream.data(), meshData.TangentsStream.size(), sizeof(Vector4), &remap[0]);
+			meshopt_remapVertexBuffer(meshData.UVsStream.data(), meshData.UVsStream.data(), meshData.UVsStream.size(), sizeof(Vector2), &remap[0]);
+			if (!meshData.ColorsStream.empty())
+				meshopt_remapVertexBuffer(meshData.ColorsStream.data(), meshData.ColorsStream.data(), meshData.ColorsStream.size(), sizeof(Vector4), &remap[0]);
+			if (!meshData.JointsStream.empty() && !meshData.WeightsStream.empty())
+			{
+				meshopt_remapVertexBuffer(meshData.JointsStream.data(), meshData.JointsStream.data(), meshData.JointsStream.size(), sizeof(Vector4), &remap[0]);
+				meshopt_remapVertexBuffer(meshData.WeightsStream.data(), meshData.WeightsStream.data(), meshData.WeightsStream.size(), sizeof(Vector4), &remap[0]);
+			}
+
+			// Meshlet generation, including the meshlets of all LOD levels
+			MeshletLOD::BuildSettings lodSettings;
+			lodSettings.MaxVertices = ShaderInterop::MESHLET_MAX_VERTICES;
+			lodSettings.MaxTriangles = ShaderInterop::MESHLET_MAX_TRIANGLES;
+			std::vector<MeshletLOD::Cluster> clusters;
+			MeshletLOD::Build(meshData.PositionsStream, meshData.Indices, lodSettings, clusters);
 
-			Vector3 min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
-			Vector3 max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-			for (uint32 k = 0; k < meshlet.triangle_count * 3; ++k)
+			meshData.Meshlets.resize(clusters.size());
+			meshData.MeshletBounds.resize(clusters.size());
+			meshData.MeshletLODs.resize(clusters.size());
+			meshData.NumBaseMeshlets = 0;
+
+			for (size_t i = 0; i < clusters.size(); ++i)
 			{
-				uint32 idx = meshData.MeshletVertices[meshlet.vertex_offset + meshletTriangles[meshlet.triangle_offset + k]];
-				const Vector3& p = meshData.PositionsStream[idx];
-				max = Vector3::Max(max, p);
-				min = Vector3::Min(min, p);
+				const MeshletLOD::Cluster& cluster = clusters[i];
+				if (cluster.Level == 0)
+					++meshData.NumBaseMeshlets;
+
+				Vector3 min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+				Vector3 max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for (uint8 triangleVertex : cluster.Triangles)
+				{
+					const Vector3& p = meshData.PositionsStream[cluster.Vertices[triangleVertex]];
+					max = Vector3::Max(max, p);
+					min = Vector3::Min(min, p);
+				}
+				ShaderInterop::Meshlet::Bounds& outBounds = meshData.MeshletBounds[i];
+				outBounds.LocalCenter = (max + min) / 2;
+				outBounds.LocalExtents = (max - min) / 2;
+
+				meshopt_Bounds coneBounds = meshopt_computeMeshletBounds(cluster.Vertices.data(), cluster.Triangles.data(), cluster.Triangles.size() / 3,
+					&meshData.PositionsStream[0].x, meshData.PositionsStream.size(), sizeof(Vector3));
+				outBounds.SphereCenter = Vector3(coneBounds.center);
+				outBounds.SphereRadius = coneBounds.radius;
+				outBounds.ConeApex = Vector3(coneBounds.cone_apex);
+				outBounds.ConeAxis = Vector3(coneBounds.cone_axis);
+				outBounds.ConeCutoff = coneBounds.cone_cutoff;
+
+				ShaderInterop::Meshlet::LOD& outLOD = meshData.MeshletLODs[i];
+				outLOD.Center = cluster.Bounds.Center;
+				outLOD.Radius = cluster.Bounds.Radius;
+				outLOD.Error = cluster.Error;
+				outLOD.ParentCenter = cluster.ParentBounds.Center;
+				outLOD.ParentRadius = cluster.ParentBounds.Radius;
+				outLOD.ParentError = cluster.ParentError;
+
+				ShaderInterop::Meshlet& outMeshlet = meshData.Meshlets[i];
+				outMeshlet.TriangleCount = (uint32)cluster.Triangles.size() / 3;
+				outMeshlet.TriangleOffset = (uint32)meshData.MeshletTriangles.size();
+				outMeshlet.VertexCount = (uint32)cluster.Vertices.size();
+				outMeshlet.VertexOffset = (uint32)meshData.MeshletVertices.size();
+
+				meshData.MeshletVertices.insert(meshData.MeshletVertices.end(), cluster.Vertices.begin(), cluster.Vertices.end());
+				for (size_t triIdx = 0; triIdx < cluster.Triangles.size(); triIdx += 3)
+				{
+					ShaderInterop::Meshlet::Triangle& tri = meshData.MeshletTriangles.emplace_back();
+					tri.V0 = cluster.Triangles[triIdx + 0];
+					tri.V1 = cluster.Triangles[triIdx + 1];
+					tri.V2 = cluster.Triangles[triIdx + 2];
+				}
 			}
-			ShaderInterop::Meshlet::Bounds& outBounds = meshData.MeshletBounds[i];
-			outBounds.LocalCenter = (max + min) / 2;
-			outBounds.LocalExtents = (max - min) / 2;
 
-			// Encode triangles and get rid of 4 byte padding
-			unsigned char* pSourceTriangles = meshletTriangles.data() + meshlet.triangle_offset;
-			for (uint32 triIdx = 0; triIdx < meshlet.triangle_count; ++triIdx)
+			// Pack into the GPU format
+			meshData.Bounds.CreateFromPoints(meshData.Bounds, meshData.PositionsStream.size(), (DirectX::XMFLOAT3*)meshData.PositionsStream.data(), sizeof(Vector3));
+
+			meshData.PackedPositions.reserve(meshData.PositionsStream.size());
+			for (const Vector3& position : meshData.PositionsStream)
+				meshData.PackedPositions.push_back(Math::Pack_RGBA16_SNORM(Vector4(position)));
+
+			meshData.PackedNormals.reserve(meshData.NormalsStream.size());
+			for (size_t i = 0; i < meshData.NormalsStream.size(); ++i)
 			{
-				ShaderInterop::Meshlet::Triangle& tri = meshData.MeshletTriangles[triIdx + triangleOffset];
-				tri.V0 = *pSourceTriangles++;
-				tri.V1 = *pSourceTriangles++;
-				tri.V2 = *pSourceTriangles++;
+				meshData.PackedNormals.push_back({
+						Math::Pack_RGB10A2_SNORM(Vector4(meshData.NormalsStream[i])),
+						Math::Pack_RGB10A2_SNORM(meshData.TangentsStream.empty() ? Vector4(1, 0, 0, 1) : meshData.TangentsStream[i])
+					});
 			}
 
-			ShaderInterop::Meshlet& outMeshlet = meshData.Meshlets[i];
-			outMeshlet.TriangleCount = meshlet.triangle_count;
-			outMeshlet.TriangleOffset = triangleOffset;
-			outMeshlet.VertexCount = meshlet.vertex_count;
-			outMeshlet.VertexOffset = meshlet.vertex_offset;
-			triangleOffset += meshlet.triangle_count;
+			meshData.PackedColors.reserve(meshData.ColorsStream.size());
+			for (const Vector4& color : meshData.ColorsStream)
+				meshData.PackedColors.push_back(Math::Pack_RGBA8_UNORM(color));
+
+			meshData.PackedUVs.reserve(meshData.UVsStream.size());
+			for (const Vector2& uv : meshData.UVsStream)
+				meshData.PackedUVs.push_back(Math::Pack_RG16_FLOAT(uv));
+
+			if (!meshData.JointsStream.empty() && !meshData.WeightsStream.empty())
+			{
+				auto PackUnorm16 = [](float value) { return (uint32)roundf(Math::Clamp(value, 0.0f, 1.0f) * 65535.0f); };
+				meshData.PackedSkin.reserve(meshData.JointsStream.size());
+				for (size_t i = 0; i < meshData.JointsStream.size(); ++i)
+				{
+					const Vector4& joints = meshData.JointsStream[i];
+					Vector4 weights = meshData.WeightsStream[i];
+					float weightSum = weights.x + weights.y + weights.z + weights.w;
+					if (weightSum > 0.0f)
+						weights /= weightSum;
+					meshData.PackedSkin.push_back({
+							(uint32)joints.x | ((uint32)joints.y << 16u),
+							(uint32)joints.z | ((uint32)joints.w << 16u),
+							PackUnorm16(weights.x) | (PackUnorm16(weights.y) << 16u),
+							PackUnorm16(weights.z) | (PackUnorm16(weights.w) << 16u),
+						});
+				}
+			}
 		}
-		meshData.MeshletTriangles.resize(triangleOffset);
 
+		if (!cookedPath.empty() && Tweakables::g_CookGeometry)
+			CookedGeometry::Save(cookedPath.c_str(), meshDatas);
+	}
+
+	for (const MeshData& meshData : meshDatas)
+	{
 		bufferSize += Math::AlignUp<uint64>(meshData.Indices.size() * sizeof(uint32), bufferAlignment);
-		bufferSize += Math::AlignUp<uint64>(meshData.PositionsStream.size() * sizeof(TVertexPositionStream), bufferAlignment);
-		bufferSize += Math::AlignUp<uint64>(meshData.UVsStream.size() * sizeof(TVertexUVStream), bufferAlignment);
-		bufferSize += Math::AlignUp<uint64>(meshData.NormalsStream.size() * sizeof(TVertexNormalStream), bufferAlignment);
-		bufferSize += Math::AlignUp<uint64>(meshData.ColorsStream.size() * sizeof(TVertexColorStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedPositions.size() * sizeof(TVertexPositionStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedUVs.size() * sizeof(TVertexUVStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedNormals.size() * sizeof(TVertexNormalStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedColors.size() * sizeof(TVertexColorStream), bufferAlignment);
 
 		bufferSize += Math::AlignUp<uint64>(meshData.Meshlets.size() * sizeof(ShaderInterop::Meshlet), bufferAlignment);
 		bufferSize += Math::AlignUp<uint64>(meshData.MeshletVertices.size() * sizeof(uint32), bufferAlignment);
 		bufferSize += Math::AlignUp<uint64>(meshData.MeshletTriangles.size() * sizeof(ShaderInterop::Meshlet::Triangle), bufferAlignment);
 		bufferSize += Math::AlignUp<uint64>(meshData.MeshletBounds.size() * sizeof(ShaderInterop::Meshlet::Bounds), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.MeshletLODs.size() * sizeof(ShaderInterop::Meshlet::LOD), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedSkin.size() * sizeof(TVertexSkinStream), bufferAlignment);
 	}
 
-	check(bufferSize < std::numeric_limits<uint32>::max(), "Offset stored in 32-bit int");
-	m_pGeometryData = pDevice->CreateBuffer(BufferDesc::CreateBuffer(bufferSize, BufferFlag::ShaderResource | BufferFlag::ByteAddress), "Geometry Buffer");
+	// Skinned copies: the current and previous positions, normals and the meshlet bounds and LODs
+	bool hasSkinnedInstances = false;
+	for (const SubMeshInstance& instance : m_MeshInstances)
+	{
+		if (instance.SkinIndex == Skin::InvalidSkin)
+			continue;
+		const MeshData& meshData = meshDatas[instance.MeshIndex];
+		bufferSize += 2 * Math::AlignUp<uint64>(meshData.PackedPositions.size() * sizeof(TVertexPositionStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.PackedNormals.size() * sizeof(TVertexNormalStream), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.NumBaseMeshlets * sizeof(ShaderInterop::Meshlet::Bounds), bufferAlignment);
+		bufferSize += Math::AlignUp<uint64>(meshData.NumBaseMeshlets * sizeof(ShaderInterop::Meshlet::LOD), bufferAlignment);
+		hasSkinnedInstances = true;
+	}
 
-	RingBufferAllocation allocation;
-	pDevice->GetRingBuffer()->Allocate((uint32)bufferSize, allocation);
+	check(bufferSize < std::numeric_limits<uint32>::max(), "Offset stored in 32-bit int");
+	BufferFlag bufferFlags = BufferFlag::ShaderResource | BufferFlag::ByteAddress;
+	if (hasSkinnedInstances)
+		bufferFlags |= BufferFlag::UnorderedAccess;
+	m_pGeometryData = pDevice->CreateBuffer(BufferDesc::CreateBuffer(bufferSize, bufferFlags), "Geometry Buffer");
 
-	char* pMappedMemory = (char*)allocation.pMappedMemory;
+	StreamingUploader* pUploader = pDevice->GetStreamingUploader();
 
 	uint64 dataOffset = 0;
-	auto CopyData = [&dataOffset, &allocation](const void* pSource, uint64 size)
+	auto CopyData = [this, &dataOffset, pUploader](const void* pSource, uint64 size)
 	{
-		memcpy(static_cast<char*>(allocation.pMappedMemory) + dataOffset, pSource, size);
+		pUploader->Upload(m_pGeometryData, dataOffset, pSource, size);
 		dataOffset = Math::AlignUp(dataOffset + size, bufferAlignment);
 	};
+	std::vector<char> indices;
 
 	for (const MeshData& meshData : meshDatas)
 	{
-		BoundingBox bounds;
-		bounds.CreateFromPoints(bounds, meshData.PositionsStream.size(), (DirectX::XMFLOAT3*)meshData.PositionsStream.data(), sizeof(Vector3));
-
 		SubMesh subMesh;
-		subMesh.Bounds = bounds;
+		subMesh.Bounds = meshData.Bounds;
 		subMesh.MaterialId = meshData.MaterialIndex;
+		subMesh.ScaleFactor = meshData.ScaleFactor;
 		subMesh.PositionsFormat = ResourceFormat::RGBA16_SNORM;
 
-		{
-			subMesh.PositionStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PositionsStream.size(), sizeof(TVertexPositionStream), dataOffset);
-			TVertexPositionStream* pTarget = (TVertexPositionStream*)(pMappedMemory + dataOffset);
-			for (const Vector3& position : meshData.PositionsStream)
-			{
-				*pTarget++ = { Math::Pack_RGBA16_SNORM(Vector4(position)) };
-			}
-			dataOffset = Math::AlignUp(dataOffset + meshData.PositionsStream.size() * sizeof(TVertexPositionStream), bufferAlignment);
-		}
+		subMesh.PositionStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PackedPositions.size(), sizeof(TVertexPositionStream), dataOffset);
+		subMesh.PositionPrevStreamLocation = subMesh.PositionStreamLocation;
+		CopyData(meshData.PackedPositions.data(), sizeof(TVertexPositionStream) * meshData.PackedPositions.size());
+
+		subMesh.NormalStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PackedNormals.size(), sizeof(TVertexNormalStream), dataOffset);
+		CopyData(meshData.PackedNormals.data(), sizeof(TVertexNormalStream) * meshData.PackedNormals.size());
 
+		if (!meshData.PackedColors.empty())
 		{
-			subMesh.NormalStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.NormalsStream.size(), sizeof(TVertexNormalStream), dataOffset);
-			TVertexNormalStream* pTarget = (TVertexNormalStream*)(pMappedMemory + dataOffset);
-			for (size_t i = 0; i < meshData.NormalsStream.size(); ++i)
-			{
-				*pTarget++ = {
-						Math::Pack_RGB10A2_SNORM(Vector4(meshData.NormalsStream[i])),
-						Math::Pack_RGB10A2_SNORM(meshData.TangentsStream.empty() ? Vector4(1, 0, 0, 1) : meshData.TangentsStream[i])
-				};
-			}
-			dataOffset = Math::AlignUp(dataOffset + meshData.NormalsStream.size() * sizeof(TVertexNormalStream), bufferAlignment);
+			subMesh.ColorsStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PackedColors.size(), sizeof(TVertexColorStream), dataOffset);
+			CopyData(meshData.PackedColors.data(), sizeof(TVertexColorStream) * meshData.PackedColors.size());
 		}
 
-		if (!meshData.ColorsStream.empty())
+		if (!meshData.PackedUVs.empty())
 		{
-			subMesh.ColorsStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.ColorsStream.size(), sizeof(TVertexColorStream), dataOffset);
-			TVertexColorStream* pTarget = (TVertexColorStream*)(pMappedMemory + dataOffset);
-			for (const Vector4& color : meshData.ColorsStream)
-			{
-				*pTarget++ = { Math::Pack_RGBA8_UNORM(color) };
-			}
-			dataOffset = Math::AlignUp(dataOffset + meshData.ColorsStream.size() * sizeof(TVertexColorStream), bufferAlignment);
+			subMesh.UVStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PackedUVs.size(), sizeof(TVertexUVStream), dataOffset);
+			CopyData(meshData.PackedUVs.data(), sizeof(TVertexUVStream) * meshData.PackedUVs.size());
 		}
 
-		if (!meshData.UVsStream.empty())
+		if (!meshData.PackedSkin.empty())
 		{
-			subMesh.UVStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.UVsStream.size(), sizeof(TVertexUVStream), dataOffset);
-			TVertexUVStream* pTarget = (TVertexUVStream*)(pMappedMemory + dataOffset);
-			for (const Vector2& uv : meshData.UVsStream)
-			{
-				*pTarget++ = { Math::Pack_RG16_FLOAT(uv) };
-			}
-			dataOffset = Math::AlignUp(dataOffset + meshData.UVsStream.size() * sizeof(TVertexUVStream), bufferAlignment);
+			subMesh.SkinStreamLocation = VertexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.PackedSkin.size(), sizeof(TVertexSkinStream), dataOffset);
+			CopyData(meshData.PackedSkin.data(), sizeof(TVertexSkinStream) * meshData.PackedSkin.size());
 		}
 
 		{
-			bool smallIndices = meshData.PositionsStream.size() < std::numeric_limits<uint16>::max();
+			bool smallIndices = meshData.PackedPositions.size() < std::numeric_limits<uint16>::max();
 			uint32 indexSize = smallIndices ? sizeof(uint16) : sizeof(uint32);
 			subMesh.IndicesLocation = IndexBufferView(m_pGeometryData->GetGpuHandle() + dataOffset, (uint32)meshData.Indices.size(), smallIndices ? ResourceFormat::R16_UINT : ResourceFormat::R32_UINT, dataOffset);
-			char* pTarget = (char*)(pMappedMemory + dataOffset);
+			indices.resize(meshData.Indices.size() * indexSize);
+			char* pTarget = indices.data();
 			for (uint32 index : meshData.Indices)
 			{
 				memcpy(pTarget, &index, indexSize);
 				pTarget += indexSize;
 			}
-			dataOffset = Math::AlignUp(dataOffset + meshData.Indices.size() * indexSize, bufferAlignment);
+			CopyData(indices.data(), indices.size());
 		}
 
 		subMesh.MeshletsLocation = (uint32)dataOffset;
@@ -594,15 +1168,213 @@ bool Mesh::Load(const char* pFilePath, GraphicsDevice* pDevice, float uniformSca
 		subMesh.MeshletBoundsLocation = (uint32)dataOffset;
 		CopyData(meshData.MeshletBounds.data(), sizeof(ShaderInterop::Meshlet::Bounds) * meshData.MeshletBounds.size());
 
-		subMesh.NumMeshlets = (uint32)meshData.Meshlets.size();
+		subMesh.MeshletLODsLocation = (uint32)dataOffset;
+		CopyData(meshData.MeshletLODs.data(), sizeof(ShaderInterop::Meshlet::LOD) * meshData.MeshletLODs.size());
+
+		subMesh.NumMeshlets = meshData.NumBaseMeshlets;
+		subMesh.MeshletBounds.assign(meshData.MeshletBounds.begin(), meshData.MeshletBounds.begin() + meshData.NumBaseMeshlets);
+		subMesh.NumLODMeshlets = (uint32)meshData.Meshlets.size();
+
+		if (!meshData.PackedSkin.empty())
+		{
+			auto DecodeSNORM16 = [](uint32 value) { return Math::Max((float)(int16)(value & 0xFFFF) / 32767.0f, -1.0f); };
+			std::vector<Vector3> jointMin, jointMax;
+			for (size_t i = 0; i < meshData.PackedSkin.size(); ++i)
+			{
+				const TVertexPositionStream& packedPosition = meshData.PackedPositions[i];
+				const Vector3 position(DecodeSNORM16(packedPosition.x), DecodeSNORM16(packedPosition.x >> 16), DecodeSNORM16(packedPosition.y));
+				const TVertexSkinStream& skin = meshData.PackedSkin[i];
+				const uint32 joints[] = { skin.x & 0xFFFF, skin.x >> 16, skin.y & 0xFFFF, skin.y >> 16 };
+				const uint32 weights[] = { skin.z & 0xFFFF, skin.z >> 16, skin.w & 0xFFFF, skin.w >> 16 };
+				for (uint32 j = 0; j < 4; ++j)
+				{
+					if (weights[j] == 0)
+						continue;
+					if (joints[j] >= jointMin.size())
+					{
+						jointMin.resize(joints[j] + 1, Vector3(FLT_MAX));
+						jointMax.resize(joints[j] + 1, Vector3(-FLT_MAX));
+					}
+					jointMin[joints[j]] = Vector3::Min(jointMin[joints[j]], position);
+					jointMax[joints[j]] = Vector3::Max(jointMax[joints[j]], position);
+				}
+			}
+			subMesh.JointBounds.resize(jointMin.size());
+			for (size_t joint = 0; joint < jointMin.size(); ++joint)
+				subMesh.JointBounds[joint] = BoundingBox((jointMax[joint] + jointMin[joint]) / 2, (jointMax[joint] - jointMin[joint]) / 2);
+		}
 
 		subMesh.pParent = this;
-		m_Meshes.push_back(subMesh);
+		m_Meshes.push_back(std::move(subMesh));
+	}
+
+	// Each skinned instance gets a copy of its mesh, with space for the skinned positions and normals.
+	// The other streams and the meshlets are shared with the source mesh.
+	// The meshlet bounds and LODs are bind pose data, so all meshlets get the full range of the skinned positions and LODs are not used.
+	// The bounds of the copy follow the pose instead, see UpdateSkinnedBounds().
+	std::vector<ShaderInterop::Meshlet::Bounds> skinnedMeshletBounds;
+	std::vector<ShaderInterop::Meshlet::LOD> skinnedMeshletLODs;
+	for (SubMeshInstance& instance : m_MeshInstances)
+	{
+		if (instance.SkinIndex == Skin::InvalidSkin)
+			continue;
+
+		SubMesh subMesh = m_Meshes[instance.MeshIndex];
+		subMesh.SkinSourceMesh = instance.MeshIndex;
+		subMesh.Bounds = BoundingBox(Vector3::Zero, Vector3::One);
+
+		auto ReserveData = [&](uint32 numElements, uint32 stride)
+		{
+			VertexBufferView view(m_pGeometryData->GetGpuHandle() + dataOffset, numElements, stride, dataOffset);
+			dataOffset = Math::AlignUp<uint64>(dataOffset + (uint64)numElements * stride, bufferAlignment);
+			return view;
+		};
+		subMesh.PositionStreamLocation = ReserveData(subMesh.PositionStreamLocation.Elements, sizeof(TVertexPositionStream));
+		subMesh.PositionPrevStreamLocation = ReserveData(subMesh.PositionStreamLocation.Elements, sizeof(TVertexPositionStream));
+		subMesh.NormalStreamLocation = ReserveData(subMesh.NormalStreamLocation.Elements, sizeof(TVertexNormalStream));
+
+		ShaderInterop::Meshlet::Bounds bounds{};
+		bounds.LocalExtents = Vector3::One;
+		bounds.SphereRadius = Vector3::One.Length();
+		bounds.ConeCutoff = 1.0f;
+		skinnedMeshletBounds.assign(subMesh.NumMeshlets, bounds);
+		subMesh.MeshletBoundsLocation = (uint32)dataOffset;
+		CopyData(skinnedMeshletBounds.data(), sizeof(ShaderInterop::Meshlet::Bounds) * skinnedMeshletBounds.size());
+		subMesh.MeshletBounds = skinnedMeshletBounds;
+
+		// Only the full detail meshlets, which are always in the LOD cut
+		ShaderInterop::Meshlet::LOD lod{};
+		lod.ParentError = FLT_MAX;
+		skinnedMeshletLODs.assign(subMesh.NumMeshlets, lod);
+		subMesh.MeshletLODsLocation = (uint32)dataOffset;
+		CopyData(skinnedMeshletLODs.data(), sizeof(ShaderInterop::Meshlet::LOD) * skinnedMeshletLODs.size());
+		subMesh.NumLODMeshlets = subMesh.NumMeshlets;
+
+		instance.MeshIndex = (int)m_Meshes.size();
+		m_Meshes.push_back(std::move(subMesh));
 	}
 
-	allocation.pContext->CopyBuffer(allocation.pBackingResource, m_pGeometryData, bufferSize, allocation.Offset, 0);
-	pDevice->GetRingBuffer()->Free(allocation);
+	// The mesh is drawn right after loading, so its data can't wait for the per-frame budget
+	pUploader->Flush();
+
+	m_DirtyInstances.Resize((uint32)m_MeshInstances.size());
+	m_DirtyInstances.SetAll();
+	m_DirtyMaterials.Resize((uint32)m_Materials.size());
+	m_DirtyMaterials.SetAll();
+
+	UpdateTransforms();
+
+	if (!m_Animations.empty())
+	{
+		m_Animator.Initialize(m_Animations, m_Transforms);
+		m_Animator.Play(0);
+	}
 
 	return true;
 }
 
+
+void Mesh::UpdateTransforms(bool parallel)
+{
+	if (!m_Transforms.Update(parallel))
+		return;
+
+	for (const Skin& skin : m_Skins)
+		skin.ComputeJointMatrices(m_Transforms, &m_JointMatrices[skin.JointMatricesOffset]);
+
+	for (uint32 i = 0; i < (uint32)m_MeshInstances.size(); ++i)
+	{
+		SubMeshInstance& instance = m_MeshInstances[i];
+		if (instance.SkinIndex != Skin::InvalidSkin)
+		{
+			// Any of the joints may have moved
+			instance.Transform = GetSkinnedInstanceTransform(instance);
+			UpdateSkinnedBounds(instance);
+			m_SkinningPassesLeft = 2;
+			m_DirtyInstances.SetBit(i);
+		}
+		else if (instance.TransformNode != TransformHierarchy::InvalidNode && m_Transforms.HasChanged(instance.TransformNode))
+		{
+			instance.Transform = Matrix::CreateScale(m_Meshes[instance.MeshIndex].ScaleFactor) * m_Transforms.GetWorldMatrix(instance.TransformNode);
+			m_DirtyInstances.SetBit(i);
+		}
+	}
+}
+
+Matrix Mesh::GetSkinnedInstanceTransform(const SubMeshInstance& instance) const
+{
+	// Skinned positions are stored normalized like all positions, but the pose can reach further than the bind pose
+	constexpr float SkinnedPositionRange = 2.0f;
+
+	const Skin& skin = m_Skins[instance.SkinIndex];
+	const Matrix& nodeToWorld = m_Transforms.GetWorldMatrix(instance.TransformNode);
+
+	// Follow the first joint, usually the root, so root motion doesn't move the vertices out of the range
+	Vector3 bindPosition = skin.InverseBindMatrices[0].Invert().Translation();
+	Vector3 position = Vector3::Transform(m_Transforms.GetWorldMatrix(skin.Joints[0]).Translation(), nodeToWorld.Invert());
+
+	float scale = m_Meshes[instance.MeshIndex].ScaleFactor * SkinnedPositionRange;
+	return Matrix::CreateScale(scale) * Matrix::CreateTranslation(position - bindPosition) * nodeToWorld;
+}
+
+void Mesh::UpdateSkinnedBounds(const SubMeshInstance& instance)
+{
+	SubMesh& skinnedMesh = m_Meshes[instance.MeshIndex];
+	const SubMesh& sourceMesh = m_Meshes[skinnedMesh.SkinSourceMesh];
+	const Skin& skin = m_Skins[instance.SkinIndex];
+
+	// A skinned vertex is a weighted average of the vertex transformed by each of its joints,
+	// so it stays within the bounds of its joints' vertices transformed by those joints.
+	// Same transform as the skinning pass: normalized source position > bind pose > world > normalized skinned position
+	const Matrix sourceScale = Matrix::CreateScale(sourceMesh.ScaleFactor);
+	const Matrix worldToInstance = instance.Transform.Invert();
+	Vector3 minimum(FLT_MAX);
+	Vector3 maximum(-FLT_MAX);
+	const uint32 numJoints = Math::Min((uint32)sourceMesh.JointBounds.size(), (uint32)skin.Joints.size());
+	for (uint32 joint = 0; joint < numJoints; ++joint)
+	{
+		const BoundingBox& jointBounds = sourceMesh.JointBounds[joint];
+		if (jointBounds.Extents.x < 0.0f)
+			continue;
+		BoundingBox bounds;
+		jointBounds.Transform(bounds, sourceScale * m_JointMatrices[skin.JointMatricesOffset + joint] * worldToInstance);
+		minimum = Vector3::Min(minimum, Vector3(bounds.Center) - Vector3(bounds.Extents));
+		maximum = Vector3::Max(maximum, Vector3(bounds.Center) + Vector3(bounds.Extents));
+	}
+
+	// Skinned positions are clamped to the normalized range when packed
+	minimum = Vector3::Max(minimum, -Vector3::One);
+	maximum = Vector3::Min(maximum, Vector3::One);
+	if (minimum.x <= maximum.x && minimum.y <= maximum.y && minimum.z <= maximum.z)
+		skinnedMesh.Bounds = BoundingBox((maximum + minimum) / 2, (maximum - minimum) / 2);
+}
+
+void Mesh::UpdateAnimation(float deltaTime, bool parallel)
+{
+	if (!m_Animator.IsPlaying())
+		return;
+
+	m_Animator.Update(deltaTime, m_Transforms);
+	UpdateTransforms(parallel);
+}
+
+void Mesh::ReplaceTexture(Texture* pOld, Texture* pNew)
+{
+	for (uint32 i = 0; i < (uint32)m_Materials.size(); ++i)
+	{
+		Material& material = m_Materials[i];
+		for (Texture** ppTexture : { &material.pDiffuseTexture, &material.pNormalTexture, &material.pRoughnessMetalnessTexture, &material.pEmissiveTexture })
+		{
+			if (*ppTexture == pOld)
+			{
+				*ppTexture = pNew;
+				m_DirtyMaterials.SetBit(i);
+			}
+		}
+	}
+	for (RefCountPtr<Texture>& pTexture : m_Textures)
+	{
+		if (pTexture == pOld)
+			pTexture = pNew;
+	}
+}
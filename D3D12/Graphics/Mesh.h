@@ -2,8 +2,13 @@
 
 #include "Graphics/RHI/RHI.h"
 #include "RHI/Buffer.h"
+#include "ShaderInterop.h"
+#include "TransformHierarchy.h"
+#include "Animation.h"
+#include "Core/DynamicBitField.h"
 
 class Mesh;
+class TextureStreamer;
 struct World;
 
 struct SubMesh
@@ -15,22 +20,48 @@ struct SubMesh
 	VertexBufferView UVStreamLocation;
 	VertexBufferView NormalStreamLocation;
 	VertexBufferView ColorsStreamLocation;
+	// Positions of the previous skinning pass. Same as the positions if the mesh isn't skinned.
+	VertexBufferView PositionPrevStreamLocation;
+	// Joint indices and weights of each vertex. Only valid for meshes with a skin.
+	VertexBufferView SkinStreamLocation;
 	IndexBufferView IndicesLocation;
 	uint32 MeshletsLocation;
 	uint32 MeshletVerticesLocation;
 	uint32 MeshletTrianglesLocation;
 	uint32 MeshletBoundsLocation;
+	uint32 MeshletLODsLocation;
 	uint32 NumMeshlets;
+	uint32 NumLODMeshlets;
 
 	BoundingBox Bounds;
+	// Positions are normalized, the instance transform scales them back
+	float ScaleFactor = 1.0f;
 	Mesh* pParent = nullptr;
 
+	// CPU copy of the full detail meshlet bounds, for reference culling
+	std::vector<ShaderInterop::Meshlet::Bounds> MeshletBounds;
+	// Bind pose bounds of the vertices influenced by each joint, in the normalized positions. Only for meshes with a skin.
+	// Joints without vertices have negative extents.
+	std::vector<BoundingBox> JointBounds;
+
+	// Skinned instances draw their own copy of the mesh, which has the skinned positions and normals. See Skinning.h
+	// Index of the mesh the copy is skinned from, or -1 if this isn't a skinned copy.
+	int SkinSourceMesh = -1;
+	// False until the first skinning pass wrote the positions
+	bool IsSkinned = false;
+	// Set by the skinning pass, so the BLAS is refit
+	bool NeedsBLASUpdate = false;
+
 	RefCountPtr<Buffer> pBLAS;
 };
 
 struct SubMeshInstance
 {
 	int MeshIndex;
+	// Node in the mesh's transform hierarchy. If invalid, the transform is static.
+	uint32 TransformNode = TransformHierarchy::InvalidNode;
+	// Skin of the instance, or 'Skin::InvalidSkin'. MeshIndex is then the instance's skinned copy of the mesh.
+	uint32 SkinIndex = Skin::InvalidSkin;
 	Matrix Transform;
 };
 
@@ -60,7 +91,8 @@ class Mesh
 {
 public:
 	~Mesh();
-	bool Load(const char* pFilePath, GraphicsDevice* pDevice, float scale = 1.0f);
+	bool Load(const char* pFilePath, GraphicsDevice* pDevice, float scale = 1.0f, TextureStreamer* pTextureStreamer = nullptr);
+	void ReplaceTexture(Texture* pOld, Texture* pNew);
 	int GetMeshCount() const { return (int)m_Meshes.size(); }
 	SubMesh& GetMesh(const int index) { return m_Meshes[index]; }
 	const Material& GetMaterial(int materialId) const { return m_Materials[materialId]; }
@@ -68,11 +100,47 @@ public:
 	Span<SubMesh> GetMeshes() const { return m_Meshes; }
 	Span<Material> GetMaterials() { return m_Materials; }
 	Buffer* GetData() const { return m_pGeometryData; }
+	TransformHierarchy& GetTransforms() { return m_Transforms; }
+
+	// Propagates changes in the transform hierarchy to the instance transforms and the joint matrices of the skins
+	void UpdateTransforms(bool parallel = true);
+
+	// Instances and materials which changed since the last call to ClearDirty(). Everything is dirty after loading.
+	const DynamicBitField& GetDirtyInstances() const { return m_DirtyInstances; }
+	const DynamicBitField& GetDirtyMaterials() const { return m_DirtyMaterials; }
+	void ClearDirty() { m_DirtyInstances.ClearAll(); m_DirtyMaterials.ClearAll(); }
+
+	Span<AnimationClip> GetAnimations() const { return m_Animations; }
+	Span<Skin> GetSkins() const { return m_Skins; }
+	Span<Matrix> GetJointMatrices() const { return m_JointMatrices; }
+	Animator& GetAnimator() { return m_Animator; }
+	bool IsAnimated() const { return m_Animator.IsPlaying(); }
+
+	// Advances the animation and updates the transforms
+	void UpdateAnimation(float deltaTime, bool parallel = true);
+
+	// True if the joints of a skinned instance moved since the last skinning passes.
+	// Skinned once more after the joints stop, so the previous positions catch up.
+	bool NeedsSkinning() const { return m_SkinningPassesLeft > 0; }
+	void OnSkinned() { --m_SkinningPassesLeft; }
 
 private:
+	Matrix GetSkinnedInstanceTransform(const SubMeshInstance& instance) const;
+	// Computes the bounds of the instance's skinned copy from the current joint matrices
+	void UpdateSkinnedBounds(const SubMeshInstance& instance);
+
 	std::vector<Material> m_Materials;
 	RefCountPtr<Buffer> m_pGeometryData;
 	std::vector<SubMesh> m_Meshes;
 	std::vector<SubMeshInstance> m_MeshInstances;
+	TransformHierarchy m_Transforms;
+	std::vector<AnimationClip> m_Animations;
+	std::vector<Skin> m_Skins;
+	std::vector<Matrix> m_JointMatrices;
+	Animator m_Animator;
+	uint32 m_SkinningPassesLeft = 0;
+	DynamicBitField m_DirtyInstances;
+	DynamicBitField m_DirtyMaterials;
 	std::vector<RefCountPtr<Texture>> m_Textures;
+	TextureStreamer* m_pTextureStreamer = nullptr;
 };
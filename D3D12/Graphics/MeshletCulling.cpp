@@ -0,0 +1,53 @@
+#include "stdafx.h"
+#include "MeshletCulling.h"
+#include "Mesh.h"
+#include "SceneView.h"
+#include "Core/Profiler.h"
+
+namespace MeshletCulling
+{
+	bool IsBackfacing(const ShaderInterop::Meshlet::Bounds& bounds, const Matrix& localToWorld, const Vector3& viewLocation)
+	{
+		if (bounds.ConeCutoff >= 1.0f)
+			return false;
+		Vector3 apex = Vector3::Transform(bounds.ConeApex, localToWorld);
+		Vector3 axis = Vector3::TransformNormal(bounds.ConeAxis, localToWorld);
+		axis.Normalize();
+		Vector3 direction = apex - viewLocation;
+		direction.Normalize();
+		return direction.Dot(axis) >= bounds.ConeCutoff;
+	}
+
+	Stats Measure(const SceneView& sceneView, const ViewTransform& view)
+	{
+		PROFILE_CPU_SCOPE();
+
+		Stats stats;
+		for (const Batch& batch : sceneView.Batches)
+		{
+			if (batch.BlendMode != Batch::Blending::Opaque)
+				continue;
+
+			for (const ShaderInterop::Meshlet::Bounds& bounds : batch.pMesh->MeshletBounds)
+			{
+				++stats.NumMeshlets;
+
+				BoundingSphere worldSphere;
+				BoundingSphere(bounds.SphereCenter, bounds.SphereRadius).Transform(worldSphere, batch.WorldMatrix);
+				const bool sphereInFrustum = view.IsPerspective ? view.PerspectiveFrustum.Contains(worldSphere) : view.OrthographicFrustum.Contains(worldSphere);
+
+				BoundingBox worldBounds;
+				BoundingBox(bounds.LocalCenter, bounds.LocalExtents).Transform(worldBounds, batch.WorldMatrix);
+				if (!sphereInFrustum || !view.IsInFrustum(worldBounds))
+				{
+					++stats.NumFrustumCulled;
+					if (!sphereInFrustum)
+						++stats.NumSphereCulled;
+				}
+				else if (view.IsPerspective && IsBackfacing(bounds, batch.WorldMatrix, view.Position))
+					++stats.NumBackfaceCulled;
+			}
+		}
+		return stats;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ShaderInterop.h"
+
+struct SceneView;
+struct ViewTransform;
+
+/*
+	CPU reference of the per-meshlet tests done in MeshletCull.hlsl.
+	Used to validate the meshlet bounds and to measure how much each test rejects on a scene.
+*/
+namespace MeshletCulling
+{
+	// Returns true if all triangles of the meshlet face away from 'viewLocation'.
+	bool IsBackfacing(const ShaderInterop::Meshlet::Bounds& bounds, const Matrix& localToWorld, const Vector3& viewLocation);
+
+	struct Stats
+	{
+		uint32 NumMeshlets = 0;
+		uint32 NumFrustumCulled = 0;
+		// Meshlets outside the frustum which are already rejected by the bounding sphere pre-test
+		uint32 NumSphereCulled = 0;
+		// Meshlets inside the frustum which are backfacing
+		uint32 NumBackfaceCulled = 0;
+	};
+
+	// Culls the full detail meshlets of all opaque batches against the view.
+	Stats Measure(const SceneView& sceneView, const ViewTransform& view);
+}
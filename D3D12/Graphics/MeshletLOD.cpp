@@ -0,0 +1,238 @@
+#include "stdafx.h"
+#include "MeshletLOD.h"
+#include "Core/Profiler.h"
+
+#include "meshoptimizer.h"
+
+namespace MeshletLOD
+{
+	// Splits a triangle list into clusters and appends them to 'outClusters'
+	static void BuildClusters(Span<Vector3> positions, const std::vector<uint32>& indices, const BuildSettings& settings, uint32 level, std::vector<Cluster>& outClusters)
+	{
+		const size_t maxMeshlets = meshopt_buildMeshletsBound(indices.size(), settings.MaxVertices, settings.MaxTriangles);
+		std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+		std::vector<uint32> meshletVertices(maxMeshlets * settings.MaxVertices);
+		std::vector<uint8> meshletTriangles(maxMeshlets * settings.MaxTriangles * 3);
+
+		size_t meshletCount = meshopt_buildMeshlets(meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+			indices.data(), indices.size(), &positions[0].x, positions.GetSize(), sizeof(Vector3), settings.MaxVertices, settings.MaxTriangles, 0);
+
+		std::vector<Vector3> clusterPositions;
+		for (size_t i = 0; i < meshletCount; ++i)
+		{
+			const meshopt_Meshlet& meshlet = meshlets[i];
+			Cluster& cluster = outClusters.emplace_back();
+			cluster.Level = level;
+			cluster.Vertices.assign(meshletVertices.begin() + meshlet.vertex_offset, meshletVertices.begin() + meshlet.vertex_offset + meshlet.vertex_count);
+			cluster.Triangles.assign(meshletTriangles.begin() + meshlet.triangle_offset, meshletTriangles.begin() + meshlet.triangle_offset + meshlet.triangle_count * 3);
+
+			clusterPositions.clear();
+			for (uint32 vertex : cluster.Vertices)
+				clusterPositions.push_back(positions[vertex]);
+			BoundingSphere::CreateFromPoints(cluster.Bounds, clusterPositions.size(), (DirectX::XMFLOAT3*)clusterPositions.data(), sizeof(Vector3));
+			cluster.ParentBounds = cluster.Bounds;
+		}
+	}
+
+	// Greedily groups clusters with the clusters they share the most vertices with
+	static void GroupClusters(const std::vector<Cluster>& clusters, const std::vector<uint32>& levelClusters, const std::vector<uint32>& positionRemap, uint32 groupSize, std::vector<std::vector<uint32>>& outGroups)
+	{
+		// Map each unique position to the clusters referencing it
+		std::unordered_map<uint32, std::vector<uint32>> vertexToClusters;
+		for (uint32 i = 0; i < (uint32)levelClusters.size(); ++i)
+		{
+			for (uint32 vertex : clusters[levelClusters[i]].Vertices)
+			{
+				std::vector<uint32>& vertexClusters = vertexToClusters[positionRemap[vertex]];
+				if (vertexClusters.empty() || vertexClusters.back() != i)
+					vertexClusters.push_back(i);
+			}
+		}
+
+		std::vector<bool> isGrouped(levelClusters.size());
+		std::vector<uint32> sharedVertices(levelClusters.size());
+		std::vector<uint32> candidates;
+
+		for (uint32 seed = 0; seed < (uint32)levelClusters.size(); ++seed)
+		{
+			if (isGrouped[seed])
+				continue;
+
+			std::vector<uint32>& group = outGroups.emplace_back();
+			uint32 member = seed;
+			while (true)
+			{
+				isGrouped[member] = true;
+				group.push_back(member);
+				if (group.size() >= groupSize)
+					break;
+
+				// Accumulate the number of vertices shared with the group
+				for (uint32 vertex : clusters[levelClusters[member]].Vertices)
+				{
+					for (uint32 neighbor : vertexToClusters[positionRemap[vertex]])
+					{
+						if (isGrouped[neighbor])
+							continue;
+						if (sharedVertices[neighbor]++ == 0)
+							candidates.push_back(neighbor);
+					}
+				}
+
+				uint32 bestCandidate = 0xFFFFFFFF;
+				uint32 bestShared = 0;
+				for (uint32 candidate : candidates)
+				{
+					if (!isGrouped[candidate] && sharedVertices[candidate] > bestShared)
+					{
+						bestShared = sharedVertices[candidate];
+						bestCandidate = candidate;
+					}
+				}
+				if (bestCandidate == 0xFFFFFFFF)
+					break;
+				member = bestCandidate;
+			}
+
+			for (uint32 candidate : candidates)
+				sharedVertices[candidate] = 0;
+			candidates.clear();
+
+			for (uint32& groupMember : group)
+				groupMember = levelClusters[groupMember];
+		}
+	}
+
+	void Build(Span<Vector3> positions, Span<uint32> indices, const BuildSettings& settings, std::vector<Cluster>& outClusters)
+	{
+		PROFILE_CPU_SCOPE();
+
+		outClusters.clear();
+		if (indices.GetSize() == 0)
+			return;
+
+		std::vector<uint32> levelIndices(indices.begin(), indices.end());
+		BuildClusters(positions, levelIndices, settings, 0, outClusters);
+
+		// Vertices split on attribute seams still connect clusters
+		std::vector<uint32> positionRemap(positions.GetSize());
+		meshopt_generateVertexRemap(positionRemap.data(), nullptr, positions.GetSize(), &positions[0].x, positions.GetSize(), sizeof(Vector3));
+
+		// meshopt_simplify outputs an error relative to the mesh extents
+		const float errorScale = meshopt_simplifyScale(&positions[0].x, positions.GetSize(), sizeof(Vector3));
+
+		std::vector<uint32> levelClusters(outClusters.size());
+		for (uint32 i = 0; i < (uint32)levelClusters.size(); ++i)
+			levelClusters[i] = i;
+
+		std::vector<std::vector<uint32>> groups;
+		std::vector<uint32> groupIndices;
+		std::vector<uint32> localIndices;
+		std::vector<uint32> localToGlobal;
+		std::vector<Vector3> localPositions;
+		std::unordered_map<uint32, uint32> globalToLocal;
+
+		for (uint32 level = 1; level < settings.MaxLevels && levelClusters.size() > 1; ++level)
+		{
+			groups.clear();
+			GroupClusters(outClusters, levelClusters, positionRemap, settings.GroupSize, groups);
+
+			std::vector<uint32> nextLevelClusters;
+			for (const std::vector<uint32>& group : groups)
+			{
+				// Merge the triangles of the group into a local vertex buffer so simplification only touches the vertices it needs
+				localIndices.clear();
+				localToGlobal.clear();
+				localPositions.clear();
+				globalToLocal.clear();
+				for (uint32 clusterIndex : group)
+				{
+					const Cluster& cluster = outClusters[clusterIndex];
+					for (uint8 triangleVertex : cluster.Triangles)
+					{
+						uint32 vertex = cluster.Vertices[triangleVertex];
+						auto it = globalToLocal.find(vertex);
+						if (it == globalToLocal.end())
+						{
+							it = globalToLocal.emplace(vertex, (uint32)localToGlobal.size()).first;
+							localToGlobal.push_back(vertex);
+							localPositions.push_back(positions[vertex]);
+						}
+						localIndices.push_back(it->second);
+					}
+				}
+
+				// Simplify to half the triangles. Locking the border keeps the edges shared with other groups intact.
+				size_t targetIndexCount = (localIndices.size() / 6) * 3;
+				float simplifyError = 0.0f;
+				groupIndices.resize(localIndices.size());
+				size_t indexCount = meshopt_simplify(groupIndices.data(), localIndices.data(), localIndices.size(), &localPositions[0].x, localPositions.size(), sizeof(Vector3),
+					targetIndexCount, FLT_MAX, meshopt_SimplifyLockBorder, &simplifyError);
+
+				// If the group can't be simplified enough, its clusters become roots
+				if (indexCount == 0 || indexCount > localIndices.size() * settings.MaxReduction)
+					continue;
+
+				groupIndices.resize(indexCount);
+				for (uint32& index : groupIndices)
+					index = localToGlobal[index];
+
+				// The group's bounds and error contain the bounds and errors of all its clusters, so the error is monotonic up the hierarchy
+				BoundingSphere groupBounds = outClusters[group[0]].Bounds;
+				float groupError = 0.0f;
+				for (uint32 clusterIndex : group)
+				{
+					const Cluster& cluster = outClusters[clusterIndex];
+					BoundingSphere mergedBounds;
+					BoundingSphere::CreateMerged(mergedBounds, groupBounds, cluster.Bounds);
+					groupBounds = mergedBounds;
+					groupError = Math::Max(groupError, cluster.Error);
+				}
+				groupError += simplifyError * errorScale;
+
+				for (uint32 clusterIndex : group)
+				{
+					Cluster& cluster = outClusters[clusterIndex];
+					cluster.ParentBounds = groupBounds;
+					cluster.ParentError = groupError;
+				}
+
+				size_t firstCluster = outClusters.size();
+				BuildClusters(positions, groupIndices, settings, level, outClusters);
+				for (size_t i = firstCluster; i < outClusters.size(); ++i)
+				{
+					Cluster& cluster = outClusters[i];
+					cluster.Bounds = groupBounds;
+					cluster.Error = groupError;
+					cluster.ParentBounds = groupBounds;
+					cluster.ParentError = FLT_MAX;
+					nextLevelClusters.push_back((uint32)i);
+				}
+			}
+
+			if (nextLevelClusters.empty())
+				break;
+			levelClusters.swap(nextLevelClusters);
+		}
+	}
+
+	float GetProjectionScale(const Matrix& projection, float viewportHeight)
+	{
+		return projection._22 * viewportHeight * 0.5f;
+	}
+
+	float ProjectError(const BoundingSphere& bounds, float error, const Vector3& viewLocation, float projectionScale, bool isOrthographic)
+	{
+		if (isOrthographic)
+			return error * projectionScale;
+		// Use the closest point of the bounds, so a parent is never projected smaller than its children
+		float distance = Math::Max(Vector3::Distance(Vector3(bounds.Center), viewLocation) - bounds.Radius, 1.0e-4f);
+		return error * projectionScale / distance;
+	}
+
+	bool IsInCut(const Cluster& cluster, const Vector3& viewLocation, float projectionScale, bool isOrthographic, float threshold)
+	{
+		return ProjectError(cluster.Bounds, cluster.Error, viewLocation, projectionScale, isOrthographic) <= threshold &&
+			ProjectError(cluster.ParentBounds, cluster.ParentError, viewLocation, projectionScale, isOrthographic) > threshold;
+	}
+}
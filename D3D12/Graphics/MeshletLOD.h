@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+	Continuous LOD through a hierarchy of meshlets.
+
+	Level 0 are the meshlets of the source mesh. To build the next level, adjacent meshlets are grouped,
+	their triangles merged and simplified to half while the borders of the group are locked,
+	and the result is split into meshlets again. Because group borders never move, any mix of levels can be
+	rendered without cracks, as long as all meshlets of a group make the same decision.
+
+	Every meshlet stores the error of its own simplification and the error of the group it was simplified into (its parent).
+	Both are stored with a bounding sphere and errors only increase going up the hierarchy.
+	A meshlet is part of the rendered cut when its own error projected on screen is small enough but its parent's isn't.
+	This only depends on the meshlet itself so the cut can be evaluated in parallel for every meshlet.
+
+	This has no GPU dependencies, so the builder and the error metric can be validated offline.
+	MeshletCull.hlsl evaluates the same test as IsInCut().
+*/
+namespace MeshletLOD
+{
+	struct Cluster
+	{
+		// Indices into the source vertex buffer
+		std::vector<uint32> Vertices;
+		// Triangle list indexing into 'Vertices'
+		std::vector<uint8> Triangles;
+
+		uint32 Level = 0;
+
+		// Simplification error of this cluster, in object space units
+		BoundingSphere Bounds;
+		float Error = 0.0f;
+
+		// Error of the group this cluster was simplified into. FLT_MAX if this is a root.
+		BoundingSphere ParentBounds;
+		float ParentError = FLT_MAX;
+	};
+
+	struct BuildSettings
+	{
+		uint32 MaxVertices = 64;
+		uint32 MaxTriangles = 124;
+		// Number of meshlets merged and simplified together
+		uint32 GroupSize = 4;
+		// Maximum number of levels, including level 0
+		uint32 MaxLevels = 16;
+		// Groups that can't be simplified below this fraction of their triangles become roots
+		float MaxReduction = 0.85f;
+	};
+
+	// Outputs the clusters of all levels, sorted by level so that the level 0 clusters come first.
+	void Build(Span<Vector3> positions, Span<uint32> indices, const BuildSettings& settings, std::vector<Cluster>& outClusters);
+
+	// Number of pixels per unit at a distance of 1 for a projection matrix and viewport height.
+	float GetProjectionScale(const Matrix& projection, float viewportHeight);
+
+	// Projects an error on the screen, in pixels.
+	float ProjectError(const BoundingSphere& bounds, float error, const Vector3& viewLocation, float projectionScale, bool isOrthographic);
+
+	// Returns true if the cluster is part of the cut for the given view and error threshold (in pixels).
+	bool IsInCut(const Cluster& cluster, const Vector3& viewLocation, float projectionScale, bool isOrthographic, float threshold);
+}
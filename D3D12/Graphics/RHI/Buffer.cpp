@@ -1,12 +1,19 @@
 #include "stdafx.h"
 #include "Buffer.h"
 #include "ResourceViews.h"
+#include "BufferSubAllocator.h"
 
 Buffer::Buffer(GraphicsDevice* pParent, const BufferDesc& desc, ID3D12Resource* pResource)
 	: GraphicsResource(pParent, pResource), m_Desc(desc)
 {
 }
 
+Buffer::~Buffer()
+{
+	if (m_pSubAllocator)
+		m_pSubAllocator->Release(this);
+}
+
 uint32 Buffer::GetUAVIndex() const
 {
 	return m_pUAV->GetHeapIndex();
@@ -1,6 +1,9 @@
 #pragma once
 #include "GraphicsResource.h"
 #include "D3D.h"
+#include "Core/TLSFAllocator.h"
+
+class BufferSubAllocator;
 
 enum class BufferFlag
 {
@@ -138,8 +141,13 @@ public:
 	friend class GraphicsDevice;
 
 	Buffer(GraphicsDevice* pParent, const BufferDesc& desc, ID3D12Resource* pResource);
+	~Buffer();
 
 	inline uint64 GetSize() const { return m_Desc.Size; }
+	// Offset in the resource, if the buffer is a range of a larger buffer
+	inline uint64 GetOffset() const { return m_Offset; }
+	// Only buffers have a GPU address, so there is no GraphicsResource version that would miss the offset
+	inline D3D12_GPU_VIRTUAL_ADDRESS GetGpuHandle() const { return m_pResource->GetGPUVirtualAddress() + m_Offset; }
 	inline uint32 GetNumElements() const { return m_Desc.NumElements(); }
 	inline const BufferDesc& GetDesc() const { return m_Desc; }
 	UnorderedAccessView* GetUAV() const { return m_pUAV; }
@@ -149,10 +157,16 @@ public:
 
 
 private:
+	friend class BufferSubAllocator;
+
 	RefCountPtr<UnorderedAccessView> m_pUAV;
 	RefCountPtr<ShaderResourceView> m_pSRV;
 	
 	const BufferDesc m_Desc;
+
+	uint64 m_Offset = 0;
+	RefCountPtr<BufferSubAllocator> m_pSubAllocator;
+	TLSFAllocator::Allocation m_SubAllocation;
 };
 
 struct VertexBufferView
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "BufferSubAllocator.h"
+#include "Graphics.h"
+#include "Fence.h"
+#include "ResourceViews.h"
+
+BufferSubAllocator::BufferSubAllocator(GraphicsDevice* pParent, BufferFlag flags, uint64 pageSize, const char* pName)
+	: GraphicsObject(pParent), m_Flags(flags), m_PageSize(pageSize), m_Name(pName)
+{
+	check(EnumHasAnyFlags(flags, BufferFlag::Upload | BufferFlag::Readback | BufferFlag::AccelerationStructure), "Only buffers which are never transitioned can be sub-allocated");
+}
+
+RefCountPtr<Buffer> BufferSubAllocator::CreateBuffer(const BufferDesc& desc, const char* pName, uint32 alignment)
+{
+	constexpr BufferFlag ResourceFlags = BufferFlag::Upload | BufferFlag::Readback | BufferFlag::AccelerationStructure | BufferFlag::UnorderedAccess;
+	check(EnumHasAllFlags(m_Flags, desc.Flags & ResourceFlags), "Buffer '%s' needs resource flags the pages of '%s' don't have", pName, m_Name.c_str());
+
+	// Views address the range in elements, so it has to start at a multiple of the element size.
+	// Element sizes which are not a power of two are aligned by allocating a bit more.
+	const uint32 elementSize = Math::Max(desc.ElementSize, 1u);
+	const bool isElementSizePow2 = (elementSize & (elementSize - 1)) == 0;
+	if (isElementSizePow2)
+		alignment = Math::Max(alignment, elementSize);
+	const uint64 size = isElementSizePow2 ? desc.Size : desc.Size + elementSize - 1;
+
+	std::scoped_lock lock(m_Lock);
+
+	const uint64 completedFence = GetParent()->GetFrameFence()->GetLastCompletedValue();
+	Page* pPage = nullptr;
+	TLSFAllocator::Allocation allocation;
+	for (std::unique_ptr<Page>& page : m_Pages)
+	{
+		page->Allocator.Recycle(completedFence);
+		allocation = page->Allocator.Allocate(size, alignment);
+		if (allocation.IsValid())
+		{
+			pPage = page.get();
+			break;
+		}
+	}
+
+	if (!pPage)
+	{
+		uint64 pageSize = Math::AlignUp<uint64>(Math::Max(m_PageSize, size + alignment), 4);
+		RefCountPtr<Buffer> pPageBuffer = GetParent()->CreateBuffer(BufferDesc((uint32)(pageSize / 4), 4, m_Flags | BufferFlag::NoBindless), Sprintf("%s.Page%d", m_Name.c_str(), (int)m_Pages.size()).c_str());
+		pPage = m_Pages.emplace_back(std::make_unique<Page>(pPageBuffer)).get();
+		allocation = pPage->Allocator.Allocate(size, alignment);
+		check(allocation.IsValid());
+	}
+
+	Buffer* pPageBuffer = pPage->pBuffer;
+	pPageBuffer->GetResource()->AddRef();
+
+	Buffer* pBuffer = new Buffer(GetParent(), desc, pPageBuffer->GetResource());
+	pBuffer->m_Offset = (allocation.Offset + elementSize - 1) / elementSize * elementSize;
+	pBuffer->m_pSubAllocator = this;
+	pBuffer->m_SubAllocation = allocation;
+	// The name of the resource is the name of the page
+	pBuffer->m_Name = pName;
+	pBuffer->SetResourceState(pPageBuffer->GetResourceState());
+	pBuffer->m_NeedsStateTracking = pPageBuffer->UseStateTracking();
+	if (EnumHasAnyFlags(m_Flags, BufferFlag::Upload | BufferFlag::Readback))
+		pBuffer->m_pMappedData = (char*)pPageBuffer->GetMappedData() + pBuffer->m_Offset;
+
+	bool isRaw = EnumHasAnyFlags(desc.Flags, BufferFlag::ByteAddress);
+	bool withCounter = !isRaw && desc.Format == ResourceFormat::Unknown;
+	if (EnumHasAnyFlags(desc.Flags, BufferFlag::ShaderResource | BufferFlag::AccelerationStructure))
+		pBuffer->m_pSRV = GetParent()->CreateSRV(pBuffer, BufferSRVDesc(desc.Format, isRaw));
+	if (EnumHasAnyFlags(desc.Flags, BufferFlag::UnorderedAccess))
+		pBuffer->m_pUAV = GetParent()->CreateUAV(pBuffer, BufferUAVDesc(desc.Format, isRaw, withCounter));
+
+	return pBuffer;
+}
+
+TLSFAllocator::Stats BufferSubAllocator::GetStats() const
+{
+	std::scoped_lock lock(m_Lock);
+	TLSFAllocator::Stats stats;
+	for (const std::unique_ptr<Page>& page : m_Pages)
+	{
+		TLSFAllocator::Stats pageStats = page->Allocator.GetStats();
+		stats.Size += pageStats.Size;
+		stats.UsedSize += pageStats.UsedSize;
+		stats.LargestFreeBlock = Math::Max(stats.LargestFreeBlock, pageStats.LargestFreeBlock);
+		stats.NumAllocations += pageStats.NumAllocations;
+		stats.NumFreeBlocks += pageStats.NumFreeBlocks;
+		stats.NumPendingFrees += pageStats.NumPendingFrees;
+	}
+	return stats;
+}
+
+void BufferSubAllocator::Release(const Buffer* pBuffer)
+{
+	std::scoped_lock lock(m_Lock);
+	for (std::unique_ptr<Page>& page : m_Pages)
+	{
+		if (page->pBuffer->GetResource() == pBuffer->GetResource())
+		{
+			page->Allocator.Free(pBuffer->m_SubAllocation, GetParent()->GetFrameFence()->GetCurrentValue());
+			return;
+		}
+	}
+	noEntry();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Buffer.h"
+#include "Core/TLSFAllocator.h"
+
+/*
+	Creates buffers as ranges of large page buffers, instead of a committed resource each.
+
+	- Ranges come from a TLSFAllocator for each page. A new page is created when no page has a free range large enough.
+	- Buffers share the resource of their page, so they can't be transitioned.
+	  Only buffers which stay in their initial state can be sub-allocated: upload, readback and acceleration structure buffers.
+	- The range of a released buffer is only reused once the GPU completed the frame it was released in.
+	- Buffers keep a reference to their allocator, so it lives as long as the last of its buffers.
+*/
+class BufferSubAllocator : public GraphicsObject
+{
+public:
+	BufferSubAllocator(GraphicsDevice* pParent, BufferFlag flags, uint64 pageSize, const char* pName);
+
+	// The range is aligned to 'alignment' and to the element size of the buffer.
+	// If the element size is not a power of two, the range is only aligned to the element size.
+	RefCountPtr<Buffer> CreateBuffer(const BufferDesc& desc, const char* pName, uint32 alignment = 16);
+
+	// Combined stats of all pages
+	TLSFAllocator::Stats GetStats() const;
+
+private:
+	friend class Buffer;
+
+	struct Page
+	{
+		Page(RefCountPtr<Buffer> pBuffer)
+			: pBuffer(pBuffer), Allocator(pBuffer->GetSize())
+		{}
+
+		RefCountPtr<Buffer> pBuffer;
+		TLSFAllocator Allocator;
+	};
+
+	void Release(const Buffer* pBuffer);
+
+	mutable std::mutex m_Lock;
+	std::vector<std::unique_ptr<Page>> m_Pages;
+	BufferFlag m_Flags;
+	uint64 m_PageSize;
+	std::string m_Name;
+};
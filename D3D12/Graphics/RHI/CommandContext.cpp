@@ -32,7 +32,7 @@ void CommandContext::Reset()
 
 	check(m_NumBatchedBarriers == 0);
 	check(m_PendingBarriers.empty());
-	m_ResourceStates.clear();
+	m_ResourceStates.Reset();
 
 	ClearState();
 }
@@ -84,6 +84,7 @@ void CommandContext::ClearState()
 		m_pCurrentPSO = nullptr;
 		m_pCurrentSO = nullptr;
 		m_pCurrentRS = nullptr;
+		m_SkipWork = false;
 
 		m_pCommandList->ClearState(nullptr);
 
@@ -127,15 +128,15 @@ void CommandContext::InsertResourceBarrier(GraphicsResource* pResource, D3D12_RE
 	check(IsTransitionAllowed(m_Type, state), "After state (%s) is not valid on this commandlist type (%s)", D3D::ResourceStateToString(state).c_str(), D3D::CommandlistTypeToString(m_Type));
 	check(pResource->UseStateTracking());
 
-	ResourceState& resourceState = m_ResourceStates[pResource];
-	D3D12_RESOURCE_STATES beforeState = resourceState.Get(subResource);
+	const ResourceTrackingHandle handle = pResource->GetTrackingHandle();
+	D3D12_RESOURCE_STATES beforeState = m_ResourceStates.Get(handle, subResource);
 	if (beforeState == D3D12_RESOURCE_STATE_UNKNOWN)
 	{
-		resourceState.Set(state, subResource);
+		m_ResourceStates.Set(handle, state, subResource);
 
 		PendingBarrier& barrier = m_PendingBarriers.emplace_back();
 		barrier.pResource = pResource;
-		barrier.State = resourceState;
+		barrier.State = state;
 		barrier.Subresource = subResource;
 	}
 	else
@@ -164,7 +165,7 @@ void CommandContext::InsertResourceBarrier(GraphicsResource* pResource, D3D12_RE
 						D3D12_RESOURCE_BARRIER_FLAG_NONE)
 			);
 
-			resourceState.Set(state, subResource);
+			m_ResourceStates.Set(handle, state, subResource);
 		}
 	}
 }
@@ -203,7 +204,7 @@ void CommandContext::CopyTexture(const Texture* pSource, const Buffer* pTarget,
 	check(pTarget && pTarget->GetResource(), "Target is invalid");
 
 	D3D12_PLACED_SUBRESOURCE_FOOTPRINT textureFootprint;
-	textureFootprint.Offset = 0;
+	textureFootprint.Offset = pTarget->GetOffset();
 	textureFootprint.Footprint.Width = sourceRegion.right - sourceRegion.left;
 	textureFootprint.Footprint.Depth = sourceRegion.back - sourceRegion.front;
 	textureFootprint.Footprint.Height = sourceRegion.bottom - sourceRegion.top;
@@ -233,7 +234,7 @@ void CommandContext::CopyBuffer(const Buffer* pSource, const Buffer* pTarget, ui
 	check(pTarget && pTarget->GetResource(), "Target is invalid");
 
 	FlushResourceBarriers();
-	m_pCommandList->CopyBufferRegion(pTarget->GetResource(), destinationOffset, pSource->GetResource(), sourceOffset, size);
+	m_pCommandList->CopyBufferRegion(pTarget->GetResource(), pTarget->GetOffset() + destinationOffset, pSource->GetResource(), pSource->GetOffset() + sourceOffset, size);
 }
 
 void CommandContext::WriteBuffer(const Buffer* pResource, const void* pData, uint64 dataSize, uint64 offset)
@@ -261,6 +262,9 @@ void CommandContext::Dispatch(uint32 groupCountX, uint32 groupCountY, uint32 gro
 		groupCountZ <= D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION,
 		"Dispatch group size (%d x %d x %d) can not exceed %d", groupCountX, groupCountY, groupCountZ, D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION);
 	
+	if (m_SkipWork)
+		return;
+
 	PrepareDraw();
 	if(groupCountX > 0 && groupCountY > 0 && groupCountZ > 0)
 		m_pCommandList->Dispatch(groupCountX, groupCountY, groupCountZ);
@@ -275,6 +279,8 @@ void CommandContext::DispatchMesh(uint32 groupCountX, uint32 groupCountY /*= 1*/
 {
 	check(m_pCurrentPSO);
 	check(m_CurrentCommandContext == CommandListContext::Graphics);
+	if (m_SkipWork)
+		return;
 	
 	PrepareDraw();
 	m_pCommandList->DispatchMesh(groupCountX, groupCountY, groupCountZ);
@@ -288,6 +294,8 @@ void CommandContext::DispatchMesh(const Vector3i& groupCounts)
 void CommandContext::ExecuteIndirect(const CommandSignature* pCommandSignature, uint32 maxCount, const Buffer* pIndirectArguments, const Buffer* pCountBuffer, uint32 argumentsOffset /*= 0*/, uint32 countOffset /*= 0*/)
 {
 	check(m_pCurrentPSO || m_pCurrentSO);
+	if (m_SkipWork)
+		return;
 	
 	PrepareDraw();
 	m_pCommandList->ExecuteIndirect(pCommandSignature->GetCommandSignature(), maxCount, pIndirectArguments->GetResource(), argumentsOffset, pCountBuffer ? pCountBuffer->GetResource() : nullptr, countOffset);
@@ -460,7 +468,7 @@ void CommandContext::ResolvePendingBarriers(CommandContext& resolveContext)
 			pResource->GetName(), D3D::ResourceStateToString(beforeState).c_str(), D3D::CommandlistTypeToString(m_Type));
 
 		// Get the after state of the first use in the current cmdlist
-		D3D12_RESOURCE_STATES afterState = pending.State.Get(subResource);
+		D3D12_RESOURCE_STATES afterState = pending.State;
 		if(NeedsTransition(beforeState, afterState, false))
 			resolveContext.AddBarrier(CD3DX12_RESOURCE_BARRIER::Transition(pResource->GetResource(), beforeState, afterState, subResource));
 
@@ -634,6 +642,8 @@ void CommandContext::Draw(uint32 vertexStart, uint32 vertexCount, uint32 instanc
 {
 	check(m_pCurrentPSO);
 	check(m_CurrentCommandContext == CommandListContext::Graphics);
+	if (m_SkipWork)
+		return;
 	PrepareDraw();
 	m_pCommandList->DrawInstanced(vertexCount, instances, vertexStart, instanceStart);
 }
@@ -642,6 +652,8 @@ void CommandContext::DrawIndexedInstanced(uint32 indexCount, uint32 indexStart,
 {
 	check(m_pCurrentPSO);
 	check(m_CurrentCommandContext == CommandListContext::Graphics);
+	if (m_SkipWork)
+		return;
 	PrepareDraw();
 	m_pCommandList->DrawIndexedInstanced(indexCount, instanceCount, indexStart, minVertex, instanceStart);
 }
@@ -687,7 +699,12 @@ void CommandContext::SetPipelineState(PipelineState* pPipelineState)
 	if (m_pCurrentPSO != pPipelineState)
 	{
 		pPipelineState->ConditionallyReload();
-		m_pCommandList->SetPipelineState(pPipelineState->GetPipelineState());
+		PipelineState* pReadyPipeline = pPipelineState->GetReadyPipeline();
+		m_SkipWork = pReadyPipeline == nullptr;
+		if (pReadyPipeline)
+			m_pCommandList->SetPipelineState(pReadyPipeline->GetPipelineState());
+		else if (pPipelineState->WarnSkippedWork())
+			E_LOG(Warning, "Pipeline '%s' is not ready and has no fallback. Its work is skipped and its outputs are not written until it is.", pPipelineState->GetName().c_str());
 		m_pCurrentPSO = pPipelineState;
 	}
 }
@@ -699,6 +716,7 @@ void CommandContext::SetPipelineState(StateObject* pStateObject)
 		pStateObject->ConditionallyReload();
 		m_pCommandList->SetPipelineState1(pStateObject->GetStateObject());
 		m_pCurrentSO = pStateObject;
+		m_SkipWork = false;
 	}
 }
 
@@ -218,14 +218,15 @@ private:
 	static bool IsTransitionAllowed(D3D12_COMMAND_LIST_TYPE commandlistType, D3D12_RESOURCE_STATES state);
 	D3D12_RESOURCE_STATES GetLocalResourceState(const GraphicsResource* pResource, uint32 subResource) const
 	{
-		auto it = m_ResourceStates.find(pResource);
-		check(it != m_ResourceStates.end());
-		return it->second.Get(subResource);
+		D3D12_RESOURCE_STATES state = m_ResourceStates.Get(pResource->GetTrackingHandle(), subResource);
+		check(state != D3D12_RESOURCE_STATE_UNKNOWN);
+		return state;
 	}
 	struct PendingBarrier
 	{
 		GraphicsResource* pResource;
-		ResourceState State;
+		// State of the first use in this context
+		D3D12_RESOURCE_STATES State;
 		uint32 Subresource;
 	};
 
@@ -239,7 +240,7 @@ private:
 	std::array<D3D12_RESOURCE_BARRIER, MaxNumBatchedBarriers> m_BatchedBarriers{};
 	uint32 m_NumBatchedBarriers = 0;
 	std::vector<PendingBarrier> m_PendingBarriers;
-	std::unordered_map<const GraphicsResource*, ResourceState> m_ResourceStates;
+	ResourceStateTracker m_ResourceStates;
 
 	D3D12_COMMAND_LIST_TYPE m_Type;
 	CommandListContext m_CurrentCommandContext = CommandListContext::Invalid;
@@ -248,6 +249,8 @@ private:
 	bool m_InRenderPass = false;
 
 	const PipelineState* m_pCurrentPSO = nullptr;
+	// The current pipeline and its fallback are still being created. Draws and dispatches are skipped.
+	bool m_SkipWork = false;
 	const StateObject* m_pCurrentSO = nullptr;
 	const RootSignature* m_pCurrentRS = nullptr;
 };
@@ -7,7 +7,7 @@
 Fence::Fence(GraphicsDevice* pParent, const char* pName, uint64 fenceValue)
 	: GraphicsObject(pParent), m_CurrentValue(fenceValue + 1), m_LastSignaled(0), m_LastCompleted(fenceValue)
 {
-	VERIFY_HR_EX(pParent->GetDevice()->CreateFence(m_LastCompleted, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(m_pFence.GetAddressOf())), pParent->GetDevice());
+	VERIFY_HR_EX(pParent->GetDevice()->CreateFence(fenceValue, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(m_pFence.GetAddressOf())), pParent->GetDevice());
 	D3D::SetObjectName(m_pFence.Get(), pName);
 	m_CompleteEvent = CreateEventExA(nullptr, "Fence Event", 0, EVENT_ALL_ACCESS);
 }
@@ -28,7 +28,7 @@ uint64 Fence::Signal(CommandQueue* pQueue)
 uint64 Fence::Signal(uint64 fenceValue)
 {
 	m_LastSignaled = fenceValue;
-	m_LastCompleted = fenceValue;
+	m_LastCompleted.store(fenceValue);
 	m_CurrentValue++;
 	return m_LastSignaled;
 }
@@ -55,7 +55,7 @@ void Fence::CpuWait(uint64 fenceValue)
 	UNREFERENCED_PARAMETER(result);
 #endif
 
-	m_LastCompleted = m_pFence->GetCompletedValue();
+	UpdateLastCompleted();
 }
 
 void Fence::CpuWait()
@@ -63,12 +63,27 @@ void Fence::CpuWait()
 	CpuWait(m_LastSignaled);
 }
 
+uint64 Fence::GetLastCompletedValue()
+{
+	return UpdateLastCompleted();
+}
+
 bool Fence::IsComplete(uint64 fenceValue)
 {
-	if (fenceValue <= m_LastCompleted)
+	if (fenceValue <= m_LastCompleted.load())
 	{
 		return true;
 	}
-	m_LastCompleted = Math::Max(m_LastCompleted, m_pFence->GetCompletedValue());
-	return fenceValue <= m_LastCompleted;
+	return fenceValue <= UpdateLastCompleted();
+}
+
+uint64 Fence::UpdateLastCompleted()
+{
+	// Only ever move forward. Another thread may have stored a newer value since we queried the fence.
+	const uint64 completed = m_pFence->GetCompletedValue();
+	uint64 lastCompleted = m_LastCompleted.load();
+	while (lastCompleted < completed && !m_LastCompleted.compare_exchange_weak(lastCompleted, completed))
+	{
+	}
+	return Math::Max(lastCompleted, completed);
 }
@@ -15,6 +15,8 @@ public:
 	void CpuWait();
 	// Returns true if the fence has reached this value or higher
 	bool IsComplete(uint64 fenceValue);
+	// Returns the last fence value the GPU completed
+	uint64 GetLastCompletedValue();
 	// Get the fence value that will get signaled next
 	uint64 GetCurrentValue() const { return m_CurrentValue; }
 	uint64 GetLastSignaledValue() const { return m_LastSignaled; }
@@ -22,12 +24,15 @@ public:
 	inline ID3D12Fence* GetFence() const { return m_pFence.Get(); }
 
 private:
+	// Raises m_LastCompleted to the GPU's completed value. Safe to call from multiple threads.
+	uint64 UpdateLastCompleted();
+
 	RefCountPtr<ID3D12Fence> m_pFence;
 	std::mutex m_FenceWaitCS;
 	HANDLE m_CompleteEvent;
 	uint64 m_CurrentValue;
 	uint64 m_LastSignaled;
-	uint64 m_LastCompleted;
+	std::atomic<uint64> m_LastCompleted;
 };
 
 class SyncPoint
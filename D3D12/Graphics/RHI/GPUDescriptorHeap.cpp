@@ -36,7 +36,9 @@ GPUDescriptorHeap::GPUDescriptorHeap(GraphicsDevice* pParent, D3D12_DESCRIPTOR_H
 
 GPUDescriptorHeap::~GPUDescriptorHeap()
 {
-	CleanupPersistent();
+	// The GPU is idle by now. Descriptors freed after that are tagged with a fence value that is never signaled, so drain everything.
+	m_PersistentHandles.Recycle(~0ull);
+	check(m_PersistentHandles.GetNumAllocations() == 0, "Not all persistent GPU descriptors are freed.");
 
 	CleanupDynamic();
 	check(m_ReleasedDynamicPages.size() == 0, "Not all dynamic GPU descriptors are freed.");
@@ -45,21 +47,21 @@ GPUDescriptorHeap::~GPUDescriptorHeap()
 
 DescriptorHandle GPUDescriptorHeap::AllocatePersistent()
 {
-	std::lock_guard lock(m_AllocationLock);
-	if (!m_PersistentHandles.CanAllocate())
+	uint32 index = m_PersistentHandles.Allocate();
+	if (index == FencedFreeList::InvalidIndex)
 	{
-		CleanupPersistent();
+		m_PersistentHandles.Recycle(GetParent()->GetFrameFence()->GetLastCompletedValue());
+		index = m_PersistentHandles.Allocate();
 	}
 
-	check(m_PersistentHandles.CanAllocate(), "Out of persistent descriptor heap space (%d), increase heap size", m_NumPersistentDescriptors);
-	return m_StartHandle.Offset(m_PersistentHandles.Allocate(), m_DescriptorSize);
+	check(index != FencedFreeList::InvalidIndex, "Out of persistent descriptor heap space (%d), increase heap size", m_NumPersistentDescriptors);
+	return m_StartHandle.Offset(index, m_DescriptorSize);
 }
 
 void GPUDescriptorHeap::FreePersistent(uint32& heapIndex)
 {
 	check(heapIndex != DescriptorHandle::InvalidHeapIndex);
-	std::lock_guard lock(m_AllocationLock);
-	m_PersistentDeletionQueue.emplace(heapIndex, GetParent()->GetFrameFence()->GetCurrentValue());
+	m_PersistentHandles.Free(heapIndex, GetParent()->GetFrameFence()->GetCurrentValue());
 	heapIndex = DescriptorHandle::InvalidHeapIndex;
 }
 
@@ -98,19 +100,6 @@ void GPUDescriptorHeap::CleanupDynamic()
 	}
 }
 
-void GPUDescriptorHeap::CleanupPersistent()
-{
-	while (m_PersistentDeletionQueue.size())
-	{
-		const auto& f = m_PersistentDeletionQueue.front();
-		if (!GetParent()->GetFrameFence()->IsComplete(f.second))
-			break;
-
-		m_PersistentHandles.Free(f.first);
-		m_PersistentDeletionQueue.pop();
-	}
-}
-
 DynamicGPUDescriptorAllocator::DynamicGPUDescriptorAllocator(GPUDescriptorHeap* pGlobalHeap)
 	: GraphicsObject(pGlobalHeap->GetParent()), m_Type(pGlobalHeap->GetType()), m_pHeapAllocator(pGlobalHeap)
 {
@@ -37,7 +37,6 @@ public:
 	DescriptorHandle GetStartHandle() const { return m_StartHandle; }
 
 private:
-	void CleanupPersistent();
 	void CleanupDynamic();
 
 	RefCountPtr<ID3D12DescriptorHeap> m_pHeap;
@@ -52,10 +51,8 @@ private:
 	std::queue<DescriptorHeapPage*> m_ReleasedDynamicPages;
 	std::vector<DescriptorHeapPage*> m_FreeDynamicPages;
 
-	FreeList m_PersistentHandles;
+	FencedFreeList m_PersistentHandles;
 	uint32 m_NumPersistentDescriptors;
-	std::mutex m_AllocationLock;
-	std::queue<std::pair<uint32, uint64>> m_PersistentDeletionQueue;
 };
 
 class DynamicGPUDescriptorAllocator : public GraphicsObject
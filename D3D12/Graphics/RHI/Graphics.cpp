@@ -6,8 +6,10 @@
 #include "GraphicsResource.h"
 #include "RootSignature.h"
 #include "PipelineState.h"
+#include "PipelineCache.h"
 #include "Shader.h"
 #include "RingBufferAllocator.h"
+#include "StreamingUploader.h"
 #include "Texture.h"
 #include "ResourceViews.h"
 #include "Buffer.h"
@@ -15,11 +17,21 @@
 #include "pix3.h"
 #include "dxgidebug.h"
 #include "Core/Commandline.h"
+#include "Core/Paths.h"
+#include "Core/Profiler.h"
+#include "Core/Utils.h"
+#include "Core/ConsoleVariables.h"
 
 // Setup the Agility D3D12 SDK
 extern "C" { _declspec(dllexport) extern const UINT D3D12SDKVersion = D3D12_SDK_VERSION; }
 extern "C" { _declspec(dllexport) extern const char* D3D12SDKPath = ".\\D3D12\\"; }
 
+namespace Tweakables
+{
+	// Bytes of streamed buffer data copied per frame. Uploads over the budget wait for the next frames.
+	ConsoleVariable g_StreamingUploadBudget("r.Streaming.UploadBudgetMB", 64);
+}
+
 GraphicsDevice::DRED::DRED(GraphicsDevice* pDevice)
 {
 	auto OnDeviceRemovedCallback = [](void* pContext, BOOLEAN) {
@@ -423,6 +435,9 @@ GraphicsDevice::GraphicsDevice(GraphicsDeviceOptions options)
 	const uint64 uploadRingBufferSize							= 128 * Math::MegaBytesToBytes;
 	m_pRingBufferAllocator										= new RingBufferAllocator(this, uploadRingBufferSize);
 
+	const uint64 streamingPageSize								= 16 * Math::MegaBytesToBytes;
+	m_pStreamingUploader										= std::make_unique<StreamingUploader>(std::make_unique<CopyQueueUploadBackend>(this), streamingPageSize);
+
 	m_pGlobalViewHeap											= new GPUDescriptorHeap(this, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 128, 16384);
 	m_pGlobalSamplerHeap										= new GPUDescriptorHeap(this, D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER, 32, 2048);
 
@@ -436,12 +451,30 @@ GraphicsDevice::GraphicsDevice(GraphicsDeviceOptions options)
 	E_LOG(Info, "Shader Model %d.%d", smMaj, smMin);
 	m_pShaderManager = std::make_unique<ShaderManager>(smMaj, smMin);
 	m_pShaderManager->AddIncludeDir("Resources/Shaders/");
+
+	std::unique_ptr<IPipelineCacheBackend> pPipelineCacheBackend;
+	if (!CommandLine::GetBool("nopipelinecache"))
+	{
+		auto pLibraryBackend = std::make_unique<PipelineLibraryBackend>(m_pDevice, Sprintf("%sPipelines.cache", Paths::ShaderCacheDir().c_str()).c_str());
+		if (pLibraryBackend->IsValid())
+			pPipelineCacheBackend = std::move(pLibraryBackend);
+		else
+			E_LOG(Warning, "Pipeline libraries are not supported. Pipelines are not cached.");
+	}
+	if (!pPipelineCacheBackend)
+		pPipelineCacheBackend = std::make_unique<NullPipelineCacheBackend>();
+	m_pPipelineCache = std::make_unique<PipelineCache>(std::move(pPipelineCacheBackend), Sprintf("%sPipelines.index", Paths::ShaderCacheDir().c_str()).c_str());
 }
 
 GraphicsDevice::~GraphicsDevice()
 {
+	// Waits for the pending uploads and releases the staging pages before everything else goes
+	m_pStreamingUploader.reset();
+
 	IdleGPU();
 
+	m_pPipelineCache->Save();
+
 	// Disable break on validation before destroying to not make live-leak detection break each time.
 	RefCountPtr<ID3D12InfoQueue> pInfoQueue;
 	if (SUCCEEDED(m_pDevice->QueryInterface(IID_PPV_ARGS(pInfoQueue.GetAddressOf()))))
@@ -496,6 +529,9 @@ void GraphicsDevice::FreeCPUDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE type, D3D12_CP
 
 void GraphicsDevice::TickFrame()
 {
+	if (m_pStreamingUploader)
+		m_pStreamingUploader->Flush((uint64)Tweakables::g_StreamingUploadBudget.GetInt() * Math::MegaBytesToBytes);
+
 	m_DeleteQueue.Clean();
 	uint64 fenceValue = m_pFrameFence->Signal(GetCommandQueue(D3D12_COMMAND_LIST_TYPE_DIRECT));
 
@@ -894,6 +930,55 @@ RefCountPtr<PipelineState> GraphicsDevice::CreatePipeline(const PipelineStateIni
 	return pPSO;
 }
 
+void GraphicsDevice::PrecompilePipelines()
+{
+	PROFILE_CPU_SCOPE();
+
+	std::vector<PipelineState*> pipelines;
+	{
+		std::lock_guard lock(m_PipelinesLock);
+		for (PipelineState* pPipeline : m_Pipelines)
+		{
+			if (pPipeline->m_NeedsReload)
+				pipelines.push_back(pPipeline);
+		}
+	}
+
+	Utils::TimeScope timer;
+
+	// Compile the shaders of all pipelines in one batch from this thread first.
+	// Pipelines share shaders, so pipeline jobs compiling their own would wait on each other.
+	std::vector<ShaderRequest> shaderRequests;
+	for (PipelineState* pPipeline : pipelines)
+		pPipeline->GetShaderRequests(shaderRequests);
+	std::vector<Shader*> shaders;
+	m_pShaderManager->GetShaders(shaderRequests, shaders);
+
+	// The shaders are all compiled, so this only creates the pipelines
+	TaskContext context;
+	TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+		{
+			pipelines[args.JobIndex]->CreateInternal();
+		}, context, (uint32)pipelines.size(), 1);
+	TaskQueue::Join(context);
+	E_LOG(Info, "Precompiled %d pipelines in %.1f ms (%d from cache)", (uint32)pipelines.size(), timer.Stop() * 1000.0f, m_pPipelineCache->GetNumHits());
+
+	// Save right away, so the next session benefits even if this one doesn't exit cleanly
+	m_pPipelineCache->Save();
+}
+
+void GraphicsDevice::RegisterPipeline(PipelineState* pPipeline)
+{
+	std::lock_guard lock(m_PipelinesLock);
+	m_Pipelines.insert(pPipeline);
+}
+
+void GraphicsDevice::UnregisterPipeline(PipelineState* pPipeline)
+{
+	std::lock_guard lock(m_PipelinesLock);
+	m_Pipelines.erase(pPipeline);
+}
+
 RefCountPtr<StateObject> GraphicsDevice::CreateStateObject(const StateObjectInitializer& stateDesc)
 {
 	return new StateObject(this, stateDesc);
@@ -924,15 +1009,19 @@ RefCountPtr<ShaderResourceView> GraphicsDevice::CreateSRV(Buffer* pBuffer, const
 		{
 			srvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
 			srvDesc.Buffer.StructureByteStride = 0;
-			srvDesc.Buffer.FirstElement = desc.ElementOffset / 4;
+			check((desc.ElementOffset + pBuffer->GetOffset()) % 4 == 0, "Raw buffer view offset (%llu) is not 4-byte aligned", desc.ElementOffset + pBuffer->GetOffset());
+			srvDesc.Buffer.FirstElement = (desc.ElementOffset + pBuffer->GetOffset()) / 4;
 			srvDesc.Buffer.NumElements = desc.NumElements > 0 ? desc.NumElements / 4 : (uint32)(bufferDesc.Size / 4);
 			srvDesc.Buffer.Flags |= D3D12_BUFFER_SRV_FLAG_RAW;
 		}
 		else
 		{
+			// The element of a typed view is the format, not the structure
+			const uint32 elementStride = desc.Format == ResourceFormat::Unknown ? bufferDesc.ElementSize : RHI::GetFormatInfo(desc.Format).BytesPerBlock;
+			check(pBuffer->GetOffset() % elementStride == 0, "Buffer offset (%llu) is not a multiple of the element stride (%d)", pBuffer->GetOffset(), elementStride);
 			srvDesc.Format = D3D::ConvertFormat(desc.Format);
 			srvDesc.Buffer.StructureByteStride = desc.Format == ResourceFormat::Unknown ? bufferDesc.ElementSize : 0;
-			srvDesc.Buffer.FirstElement = desc.ElementOffset;
+			srvDesc.Buffer.FirstElement = desc.ElementOffset + pBuffer->GetOffset() / elementStride;
 			srvDesc.Buffer.NumElements = desc.NumElements > 0 ? desc.NumElements : bufferDesc.NumElements();
 		}
 
@@ -953,7 +1042,9 @@ RefCountPtr<UnorderedAccessView> GraphicsDevice::CreateUAV(Buffer* pBuffer, cons
 	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
 	uavDesc.Format = D3D::ConvertFormat(desc.Format);
 	uavDesc.Buffer.CounterOffsetInBytes = 0;
-	uavDesc.Buffer.FirstElement = 0;
+	const uint32 elementStride = desc.Raw ? 4 : desc.Format == ResourceFormat::Unknown ? bufferDesc.ElementSize : RHI::GetFormatInfo(desc.Format).BytesPerBlock;
+	check(pBuffer->GetOffset() % elementStride == 0, "Buffer offset (%llu) is not a multiple of the element stride (%d)", pBuffer->GetOffset(), elementStride);
+	uavDesc.Buffer.FirstElement = pBuffer->GetOffset() / elementStride;
 	uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 	uavDesc.Buffer.NumElements = bufferDesc.NumElements();
 	uavDesc.Buffer.StructureByteStride = 0;
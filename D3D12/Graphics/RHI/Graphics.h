@@ -9,11 +9,13 @@
 
 class ScratchAllocationManager;
 class ShaderManager;
+class PipelineCache;
 class GPUDescriptorHeap;
 class CPUDescriptorHeap;
 class SwapChain;
 class CommandSignatureInitializer;
 class RingBufferAllocator;
+class StreamingUploader;
 
 using WindowHandle = HWND;
 
@@ -158,6 +160,8 @@ public:
 	void DeferReleaseObject(ID3D12Object* pObject);
 
 	RefCountPtr<PipelineState> CreatePipeline(const PipelineStateInitializer& psoDesc);
+	// Creates all pipelines which are not created yet in parallel, and waits for them
+	void PrecompilePipelines();
 	RefCountPtr<PipelineState> CreateComputePipeline(RootSignature* pRootSignature, const char* pShaderPath, const char* entryPoint = "", const Span<ShaderDefine>& defines = {});
 	RefCountPtr<StateObject> CreateStateObject(const StateObjectInitializer& stateDesc);
 	RefCountPtr<ShaderResourceView> CreateSRV(Buffer* pBuffer, const BufferSRVDesc& desc);
@@ -175,15 +179,21 @@ public:
 	}
 
 	RingBufferAllocator* GetRingBuffer() const { return m_pRingBufferAllocator; }
+	StreamingUploader* GetStreamingUploader() const { return m_pStreamingUploader.get(); }
 	GPUDescriptorHeap* GetGlobalViewHeap() const { return m_pGlobalViewHeap; }
 	GPUDescriptorHeap* GetGlobalSamplerHeap() const { return m_pGlobalSamplerHeap; }
 	ID3D12Device5* GetDevice() const { return m_pDevice.Get(); }
 	ShaderManager* GetShaderManager() const { return m_pShaderManager.get(); }
+	PipelineCache* GetPipelineCache() const { return m_pPipelineCache.get(); }
 	const GraphicsCapabilities& GetCapabilities() const { return m_Capabilities; }
 	Fence* GetFrameFence() const { return m_pFrameFence; }
 	IDXGIFactory6* GetFactory() const { return m_pFactory; }
 
 private:
+	friend class PipelineState;
+	void RegisterPipeline(PipelineState* pPipeline);
+	void UnregisterPipeline(PipelineState* pPipeline);
+
 	struct LiveObjectReporter
 	{
 		~LiveObjectReporter();
@@ -241,11 +251,16 @@ private:
 	DeferredDeleteQueue m_DeleteQueue;
 
 	std::unique_ptr<ShaderManager> m_pShaderManager;
+	std::unique_ptr<PipelineCache> m_pPipelineCache;
 	std::array<RefCountPtr<CPUDescriptorHeap>, D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES> m_DescriptorHeaps;
 	RefCountPtr<ScratchAllocationManager> m_pScratchAllocationManager;
 	RefCountPtr<RingBufferAllocator> m_pRingBufferAllocator;
+	std::unique_ptr<StreamingUploader> m_pStreamingUploader;
 
 	std::vector<RefCountPtr<GraphicsObject>> m_GlobalResources;
 
 	std::mutex m_ContextAllocationMutex;
+
+	std::mutex m_PipelinesLock;
+	std::unordered_set<PipelineState*> m_Pipelines;
 };
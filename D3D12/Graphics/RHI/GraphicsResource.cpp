@@ -4,7 +4,7 @@
 #include "Graphics.h"
 
 GraphicsResource::GraphicsResource(GraphicsDevice* pParent, ID3D12Resource* pResource)
-	: GraphicsObject(pParent), m_pResource(pResource)
+	: GraphicsObject(pParent), m_pResource(pResource), m_TrackingHandle(ResourceStateTracker::AllocateHandle())
 {
 }
 
@@ -22,6 +22,7 @@ GraphicsResource::~GraphicsResource()
 		}
 		m_pResource = nullptr;
 	}
+	ResourceStateTracker::ReleaseHandle(m_TrackingHandle);
 }
 
 void GraphicsResource::SetName(const char* pName)
@@ -1,5 +1,6 @@
 #pragma once
 #include "RHI.h"
+#include "ResourceStateTracker.h"
 
 template<typename T>
 class RefCounted
@@ -40,8 +41,6 @@ private:
 	GraphicsDevice* m_pParent;
 };
 
-constexpr D3D12_RESOURCE_STATES D3D12_RESOURCE_STATE_UNKNOWN = (D3D12_RESOURCE_STATES)-1;
-
 class ResourceState
 {
 public:
@@ -120,9 +119,9 @@ public:
 	const char* GetName() const { return m_Name.c_str(); }
 
 	bool UseStateTracking() const { return m_NeedsStateTracking; }
+	ResourceTrackingHandle GetTrackingHandle() const { return m_TrackingHandle; }
 
 	inline ID3D12Resource* GetResource() const { return m_pResource; }
-	inline D3D12_GPU_VIRTUAL_ADDRESS GetGpuHandle() const { return m_pResource->GetGPUVirtualAddress(); }
 
 	void SetResourceState(D3D12_RESOURCE_STATES state, uint32 subResource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES) { m_ResourceState.Set(state, subResource); }
 	inline D3D12_RESOURCE_STATES GetResourceState(uint32 subResource = 0) const { return m_ResourceState.Get(subResource); }
@@ -134,4 +133,5 @@ protected:
 	void* m_pMappedData = nullptr;
 	ResourceState m_ResourceState;
 	bool m_NeedsStateTracking = false;
+	ResourceTrackingHandle m_TrackingHandle;
 };
@@ -0,0 +1,260 @@
+#include "stdafx.h"
+#include "PipelineCache.h"
+#include "D3D.h"
+#include "Core/Paths.h"
+#include "Core/Profiler.h"
+
+namespace
+{
+	constexpr uint32 IndexMagic = 0x58444950; // "PIDX"
+	constexpr uint32 IndexVersion = 1;
+
+	struct IndexHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumEntries;
+	};
+
+	struct IndexEntry
+	{
+		Hash128 Identity;
+		Hash128 Key;
+	};
+
+	std::wstring GetPipelineName(const Hash128& key)
+	{
+		return MULTIBYTE_TO_UNICODE(Sprintf("%016llx%016llx", key.High, key.Low).c_str());
+	}
+
+	bool WriteFile(const std::string& path, const void* pData, size_t size)
+	{
+		// Write to a temporary file first so a failed write doesn't leave a broken file behind
+		std::string tempPath = path + ".tmp";
+		FILE* pFile = nullptr;
+		if (fopen_s(&pFile, tempPath.c_str(), "wb") != 0)
+			return false;
+		bool success = fwrite(pData, size, 1, pFile) == 1;
+		fclose(pFile);
+		return success && ::MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+	}
+}
+
+PipelineLibraryBackend::PipelineLibraryBackend(ID3D12Device2* pDevice, const char* pFilePath)
+	: m_pDevice(pDevice), m_FilePath(pFilePath)
+{
+	PROFILE_CPU_SCOPE();
+
+	FILE* pFile = nullptr;
+	if (fopen_s(&pFile, pFilePath, "rb") == 0)
+	{
+		fseek(pFile, 0, SEEK_END);
+		m_LibraryData.resize(ftell(pFile));
+		fseek(pFile, 0, SEEK_SET);
+		if (!m_LibraryData.empty() && fread(m_LibraryData.data(), m_LibraryData.size(), 1, pFile) != 1)
+			m_LibraryData.clear();
+		fclose(pFile);
+	}
+
+	if (!m_LibraryData.empty())
+	{
+		HRESULT hr = m_pDevice->CreatePipelineLibrary(m_LibraryData.data(), m_LibraryData.size(), IID_PPV_ARGS(m_pLibrary.GetAddressOf()));
+		if (SUCCEEDED(hr))
+		{
+			E_LOG(Info, "Loaded pipeline library '%s' (%.1f MB)", pFilePath, (float)m_LibraryData.size() / (1 << 20));
+			return;
+		}
+
+		// The library was created by another driver or adapter, or the file is corrupt. Start over.
+		if (hr == D3D12_ERROR_DRIVER_VERSION_MISMATCH || hr == D3D12_ERROR_ADAPTER_NOT_FOUND)
+			E_LOG(Info, "Pipeline library '%s' was created by a different driver or adapter", pFilePath);
+		else
+			E_LOG(Warning, "Failed to load pipeline library '%s' (%s)", pFilePath, D3D::GetErrorString(hr, nullptr).c_str());
+	}
+
+	Clear();
+}
+
+RefCountPtr<ID3D12PipelineState> PipelineLibraryBackend::Load(const Hash128& key, const D3D12_PIPELINE_STATE_STREAM_DESC& desc)
+{
+	if (!m_pLibrary)
+		return nullptr;
+
+	// Fails with E_INVALIDARG if there is no pipeline with this name or the description doesn't match
+	RefCountPtr<ID3D12PipelineState> pPipeline;
+	if (FAILED(m_pLibrary->LoadPipeline(GetPipelineName(key).c_str(), &desc, IID_PPV_ARGS(pPipeline.GetAddressOf()))))
+		return nullptr;
+	return pPipeline;
+}
+
+bool PipelineLibraryBackend::Store(const Hash128& key, ID3D12PipelineState* pPipeline)
+{
+	if (!m_pLibrary)
+		return false;
+	return SUCCEEDED(m_pLibrary->StorePipeline(GetPipelineName(key).c_str(), pPipeline));
+}
+
+void PipelineLibraryBackend::Clear()
+{
+	// The library must be released before the data it was created from
+	m_pLibrary.Reset();
+	m_LibraryData.clear();
+	m_LibraryData.shrink_to_fit();
+	if (FAILED(m_pDevice->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(m_pLibrary.GetAddressOf()))))
+		m_pLibrary.Reset();
+}
+
+bool PipelineLibraryBackend::Save()
+{
+	PROFILE_CPU_SCOPE();
+
+	if (!m_pLibrary)
+		return false;
+
+	std::vector<char> data(m_pLibrary->GetSerializedSize());
+	if (FAILED(m_pLibrary->Serialize(data.data(), data.size())))
+		return false;
+
+	Paths::CreateDirectoryTree(m_FilePath);
+	if (!WriteFile(m_FilePath, data.data(), data.size()))
+	{
+		E_LOG(Warning, "Failed to write pipeline library '%s'", m_FilePath.c_str());
+		return false;
+	}
+	return true;
+}
+
+PipelineCache::PipelineCache(std::unique_ptr<IPipelineCacheBackend>&& pBackend, const char* pIndexPath)
+	: m_pBackend(std::move(pBackend)), m_IndexPath(pIndexPath)
+{
+	if (!LoadIndex())
+	{
+		// Without an index, the backend can't be trusted to have only current entries
+		m_Index.clear();
+		m_pBackend->Clear();
+	}
+}
+
+Hash128 PipelineCache::ComputeKey(const Hash128& identity, Span<Hash128> shaderHashes)
+{
+	std::vector<Hash128> keyData = { identity };
+	keyData.insert(keyData.end(), shaderHashes.begin(), shaderHashes.end());
+	return Hash::Murmur3_128(keyData.data(), keyData.size() * sizeof(Hash128));
+}
+
+RefCountPtr<ID3D12PipelineState> PipelineCache::Load(const Hash128& identity, const Hash128& key, const D3D12_PIPELINE_STATE_STREAM_DESC& desc)
+{
+	std::lock_guard lock(m_Lock);
+
+	auto it = m_Index.find(identity);
+	if (it == m_Index.end() || it->second != key)
+	{
+		++m_NumMisses;
+		return nullptr;
+	}
+
+	RefCountPtr<ID3D12PipelineState> pPipeline = m_pBackend->Load(key, desc);
+	if (!pPipeline)
+	{
+		++m_NumMisses;
+		return nullptr;
+	}
+
+	++m_NumHits;
+	m_SessionPipelines[identity] = SessionPipeline{ key, pPipeline };
+	return pPipeline;
+}
+
+void PipelineCache::Store(const Hash128& identity, const Hash128& key, ID3D12PipelineState* pPipeline)
+{
+	std::lock_guard lock(m_Lock);
+	SetCurrentKey(identity, key, pPipeline);
+	if (!m_HasStaleEntries)
+		m_pBackend->Store(key, pPipeline);
+}
+
+void PipelineCache::SetCurrentKey(const Hash128& identity, const Hash128& key, ID3D12PipelineState* pPipeline)
+{
+	auto it = m_Index.find(identity);
+	if (it != m_Index.end() && it->second != key)
+		m_HasStaleEntries = true;
+	m_Index[identity] = key;
+	m_SessionPipelines[identity] = SessionPipeline{ key, pPipeline };
+	m_IsDirty = true;
+}
+
+void PipelineCache::Save()
+{
+	PROFILE_CPU_SCOPE();
+
+	std::lock_guard lock(m_Lock);
+	if (!m_IsDirty)
+		return;
+
+	if (m_HasStaleEntries)
+	{
+		// Rebuild the backend with only the pipelines of this session
+		m_pBackend->Clear();
+		m_Index.clear();
+		for (const auto& pipeline : m_SessionPipelines)
+		{
+			if (m_pBackend->Store(pipeline.second.Key, pipeline.second.pPipeline))
+				m_Index[pipeline.first] = pipeline.second.Key;
+		}
+		m_HasStaleEntries = false;
+	}
+
+	// The index is only written when the backend is, so it never refers to pipelines that aren't there
+	if (m_pBackend->Save() && SaveIndex())
+	{
+		m_IsDirty = false;
+		E_LOG(Info, "Saved pipeline cache: %d pipelines (%d hits, %d misses)", (uint32)m_Index.size(), m_NumHits, m_NumMisses);
+	}
+}
+
+bool PipelineCache::IsCurrentKey(const Hash128& identity, const Hash128& key)
+{
+	std::lock_guard lock(m_Lock);
+	auto it = m_Index.find(identity);
+	return it != m_Index.end() && it->second == key;
+}
+
+bool PipelineCache::LoadIndex()
+{
+	FILE* pFile = nullptr;
+	if (fopen_s(&pFile, m_IndexPath.c_str(), "rb") != 0)
+		return false;
+
+	IndexHeader header;
+	bool isValid = fread(&header, sizeof(IndexHeader), 1, pFile) == 1 && header.Magic == IndexMagic && header.Version == IndexVersion;
+	if (isValid)
+	{
+		std::vector<IndexEntry> entries(header.NumEntries);
+		isValid = entries.empty() || fread(entries.data(), sizeof(IndexEntry), entries.size(), pFile) == entries.size();
+		if (isValid)
+		{
+			for (const IndexEntry& entry : entries)
+				m_Index[entry.Identity] = entry.Key;
+		}
+	}
+	fclose(pFile);
+	return isValid;
+}
+
+bool PipelineCache::SaveIndex()
+{
+	std::vector<char> data(sizeof(IndexHeader) + m_Index.size() * sizeof(IndexEntry));
+	IndexHeader* pHeader = (IndexHeader*)data.data();
+	*pHeader = IndexHeader{ IndexMagic, IndexVersion, (uint32)m_Index.size() };
+	IndexEntry* pEntry = (IndexEntry*)(pHeader + 1);
+	for (const auto& entry : m_Index)
+		*pEntry++ = IndexEntry{ entry.first, entry.second };
+
+	Paths::CreateDirectoryTree(m_IndexPath);
+	if (!WriteFile(m_IndexPath, data.data(), data.size()))
+	{
+		E_LOG(Warning, "Failed to write pipeline cache index '%s'", m_IndexPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "Core/Hash.h"
+
+// Storage of the pipelines created by the driver
+class IPipelineCacheBackend
+{
+public:
+	virtual ~IPipelineCacheBackend() = default;
+
+	// Returns nullptr if no pipeline is stored with 'key'
+	virtual RefCountPtr<ID3D12PipelineState> Load(const Hash128& key, const D3D12_PIPELINE_STATE_STREAM_DESC& desc) = 0;
+	virtual bool Store(const Hash128& key, ID3D12PipelineState* pPipeline) = 0;
+	// Removes all stored pipelines
+	virtual void Clear() = 0;
+	virtual bool Save() = 0;
+};
+
+// Stores nothing. Used when pipeline libraries are not supported or disabled.
+class NullPipelineCacheBackend final : public IPipelineCacheBackend
+{
+public:
+	RefCountPtr<ID3D12PipelineState> Load(const Hash128& /*key*/, const D3D12_PIPELINE_STATE_STREAM_DESC& /*desc*/) override { return nullptr; }
+	bool Store(const Hash128& /*key*/, ID3D12PipelineState* /*pPipeline*/) override { return true; }
+	void Clear() override {}
+	bool Save() override { return true; }
+};
+
+// Stores the pipelines in an ID3D12PipelineLibrary, serialized to a file
+class PipelineLibraryBackend final : public IPipelineCacheBackend
+{
+public:
+	PipelineLibraryBackend(ID3D12Device2* pDevice, const char* pFilePath);
+
+	bool IsValid() const { return m_pLibrary != nullptr; }
+
+	RefCountPtr<ID3D12PipelineState> Load(const Hash128& key, const D3D12_PIPELINE_STATE_STREAM_DESC& desc) override;
+	bool Store(const Hash128& key, ID3D12PipelineState* pPipeline) override;
+	void Clear() override;
+	bool Save() override;
+
+private:
+	RefCountPtr<ID3D12Device2> m_pDevice;
+	RefCountPtr<ID3D12PipelineLibrary1> m_pLibrary;
+	// The library references the data it was created from until it is released
+	std::vector<char> m_LibraryData;
+	std::string m_FilePath;
+};
+
+/*
+	Persistent cache of pipelines, so the driver doesn't compile them again in the next session.
+
+	- A pipeline has an identity: its description with the shader permutations, but without the shader byte code.
+	- Its key is the identity combined with the hashes of its shaders.
+	- The index stores the current key of each identity. When a pipeline is stored with a new key, the entry of the
+	  previous key is stale.
+	- Entries can't be removed from a pipeline library. When there are stale entries, the backend is cleared and
+	  only the pipelines of this session are stored again on Save().
+*/
+class PipelineCache
+{
+public:
+	PipelineCache(std::unique_ptr<IPipelineCacheBackend>&& pBackend, const char* pIndexPath);
+
+	// The key changes when any of the shaders is recompiled
+	static Hash128 ComputeKey(const Hash128& identity, Span<Hash128> shaderHashes);
+
+	RefCountPtr<ID3D12PipelineState> Load(const Hash128& identity, const Hash128& key, const D3D12_PIPELINE_STATE_STREAM_DESC& desc);
+	void Store(const Hash128& identity, const Hash128& key, ID3D12PipelineState* pPipeline);
+
+	// Writes the index and the backend, if anything changed
+	void Save();
+
+	// Returns true if the index has 'key' as the current key of 'identity'
+	bool IsCurrentKey(const Hash128& identity, const Hash128& key);
+
+	uint32 GetNumHits() const { return m_NumHits; }
+	uint32 GetNumMisses() const { return m_NumMisses; }
+
+private:
+	void SetCurrentKey(const Hash128& identity, const Hash128& key, ID3D12PipelineState* pPipeline);
+	bool LoadIndex();
+	bool SaveIndex();
+
+	struct SessionPipeline
+	{
+		Hash128 Key;
+		RefCountPtr<ID3D12PipelineState> pPipeline;
+	};
+
+	std::mutex m_Lock;
+	std::unique_ptr<IPipelineCacheBackend> m_pBackend;
+	std::string m_IndexPath;
+	// Identity -> Key
+	std::unordered_map<Hash128, Hash128> m_Index;
+	// Identity -> Pipeline used in this session
+	std::unordered_map<Hash128, SessionPipeline> m_SessionPipelines;
+	bool m_HasStaleEntries = false;
+	bool m_IsDirty = false;
+	uint32 m_NumHits = 0;
+	uint32 m_NumMisses = 0;
+};
@@ -3,6 +3,14 @@
 #include "Shader.h"
 #include "Graphics.h"
 #include "RootSignature.h"
+#include "PipelineCache.h"
+#include "Core/ConsoleVariables.h"
+
+namespace Tweakables
+{
+	// Create pipelines on the TaskQueue instead of on first use. Passes skip draws until their pipeline or its fallback is ready.
+	ConsoleVariable g_AsyncPipelineCreation("r.AsyncPipelineCreation", true);
+}
 
 PipelineStateInitializer::PipelineStateInitializer()
 {
@@ -219,6 +227,7 @@ void PipelineStateInitializer::SetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY_TYP
 void PipelineStateInitializer::SetRootSignature(RootSignature* pRootSignature)
 {
 	m_Stream.pRootSignature = pRootSignature->GetRootSignature();
+	m_RootSignatureHash = pRootSignature->GetHash();
 }
 
 void PipelineStateInitializer::SetVertexShader(const char* pShaderPath, const char* entryPoint, const Span<ShaderDefine>& defines)
@@ -246,24 +255,119 @@ void PipelineStateInitializer::SetAmplificationShader(const char* pShaderPath, c
 	m_ShaderDescs[(int)ShaderType::Amplification] = { pShaderPath, entryPoint, defines.Copy() };
 }
 
+Hash128 PipelineStateInitializer::ComputeIdentity()
+{
+	// Structs with padding are hashed per member. Pointers are replaced by what they point to.
+	std::vector<char> data;
+	auto Add = [&data](const auto& value)
+	{
+		static_assert(std::is_trivially_copyable_v<std::remove_reference_t<decltype(value)>>);
+		data.insert(data.end(), (const char*)&value, (const char*)&value + sizeof(value));
+	};
+	auto AddString = [&](const std::string& value)
+	{
+		Add((uint32)value.length());
+		data.insert(data.end(), value.begin(), value.end());
+	};
+
+	Add((D3D12_RT_FORMAT_ARRAY&)m_Stream.RTFormats);
+	Add((DXGI_FORMAT&)m_Stream.DSVFormat);
+
+	const D3D12_DEPTH_STENCIL_DESC1& depthStencil = m_Stream.DepthStencil;
+	Add(depthStencil.DepthEnable);
+	Add(depthStencil.DepthWriteMask);
+	Add(depthStencil.DepthFunc);
+	Add(depthStencil.StencilEnable);
+	Add(depthStencil.StencilReadMask);
+	Add(depthStencil.StencilWriteMask);
+	Add(depthStencil.FrontFace);
+	Add(depthStencil.BackFace);
+	Add(depthStencil.DepthBoundsTestEnable);
+
+	Add((D3D12_RASTERIZER_DESC&)m_Stream.Rasterizer);
+
+	const D3D12_BLEND_DESC& blend = m_Stream.Blend;
+	Add(blend.AlphaToCoverageEnable);
+	Add(blend.IndependentBlendEnable);
+	for (const D3D12_RENDER_TARGET_BLEND_DESC& rt : blend.RenderTarget)
+	{
+		Add(rt.BlendEnable);
+		Add(rt.LogicOpEnable);
+		Add(rt.SrcBlend);
+		Add(rt.DestBlend);
+		Add(rt.BlendOp);
+		Add(rt.SrcBlendAlpha);
+		Add(rt.DestBlendAlpha);
+		Add(rt.BlendOpAlpha);
+		Add(rt.LogicOp);
+		Add(rt.RenderTargetWriteMask);
+	}
+
+	Add((D3D12_PRIMITIVE_TOPOLOGY_TYPE&)m_Stream.PrimitiveTopology);
+	Add((UINT&)m_Stream.SampleMask);
+	Add((DXGI_SAMPLE_DESC&)m_Stream.SampleDesc);
+	Add((D3D12_INDEX_BUFFER_STRIP_CUT_VALUE&)m_Stream.StripCutValue);
+	Add((D3D12_PIPELINE_STATE_FLAGS&)m_Stream.Flags);
+	Add((UINT&)m_Stream.NodeMask);
+	// Stream output is not used
+	check(((D3D12_STREAM_OUTPUT_DESC&)m_Stream.StreamOutput).NumEntries == 0);
+
+	Add((uint32)m_IlDesc.size());
+	for (const D3D12_INPUT_ELEMENT_DESC& element : m_IlDesc)
+	{
+		AddString(element.SemanticName);
+		Add(element.SemanticIndex);
+		Add(element.Format);
+		Add(element.InputSlot);
+		Add(element.AlignedByteOffset);
+		Add(element.InputSlotClass);
+		Add(element.InstanceDataStepRate);
+	}
+
+	Add(m_RootSignatureHash);
+
+	for (const ShaderDesc& shader : m_ShaderDescs)
+	{
+		AddString(shader.Path);
+		AddString(shader.EntryPoint);
+		Add((uint32)shader.Defines.size());
+		for (const ShaderDefine& define : shader.Defines)
+			AddString(define.Value);
+	}
+
+	return Hash::Murmur3_128(data.data(), data.size());
+}
+
 PipelineState::PipelineState(GraphicsDevice* pParent, const PipelineStateInitializer& initializer)
 	: GraphicsObject(pParent), m_Desc(initializer)
 {
 	m_ReloadHandle = pParent->GetShaderManager()->OnShaderEditedEvent().AddRaw(this, &PipelineState::OnShaderReloaded);
+	pParent->RegisterPipeline(this);
 }
 
 PipelineState::~PipelineState()
 {
+	TaskQueue::Join(m_CreateTask);
+	GetParent()->UnregisterPipeline(this);
 	GetParent()->GetShaderManager()->OnShaderEditedEvent().Remove(m_ReloadHandle);
 	GetParent()->DeferReleaseObject(m_pPipelineState.Detach());
 }
 
+ID3D12PipelineState* PipelineState::GetPipelineState() const
+{
+	std::lock_guard lock(m_PipelineStateLock);
+	return m_pPipelineState;
+}
+
 void PipelineState::CreateInternal()
 {
 	std::lock_guard lock(m_BuildLock);
 	if (!m_NeedsReload)
 		return;
 
+	// Cleared before getting the shaders, so a shader reloaded meanwhile creates the pipeline again
+	m_NeedsReload = false;
+
 	if (m_Desc.m_IlDesc.size() > 0)
 	{
 		D3D12_INPUT_LAYOUT_DESC& ilDesc = m_Desc.m_Stream.InputLayout;
@@ -286,58 +390,138 @@ void PipelineState::CreateInternal()
 		}
 	};
 
+	// Compile all stages together
+	ShaderManager* pShaderManager = GetParent()->GetShaderManager();
+	std::vector<ShaderRequest> shaderRequests;
+	GetShaderRequests(shaderRequests);
+	std::vector<Shader*> shaders;
+	pShaderManager->GetShaders(shaderRequests, shaders);
+
+	// This can run on the TaskQueue while a hot reload replaces the byte code, so the blobs are referenced until the pipeline is created
+	std::array<Shader*, (int)ShaderType::MAX> pipelineShaders{};
+	std::vector<ShaderBlob> byteCodes;
+	std::vector<Hash128> shaderHashes;
 	bool shaderCompileError = false;
 	std::string name = m_Desc.m_Name;
+	uint32 shaderIndex = 0;
 	for (uint32 i = 0; i < (int)ShaderType::MAX; ++i)
 	{
 		Shader* pShader = nullptr;
 		const PipelineStateInitializer::ShaderDesc& desc = m_Desc.m_ShaderDescs[i];
 		if (desc.Path.length() > 0)
 		{
-			pShader = GetParent()->GetShaderManager()->GetShader(desc.Path.c_str(), (ShaderType)i, desc.EntryPoint.c_str(), desc.Defines);
+			pShader = shaders[shaderIndex++];
 			if (!pShader)
 			{
 				shaderCompileError = true;
 			}
 			else
 			{
-				GetByteCode((ShaderType)i) = CD3DX12_SHADER_BYTECODE(pShader->pByteCode->GetBufferPointer(), pShader->pByteCode->GetBufferSize());
+				ShaderManager::ByteCode byteCode = pShaderManager->GetByteCode(pShader);
+				GetByteCode((ShaderType)i) = CD3DX12_SHADER_BYTECODE(byteCode.pBlob->GetBufferPointer(), byteCode.pBlob->GetBufferSize());
+				byteCodes.push_back(byteCode.pBlob);
+				shaderHashes.push_back(byteCode.Hash);
 				if (name.empty())
 					name = Sprintf("%s (Unnamed)", pShader->EntryPoint.c_str());
-				m_Shaders[i] = pShader;
+				pipelineShaders[i] = pShader;
 			}
 		}
 	}
 
+	{
+		// Read by OnShaderReloaded on the main thread
+		std::lock_guard shadersLock(m_ShadersLock);
+		for (uint32 i = 0; i < (int)ShaderType::MAX; ++i)
+		{
+			if (pipelineShaders[i])
+				m_Shaders[i] = pipelineShaders[i];
+		}
+	}
+
 	if (!shaderCompileError)
 	{
-		GetParent()->DeferReleaseObject(m_pPipelineState.Detach());
 		D3D12_PIPELINE_STATE_STREAM_DESC streamDesc;
 		streamDesc.SizeInBytes = sizeof(m_Desc.m_Stream);
 		streamDesc.pPipelineStateSubobjectStream = &m_Desc.m_Stream;
-		VERIFY_HR_EX(GetParent()->GetDevice()->CreatePipelineState(&streamDesc, IID_PPV_ARGS(m_pPipelineState.ReleaseAndGetAddressOf())), GetParent()->GetDevice());
-		D3D::SetObjectName(m_pPipelineState.Get(), name.c_str());
+
+		const Hash128 identity = m_Desc.ComputeIdentity();
+		const Hash128 key = PipelineCache::ComputeKey(identity, shaderHashes);
+
+		PipelineCache* pCache = GetParent()->GetPipelineCache();
+		RefCountPtr<ID3D12PipelineState> pPipelineState = pCache->Load(identity, key, streamDesc);
+		if (!pPipelineState)
+		{
+			VERIFY_HR_EX(GetParent()->GetDevice()->CreatePipelineState(&streamDesc, IID_PPV_ARGS(pPipelineState.GetAddressOf())), GetParent()->GetDevice());
+			pCache->Store(identity, key, pPipelineState);
+		}
+		D3D::SetObjectName(pPipelineState.Get(), name.c_str());
+
+		// The previous pipeline may still be in use by the GPU or a command list being recorded
+		std::lock_guard pipelineLock(m_PipelineStateLock);
+		GetParent()->DeferReleaseObject(m_pPipelineState.Detach());
+		m_pPipelineState = pPipelineState;
 	}
 	else
 	{
-		E_LOG(Warning, "Failed to compile PipelineState '%s'", m_Desc.m_Name);
+		E_LOG(Warning, "Failed to compile PipelineState '%s'", m_Desc.m_Name.c_str());
 	}
-	check(m_pPipelineState);
+	check(GetPipelineState());
 	E_LOG(Info, "Compiled Pipeline: %s", m_Desc.m_Name.c_str());
-	m_NeedsReload = false;
+}
+
+void PipelineState::GetShaderRequests(std::vector<ShaderRequest>& outRequests) const
+{
+	for (uint32 i = 0; i < (int)ShaderType::MAX; ++i)
+	{
+		const PipelineStateInitializer::ShaderDesc& desc = m_Desc.m_ShaderDescs[i];
+		if (desc.Path.length() > 0)
+			outRequests.push_back(ShaderRequest{ desc.Path, (ShaderType)i, desc.EntryPoint, desc.Defines });
+	}
+}
+
+bool PipelineState::WarnSkippedWork()
+{
+	return !m_HasWarnedSkippedWork.exchange(true);
 }
 
 void PipelineState::ConditionallyReload()
 {
-	if (m_NeedsReload || !m_pPipelineState)
+	if (m_NeedsReload || !IsReady())
+	{
+		if (Tweakables::g_AsyncPipelineCreation)
+			CreateAsync();
+		else
+			CreateInternal();
+	}
+}
+
+void PipelineState::CreateAsync()
+{
+	if (!m_NeedsReload || IsCompiling())
+		return;
+	TaskQueue::Execute([this](int)
+		{
+			CreateInternal();
+		}, m_CreateTask);
+}
+
+PipelineState* PipelineState::GetReadyPipeline()
+{
+	if (IsReady())
+		return this;
+	if (m_pFallback)
 	{
-		CreateInternal();
+		m_pFallback->ConditionallyReload();
+		if (m_pFallback->IsReady())
+			return m_pFallback;
 	}
+	return nullptr;
 }
 
 void PipelineState::OnShaderReloaded(Shader* pShader)
 {
-	for (Shader*& pCurrentShader : m_Shaders)
+	std::lock_guard lock(m_ShadersLock);
+	for (const Shader* pCurrentShader : m_Shaders)
 	{
 		if (pCurrentShader && pCurrentShader == pShader)
 		{
@@ -73,6 +73,9 @@ public:
 	void SetAmplificationShader(const char* pShaderPath, const char* entryPoint = "", const Span<ShaderDefine>& defines = {});
 
 private:
+	// Hash of everything describing the pipeline, except the shader byte code
+	Hash128 ComputeIdentity();
+
 #pragma warning(push)
 	#pragma warning(disable : 4324)
 	template<D3D12_PIPELINE_STATE_SUBOBJECT_TYPE SubObjectType, typename T>
@@ -115,6 +118,7 @@ private:
 	} m_Stream;
 
 	std::string m_Name;
+	Hash128 m_RootSignatureHash;
 	std::vector<D3D12_INPUT_ELEMENT_DESC> m_IlDesc;
 	std::array<ShaderDesc, (int)ShaderType::MAX> m_ShaderDescs{};
 };
@@ -126,19 +130,50 @@ public:
 	PipelineState(const PipelineState& rhs) = delete;
 	PipelineState& operator=(const PipelineState& rhs) = delete;
 	~PipelineState();
-	ID3D12PipelineState* GetPipelineState() const { return m_pPipelineState; }
+	ID3D12PipelineState* GetPipelineState() const;
+
+	// Creates the pipeline if it needs to be (re)created.
+	// With async pipeline creation enabled, this starts a task and returns right away.
 	void ConditionallyReload();
 
+	// Starts creating the pipeline on the TaskQueue if it needs to be (re)created
+	void CreateAsync();
+
+	// True if the pipeline can be bound.
+	// While a reloaded pipeline is created, the previous one stays ready.
+	bool IsReady() const { return GetPipelineState() != nullptr; }
+	bool IsCompiling() const { return m_CreateTask.load() > 0; }
+
+	// Pipeline bound instead of this one while it is not ready
+	void SetFallback(PipelineState* pFallback) { m_pFallback = pFallback; }
+	PipelineState* GetFallback() const { return m_pFallback; }
+
+	// Returns the pipeline to bind: this one if it is ready, else its fallback if that is ready, else nullptr
+	PipelineState* GetReadyPipeline();
+
+	// Appends the shaders of all stages
+	void GetShaderRequests(std::vector<ShaderRequest>& outRequests) const;
+
+	// True the first time work is skipped because neither the pipeline nor a fallback is ready
+	bool WarnSkippedWork();
+	const std::string& GetName() const { return m_Desc.m_Name; }
+
 private:
 	friend class GraphicsDevice;
 
 	void CreateInternal();
 	void OnShaderReloaded(Shader* pShader);
 	RefCountPtr<ID3D12PipelineState> m_pPipelineState;
+	mutable std::mutex m_PipelineStateLock;
 
+	// Written when the pipeline is created, possibly on the TaskQueue. Read on shader reload.
+	std::mutex m_ShadersLock;
 	std::array<Shader*, (int)ShaderType::MAX> m_Shaders{};
 	PipelineStateInitializer m_Desc;
 	DelegateHandle m_ReloadHandle;
 	std::mutex m_BuildLock;
-	bool m_NeedsReload = true;
+	std::atomic<bool> m_NeedsReload = true;
+	TaskContext m_CreateTask = 0;
+	RefCountPtr<PipelineState> m_pFallback;
+	std::atomic<bool> m_HasWarnedSkippedWork = false;
 };
@@ -141,3 +141,86 @@ namespace RHI
 		return size;
 	}
 }
+
+FencedFreeList::FencedFreeList(uint32 size)
+	: m_Size(size), m_Next(std::make_unique<std::atomic<uint32>[]>(size)), m_FreeFenceValues(std::make_unique<uint64[]>(size)),
+	m_FreeHead(size > 0 ? 0 : InvalidIndex), m_PendingHead(InvalidIndex), m_NumAllocations(0)
+{
+	for (uint32 i = 0; i < size; ++i)
+		m_Next[i].store(i + 1 < size ? i + 1 : InvalidIndex, std::memory_order_relaxed);
+}
+
+uint32 FencedFreeList::Allocate()
+{
+	uint64 head = m_FreeHead.load(std::memory_order_acquire);
+	while (true)
+	{
+		const uint32 index = (uint32)head;
+		if (index == InvalidIndex)
+			return InvalidIndex;
+
+		// 'next' may be stale if another thread popped 'index' meanwhile. The tag makes the exchange fail in that case.
+		const uint32 next = m_Next[index].load(std::memory_order_relaxed);
+		const uint64 newHead = (((head >> 32) + 1) << 32) | next;
+		if (m_FreeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			m_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+			return index;
+		}
+	}
+}
+
+void FencedFreeList::Free(uint32 index, uint64 fenceValue)
+{
+	check(index < m_Size);
+	m_FreeFenceValues[index] = fenceValue;
+
+	uint32 head = m_PendingHead.load(std::memory_order_relaxed);
+	do
+	{
+		m_Next[index].store(head, std::memory_order_relaxed);
+	} while (!m_PendingHead.compare_exchange_weak(head, index, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint32 FencedFreeList::Recycle(uint64 completedFenceValue)
+{
+	std::lock_guard lock(m_RecycleLock);
+
+	// The pending stack is only ever emptied as a whole, so it doesn't suffer from ABA
+	uint32 index = m_PendingHead.exchange(InvalidIndex, std::memory_order_acquire);
+	while (index != InvalidIndex)
+	{
+		m_WaitingIndices.push_back(index);
+		index = m_Next[index].load(std::memory_order_relaxed);
+	}
+
+	uint32 numRecycled = 0;
+	for (size_t i = 0; i < m_WaitingIndices.size();)
+	{
+		const uint32 waitingIndex = m_WaitingIndices[i];
+		if (m_FreeFenceValues[waitingIndex] <= completedFenceValue)
+		{
+			PushFree(waitingIndex);
+			m_WaitingIndices[i] = m_WaitingIndices.back();
+			m_WaitingIndices.pop_back();
+			++numRecycled;
+		}
+		else
+		{
+			++i;
+		}
+	}
+	m_NumAllocations.fetch_sub(numRecycled, std::memory_order_relaxed);
+	return numRecycled;
+}
+
+void FencedFreeList::PushFree(uint32 index)
+{
+	uint64 head = m_FreeHead.load(std::memory_order_relaxed);
+	uint64 newHead;
+	do
+	{
+		m_Next[index].store((uint32)head, std::memory_order_relaxed);
+		newHead = (((head >> 32) + 1) << 32) | index;
+	} while (!m_FreeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
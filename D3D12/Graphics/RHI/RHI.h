@@ -155,3 +155,48 @@ private:
 	std::vector<uint32> m_FreeList;
 	std::atomic<uint32> m_NumAllocations;
 };
+
+/*
+	Lock-free free list of indices. Freed indices are only recycled once the GPU completed a fence value.
+
+	- Free indices are on a lock-free stack. The head is tagged with a counter, so a head which was popped and pushed again
+	  between a read and a compare-exchange is detected (ABA).
+	- Freed indices are pushed on a second lock-free stack with the fence value they were freed at.
+	  Recycle() takes them all at once and moves those whose fence value completed to the free stack.
+	- Allocate() and Free() never lock. Recycle() locks, but only runs when the free stack is empty.
+*/
+class FencedFreeList
+{
+public:
+	static constexpr uint32 InvalidIndex = 0xFFFFFFFF;
+
+	FencedFreeList(uint32 size);
+
+	// Returns InvalidIndex if there are no free indices. Recycle() may free some.
+	uint32 Allocate();
+	// The index can be allocated again once 'fenceValue' completed
+	void Free(uint32 index, uint64 fenceValue);
+	// Makes the indices freed with a fence value up to 'completedFenceValue' available. Returns the number of recycled indices.
+	uint32 Recycle(uint64 completedFenceValue);
+
+	uint32 GetSize() const { return m_Size; }
+	// Allocated indices, including the freed ones waiting for their fence
+	uint32 GetNumAllocations() const { return m_NumAllocations.load(std::memory_order_relaxed); }
+
+private:
+	void PushFree(uint32 index);
+
+	uint32 m_Size;
+	// Next index in the stack the index is in
+	std::unique_ptr<std::atomic<uint32>[]> m_Next;
+	// Fence value each index was freed at
+	std::unique_ptr<uint64[]> m_FreeFenceValues;
+	// Tag in the high 32 bits, index in the low 32 bits
+	std::atomic<uint64> m_FreeHead;
+	std::atomic<uint32> m_PendingHead;
+	std::atomic<uint32> m_NumAllocations;
+
+	std::mutex m_RecycleLock;
+	// Freed indices whose fence did not complete yet. Only accessed by Recycle().
+	std::vector<uint32> m_WaitingIndices;
+};
@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "ResourceStateTracker.h"
+
+namespace
+{
+	// Handles are only allocated when a resource is created, so a lock is fine here
+	std::mutex gHandleLock;
+	std::vector<uint32> gHandleGenerations;
+	std::vector<uint32> gFreeHandles;
+}
+
+ResourceTrackingHandle ResourceStateTracker::AllocateHandle()
+{
+	std::scoped_lock lock(gHandleLock);
+	ResourceTrackingHandle handle;
+	if (!gFreeHandles.empty())
+	{
+		handle.Index = gFreeHandles.back();
+		gFreeHandles.pop_back();
+	}
+	else
+	{
+		handle.Index = (uint32)gHandleGenerations.size();
+		gHandleGenerations.push_back(0);
+	}
+	handle.Generation = ++gHandleGenerations[handle.Index];
+	return handle;
+}
+
+void ResourceStateTracker::ReleaseHandle(ResourceTrackingHandle handle)
+{
+	check(handle.IsValid());
+	std::scoped_lock lock(gHandleLock);
+	check(gHandleGenerations[handle.Index] == handle.Generation, "Resource tracking handle released twice");
+	// Invalidate the handle right away so a second release of it is caught before the index is reused
+	++gHandleGenerations[handle.Index];
+	gFreeHandles.push_back(handle.Index);
+}
+
+void ResourceStateTracker::Reset()
+{
+	m_SubresourceStates.clear();
+	// On wrap around, old entries could match the epoch again
+	if (++m_Epoch == 0)
+	{
+		m_Entries.assign(m_Entries.size(), Entry());
+		m_Epoch = 1;
+	}
+}
+
+void ResourceStateTracker::Set(ResourceTrackingHandle handle, D3D12_RESOURCE_STATES state, uint32 subResource)
+{
+	check(handle.IsValid());
+	if (handle.Index >= m_Entries.size())
+		m_Entries.resize(Math::Max((size_t)handle.Index + 1, m_Entries.size() * 2));
+
+	Entry& entry = m_Entries[handle.Index];
+	if (entry.Epoch != m_Epoch || entry.Generation != handle.Generation)
+	{
+		entry.Epoch = m_Epoch;
+		entry.Generation = handle.Generation;
+		entry.CommonState = D3D12_RESOURCE_STATE_UNKNOWN;
+		entry.SubresourceStates = InvalidSubresourceStates;
+	}
+
+	if (subResource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+	{
+		entry.CommonState = state;
+		entry.SubresourceStates = InvalidSubresourceStates;
+		return;
+	}
+
+	check(subResource < D3D12_REQ_MIP_LEVELS);
+	if (entry.SubresourceStates == InvalidSubresourceStates)
+	{
+		entry.SubresourceStates = (uint32)m_SubresourceStates.size();
+		m_SubresourceStates.emplace_back().fill(entry.CommonState);
+	}
+	m_SubresourceStates[entry.SubresourceStates][subResource] = state;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "RHI.h"
+
+constexpr D3D12_RESOURCE_STATES D3D12_RESOURCE_STATE_UNKNOWN = (D3D12_RESOURCE_STATES)-1;
+
+// Compact identifier of a resource for the state tracking of command contexts.
+// Indices are recycled, the generation tells apart resources which had the same index.
+struct ResourceTrackingHandle
+{
+	static constexpr uint32 InvalidIndex = 0xFFFFFFFF;
+
+	uint32 Index = InvalidIndex;
+	uint32 Generation = 0;
+
+	bool IsValid() const { return Index != InvalidIndex; }
+};
+
+/*
+	Resource states local to a command context, in a flat array indexed by the tracking handle of the resource.
+
+	- Each entry is stamped with the epoch of the tracker, so Reset() forgets all states without touching the array.
+	- Entries are also stamped with the generation of the handle, so a destroyed resource's state never leaks into
+	  a new resource which got the same index.
+	- A resource has a single state, until a barrier is done on a single subresource.
+	  Only then are the states of its subresources stored, in a separate array.
+*/
+class ResourceStateTracker
+{
+public:
+	static ResourceTrackingHandle AllocateHandle();
+	static void ReleaseHandle(ResourceTrackingHandle handle);
+
+	// Forgets the states of all resources
+	void Reset();
+
+	// Returns D3D12_RESOURCE_STATE_UNKNOWN if the resource is not used in this context yet
+	D3D12_RESOURCE_STATES Get(ResourceTrackingHandle handle, uint32 subResource) const
+	{
+		check(handle.IsValid());
+		if (handle.Index >= m_Entries.size())
+			return D3D12_RESOURCE_STATE_UNKNOWN;
+		const Entry& entry = m_Entries[handle.Index];
+		if (entry.Epoch != m_Epoch || entry.Generation != handle.Generation)
+			return D3D12_RESOURCE_STATE_UNKNOWN;
+		if (entry.SubresourceStates == InvalidSubresourceStates)
+			return entry.CommonState;
+		check(subResource < D3D12_REQ_MIP_LEVELS);
+		return m_SubresourceStates[entry.SubresourceStates][subResource];
+	}
+
+	void Set(ResourceTrackingHandle handle, D3D12_RESOURCE_STATES state, uint32 subResource);
+
+private:
+	static constexpr uint32 InvalidSubresourceStates = 0xFFFFFFFF;
+
+	struct Entry
+	{
+		uint32 Epoch = 0;
+		uint32 Generation = 0;
+		D3D12_RESOURCE_STATES CommonState = D3D12_RESOURCE_STATE_UNKNOWN;
+		// Index in m_SubresourceStates, if the subresources are not all in the same state
+		uint32 SubresourceStates = InvalidSubresourceStates;
+	};
+
+	std::vector<Entry> m_Entries;
+	std::vector<std::array<D3D12_RESOURCE_STATES, D3D12_REQ_MIP_LEVELS>> m_SubresourceStates;
+	uint32 m_Epoch = 1;
+};
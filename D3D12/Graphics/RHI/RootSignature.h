@@ -1,5 +1,6 @@
 #pragma once
 #include "GraphicsResource.h"
+#include "Core/Hash.h"
 
 /*
 	The RootSignature describes how the GPU resources map to the shader.
@@ -30,6 +31,8 @@ public:
 	void Finalize(const char* pName, D3D12_ROOT_SIGNATURE_FLAGS flags = D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
 	ID3D12RootSignature* GetRootSignature() const { return m_pRootSignature.Get(); }
+	// Hash of the serialized root signature. Identical root signatures have the same hash.
+	const Hash128& GetHash() const { return m_Hash; }
 
 	uint32 GetNumRootConstants(uint32 rootIndex) const { check(IsRootConstant(rootIndex)); return m_RootParameters[rootIndex].Data.Constants.Num32BitValues; }
 	bool IsRootConstant(uint32 rootIndex) const { return m_RootParameters[rootIndex].Data.ParameterType == D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS; }
@@ -46,5 +49,6 @@ private:
 	std::array<RootParameter, sMaxNumParameters> m_RootParameters{};
 	std::vector<D3D12_STATIC_SAMPLER_DESC> m_StaticSamplers;
 	RefCountPtr<ID3D12RootSignature> m_pRootSignature;
+	Hash128 m_Hash;
 	uint32 m_NumParameters;
 };
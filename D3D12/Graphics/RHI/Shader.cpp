@@ -6,27 +6,74 @@
 #include "dxc/dxcapi.h"
 #include "dxc/d3d12shader.h"
 #include "D3D.h"
-#include "Core/Serializer.h"
 #include "Core/Profiler.h"
+#include "Core/Hash.h"
+#include "Core/TaskQueue.h"
+#include "Core/ConsoleVariables.h"
+#include "ShaderCache.h"
 
 namespace ShaderCompiler
 {
 	constexpr const char* pCompilerPath = "dxcompiler.dll";
 	constexpr const char* pShaderSymbolsPath = "Saved/ShaderSymbols/";
 
-	static RefCountPtr<IDxcUtils> pUtils;
-	static RefCountPtr<IDxcCompiler3> pCompiler3;
-	static RefCountPtr<IDxcValidator> pValidator;
-	static RefCountPtr<IDxcIncludeHandler> pDefaultIncludeHandler;
+	FN_PROC(DxcCreateInstance);
+
+	// DXC objects are not thread safe. Each compiling thread takes its own instance from the pool.
+	struct CompilerInstance
+	{
+		RefCountPtr<IDxcUtils> pUtils;
+		RefCountPtr<IDxcCompiler3> pCompiler;
+		RefCountPtr<IDxcValidator> pValidator;
+	};
+	static std::vector<std::unique_ptr<CompilerInstance>> CompilerPool;
+	static std::vector<CompilerInstance*> FreeCompilers;
+	static std::mutex CompilerPoolMutex;
+
+	class ScopedCompiler
+	{
+	public:
+		ScopedCompiler()
+		{
+			std::lock_guard lock(CompilerPoolMutex);
+			if (FreeCompilers.empty())
+			{
+				m_pInstance = CompilerPool.emplace_back(std::make_unique<CompilerInstance>()).get();
+				VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcUtils, IID_PPV_ARGS(m_pInstance->pUtils.GetAddressOf())));
+				VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcCompiler, IID_PPV_ARGS(m_pInstance->pCompiler.GetAddressOf())));
+				VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcValidator, IID_PPV_ARGS(m_pInstance->pValidator.GetAddressOf())));
+			}
+			else
+			{
+				m_pInstance = FreeCompilers.back();
+				FreeCompilers.pop_back();
+			}
+		}
+
+		~ScopedCompiler()
+		{
+			std::lock_guard lock(CompilerPoolMutex);
+			FreeCompilers.push_back(m_pInstance);
+		}
+
+		CompilerInstance* operator->() const { return m_pInstance; }
+
+	private:
+		CompilerInstance* m_pInstance;
+	};
+
 	static std::mutex IncludeCacheMutex;
 
 	struct CachedFile
 	{
 		RefCountPtr<IDxcBlobEncoding> pBlob;
+		Hash128 ContentHash;
 		uint64 Timestamp;
 	};
 	static std::unordered_map<StringHash, CachedFile> IncludeCache;
-	std::mutex ShaderCacheMutex;
+
+	static ShaderCacheArchive ShaderCache;
+	static std::string CompilerVersion;
 
 	struct CompileJob
 	{
@@ -38,20 +85,28 @@ namespace ShaderCompiler
 		uint8 MajVersion;
 		uint8 MinVersion;
 		bool EnableDebugMode;
+		bool UseCache = true;
+		// Preprocessed hash of the current byte code, if any. The compile is skipped if it didn't change.
+		Hash128 PreviousPreprocessedHash;
 	};
 
 	struct CompileResult
 	{
-		static constexpr int Version = 7;
+		static constexpr int Version = 9;
 
 		std::string ErrorMessage;
 		ShaderBlob pBlob;
 		RefCountPtr<IUnknown> pReflection;
 		std::vector<std::string> Includes;
+		// Hash of the content of each file in 'Includes'
+		std::vector<Hash128> IncludeHashes;
 		uint64 ShaderHash[2];
-		bool IsDebug;
+		Hash128 PreprocessedHash;
+		bool IsDebug = false;
+		// The preprocessed source matches 'PreviousPreprocessedHash'. There is no byte code, the previous one is still valid.
+		bool IsUnchanged = false;
 
-		bool Success() const { return pBlob.Get() && ErrorMessage.length() == 0; }
+		bool Success() const { return (pBlob.Get() || IsUnchanged) && ErrorMessage.length() == 0; }
 	};
 
 	constexpr const char* GetShaderTarget(ShaderType type)
@@ -69,16 +124,38 @@ namespace ShaderCompiler
 
 	static void LoadDXC()
 	{
-		FN_PROC(DxcCreateInstance);
-
 		HMODULE lib = LoadLibraryA(pCompilerPath);
 		DxcCreateInstanceFn.Load(lib);
 
-		VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcUtils, IID_PPV_ARGS(pUtils.GetAddressOf())));
-		VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcCompiler, IID_PPV_ARGS(pCompiler3.GetAddressOf())));
-		VERIFY_HR(DxcCreateInstanceFn(CLSID_DxcValidator, IID_PPV_ARGS(pValidator.GetAddressOf())));
-		VERIFY_HR(pUtils->CreateDefaultIncludeHandler(pDefaultIncludeHandler.GetAddressOf()));
-		E_LOG(Info, "Loaded %s", pCompilerPath);
+		// The compiler version is part of the cache key, so a different compiler doesn't load stale byte code
+		ScopedCompiler compiler;
+		CompilerVersion = "Unknown";
+		RefCountPtr<IDxcVersionInfo> pVersionInfo;
+		if (compiler->pCompiler.As(&pVersionInfo))
+		{
+			uint32 major, minor;
+			VERIFY_HR(pVersionInfo->GetVersion(&major, &minor));
+			CompilerVersion = Sprintf("%d.%d", major, minor);
+
+			RefCountPtr<IDxcVersionInfo2> pVersionInfo2;
+			if (pVersionInfo.As(&pVersionInfo2))
+			{
+				uint32 commitCount;
+				char* pCommitHash = nullptr;
+				if (SUCCEEDED(pVersionInfo2->GetCommitInfo(&commitCount, &pCommitHash)))
+				{
+					CompilerVersion += Sprintf(".%d (%s)", commitCount, pCommitHash);
+					CoTaskMemFree(pCommitHash);
+				}
+			}
+		}
+		E_LOG(Info, "Loaded %s - Version %s", pCompilerPath, CompilerVersion.c_str());
+	}
+
+	static void OpenCache()
+	{
+		std::string environment = Sprintf("%s|%d", CompilerVersion.c_str(), CompileResult::Version);
+		ShaderCache.Open(Sprintf("%sShaders.cache", Paths::ShaderCacheDir().c_str()).c_str(), Hash::Murmur3_128(environment));
 	}
 
 	static bool ResolveFilePath(const CompileJob& job, std::string& outPath)
@@ -93,76 +170,137 @@ namespace ShaderCompiler
 		return false;
 	}
 
-	static bool TryLoadFromCache(const char* pCachePath, const CompileJob& compileJob, CompileResult& result)
+	// Key of a compiled shader, from everything that affects it except the content of the source files.
+	// The source files are validated with the content hashes stored in the cache.
+	static Hash128 GetCacheKey(const CompileJob& compileJob)
 	{
-		std::lock_guard lock(ShaderCacheMutex);
-
-		// See if the cache file exists
-		if (!Paths::FileExists(pCachePath))
-			return false;
-
-		std::string shaderFullPath;
-		if (!ResolveFilePath(compileJob, shaderFullPath))
-			return false;
-
-		// Check if the shader source is not newer than the cached file
-		uint64 cacheTime, temp;
-		Paths::GetFileTime(pCachePath, temp, temp, cacheTime);
+		std::string key = Sprintf("%s|%s|%s_%d_%d|%d|%s",
+			compileJob.FilePath.c_str(),
+			compileJob.EntryPoint.c_str(),
+			compileJob.Target.c_str(),
+			compileJob.MajVersion,
+			compileJob.MinVersion,
+			compileJob.EnableDebugMode,
+			CompilerVersion.c_str());
+		for (const ShaderDefine& define : compileJob.Defines)
+			key += "|D" + define.Value;
+		for (const std::string& includeDir : compileJob.IncludeDirs)
+			key += "|I" + includeDir;
+		return Hash::Murmur3_128(key, CompileResult::Version);
+	}
 
-		auto TestFileTime = [&](const char* pFilePath) {
-			uint64 shaderTime;
-			Paths::GetFileTime(pFilePath, temp, temp, shaderTime);
-			return cacheTime >= shaderTime;
-		};
+	// Hash of preprocessed source, ignoring whitespace and line directives.
+	// Edits to formatting, comments or code in inactive #if blocks give the same hash.
+	// Line numbers are ignored too, so the embedded debug info can refer to old lines until the byte code changes.
+	static Hash128 HashPreprocessedSource(const char* pSource, size_t length)
+	{
+		// Whitespace only separates tokens between identifiers and between operators which could otherwise merge (eg. "- -")
+		auto IsWordChar = [](char c) { return isalnum((unsigned char)c) || c == '_'; };
+		auto IsOperatorChar = [](char c) { return strchr("+-*/%&|^<>=!:.", c) != nullptr; };
+
+		std::string tokens;
+		tokens.reserve(length);
+		bool isLineStart = true;
+		bool isDirective = false;
+		bool needsSpace = false;
+		for (size_t i = 0; i < length; ++i)
+		{
+			const char c = pSource[i];
+			if (c == '\n')
+			{
+				// Directives are on their own line
+				if (isDirective)
+					tokens += '\n';
+				isLineStart = true;
+				isDirective = false;
+				needsSpace = !tokens.empty() && tokens.back() != '\n';
+				continue;
+			}
+			if (isspace((unsigned char)c))
+			{
+				needsSpace = true;
+				continue;
+			}
 
-		if (!TestFileTime(shaderFullPath.c_str()))
-			return false;
+			// Skip "#line 12 "file"" and "# 12 "file"" directives. Other directives, like #pragma, are kept.
+			if (isLineStart && c == '#')
+			{
+				size_t next = i + 1;
+				while (next < length && (pSource[next] == ' ' || pSource[next] == '\t'))
+					++next;
+				if ((next < length && isdigit((unsigned char)pSource[next])) || (length - next >= 4 && strncmp(&pSource[next], "line", 4) == 0))
+				{
+					while (i + 1 < length && pSource[i + 1] != '\n')
+						++i;
+					continue;
+				}
+				if (!tokens.empty() && tokens.back() != '\n')
+					tokens += '\n';
+				isDirective = true;
+				needsSpace = false;
+			}
 
-		Serializer s;
-		s.Open(pCachePath, Serializer::Mode::Read);
-		uint32 version = 0;
-		s.Serialize(version);
-		if (version != CompileResult::Version)
-			return false;
+			if (needsSpace && !tokens.empty())
+			{
+				const char previous = tokens.back();
+				if ((IsWordChar(previous) && IsWordChar(c)) || (IsOperatorChar(previous) && IsOperatorChar(c)))
+					tokens += ' ';
+			}
+			tokens += c;
+			isLineStart = false;
+			needsSpace = false;
+		}
+		return Hash::Murmur3_128(tokens);
+	}
 
-		s.Serialize(result.ShaderHash);
-		s.Serialize(result.Includes);
+	static HRESULT TryLoadFile(IDxcUtils* pUtils, const char* pFileName, RefCountPtr<IDxcBlobEncoding>* pOutFile, Hash128* pOutContentHash = nullptr);
 
-		// Test if includes sources are not newer than the cached file
-		for (std::string& include : result.Includes)
+	// Content hash of a file, read from disk only the first time the file is seen this session.
+	// After that the include cache has the hash, and the file watcher keeps it up to date.
+	static bool GetSessionContentHash(IDxcUtils* pUtils, const std::string& filePath, Hash128& outHash)
+	{
 		{
-			if (!TestFileTime(include.c_str()))
+			std::lock_guard cacheLock(IncludeCacheMutex);
+			auto it = IncludeCache.find(filePath.c_str());
+			if (it != IncludeCache.end())
 			{
-				result.Includes.clear();
-				return false;
+				outHash = it->second.ContentHash;
+				return true;
 			}
 		}
+		RefCountPtr<IDxcBlobEncoding> pFile;
+		return SUCCEEDED(TryLoadFile(pUtils, filePath.c_str(), &pFile, &outHash));
+	}
 
-		uint32 size = 0;
-		void* pData = nullptr;
-		s.Serialize(pData, size);
-		pUtils->CreateBlob(pData, size, DXC_CP_ACP, (IDxcBlobEncoding**)result.pBlob.GetAddressOf());
-		delete[] pData;
-
+	// True if the content of the shader and its includes didn't change.
+	// Includes are shared by many permutations, so each file is only validated against the disk once.
+	static bool DependenciesUnchanged(IDxcUtils* pUtils, const ShaderCacheArchive::Record& record)
+	{
+		for (const ShaderCacheArchive::Dependency& dependency : record.Dependencies)
+		{
+			Hash128 contentHash;
+			if (!GetSessionContentHash(pUtils, dependency.Path, contentHash) || contentHash != dependency.ContentHash)
+				return false;
+		}
 		return true;
 	}
 
-	static bool SaveToCache(const char* pCachePath, const CompileJob& compileJob, CompileResult& result)
+	static bool LoadFromRecord(IDxcUtils* pUtils, const ShaderCacheArchive::Record& record, CompileResult& result)
 	{
-		std::lock_guard lock(ShaderCacheMutex);
-
-		Paths::CreateDirectoryTree(pCachePath);
+		memcpy(result.ShaderHash, record.ShaderHash, sizeof(uint64) * 2);
+		result.PreprocessedHash = record.PreprocessedHash;
+		return SUCCEEDED(pUtils->CreateBlob(record.pByteCode, record.ByteCodeSize, DXC_CP_ACP, (IDxcBlobEncoding**)result.pBlob.GetAddressOf()));
+	}
 
-		Serializer s;
-		s.Open(pCachePath, Serializer::Mode::Write);
-		uint32 version = CompileResult::Version;
-		s.Serialize(version);
-		s.Serialize(result.ShaderHash);
-		s.Serialize(result.Includes);
-		void* pBlob = result.pBlob->GetBufferPointer();
-		uint32 size = (uint32)result.pBlob->GetBufferSize();
-		s.Serialize(pBlob, size);
-		return true;
+	static bool SaveToCache(const Hash128& key, CompileResult& result)
+	{
+		std::vector<ShaderCacheArchive::Dependency> dependencies(result.Includes.size());
+		for (size_t i = 0; i < result.Includes.size(); ++i)
+		{
+			dependencies[i].Path = result.Includes[i];
+			dependencies[i].ContentHash = result.IncludeHashes[i];
+		}
+		return ShaderCache.Add(key, result.ShaderHash, result.PreprocessedHash, dependencies, result.pBlob->GetBufferPointer(), (uint32)result.pBlob->GetBufferSize());
 	}
 
 	static std::string CustomPreprocess(const std::string& input)
@@ -214,7 +352,7 @@ namespace ShaderCompiler
 		return output;
 	}
 
-	static HRESULT TryLoadFile(const char* pFileName, RefCountPtr<IDxcBlobEncoding>* pOutFile)
+	static HRESULT TryLoadFile(IDxcUtils* pUtils, const char* pFileName, RefCountPtr<IDxcBlobEncoding>* pOutFile, Hash128* pOutContentHash)
 	{
 		HRESULT hr = E_FAIL;
 		if (!Paths::FileExists(pFileName))
@@ -232,6 +370,8 @@ namespace ShaderCompiler
 				if (fileTime <= file.Timestamp)
 				{
 					*pOutFile = file.pBlob;
+					if (pOutContentHash)
+						*pOutContentHash = file.ContentHash;
 					return S_OK;
 				}
 			}
@@ -250,11 +390,14 @@ namespace ShaderCompiler
 
 			CachedFile file;
 			file.Timestamp = fileTime;
+			file.ContentHash = Hash::Murmur3_128(buffer);
 			hr = pUtils->CreateBlob(buffer.data(), (int)buffer.size(), 0, file.pBlob.GetAddressOf());
 			if (SUCCEEDED(hr))
 			{
 				std::lock_guard cacheLock(IncludeCacheMutex);
 				*pOutFile = file.pBlob;
+				if (pOutContentHash)
+					*pOutContentHash = file.ContentHash;
 				IncludeCache[pFileName] = file;
 			}
 		}
@@ -262,95 +405,161 @@ namespace ShaderCompiler
 		return hr;
 	}
 
-	static CompileResult Compile(const CompileJob& compileJob)
+	class CompileArguments
 	{
-		CompileResult result;
-
-		std::string defineKey;
-		for (const ShaderDefine& define : compileJob.Defines)
-			defineKey += define.Value;
-		StringHash hash(defineKey.c_str());
+	public:
+		void AddArgument(const char* pArgument, const char* pValue = nullptr)
+		{
+			m_Arguments.push_back(MULTIBYTE_TO_UNICODE(pArgument));
+			if (pValue)
+				m_Arguments.push_back(MULTIBYTE_TO_UNICODE(pValue));
+		}
+		void AddArgument(const wchar_t* pArgument, const wchar_t* pValue = nullptr)
+		{
+			m_Arguments.push_back(pArgument);
+			if (pValue)
+				m_Arguments.push_back(pValue);
+		}
 
-		std::string cachePath = Sprintf(
-			"%s%s_%s_%x%s.bin",
-			Paths::ShaderCacheDir().c_str(),
-			Paths::GetFileNameWithoutExtension(compileJob.FilePath).c_str(),
-			compileJob.EntryPoint.c_str(),
-			hash.m_Hash,
-			compileJob.EnableDebugMode ? "_DEBUG" : ""
-		);
-		Paths::CreateDirectoryTree(cachePath);
+		void AddDefine(const char* pDefine, const char* pValue = nullptr)
+		{
+			if (strstr(pDefine, "=") != nullptr)
+				AddArgument("-D", pDefine);
+			else
+				AddArgument("-D", Sprintf("%s=%s", pDefine, pValue ? pValue : "1").c_str());
+		}
 
-		if (TryLoadFromCache(cachePath.c_str(), compileJob, result))
+		const wchar_t** GetArguments()
 		{
-			E_LOG(Info, "Loaded shader '%s.%s' from cache.", compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
-			return result;
+			m_ArgumentArr.clear();
+			m_ArgumentArr.reserve(GetNumArguments());
+			for (const auto& arg : m_Arguments)
+				m_ArgumentArr.push_back(arg.c_str());
+			return m_ArgumentArr.data();
 		}
 
-		Utils::TimeScope timer;
-		RefCountPtr<IDxcBlobEncoding> pSource;
-		std::string fullPath;
-		if (!ResolveFilePath(compileJob, fullPath))
+		size_t GetNumArguments() const
 		{
-			result.ErrorMessage = Sprintf("Failed to open file '%s'", compileJob.FilePath.c_str());
-			return result;
+			return m_Arguments.size();
 		}
 
-		if (!SUCCEEDED(TryLoadFile(fullPath.c_str(), &pSource)))
+		std::string ToString() const
 		{
-			result.ErrorMessage = Sprintf("Failed to load file '%s'", fullPath.c_str());
-			return result;
+			std::string str;
+			for (const std::wstring& arg : m_Arguments)
+				str += Sprintf(" %s", UNICODE_TO_MULTIBYTE(arg.c_str()));
+			return str;
 		}
 
-		class CompileArguments
+	private:
+		std::vector<const wchar_t*> m_ArgumentArr;
+		std::vector<std::wstring> m_Arguments;
+	};
+
+	class CustomIncludeHandler : public IDxcIncludeHandler
+	{
+	public:
+		CustomIncludeHandler(IDxcUtils* pUtils)
+			: m_pUtils(pUtils)
+		{}
+
+		HRESULT STDMETHODCALLTYPE LoadSource(_In_ LPCWSTR pFilename, _COM_Outptr_result_maybenull_ IDxcBlob** ppIncludeSource) override
 		{
-		public:
-			void AddArgument(const char* pArgument, const char* pValue = nullptr)
-			{
-				m_Arguments.push_back(MULTIBYTE_TO_UNICODE(pArgument));
-				if (pValue)
-					m_Arguments.push_back(MULTIBYTE_TO_UNICODE(pValue));
-			}
-			void AddArgument(const wchar_t* pArgument, const wchar_t* pValue = nullptr)
-			{
-				m_Arguments.push_back(pArgument);
-				if (pValue)
-					m_Arguments.push_back(pValue);
-			}
+			RefCountPtr<IDxcBlobEncoding> pEncoding;
+			std::string path = Paths::Normalize(UNICODE_TO_MULTIBYTE(pFilename));
+			check(Paths::ResolveRelativePaths(path));
 
-			void AddDefine(const char* pDefine, const char* pValue = nullptr)
-			{
-				if (strstr(pDefine, "=") != nullptr)
-					AddArgument("-D", pDefine);
-				else
-					AddArgument("-D", Sprintf("%s=%s", pDefine, pValue ? pValue : "1").c_str());
-			}
+			auto existingInclude = std::find_if(IncludedFiles.begin(), IncludedFiles.end(), [&path](const std::string& include) {
+				return CString::StrCmp(include.c_str(), path.c_str(), false);
+				});
 
-			const wchar_t** GetArguments()
+			if (existingInclude != IncludedFiles.end())
 			{
-				m_ArgumentArr.reserve(GetNumArguments());
-				for (const auto& arg : m_Arguments)
-					m_ArgumentArr.push_back(arg.c_str());
-				return m_ArgumentArr.data();
+				static const char nullStr[] = " ";
+				m_pUtils->CreateBlobFromPinned(nullStr, ARRAYSIZE(nullStr), DXC_CP_ACP, pEncoding.GetAddressOf());
+				*ppIncludeSource = pEncoding.Detach();
+				return S_OK;
 			}
 
-			size_t GetNumArguments() const
+			Hash128 contentHash;
+			HRESULT hr = TryLoadFile(m_pUtils, UNICODE_TO_MULTIBYTE(pFilename), &pEncoding, &contentHash);
+			if (SUCCEEDED(hr))
 			{
-				return m_Arguments.size();
+				IncludedFiles.push_back(path);
+				IncludedFileHashes.push_back(contentHash);
+				*ppIncludeSource = pEncoding.Detach();
 			}
+			return hr;
+		}
+
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, _COM_Outptr_ void __RPC_FAR* __RPC_FAR* ppvObject) override {	return E_NOINTERFACE; }
+		ULONG STDMETHODCALLTYPE AddRef(void) override { return 0; }
+		ULONG STDMETHODCALLTYPE Release(void) override { return 0; }
+
+		std::vector<std::string> IncludedFiles;
+		std::vector<Hash128> IncludedFileHashes;
+
+	private:
+		IDxcUtils* m_pUtils;
+	};
+
+	static void SetIncludes(const std::string& sourcePath, const Hash128& sourceHash, const CustomIncludeHandler& includeHandler, CompileResult& result)
+	{
+		result.Includes = { sourcePath };
+		result.IncludeHashes = { sourceHash };
+		result.Includes.insert(result.Includes.end(), includeHandler.IncludedFiles.begin(), includeHandler.IncludedFiles.end());
+		result.IncludeHashes.insert(result.IncludeHashes.end(), includeHandler.IncludedFileHashes.begin(), includeHandler.IncludedFileHashes.end());
+	}
 
-			std::string ToString() const
+	static bool GetContentHash(const std::string& filePath, Hash128& outHash)
+	{
+		ScopedCompiler compiler;
+		RefCountPtr<IDxcBlobEncoding> pFile;
+		return SUCCEEDED(TryLoadFile(compiler->pUtils, filePath.c_str(), &pFile, &outHash));
+	}
+
+	static CompileResult Compile(const CompileJob& compileJob)
+	{
+		CompileResult result;
+		// Debug mode is part of the cache key, so this also holds for byte code loaded from the cache
+		result.IsDebug = compileJob.EnableDebugMode;
+
+		ScopedCompiler compiler;
+		IDxcUtils* pUtils = compiler->pUtils;
+		IDxcCompiler3* pCompiler3 = compiler->pCompiler;
+		IDxcValidator* pValidator = compiler->pValidator;
+
+		Hash128 cacheKey = GetCacheKey(compileJob);
+		ShaderCacheArchive::Record record;
+		const bool hasRecord = compileJob.UseCache && ShaderCache.Find(cacheKey, record);
+		if (hasRecord && DependenciesUnchanged(pUtils, record) && LoadFromRecord(pUtils, record, result))
+		{
+			for (const ShaderCacheArchive::Dependency& dependency : record.Dependencies)
 			{
-				std::string str;
-				for (const std::wstring& arg : m_Arguments)
-					str += Sprintf(" %s", UNICODE_TO_MULTIBYTE(arg.c_str()));
-				return str;
+				result.Includes.push_back(dependency.Path);
+				result.IncludeHashes.push_back(dependency.ContentHash);
 			}
+			E_LOG(Info, "Loaded shader '%s.%s' from cache.", compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+			return result;
+		}
+
+		Utils::TimeScope timer;
+		RefCountPtr<IDxcBlobEncoding> pSource;
+		std::string fullPath;
+		if (!ResolveFilePath(compileJob, fullPath))
+		{
+			result.ErrorMessage = Sprintf("Failed to open file '%s'", compileJob.FilePath.c_str());
+			return result;
+		}
 
-		private:
-			std::vector<const wchar_t*> m_ArgumentArr;
-			std::vector<std::wstring> m_Arguments;
-		} arguments;
+		Hash128 sourceHash;
+		if (!SUCCEEDED(TryLoadFile(pUtils, fullPath.c_str(), &pSource, &sourceHash)))
+		{
+			result.ErrorMessage = Sprintf("Failed to load file '%s'", fullPath.c_str());
+			return result;
+		}
+
+		CompileArguments arguments;
 
 		std::string target = Sprintf("%s_%d_%d", compileJob.Target.c_str(), compileJob.MajVersion, compileJob.MinVersion);
 		arguments.AddArgument(Paths::GetFileNameWithoutExtension(compileJob.FilePath).c_str());
@@ -375,8 +584,6 @@ namespace ShaderCompiler
 			arguments.AddDefine("_PAYLOAD_QUALIFIERS", "0");
 		}
 
-		result.IsDebug = compileJob.EnableDebugMode;
-
 		arguments.AddArgument(DXC_ARG_DEBUG);
 		arguments.AddArgument("-Qembed_debug");
 
@@ -399,74 +606,65 @@ namespace ShaderCompiler
 		sourceBuffer.Size = pSource->GetBufferSize();
 		sourceBuffer.Encoding = DXC_CP_ACP;
 
-		class CustomIncludeHandler : public IDxcIncludeHandler
+		// Preprocess first. When the preprocessed source didn't change, the existing byte code is still valid.
+		RefCountPtr<IDxcBlobUtf8> pPreprocessed;
 		{
-		public:
-			HRESULT STDMETHODCALLTYPE LoadSource(_In_ LPCWSTR pFilename, _COM_Outptr_result_maybenull_ IDxcBlob** ppIncludeSource) override
+			RefCountPtr<IDxcResult> pPreprocessOutput;
+			CompileArguments preprocessArgs = arguments;
+			preprocessArgs.AddArgument("-P", ".");
+			CustomIncludeHandler preprocessIncludeHandler(pUtils);
+			HRESULT preprocessStatus;
+			if (SUCCEEDED(pCompiler3->Compile(&sourceBuffer, preprocessArgs.GetArguments(), (uint32)preprocessArgs.GetNumArguments(), &preprocessIncludeHandler, IID_PPV_ARGS(pPreprocessOutput.GetAddressOf())))
+				&& SUCCEEDED(pPreprocessOutput->GetStatus(&preprocessStatus)) && SUCCEEDED(preprocessStatus)
+				&& SUCCEEDED(pPreprocessOutput->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(pPreprocessed.GetAddressOf()), nullptr)) && pPreprocessed)
 			{
-				RefCountPtr<IDxcBlobEncoding> pEncoding;
-				std::string path = Paths::Normalize(UNICODE_TO_MULTIBYTE(pFilename));
-				check(Paths::ResolveRelativePaths(path));
-
-				auto existingInclude = std::find_if(IncludedFiles.begin(), IncludedFiles.end(), [&path](const std::string& include) {
-					return CString::StrCmp(include.c_str(), path.c_str(), false);
-					});
+				result.PreprocessedHash = HashPreprocessedSource(pPreprocessed->GetStringPointer(), pPreprocessed->GetStringLength());
+				SetIncludes(fullPath, sourceHash, preprocessIncludeHandler, result);
 
-				if (existingInclude != IncludedFiles.end())
+				if (hasRecord && record.PreprocessedHash == result.PreprocessedHash && LoadFromRecord(pUtils, record, result))
 				{
-					static const char nullStr[] = " ";
-					pUtils->CreateBlobFromPinned(nullStr, ARRAYSIZE(nullStr), DXC_CP_ACP, pEncoding.GetAddressOf());
-					*ppIncludeSource = pEncoding.Detach();
-					return S_OK;
+					// Store the new content hashes, so the next lookup doesn't need to preprocess
+					SaveToCache(cacheKey, result);
+					E_LOG(Info, "Shader '%s.%s' is unchanged after preprocessing. Loaded from cache.", compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+					return result;
 				}
 
-				HRESULT hr = TryLoadFile(UNICODE_TO_MULTIBYTE(pFilename), &pEncoding);
-				if (SUCCEEDED(hr))
+				if (compileJob.PreviousPreprocessedHash == result.PreprocessedHash)
 				{
-					IncludedFiles.push_back(path);
-					*ppIncludeSource = pEncoding.Detach();
+					result.IsUnchanged = true;
+					E_LOG(Info, "Shader '%s.%s' is unchanged after preprocessing. Skipped compile.", compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+					return result;
 				}
-				return hr;
 			}
+			else
+			{
+				pPreprocessed = nullptr;
+			}
+		}
 
-			HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, _COM_Outptr_ void __RPC_FAR* __RPC_FAR* ppvObject) override {	return E_NOINTERFACE; }
-			ULONG STDMETHODCALLTYPE AddRef(void) override { return 0; }
-			ULONG STDMETHODCALLTYPE Release(void) override { return 0; }
-
-			std::vector<std::string> IncludedFiles;
-		};
-
-		if (CommandLine::GetBool("dumpshaders"))
+		if (pPreprocessed && CommandLine::GetBool("dumpshaders"))
 		{
-			// Preprocessed source
-			RefCountPtr<IDxcResult> pPreprocessOutput;
-			CompileArguments preprocessArgs = arguments;
-			preprocessArgs.AddArgument("-P", ".");
-			CustomIncludeHandler preprocessIncludeHandler;
-			if (SUCCEEDED(pCompiler3->Compile(&sourceBuffer, preprocessArgs.GetArguments(), (uint32)preprocessArgs.GetNumArguments(), &preprocessIncludeHandler, IID_PPV_ARGS(pPreprocessOutput.GetAddressOf()))))
+			std::string filePathBase = Sprintf("%s_%s_%016llx",
+				Paths::GetFileNameWithoutExtension(compileJob.FilePath).c_str(),
+				compileJob.EntryPoint.c_str(),
+				cacheKey.Low);
+			Paths::CreateDirectoryTree(Paths::ShaderCacheDir());
 			{
-				RefCountPtr<IDxcBlobUtf8> pHLSL;
-				if (SUCCEEDED(pPreprocessOutput->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(pHLSL.GetAddressOf()), nullptr)))
-				{
-					std::string filePathBase = Paths::GetFileNameWithoutExtension(cachePath);
-					{
-						FILE* pFile = nullptr;
-						fopen_s(&pFile, Sprintf("%s%s.hlsl", Paths::ShaderCacheDir(), filePathBase).c_str(), "w");
-						fwrite(pHLSL->GetStringPointer(), pHLSL->GetStringLength(), 1, pFile);
-						fclose(pFile);
-					}
-					{
-						FILE* pFile = nullptr;
+				FILE* pFile = nullptr;
+				fopen_s(&pFile, Sprintf("%s%s.hlsl", Paths::ShaderCacheDir(), filePathBase).c_str(), "w");
+				fwrite(pPreprocessed->GetStringPointer(), pPreprocessed->GetStringLength(), 1, pFile);
+				fclose(pFile);
+			}
+			{
+				FILE* pFile = nullptr;
 
-						fopen_s(&pFile, Sprintf("%s%s.bat", Paths::ShaderCacheDir(), filePathBase).c_str(), "w");
-						std::string txt = Sprintf("dxc.exe %s -Fo %s.shaderbin %s.hlsl", arguments.ToString(), filePathBase, filePathBase);
-						fwrite(txt.c_str(), txt.size(), 1, pFile);
-					}
-				}
+				fopen_s(&pFile, Sprintf("%s%s.bat", Paths::ShaderCacheDir(), filePathBase).c_str(), "w");
+				std::string txt = Sprintf("dxc.exe %s -Fo %s.shaderbin %s.hlsl", arguments.ToString(), filePathBase, filePathBase);
+				fwrite(txt.c_str(), txt.size(), 1, pFile);
 			}
 		}
 
-		CustomIncludeHandler includeHandler;
+		CustomIncludeHandler includeHandler(pUtils);
 		RefCountPtr<IDxcResult> pCompileResult;
 		VERIFY_HR(pCompiler3->Compile(&sourceBuffer, arguments.GetArguments(), (uint32)arguments.GetNumArguments(), &includeHandler, IID_PPV_ARGS(pCompileResult.GetAddressOf())));
 
@@ -546,17 +744,25 @@ namespace ShaderCompiler
 			}
 		}
 
-		result.Includes.push_back(fullPath);
-		for (const std::string& includePath : includeHandler.IncludedFiles)
-			result.Includes.push_back(includePath);
+		SetIncludes(fullPath, sourceHash, includeHandler, result);
 
-		check(SaveToCache(cachePath.c_str(), compileJob, result));
-		E_LOG(Warning, "Missing cached shader. Compile time: %.1fms ('%s.%s')", timer.Stop() * 1000, compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+		if (compileJob.UseCache)
+		{
+			if (!SaveToCache(cacheKey, result))
+				E_LOG(Warning, "Failed to save shader '%s.%s' to cache", compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+			E_LOG(Warning, "Missing cached shader. Compile time: %.1fms ('%s.%s')", timer.Stop() * 1000, compileJob.FilePath.c_str(), compileJob.EntryPoint.c_str());
+		}
 
 		return result;
 	}
 }
 
+namespace Tweakables
+{
+	// Set by the BenchmarkShaderCompile command
+	bool g_BenchmarkShaderCompile = false;
+}
+
 ShaderManager::ShaderStringHash ShaderManager::GetEntryPointHash(const char* pEntryPoint, const Span<ShaderDefine>& defines)
 {
 	ShaderStringHash hash(pEntryPoint);
@@ -567,26 +773,77 @@ ShaderManager::ShaderStringHash ShaderManager::GetEntryPointHash(const char* pEn
 
 void ShaderManager::RecompileFromFileChange(const std::string& filePath)
 {
-	auto it = m_IncludeDependencyMap.find(ShaderStringHash(filePath));
-	if (it != m_IncludeDependencyMap.end())
+	// Reading the file refreshes its content hash in the include cache, which is what cached shaders are validated against
+	Hash128 contentHash;
+	const bool hasContent = ShaderCompiler::GetContentHash(filePath, contentHash);
+
+	std::lock_guard lock(m_CompileMutex);
+	auto it = m_IncludeGraph.find(ShaderStringHash(filePath));
+	if (it == m_IncludeGraph.end())
+		return;
+
+	// Saving without changes, or a file event reported twice, doesn't dirty anything
+	IncludeNode& node = it->second;
+	if (hasContent && contentHash == node.ContentHash)
+		return;
+	node.ContentHash = contentHash;
+
+	E_LOG(Info, "Modified \"%s\". Dirtying %d dependent shaders...", filePath.c_str(), (uint32)node.Dependents.size());
+	for (Shader* pShader : node.Dependents)
+		pShader->IsDirty = true;
+}
+
+void ShaderManager::RecompileDirtyShaders()
+{
+	std::vector<Shader*> dirtyShaders;
+	std::vector<ShaderRequest> requests;
+	std::vector<std::array<uint64, 2>> previousHashes;
 	{
-		E_LOG(Info, "Modified \"%s\". Dirtying dependent shaders...", filePath.c_str());
-		const std::unordered_set<std::string>& dependencies = it->second;
-		for (const std::string& dependency : dependencies)
+		std::lock_guard lock(m_CompileMutex);
+		for (Shader* pShader : m_Shaders)
 		{
-			auto objectMapIt = m_FilepathToObjectMap.find(ShaderStringHash(dependency));
-			if (objectMapIt != m_FilepathToObjectMap.end())
+			if (pShader->IsDirty)
 			{
-				ShadersInFileMap objectMap = objectMapIt->second;
-				for (auto shader : objectMap.Shaders)
-				{
-					shader.second->IsDirty = true;
-					if (shader.second)
-						m_OnShaderEditedEvent.Broadcast(shader.second);
-				}
+				dirtyShaders.push_back(pShader);
+				requests.push_back(ShaderRequest{ pShader->FilePath, pShader->Type, pShader->EntryPoint, pShader->Defines });
+				previousHashes.push_back({ pShader->Hash[0], pShader->Hash[1] });
 			}
 		}
 	}
+	if (dirtyShaders.empty())
+		return;
+
+	// Compile all edited shaders together before the users reload them
+	Utils::TimeScope timer;
+	std::vector<Shader*> shaders;
+	GetShaders(requests, shaders);
+
+	// Only shaders whose byte code changed need their users to reload
+	uint32 numChanged = 0;
+	for (uint32 i = 0; i < (uint32)shaders.size(); ++i)
+	{
+		if (shaders[i] && memcmp(shaders[i]->Hash, previousHashes[i].data(), sizeof(uint64) * 2) != 0)
+		{
+			m_OnShaderEditedEvent.Broadcast(shaders[i]);
+			++numChanged;
+		}
+	}
+	E_LOG(Info, "Recompiled %d dirty shaders in %.1f ms. %d changed.", (uint32)dirtyShaders.size(), timer.Stop() * 1000.0f, numChanged);
+}
+
+void ShaderManager::UpdateIncludeGraph(Shader* pShader, Span<std::string> includes, Span<Hash128> includeHashes)
+{
+	// The includes can be different after a change, eg. when an #include is in an #if block
+	for (const std::string& include : pShader->Includes)
+		m_IncludeGraph[ShaderStringHash(include)].Dependents.erase(pShader);
+
+	pShader->Includes = includes.Copy();
+	for (uint32 i = 0; i < includes.GetSize(); ++i)
+	{
+		IncludeNode& node = m_IncludeGraph[ShaderStringHash(includes[i])];
+		node.ContentHash = includeHashes[i];
+		node.Dependents.insert(pShader);
+	}
 }
 
 ShaderManager::ShaderManager(uint8 shaderModelMaj, uint8 shaderModelMin)
@@ -594,18 +851,21 @@ ShaderManager::ShaderManager(uint8 shaderModelMaj, uint8 shaderModelMin)
 {
 	m_pFileWatcher = std::make_unique<FileWatcher>();
 	ShaderCompiler::LoadDXC();
+	ShaderCompiler::OpenCache();
 }
 
 ShaderManager::~ShaderManager()
 {
 	for (Shader* pShader : m_Shaders)
 		delete pShader;
+	ShaderCompiler::ShaderCache.Close();
 }
 
 void ShaderManager::ConditionallyReloadShaders()
 {
 	if (m_pFileWatcher)
 	{
+		bool anyModified = false;
 		FileEvent fileEvent;
 		while (m_pFileWatcher->GetNextChange(fileEvent))
 		{
@@ -613,6 +873,7 @@ void ShaderManager::ConditionallyReloadShaders()
 			{
 			case FileEvent::Type::Modified:
 				RecompileFromFileChange(fileEvent.Path);
+				anyModified = true;
 				break;
 			case FileEvent::Type::Added:
 				break;
@@ -620,6 +881,14 @@ void ShaderManager::ConditionallyReloadShaders()
 				break;
 			}
 		}
+		if (anyModified)
+			RecompileDirtyShaders();
+	}
+
+	if (Tweakables::g_BenchmarkShaderCompile)
+	{
+		Tweakables::g_BenchmarkShaderCompile = false;
+		BenchmarkCompile();
 	}
 }
 
@@ -637,59 +906,212 @@ void ShaderManager::AddIncludeDir(const std::string& includeDir)
 
 Shader* ShaderManager::GetShader(const char* pShaderPath, ShaderType shaderType, const char* pEntryPoint, const Span<ShaderDefine>& defines /*= {}*/)
 {
-	std::lock_guard lock(m_CompileMutex);
-
 	// Libs have no entry point
-	if (!pEntryPoint)
-		pEntryPoint = "";
+	ShaderRequest request{ pShaderPath, shaderType, pEntryPoint ? pEntryPoint : "", defines.Copy() };
+	std::vector<Shader*> shaders;
+	GetShaders(request, shaders);
+	return shaders[0];
+}
+
+static ShaderCompiler::CompileJob CreateCompileJob(const ShaderRequest& request, const std::vector<std::string>& includeDirs, uint8 majVersion, uint8 minVersion)
+{
+	ShaderCompiler::CompileJob job;
+	job.Defines = request.Defines;
+	job.EntryPoint = request.EntryPoint;
+	job.FilePath = request.Path;
+	job.IncludeDirs = includeDirs;
+	job.MajVersion = majVersion;
+	job.MinVersion = minVersion;
+	job.Target = ShaderCompiler::GetShaderTarget(request.Type);
+	job.EnableDebugMode = CommandLine::GetBool("debugshaders");
+	return job;
+}
+
+void ShaderManager::GetShaders(Span<ShaderRequest> requests, std::vector<Shader*>& outShaders)
+{
+	PROFILE_CPU_SCOPE();
 
-	ShaderStringHash pathHash(pShaderPath);
-	ShaderStringHash hash = GetEntryPointHash(pEntryPoint, defines);
+	outShaders.assign(requests.GetSize(), nullptr);
 
-	Shader* pShader = nullptr;
+	// Compiles started by this call, and compiles of other calls this call needs
+	std::vector<std::shared_ptr<CompileTask>> tasks;
+	std::vector<std::pair<uint32, std::shared_ptr<CompileTask>>> requestTasks;
+
+	// Find the shaders which need to be compiled
+	{
+		std::lock_guard lock(m_CompileMutex);
+		for (uint32 i = 0; i < requests.GetSize(); ++i)
+		{
+			const ShaderRequest& request = requests[i];
+			ShaderStringHash pathHash(request.Path.c_str());
+			ShaderStringHash hash = GetEntryPointHash(request.EntryPoint.c_str(), request.Defines);
+
+			auto& shaderMap = m_FilepathToObjectMap[pathHash].Shaders;
+			auto shaderIt = shaderMap.find(hash);
+			if (shaderIt != shaderMap.end() && shaderIt->second && !shaderIt->second->IsDirty)
+			{
+				outShaders[i] = shaderIt->second;
+				continue;
+			}
+
+			const uint64 key = ((uint64)pathHash.m_Hash << 32) | hash.m_Hash;
+			std::shared_ptr<CompileTask>& pTask = m_CompilesInFlight[key];
+			if (!pTask)
+			{
+				pTask = std::make_shared<CompileTask>();
+				pTask->Request = request;
+				pTask->PathHash = pathHash;
+				pTask->Hash = hash;
+				pTask->Key = key;
+				if (shaderIt != shaderMap.end() && shaderIt->second)
+					pTask->PreviousPreprocessedHash = shaderIt->second->PreprocessedHash;
+				tasks.push_back(pTask);
+			}
+			requestTasks.emplace_back(i, pTask);
+		}
+	}
 
+	if (tasks.size() == 1)
+	{
+		RunCompileTask(*tasks[0]);
+	}
+	else if (tasks.size() > 1)
 	{
-		auto& shaderMap = m_FilepathToObjectMap[pathHash].Shaders;
-		auto it = shaderMap.find(hash);
-		if (it != shaderMap.end())
-			pShader = it->second;
+		TaskContext context;
+		TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+			{
+				RunCompileTask(*tasks[args.JobIndex]);
+			}, context, (uint32)tasks.size(), 1);
+		TaskQueue::Join(context);
 	}
 
-	if (pShader && !pShader->IsDirty)
-		return pShader;
+	// Compiles of other calls are run here if they didn't start yet, so this never waits on a job queued behind this one
+	for (auto& requestTask : requestTasks)
+	{
+		RunCompileTask(*requestTask.second);
+		outShaders[requestTask.first] = requestTask.second->pShader;
+	}
+}
 
-	ShaderCompiler::CompileJob job;
-	job.Defines = defines;
-	job.EntryPoint = pEntryPoint;
-	job.FilePath = pShaderPath;
-	job.IncludeDirs = m_IncludeDirs;
-	job.MajVersion = m_ShaderModelMajor;
-	job.MinVersion = m_ShaderModelMinor;
-	job.Target = ShaderCompiler::GetShaderTarget(shaderType);
-	job.EnableDebugMode = CommandLine::GetBool("debugshaders");
+ShaderManager::ByteCode ShaderManager::GetByteCode(const Shader* pShader)
+{
+	std::lock_guard lock(m_CompileMutex);
+	return ByteCode{ pShader->pByteCode, Hash128{ pShader->Hash[0], pShader->Hash[1] } };
+}
+
+void ShaderManager::RunCompileTask(CompileTask& task)
+{
+	// Only held during the compile itself, which never waits on other tasks
+	std::lock_guard taskLock(task.Lock);
+	if (task.IsDone)
+		return;
 
+	ShaderCompiler::CompileJob job = CreateCompileJob(task.Request, m_IncludeDirs, m_ShaderModelMajor, m_ShaderModelMinor);
+	job.PreviousPreprocessedHash = task.PreviousPreprocessedHash;
 	ShaderCompiler::CompileResult result = ShaderCompiler::Compile(job);
 
+	std::lock_guard lock(m_CompileMutex);
+	const ShaderRequest& request = task.Request;
+	Shader* pShader = nullptr;
 	if (!result.Success())
 	{
-		E_LOG(Warning, "Failed to compile shader \"%s:%s\": %s", pShaderPath, pEntryPoint, result.ErrorMessage.c_str());
-		return nullptr;
+		E_LOG(Warning, "Failed to compile shader \"%s:%s\": %s", request.Path.c_str(), request.EntryPoint.c_str(), result.ErrorMessage.c_str());
+	}
+	else
+	{
+		Shader*& pMappedShader = m_FilepathToObjectMap[task.PathHash].Shaders[task.Hash];
+		pShader = pMappedShader ? pMappedShader : m_Shaders.emplace_back(new Shader());
+
+		pShader->Defines = request.Defines;
+		pShader->FilePath = request.Path;
+		pShader->EntryPoint = request.EntryPoint;
+		pShader->Type = request.Type;
+		if (!result.IsUnchanged)
+		{
+			pShader->pByteCode = result.pBlob;
+			memcpy(pShader->Hash, result.ShaderHash, sizeof(uint64) * 2);
+		}
+		pShader->PreprocessedHash = result.PreprocessedHash;
+		pShader->IsDirty = false;
+		UpdateIncludeGraph(pShader, result.Includes, result.IncludeHashes);
+		pMappedShader = pShader;
 	}
 
+	task.pShader = pShader;
+	task.IsDone = true;
+	m_CompilesInFlight.erase(task.Key);
+}
+
+void ShaderManager::BenchmarkCompile()
+{
+	std::vector<ShaderRequest> requests;
 	{
-		if (!pShader)
-			pShader = m_Shaders.emplace_back(new Shader());
+		std::lock_guard lock(m_CompileMutex);
+		for (Shader* pShader : m_Shaders)
+			requests.push_back(ShaderRequest{ pShader->FilePath, pShader->Type, pShader->EntryPoint, pShader->Defines });
+	}
 
-		pShader->Defines = defines.Copy();
-		pShader->EntryPoint = pEntryPoint;
-		pShader->Type = shaderType;
-		pShader->pByteCode = result.pBlob;
-		pShader->IsDirty = false;
-		memcpy(pShader->Hash, result.ShaderHash, sizeof(uint64) * 2);
+	auto CompileAll = [&](bool parallel)
+	{
+		auto Compile = [&](uint32 index)
+		{
+			ShaderCompiler::CompileJob job = CreateCompileJob(requests[index], m_IncludeDirs, m_ShaderModelMajor, m_ShaderModelMinor);
+			job.UseCache = false;
+			ShaderCompiler::Compile(job);
+		};
+
+		Utils::TimeScope timer;
+		if (parallel)
+		{
+			TaskContext context;
+			TaskQueue::ExecuteMany([&](TaskDistributeArgs args) { Compile(args.JobIndex); }, context, (uint32)requests.size(), 1);
+			TaskQueue::Join(context);
+		}
+		else
+		{
+			for (uint32 i = 0; i < (uint32)requests.size(); ++i)
+				Compile(i);
+		}
+		return timer.Stop();
+	};
+
+	E_LOG(Info, "Compiling %d shaders without cache...", (uint32)requests.size());
+	float serialTime = CompileAll(false);
+	float parallelTime = CompileAll(true);
+	E_LOG(Info, "Shader compile: %.2f s (serial) - %.2f s (parallel, %d threads) - %.2fx speedup", serialTime, parallelTime, TaskQueue::ThreadCount(), serialTime / Math::Max(parallelTime, FLT_EPSILON));
 
-		for (const std::string& include : result.Includes)
-			m_IncludeDependencyMap[ShaderStringHash(include)].insert(pShaderPath);
-		m_FilepathToObjectMap[pathHash].Shaders[hash] = pShader;
+	// Nested calls: jobs on the TaskQueue each request an overlapping window of all shaders, with everything dirty.
+	// A job waiting for a permutation another job started must not block on a job queued behind it.
+	if (requests.empty())
+		return;
+	{
+		std::lock_guard lock(m_CompileMutex);
+		for (Shader* pShader : m_Shaders)
+			pShader->IsDirty = true;
+	}
+	const uint32 numRequests = (uint32)requests.size();
+	const uint32 numJobs = TaskQueue::ThreadCount() * 4;
+	const uint32 windowSize = Math::Max(numRequests / 2, 1u);
+	std::vector<std::vector<Shader*>> jobShaders(numJobs);
+
+	Utils::TimeScope nestedTimer;
+	TaskContext context;
+	TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+		{
+			std::vector<ShaderRequest> window;
+			for (uint32 i = 0; i < windowSize; ++i)
+				window.push_back(requests[(args.JobIndex * 7 + i) % numRequests]);
+			GetShaders(window, jobShaders[args.JobIndex]);
+		}, context, numJobs, 1);
+	TaskQueue::Join(context);
+
+	// Every job must see the same shader for the same permutation
+	std::vector<Shader*> shaders;
+	GetShaders(requests, shaders);
+	for (uint32 job = 0; job < numJobs; ++job)
+	{
+		for (uint32 i = 0; i < windowSize; ++i)
+			check(jobShaders[job][i] == shaders[(job * 7 + i) % numRequests], "Nested shader requests got different shaders");
 	}
-	return pShader;
+	E_LOG(Info, "Nested shader requests: %d jobs of %d shaders in %.2f s", numJobs, windowSize, nestedTimer.Stop());
 }
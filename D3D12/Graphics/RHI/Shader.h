@@ -1,4 +1,5 @@
 #pragma once
+#include "Core/Hash.h"
 
 class FileWatcher;
 
@@ -99,10 +100,24 @@ struct Shader
 	ShaderBlob pByteCode;
 	std::vector<ShaderDefine> Defines;
 	ShaderType Type;
+	std::string FilePath;
 	std::string EntryPoint;
+	// Hash of the preprocessed source, without whitespace and line directives
+	Hash128 PreprocessedHash;
+	// Source file and all files it includes
+	std::vector<std::string> Includes;
 	bool IsDirty = false;
 };
 
+struct ShaderRequest
+{
+	std::string Path;
+	ShaderType Type;
+	// Empty for libraries
+	std::string EntryPoint;
+	std::vector<ShaderDefine> Defines;
+};
+
 class ShaderManager
 {
 public:
@@ -114,6 +129,23 @@ public:
 
 	Shader* GetShader(const char* pShaderPath, ShaderType shaderType, const char* pEntryPoint, const Span<ShaderDefine>& defines = {});
 
+	// Shaders of all requests which are not compiled yet are compiled in parallel on the TaskQueue.
+	// 'outShaders' gets a shader for each request, or nullptr if it failed to compile.
+	void GetShaders(Span<ShaderRequest> requests, std::vector<Shader*>& outShaders);
+
+	// Hot reload replaces the byte code of a shader in place.
+	// Users on other threads take a reference to the blob, so it stays alive while they use it.
+	struct ByteCode
+	{
+		ShaderBlob pBlob;
+		Hash128 Hash;
+	};
+	ByteCode GetByteCode(const Shader* pShader);
+
+	// Compiles all shaders requested so far without the cache, serially and in parallel, and logs the times.
+	// Then requests them again from nested jobs on the TaskQueue, to check overlapping calls from jobs finish.
+	void BenchmarkCompile();
+
 	DECLARE_MULTICAST_DELEGATE(OnShaderEdited, Shader* /*pShader*/);
 	OnShaderEdited& OnShaderEditedEvent() { return m_OnShaderEditedEvent; }
 
@@ -123,6 +155,8 @@ private:
 	ShaderStringHash GetEntryPointHash(const char* pEntryPoint, const Span<ShaderDefine>& defines);
 
 	void RecompileFromFileChange(const std::string& filePath);
+	void RecompileDirtyShaders();
+	void UpdateIncludeGraph(Shader* pShader, Span<std::string> includes, Span<Hash128> includeHashes);
 
 	std::vector<std::string> m_IncludeDirs;
 
@@ -130,7 +164,14 @@ private:
 
 	std::vector<Shader*> m_Shaders;
 
-	std::unordered_map<ShaderStringHash, std::unordered_set<std::string>> m_IncludeDependencyMap;
+	// Each file a shader was compiled from, with every permutation which (transitively) includes it.
+	// A file change only dirties the permutations if its content hash changed.
+	struct IncludeNode
+	{
+		Hash128 ContentHash;
+		std::unordered_set<Shader*> Dependents;
+	};
+	std::unordered_map<ShaderStringHash, IncludeNode> m_IncludeGraph;
 
 	struct ShadersInFileMap
 	{
@@ -141,6 +182,22 @@ private:
 	uint8 m_ShaderModelMajor;
 	uint8 m_ShaderModelMinor;
 
+	// A permutation being compiled. Any call which needs it runs it if it didn't start yet, or waits for the thread compiling it.
+	struct CompileTask
+	{
+		std::mutex Lock;
+		ShaderRequest Request;
+		ShaderStringHash PathHash;
+		ShaderStringHash Hash;
+		uint64 Key = 0;
+		Hash128 PreviousPreprocessedHash;
+		bool IsDone = false;
+		Shader* pShader = nullptr;
+	};
+	void RunCompileTask(CompileTask& task);
+
 	std::mutex m_CompileMutex;
+	// Shaders being compiled, so a permutation requested again meanwhile is not compiled twice
+	std::unordered_map<uint64, std::shared_ptr<CompileTask>> m_CompilesInFlight;
 	OnShaderEdited m_OnShaderEditedEvent;
 };
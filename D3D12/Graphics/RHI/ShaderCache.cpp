@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "ShaderCache.h"
+#include "Core/Paths.h"
+#include "Core/Profiler.h"
+#include <share.h>
+
+namespace
+{
+	constexpr uint32 ArchiveMagic = 0x48434853; // "SHCH"
+	constexpr uint32 ArchiveVersion = 2;
+	constexpr uint32 RecordMagic = 0x44524345; // "ECRD"
+	constexpr uint32 RecordAlignment = 8;
+
+	struct FileHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		Hash128 Environment;
+	};
+
+	// Followed by 'NumDependencies' x (DependencyHeader + path), the byte code and padding up to 'Size'
+	struct RecordHeader
+	{
+		uint32 Magic;
+		uint32 Size;
+		Hash128 Key;
+		uint64 ShaderHash[2];
+		Hash128 PreprocessedHash;
+		uint32 NumDependencies;
+		uint32 ByteCodeSize;
+	};
+
+	struct DependencyHeader
+	{
+		Hash128 ContentHash;
+		uint32 PathLength;
+	};
+}
+
+ShaderCacheArchive::~ShaderCacheArchive()
+{
+	Close();
+}
+
+bool ShaderCacheArchive::Open(const char* pFilePath, const Hash128& environment)
+{
+	PROFILE_CPU_SCOPE();
+
+	std::lock_guard lock(m_Mutex);
+	check(!m_pAppendFile);
+
+	m_FilePath = pFilePath;
+	m_Environment = environment;
+	Paths::CreateDirectoryTree(m_FilePath);
+
+	bool isValid = m_File.Open(pFilePath, true) && BuildIndex();
+	if (!isValid)
+		Rewrite();
+
+	m_pAppendFile = _fsopen(pFilePath, "ab", _SH_DENYNO);
+	if (!m_pAppendFile)
+	{
+		E_LOG(Warning, "Failed to open shader cache '%s' for writing", pFilePath);
+		return false;
+	}
+
+	E_LOG(Info, "Loaded shader cache '%s': %d shaders (%.1f MB)", pFilePath, GetNumRecords(), (float)m_Size / (1 << 20));
+	return true;
+}
+
+void ShaderCacheArchive::Close()
+{
+	std::lock_guard lock(m_Mutex);
+	if (m_pAppendFile)
+		fclose(m_pAppendFile);
+	m_pAppendFile = nullptr;
+	m_File.Close();
+	m_Index.clear();
+	m_Size = 0;
+	m_DeadBytes = 0;
+}
+
+bool ShaderCacheArchive::BuildIndex()
+{
+	m_Index.clear();
+	m_Size = 0;
+	m_DeadBytes = 0;
+
+	const uint8* pData = m_File.GetData();
+	const uint64 fileSize = m_File.GetSize();
+
+	FileHeader fileHeader;
+	if (fileSize < sizeof(FileHeader))
+		return false;
+	memcpy(&fileHeader, pData, sizeof(FileHeader));
+	if (fileHeader.Magic != ArchiveMagic || fileHeader.Version != ArchiveVersion || fileHeader.Environment != m_Environment)
+		return false;
+
+	// Later records of the same key replace earlier ones
+	uint64 offset = sizeof(FileHeader);
+	while (offset + sizeof(RecordHeader) <= fileSize)
+	{
+		const RecordHeader* pRecord = (const RecordHeader*)(pData + offset);
+		if (pRecord->Magic != RecordMagic || pRecord->Size < sizeof(RecordHeader) || offset + pRecord->Size > fileSize)
+			break;
+
+		auto it = m_Index.find(pRecord->Key);
+		if (it != m_Index.end())
+			m_DeadBytes += it->second.Size;
+		m_Index[pRecord->Key] = IndexEntry{ offset, pRecord->Size };
+		offset += pRecord->Size;
+	}
+	m_Size = offset;
+
+	if (offset != fileSize)
+	{
+		E_LOG(Warning, "Shader cache '%s' is corrupt after %llu bytes", m_FilePath.c_str(), offset);
+		return false;
+	}
+	return m_DeadBytes <= m_Size - m_DeadBytes;
+}
+
+void ShaderCacheArchive::Rewrite()
+{
+	PROFILE_CPU_SCOPE();
+
+	// Copy the live records to a new file and replace the old one with it
+	std::string tempPath = m_FilePath + ".tmp";
+	FILE* pFile = nullptr;
+	if (fopen_s(&pFile, tempPath.c_str(), "wb") != 0)
+	{
+		E_LOG(Warning, "Failed to create shader cache '%s'", tempPath.c_str());
+		m_File.Close();
+		m_Index.clear();
+		return;
+	}
+
+	FileHeader fileHeader{ ArchiveMagic, ArchiveVersion, m_Environment };
+	fwrite(&fileHeader, sizeof(FileHeader), 1, pFile);
+
+	std::unordered_map<Hash128, IndexEntry> index;
+	uint64 offset = sizeof(FileHeader);
+	for (const auto& entry : m_Index)
+	{
+		fwrite(m_File.GetData() + entry.second.Offset, entry.second.Size, 1, pFile);
+		index[entry.first] = IndexEntry{ offset, entry.second.Size };
+		offset += entry.second.Size;
+	}
+	fclose(pFile);
+
+	m_File.Close();
+	m_Index.clear();
+	m_Size = 0;
+	m_DeadBytes = 0;
+	if (!::MoveFileExA(tempPath.c_str(), m_FilePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		E_LOG(Warning, "Failed to replace shader cache '%s'", m_FilePath.c_str());
+		return;
+	}
+
+	if (m_File.Open(m_FilePath.c_str(), true))
+	{
+		m_Index.swap(index);
+		m_Size = offset;
+	}
+}
+
+bool ShaderCacheArchive::Find(const Hash128& key, Record& outRecord)
+{
+	IndexEntry entry;
+	{
+		std::lock_guard lock(m_Mutex);
+		auto it = m_Index.find(key);
+		if (it == m_Index.end())
+			return false;
+		entry = it->second;
+	}
+
+	// Appended after the file was mapped
+	if (entry.Offset + entry.Size > m_File.GetSize())
+		return false;
+
+	// The mapped part of the file doesn't change until Close()
+	const uint8* pData = m_File.GetData() + entry.Offset;
+	const uint8* pEnd = pData + entry.Size;
+	const RecordHeader* pHeader = (const RecordHeader*)pData;
+	pData += sizeof(RecordHeader);
+
+	memcpy(outRecord.ShaderHash, pHeader->ShaderHash, sizeof(uint64) * 2);
+	outRecord.PreprocessedHash = pHeader->PreprocessedHash;
+	outRecord.Dependencies.resize(pHeader->NumDependencies);
+	for (Dependency& dependency : outRecord.Dependencies)
+	{
+		DependencyHeader dependencyHeader;
+		if (pData + sizeof(DependencyHeader) > pEnd)
+			return false;
+		memcpy(&dependencyHeader, pData, sizeof(DependencyHeader));
+		pData += sizeof(DependencyHeader);
+		if (pData + dependencyHeader.PathLength > pEnd)
+			return false;
+		dependency.ContentHash = dependencyHeader.ContentHash;
+		dependency.Path.assign((const char*)pData, dependencyHeader.PathLength);
+		pData += dependencyHeader.PathLength;
+	}
+
+	if (pData + pHeader->ByteCodeSize > pEnd)
+		return false;
+	outRecord.pByteCode = pData;
+	outRecord.ByteCodeSize = pHeader->ByteCodeSize;
+	return true;
+}
+
+bool ShaderCacheArchive::Add(const Hash128& key, const uint64 shaderHash[2], const Hash128& preprocessedHash, Span<Dependency> dependencies, const void* pByteCode, uint32 byteCodeSize)
+{
+	uint64 recordSize = sizeof(RecordHeader) + byteCodeSize;
+	for (const Dependency& dependency : dependencies)
+		recordSize += sizeof(DependencyHeader) + dependency.Path.length();
+	recordSize = Math::AlignUp<uint64>(recordSize, RecordAlignment);
+
+	std::vector<uint8> buffer(recordSize);
+	RecordHeader& header = *(RecordHeader*)buffer.data();
+	header.Magic = RecordMagic;
+	header.Size = (uint32)recordSize;
+	header.Key = key;
+	memcpy(header.ShaderHash, shaderHash, sizeof(uint64) * 2);
+	header.PreprocessedHash = preprocessedHash;
+	header.NumDependencies = dependencies.GetSize();
+	header.ByteCodeSize = byteCodeSize;
+
+	uint8* pData = buffer.data() + sizeof(RecordHeader);
+	for (const Dependency& dependency : dependencies)
+	{
+		DependencyHeader dependencyHeader{ dependency.ContentHash, (uint32)dependency.Path.length() };
+		memcpy(pData, &dependencyHeader, sizeof(DependencyHeader));
+		pData += sizeof(DependencyHeader);
+		memcpy(pData, dependency.Path.data(), dependency.Path.length());
+		pData += dependency.Path.length();
+	}
+	memcpy(pData, pByteCode, byteCodeSize);
+
+	std::lock_guard lock(m_Mutex);
+	if (!m_pAppendFile)
+		return false;
+
+	if (fwrite(buffer.data(), recordSize, 1, m_pAppendFile) != 1 || fflush(m_pAppendFile) != 0)
+		return false;
+
+	auto it = m_Index.find(key);
+	if (it != m_Index.end())
+		m_DeadBytes += it->second.Size;
+	m_Index[key] = IndexEntry{ m_Size, (uint32)recordSize };
+	m_Size += recordSize;
+	return true;
+}
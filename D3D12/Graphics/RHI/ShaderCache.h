@@ -0,0 +1,68 @@
+#pragma once
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+
+/*
+	Compiled shaders of all permutations, stored in a single file.
+
+	- Records are addressed by a 128-bit key, computed by the user from everything that affects the compiled shader.
+	- Each record stores the path and content hash of every file the shader was compiled from,
+	  so the user can verify that the sources didn't change since. It also stores a hash of the preprocessed source,
+	  so byte code can be reused when a source changed in a way that doesn't affect it.
+	- The file is memory-mapped once on Open() and indexed by walking the record headers.
+	- New records are only appended. A key added again makes its previous record dead.
+	  When there are more dead bytes than live ones, or the end of the file is corrupt, the live records are
+	  copied to a new file on Open().
+	- The file starts with a hash of the environment (eg. compiler version). When it doesn't match, the file is discarded.
+*/
+class ShaderCacheArchive
+{
+public:
+	struct Dependency
+	{
+		std::string Path;
+		Hash128 ContentHash;
+	};
+
+	struct Record
+	{
+		uint64 ShaderHash[2];
+		Hash128 PreprocessedHash;
+		std::vector<Dependency> Dependencies;
+		// Points in the mapped file. Valid until Close().
+		const void* pByteCode;
+		uint32 ByteCodeSize;
+	};
+
+	~ShaderCacheArchive();
+
+	bool Open(const char* pFilePath, const Hash128& environment);
+	void Close();
+
+	// Records added after Open() are not found until the next Open()
+	bool Find(const Hash128& key, Record& outRecord);
+	bool Add(const Hash128& key, const uint64 shaderHash[2], const Hash128& preprocessedHash, Span<Dependency> dependencies, const void* pByteCode, uint32 byteCodeSize);
+
+	uint32 GetNumRecords() const { return (uint32)m_Index.size(); }
+	uint64 GetSize() const { return m_Size; }
+
+private:
+	struct IndexEntry
+	{
+		uint64 Offset;
+		uint32 Size;
+	};
+
+	// Returns false if the file needs to be written again
+	bool BuildIndex();
+	void Rewrite();
+
+	std::mutex m_Mutex;
+	std::string m_FilePath;
+	Hash128 m_Environment;
+	MappedFile m_File;
+	FILE* m_pAppendFile = nullptr;
+	std::unordered_map<Hash128, IndexEntry> m_Index;
+	uint64 m_Size = 0;
+	uint64 m_DeadBytes = 0;
+};
@@ -132,11 +132,19 @@ bool StateObjectInitializer::CreateStateObjectStream(StateObjectStream& stateObj
 		return pState;
 	};
 
-	std::vector<Shader*> shaders;
+	// Compile all libraries together
+	std::vector<ShaderRequest> libraryRequests;
 	for (const LibraryExports& library : m_Libraries)
+		libraryRequests.push_back(ShaderRequest{ library.Path, ShaderType::MAX, "", library.Defines });
+	std::vector<Shader*> libraries;
+	pDevice->GetShaderManager()->GetShaders(libraryRequests, libraries);
+
+	std::vector<Shader*> shaders;
+	for (uint32 libraryIndex = 0; libraryIndex < (uint32)m_Libraries.size(); ++libraryIndex)
 	{
+		const LibraryExports& library = m_Libraries[libraryIndex];
 		D3D12_DXIL_LIBRARY_DESC* pDesc = stateObjectStream.ContentData.Allocate<D3D12_DXIL_LIBRARY_DESC>();
-		Shader* pLibrary = pDevice->GetLibrary(library.Path.c_str(), library.Defines);
+		Shader* pLibrary = libraries[libraryIndex];
 		if (!pLibrary)
 			return false;
 
@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include "StreamingUploader.h"
+#include "Graphics.h"
+#include "Buffer.h"
+#include "CommandContext.h"
+#include "CommandQueue.h"
+#include "Core/Profiler.h"
+
+CopyQueueUploadBackend::CopyQueueUploadBackend(GraphicsDevice* pDevice)
+	: m_pDevice(pDevice)
+{
+}
+
+void* CopyQueueUploadBackend::CreatePage(uint32 pageIndex, uint64 size)
+{
+	RefCountPtr<Buffer> pPage = m_pDevice->CreateBuffer(BufferDesc::CreateBuffer(size, BufferFlag::Upload | BufferFlag::NoBindless), Sprintf("StreamingUploader.Page%d", pageIndex).c_str());
+	std::scoped_lock lock(m_PagesLock);
+	check(pageIndex == (uint32)m_Pages.size());
+	m_Pages.push_back(pPage);
+	return pPage->GetMappedData();
+}
+
+void CopyQueueUploadBackend::RecordCopy(uint32 pageIndex, uint64 pageOffset, const UploadTarget& target, uint64 targetOffset, uint64 size)
+{
+	check(target.pBuffer, "Uploads on the copy queue need a buffer target");
+	if (!m_pContext)
+		m_pContext = m_pDevice->AllocateCommandContext(D3D12_COMMAND_LIST_TYPE_COPY);
+
+	Buffer* pPage = nullptr;
+	{
+		std::scoped_lock lock(m_PagesLock);
+		pPage = m_Pages[pageIndex];
+	}
+	m_pContext->CopyBuffer(pPage, target.pBuffer, size, pageOffset, targetOffset);
+}
+
+uint64 CopyQueueUploadBackend::Submit()
+{
+	check(m_pContext);
+	SyncPoint syncPoint = m_pContext->Execute();
+	m_pContext = nullptr;
+	m_pDevice->GetCommandQueue(D3D12_COMMAND_LIST_TYPE_DIRECT)->InsertWait(syncPoint);
+	m_pDevice->GetCommandQueue(D3D12_COMMAND_LIST_TYPE_COMPUTE)->InsertWait(syncPoint);
+	return syncPoint.GetFenceValue();
+}
+
+uint64 CopyQueueUploadBackend::GetCompletedFenceValue()
+{
+	return m_pDevice->GetCommandQueue(D3D12_COMMAND_LIST_TYPE_COPY)->GetFence()->GetLastCompletedValue();
+}
+
+void CopyQueueUploadBackend::WaitForFence(uint64 fenceValue)
+{
+	m_pDevice->GetCommandQueue(D3D12_COMMAND_LIST_TYPE_COPY)->GetFence()->CpuWait(fenceValue);
+}
+
+StreamingUploader::StreamingUploader(std::unique_ptr<IUploadBackend> pBackend, uint64 pageSize)
+	: m_pBackend(std::move(pBackend)), m_PageSize(Math::AlignUp<uint64>(pageSize, 16))
+{
+}
+
+StreamingUploader::~StreamingUploader()
+{
+	Flush();
+	uint64 fenceValue = 0;
+	for (const std::unique_ptr<Page>& pPage : m_Pages)
+		fenceValue = Math::Max(fenceValue, pPage->FenceValue.load());
+	m_pBackend->WaitForFence(fenceValue);
+}
+
+UploadTicket StreamingUploader::Upload(const UploadTarget& target, uint64 targetOffset, const void* pData, uint64 size)
+{
+	UploadTicket ticket;
+	if (size == 0)
+		return ticket;
+
+	ticket.RequestId = m_NextRequestId.fetch_add(1);
+	const uint32 numChunks = (uint32)((size + m_PageSize - 1) / m_PageSize);
+	for (uint32 chunk = 0; chunk < numChunks; ++chunk)
+	{
+		const uint64 chunkOffset = chunk * m_PageSize;
+		const uint64 chunkSize = Math::Min(size - chunkOffset, m_PageSize);
+
+		StagedCopy* pCopy = new StagedCopy;
+		pCopy->RequestId = ticket.RequestId;
+		pCopy->Chunk = chunk;
+		pCopy->NumChunks = numChunks;
+		pCopy->pPage = Reserve(Math::AlignUp<uint64>(chunkSize, 16), pCopy->PageOffset);
+		pCopy->Target = target;
+		pCopy->TargetOffset = targetOffset + chunkOffset;
+		pCopy->Size = chunkSize;
+		memcpy((char*)pCopy->pPage->pMappedData + pCopy->PageOffset, (const char*)pData + chunkOffset, chunkSize);
+
+		pCopy->pNext = m_pStagedCopies.load();
+		while (!m_pStagedCopies.compare_exchange_weak(pCopy->pNext, pCopy))
+		{
+		}
+	}
+	return ticket;
+}
+
+void StreamingUploader::Flush(uint64 maxBytes)
+{
+	PROFILE_CPU_SCOPE();
+	std::scoped_lock lock(m_FlushLock);
+
+	for (StagedCopy* pCopy = m_pStagedCopies.exchange(nullptr); pCopy; pCopy = pCopy->pNext)
+		m_QueuedCopies.push_back(pCopy);
+	std::sort(m_QueuedCopies.begin(), m_QueuedCopies.end(), [](const StagedCopy* pA, const StagedCopy* pB)
+		{
+			return pA->RequestId != pB->RequestId ? pA->RequestId < pB->RequestId : pA->Chunk < pB->Chunk;
+		});
+
+	uint64 numBytes = 0;
+	uint32 numCopies = 0;
+	for (const StagedCopy* pCopy : m_QueuedCopies)
+	{
+		if (numCopies > 0 && numBytes + pCopy->Size > maxBytes)
+			break;
+		m_pBackend->RecordCopy(pCopy->pPage->Index, pCopy->PageOffset, pCopy->Target, pCopy->TargetOffset, pCopy->Size);
+		numBytes += pCopy->Size;
+		++numCopies;
+	}
+
+	if (numCopies > 0)
+	{
+		const uint64 fenceValue = m_pBackend->Submit();
+
+		std::scoped_lock requestLock(m_RequestLock);
+		for (uint32 i = 0; i < numCopies; ++i)
+		{
+			StagedCopy* pCopy = m_QueuedCopies[i];
+			// The fence value has to be set before the page can be seen without users
+			pCopy->pPage->FenceValue.store(fenceValue);
+			pCopy->pPage->NumUsers.fetch_sub(1);
+
+			RequestState& request = m_Requests.try_emplace(pCopy->RequestId, RequestState{ pCopy->NumChunks, 0 }).first->second;
+			if (--request.NumChunksLeft == 0)
+				request.FenceValue = fenceValue;
+			delete pCopy;
+		}
+		m_QueuedCopies.erase(m_QueuedCopies.begin(), m_QueuedCopies.begin() + numCopies);
+	}
+}
+
+bool StreamingUploader::IsComplete(UploadTicket ticket)
+{
+	if (ticket.RequestId == 0)
+		return true;
+
+	std::scoped_lock lock(m_RequestLock);
+	UpdateCompletedRequests();
+	return ticket.RequestId < m_OldestPendingRequest;
+}
+
+uint32 StreamingUploader::GetNumPages()
+{
+	std::scoped_lock lock(m_PageLock);
+	return (uint32)m_Pages.size();
+}
+
+StreamingUploader::Page* StreamingUploader::Reserve(uint64 size, uint64& outOffset)
+{
+	check(size <= m_PageSize);
+	for (;;)
+	{
+		Page* pPage = m_pCurrentPage.load();
+		if (pPage)
+		{
+			// The user is added first, so a page is never seen unused while it is written to
+			pPage->NumUsers.fetch_add(1);
+			uint64 offset = pPage->Offset.fetch_add(size);
+			if (offset + size <= m_PageSize)
+			{
+				outOffset = offset;
+				return pPage;
+			}
+			pPage->NumUsers.fetch_sub(1);
+		}
+		SwitchPage(pPage);
+	}
+}
+
+void StreamingUploader::SwitchPage(Page* pFullPage)
+{
+	std::scoped_lock lock(m_PageLock);
+	// Another thread switched already
+	if (m_pCurrentPage.load() != pFullPage)
+		return;
+
+	if (pFullPage)
+		pFullPage->Offset.store(ClosedPageOffset);
+
+	// Reuse a closed page whose copies are all done
+	const uint64 completedFenceValue = m_pBackend->GetCompletedFenceValue();
+	Page* pNewPage = nullptr;
+	for (std::unique_ptr<Page>& pPage : m_Pages)
+	{
+		if (pPage.get() != pFullPage && pPage->Offset.load() >= ClosedPageOffset && pPage->NumUsers.load() == 0 && pPage->FenceValue.load() <= completedFenceValue)
+		{
+			pNewPage = pPage.get();
+			break;
+		}
+	}
+
+	if (!pNewPage)
+	{
+		pNewPage = m_Pages.emplace_back(std::make_unique<Page>()).get();
+		pNewPage->Index = (uint32)m_Pages.size() - 1;
+		pNewPage->pMappedData = m_pBackend->CreatePage(pNewPage->Index, m_PageSize);
+	}
+
+	pNewPage->Offset.store(0);
+	m_pCurrentPage.store(pNewPage);
+}
+
+void StreamingUploader::UpdateCompletedRequests()
+{
+	const uint64 completedFenceValue = m_pBackend->GetCompletedFenceValue();
+	for (;;)
+	{
+		auto it = m_Requests.find(m_OldestPendingRequest);
+		if (it == m_Requests.end() || it->second.NumChunksLeft > 0 || it->second.FenceValue > completedFenceValue)
+			break;
+		m_Requests.erase(it);
+		++m_OldestPendingRequest;
+	}
+}
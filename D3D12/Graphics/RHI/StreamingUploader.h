@@ -0,0 +1,147 @@
+#pragma once
+#include "GraphicsResource.h"
+
+/*
+	Destination of an upload. The uploader only hands it to its backend.
+	The copy queue backend writes to buffers, CPU backends write to CPU memory instead.
+*/
+struct UploadTarget
+{
+	UploadTarget() = default;
+	explicit UploadTarget(Buffer* pBuffer) : pBuffer(pBuffer) {}
+	explicit UploadTarget(void* pCPUMemory) : pCPUMemory(pCPUMemory) {}
+
+	Buffer* pBuffer = nullptr;
+	void* pCPUMemory = nullptr;
+};
+
+/*
+	Where the StreamingUploader gets its staging memory and records its copies.
+	Implemented on the copy queue, or on the CPU to test the staging and batching logic.
+*/
+class IUploadBackend
+{
+public:
+	virtual ~IUploadBackend() = default;
+
+	// Creates a staging page and returns its mapped memory. Can be called from any thread.
+	virtual void* CreatePage(uint32 pageIndex, uint64 size) = 0;
+	virtual void RecordCopy(uint32 pageIndex, uint64 pageOffset, const UploadTarget& target, uint64 targetOffset, uint64 size) = 0;
+	// Submits the recorded copies and returns the fence value signaled once they are done
+	virtual uint64 Submit() = 0;
+	// Can be called from any thread
+	virtual uint64 GetCompletedFenceValue() = 0;
+	virtual void WaitForFence(uint64 fenceValue) = 0;
+};
+
+class CopyQueueUploadBackend : public IUploadBackend
+{
+public:
+	CopyQueueUploadBackend(GraphicsDevice* pDevice);
+
+	void* CreatePage(uint32 pageIndex, uint64 size) override;
+	void RecordCopy(uint32 pageIndex, uint64 pageOffset, const UploadTarget& target, uint64 targetOffset, uint64 size) override;
+	// The direct and compute queues wait for the copies, so the uploaded data can be used in any later frame
+	uint64 Submit() override;
+	uint64 GetCompletedFenceValue() override;
+	void WaitForFence(uint64 fenceValue) override;
+
+private:
+	GraphicsDevice* m_pDevice;
+	CommandContext* m_pContext = nullptr;
+	std::mutex m_PagesLock;
+	std::vector<RefCountPtr<Buffer>> m_Pages;
+};
+
+struct UploadTicket
+{
+	uint64 RequestId = 0;
+};
+
+/*
+	Uploads data to buffers through staging pages, batching the copies in as few submissions as possible.
+
+	- Upload() copies the data to a staging page right away and can be called from any thread.
+	  Space in a page is reserved with an atomic add. The lock is only taken to switch to another page.
+	- Uploads larger than a page are split in chunks of at most a page.
+	- Staged copies are pushed on a lock-free list. Flush() takes them all and submits them in the order of the requests,
+	  up to a number of bytes, so the upload bandwidth of a frame can be limited. The remaining copies wait for the next Flush().
+	- Each request gets the fence value of the submission of its last chunk. IsComplete() checks it.
+	- A page is reused once it is full, all its copies are submitted and the GPU completed them.
+	  New pages are created when none can be reused.
+	- The targets must stay alive until their upload completed.
+*/
+class StreamingUploader
+{
+public:
+	StreamingUploader(std::unique_ptr<IUploadBackend> pBackend, uint64 pageSize);
+	~StreamingUploader();
+
+	UploadTicket Upload(const UploadTarget& target, uint64 targetOffset, const void* pData, uint64 size);
+	UploadTicket Upload(Buffer* pTarget, uint64 targetOffset, const void* pData, uint64 size) { return Upload(UploadTarget(pTarget), targetOffset, pData, size); }
+
+	// Submits the staged copies, up to 'maxBytes'. At least one copy is submitted, even if it is larger.
+	void Flush(uint64 maxBytes = ~0ull);
+
+	bool IsComplete(UploadTicket ticket);
+
+	uint32 GetNumPages();
+	uint64 GetPageSize() const { return m_PageSize; }
+
+private:
+	struct Page
+	{
+		uint32 Index = 0;
+		void* pMappedData = nullptr;
+		std::atomic<uint64> Offset = 0;
+		// Uploads writing to the page, and copies from it which are not submitted yet
+		std::atomic<uint32> NumUsers = 0;
+		// Fence value of the last submission with copies from this page
+		std::atomic<uint64> FenceValue = 0;
+	};
+
+	struct StagedCopy
+	{
+		StagedCopy* pNext;
+		uint64 RequestId;
+		uint32 Chunk;
+		uint32 NumChunks;
+		Page* pPage;
+		uint64 PageOffset;
+		UploadTarget Target;
+		uint64 TargetOffset;
+		uint64 Size;
+	};
+
+	struct RequestState
+	{
+		uint32 NumChunksLeft;
+		uint64 FenceValue;
+	};
+
+	// Offset of a page which is not the current page anymore. Any reservation in it fails.
+	static constexpr uint64 ClosedPageOffset = 1ull << 62;
+
+	// Reserves 'size' bytes in the current page. The page has a user added which is removed when the copy is submitted.
+	Page* Reserve(uint64 size, uint64& outOffset);
+	void SwitchPage(Page* pFullPage);
+	void UpdateCompletedRequests();
+
+	std::unique_ptr<IUploadBackend> m_pBackend;
+	uint64 m_PageSize;
+
+	std::mutex m_PageLock;
+	std::vector<std::unique_ptr<Page>> m_Pages;
+	std::atomic<Page*> m_pCurrentPage = nullptr;
+
+	std::atomic<uint64> m_NextRequestId = 1;
+	std::atomic<StagedCopy*> m_pStagedCopies = nullptr;
+
+	std::mutex m_FlushLock;
+	std::vector<StagedCopy*> m_QueuedCopies;
+
+	std::mutex m_RequestLock;
+	std::unordered_map<uint64, RequestState> m_Requests;
+	// All requests before this one are complete
+	uint64 m_OldestPendingRequest = 1;
+};
@@ -11,11 +11,43 @@
 #include "Core/ConsoleVariables.h"
 #include "Content/Image.h"
 #include "Core/Profiler.h"
+#include "Core/TaskQueue.h"
+#include "Core/RadixSort.h"
+#include "DebugRenderer.h"
 
 namespace Tweakables
 {
 	extern ConsoleVariable<int> g_SsrSamples;
 	extern ConsoleVariable<bool> g_EnableDDGI;
+
+	ConsoleVariable g_IncrementalSceneUpload("r.Scene.IncrementalUpload", true);
+
+	// Scene upload statistics, accumulated over the number of frames passed to 'MeasureSceneUpload'
+	struct SceneUploadMeasurement
+	{
+		struct Frames
+		{
+			uint32 NumFrames = 0;
+			float CPUTime = 0.0f;
+			uint64 UploadedBytes = 0;
+		};
+		uint32 FramesLeft = 0;
+		Frames Static;
+		Frames Animated;
+		uint64 SceneBytes = 0;
+	};
+	SceneUploadMeasurement g_SceneUploadMeasurement;
+
+	// Set by the BenchmarkSceneFlattening and BenchmarkAnimation commands
+	int g_BenchmarkSceneFlattening = 0;
+	int g_BenchmarkAnimation = 0;
+	ConsoleVariable g_UpdateAnimations("r.Animation.Update", true);
+	ConsoleVariable g_DrawSkeletons("r.Animation.DrawSkeletons", false);
+	ConsoleCommand<int> gMeasureSceneUpload("MeasureSceneUpload", [](int numFrames)
+		{
+			g_SceneUploadMeasurement = {};
+			g_SceneUploadMeasurement.FramesLeft = Math::Max(numFrames, 1);
+		});
 }
 
 namespace Renderer
@@ -73,13 +105,13 @@ namespace Renderer
 		parameters.NumCascades = pView->NumShadowCascades;
 
 		parameters.TLASIndex = pView->AccelerationStructure.GetSRV() ? pView->AccelerationStructure.GetSRV()->GetHeapIndex() : DescriptorHandle::InvalidHeapIndex;
-		parameters.MeshesIndex = pView->pMeshBuffer->GetSRVIndex();
-		parameters.MaterialsIndex = pView->pMaterialBuffer->GetSRVIndex();
-		parameters.InstancesIndex = pView->pInstanceBuffer->GetSRVIndex();
-		parameters.LightsIndex = pView->pLightBuffer->GetSRVIndex();
-		parameters.LightMatricesIndex = pView->pLightMatricesBuffer->GetSRVIndex();
+		parameters.MeshesIndex = pView->MeshBuffer.GetSRVIndex();
+		parameters.MaterialsIndex = pView->MaterialBuffer.GetSRVIndex();
+		parameters.InstancesIndex = pView->InstanceBuffer.GetSRVIndex();
+		parameters.LightsIndex = pView->LightBuffer.GetSRVIndex();
+		parameters.LightMatricesIndex = pView->LightMatricesBuffer.GetSRVIndex();
 		parameters.SkyIndex = pView->pSky ? pView->pSky->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-		parameters.DDGIVolumesIndex = pView->pDDGIVolumesBuffer->GetSRVIndex();
+		parameters.DDGIVolumesIndex = pView->DDGIVolumesBuffer.GetSRVIndex();
 		parameters.NumDDGIVolumes = pView->NumDDGIVolumes;
 
 		parameters.FontDataIndex = pView->DebugRenderData.FontDataSRV;
@@ -94,65 +126,179 @@ namespace Renderer
 		return GetViewUniforms(pView, &pView->MainView, pTarget);
 	}
 
-	void UploadSceneData(CommandContext& context, SceneView* pView, const World* pWorld)
+	// Uploads the ranges of dirty elements and clears the dirty flags. The copies of all ranges share a single scratch allocation.
+	// Returns the number of bytes uploaded.
+	template<typename T>
+	static uint64 UploadSceneBuffer(CommandContext& context, const char* pName, SceneBuffer<T>& buffer)
+	{
+		constexpr uint32 stride = sizeof(T);
+		const uint32 numElements = (uint32)buffer.Data.size();
+		buffer.DirtyElements.Resize(numElements);
+		if (!Tweakables::g_IncrementalSceneUpload)
+			buffer.DirtyElements.SetAll();
+
+		uint32 desiredElements = Math::AlignUp(Math::Max(1u, numElements), 8u);
+		if (!buffer.pBuffer || desiredElements > buffer.pBuffer->GetNumElements())
+		{
+			buffer.pBuffer = context.GetParent()->CreateBuffer(BufferDesc::CreateStructured(desiredElements, stride, BufferFlag::ShaderResource), pName);
+			buffer.DirtyElements.SetAll();
+		}
+
+		struct Range
+		{
+			uint32 First;
+			uint32 Count;
+		};
+		std::vector<Range> ranges;
+		buffer.DirtyElements.ForEachSetBit([&](uint32 element)
+			{
+				if (!ranges.empty() && ranges.back().First + ranges.back().Count == element)
+					ranges.back().Count++;
+				else
+					ranges.push_back({ element, 1 });
+			});
+
+		const uint64 uploadSize = (uint64)buffer.DirtyElements.CountSetBits() * stride;
+		if (uploadSize > 0)
+		{
+			const uint8* pSource = (const uint8*)buffer.Data.data();
+			ScratchAllocation allocation = context.AllocateScratch(uploadSize);
+			uint64 offset = 0;
+			for (const Range& range : ranges)
+			{
+				const uint64 rangeSize = (uint64)range.Count * stride;
+				memcpy((uint8*)allocation.pMappedMemory + offset, pSource + (uint64)range.First * stride, rangeSize);
+				context.CopyBuffer(allocation.pBackingResource, buffer.pBuffer, rangeSize, allocation.Offset + offset, (uint64)range.First * stride);
+				offset += rangeSize;
+			}
+		}
+		buffer.DirtyElements.ClearAll();
+		return uploadSize;
+	}
+
+	// Flattened scene data, indexed by instance ID, mesh index and material index
+	struct FlatSceneData
+	{
+		std::vector<Batch> Batches;
+		std::vector<ShaderInterop::InstanceData> Instances;
+		std::vector<ShaderInterop::MeshData> Meshes;
+		std::vector<ShaderInterop::MaterialData> Materials;
+	};
+
+	// Number of instances written by a single job in FlattenScene()
+	static constexpr uint32 InstancesPerFlattenJob = 1024;
+
+	// Number of frames an instance has to stay still before it is considered static again
+	static constexpr uint32 FramesUntilStatic = 30;
+
+	static Batch::Blending GetBlendMode(MaterialAlphaMode mode)
+	{
+		switch (mode)
+		{
+		case MaterialAlphaMode::Blend: return Batch::Blending::AlphaBlend;
+		case MaterialAlphaMode::Opaque: return Batch::Blending::Opaque;
+		case MaterialAlphaMode::Masked: return Batch::Blending::AlphaMask;
+		}
+		return Batch::Blending::Opaque;
+	}
+
+	static void GetMaterialData(const Material& material, ShaderInterop::MaterialData& outData)
+	{
+		outData.Diffuse = material.pDiffuseTexture ? material.pDiffuseTexture->GetSRVIndex() : -1;
+		outData.Normal = material.pNormalTexture ? material.pNormalTexture->GetSRVIndex() : -1;
+		outData.RoughnessMetalness = material.pRoughnessMetalnessTexture ? material.pRoughnessMetalnessTexture->GetSRVIndex() : -1;
+		outData.Emissive = material.pEmissiveTexture ? material.pEmissiveTexture->GetSRVIndex() : -1;
+		outData.BaseColorFactor = material.BaseColorFactor;
+		outData.MetalnessFactor = material.MetalnessFactor;
+		outData.RoughnessFactor = material.RoughnessFactor;
+		outData.EmissiveFactor = material.EmissiveFactor;
+		outData.AlphaCutoff = material.AlphaCutoff;
+		switch (material.AlphaMode)
+		{
+		case MaterialAlphaMode::Blend:	outData.RasterBin = 0xFFFFFFFF;	break;
+		case MaterialAlphaMode::Opaque: outData.RasterBin = 0;			break;
+		case MaterialAlphaMode::Masked: outData.RasterBin = 1;			break;
+		}
+	}
+
+	// Flattens the instances, meshes and materials of all meshes into arrays.
+	// A prefix sum over the meshes gives the offset of each mesh in every array, so instance ranges and meshes are filled in parallel.
+	// 'prevInstances' is the data of the last frame and is only used if the number of instances is unchanged.
+	static void FlattenScene(Span<Mesh*> meshes, Span<ShaderInterop::InstanceData> prevInstances, FlatSceneData& outData, bool parallel)
 	{
 		PROFILE_CPU_SCOPE();
-		PROFILE_GPU_SCOPE(context.GetCommandList());
 
-		std::vector<ShaderInterop::MaterialData> materials;
-		materials.reserve(128);
-		std::vector<ShaderInterop::MeshData> meshes;
-		meshes.reserve(128);
-		std::vector<ShaderInterop::InstanceData> meshInstances;
-		meshInstances.reserve(pView->Batches.size());
-		std::vector<Batch> sceneBatches;
-		sceneBatches.reserve(pView->Batches.size());
-		uint32 instanceID = 0;
+		struct MeshOffsets
+		{
+			uint32 Instance = 0;
+			uint32 Mesh = 0;
+			uint32 Material = 0;
+		};
+		std::vector<MeshOffsets> offsets(meshes.GetSize() + 1);
+		for (uint32 i = 0; i < meshes.GetSize(); ++i)
+		{
+			Mesh* pMesh = meshes[i];
+			offsets[i + 1].Instance = offsets[i].Instance + pMesh->GetMeshInstances().GetSize();
+			offsets[i + 1].Mesh = offsets[i].Mesh + pMesh->GetMeshes().GetSize();
+			offsets[i + 1].Material = offsets[i].Material + pMesh->GetMaterials().GetSize();
+		}
 
-		for (const auto& pMesh : pWorld->Meshes)
+		const MeshOffsets& totals = offsets.back();
+		outData.Batches.resize(totals.Instance);
+		outData.Instances.resize(totals.Instance);
+		outData.Meshes.resize(totals.Mesh);
+		outData.Materials.resize(totals.Material);
+		const bool hasPrevInstances = prevInstances.GetSize() == totals.Instance;
+
+		auto FlattenInstances = [&](uint32 jobIndex)
 		{
-			for (const SubMeshInstance& node : pMesh->GetMeshInstances())
+			const uint32 first = jobIndex * InstancesPerFlattenJob;
+			const uint32 last = Math::Min(first + InstancesPerFlattenJob, totals.Instance);
+
+			// Find the mesh of the first instance, the next ones are found by walking forward
+			uint32 meshIndex = (uint32)(std::upper_bound(offsets.begin(), offsets.end(), first, [](uint32 instance, const MeshOffsets& meshOffsets) { return instance < meshOffsets.Instance; }) - offsets.begin()) - 1;
+			for (uint32 instanceID = first; instanceID < last; ++instanceID)
 			{
+				while (instanceID >= offsets[meshIndex + 1].Instance)
+					++meshIndex;
+
+				Mesh* pMesh = meshes[meshIndex];
+				const SubMeshInstance& node = pMesh->GetMeshInstances()[instanceID - offsets[meshIndex].Instance];
 				SubMesh& parentMesh = pMesh->GetMesh(node.MeshIndex);
 				const Material& meshMaterial = pMesh->GetMaterial(parentMesh.MaterialId);
 
-				auto GetBlendMode = [](MaterialAlphaMode mode) {
-					switch (mode)
-					{
-					case MaterialAlphaMode::Blend: return Batch::Blending::AlphaBlend;
-					case MaterialAlphaMode::Opaque: return Batch::Blending::Opaque;
-					case MaterialAlphaMode::Masked: return Batch::Blending::AlphaMask;
-					}
-					return Batch::Blending::Opaque;
-				};
-
-				Batch& batch = sceneBatches.emplace_back();
+				Batch& batch = outData.Batches[instanceID];
 				batch.InstanceID = instanceID;
+				batch.MaterialIndex = offsets[meshIndex].Material + parentMesh.MaterialId;
 				batch.pMesh = &parentMesh;
 				batch.BlendMode = GetBlendMode(meshMaterial.AlphaMode);
 				batch.WorldMatrix = node.Transform;
 				parentMesh.Bounds.Transform(batch.Bounds, batch.WorldMatrix);
 				batch.Radius = Vector3(batch.Bounds.Extents).Length();
 
-				ShaderInterop::InstanceData& meshInstance = meshInstances.emplace_back();
+				ShaderInterop::InstanceData& meshInstance = outData.Instances[instanceID];
 				meshInstance.ID = instanceID;
-				meshInstance.MeshIndex = (uint32)meshes.size() + node.MeshIndex;
-				meshInstance.MaterialIndex = (uint32)materials.size() + parentMesh.MaterialId;
+				meshInstance.MeshIndex = offsets[meshIndex].Mesh + node.MeshIndex;
+				meshInstance.MaterialIndex = batch.MaterialIndex;
 				meshInstance.LocalToWorld = node.Transform;
-				meshInstance.LocalToWorldPrev = node.Transform; //#todo
+				meshInstance.LocalToWorldPrev = hasPrevInstances ? prevInstances[instanceID].LocalToWorld : node.Transform;
 				meshInstance.LocalBoundsOrigin = parentMesh.Bounds.Center;
 				meshInstance.LocalBoundsExtents = parentMesh.Bounds.Extents;
-
-				++instanceID;
 			}
+		};
 
+		auto FlattenMesh = [&](uint32 meshIndex)
+		{
+			Mesh* pMesh = meshes[meshIndex];
+			uint32 meshDataIndex = offsets[meshIndex].Mesh;
 			for (const SubMesh& subMesh : pMesh->GetMeshes())
 			{
-				ShaderInterop::MeshData& mesh = meshes.emplace_back();
+				ShaderInterop::MeshData& mesh = outData.Meshes[meshDataIndex++];
 				mesh.BufferIndex = pMesh->GetData()->GetSRVIndex();
 				mesh.IndexByteSize = subMesh.IndicesLocation.Stride();
 				mesh.IndicesOffset = (uint32)subMesh.IndicesLocation.OffsetFromStart;
 				mesh.PositionsOffset = (uint32)subMesh.PositionStreamLocation.OffsetFromStart;
+				mesh.PositionsPrevOffset = (uint32)subMesh.PositionPrevStreamLocation.OffsetFromStart;
 				mesh.NormalsOffset = (uint32)subMesh.NormalStreamLocation.OffsetFromStart;
 				mesh.ColorsOffset = (uint32)subMesh.ColorsStreamLocation.OffsetFromStart;
 				mesh.UVsOffset = (uint32)subMesh.UVStreamLocation.OffsetFromStart;
@@ -162,111 +308,523 @@ namespace Renderer
 				mesh.MeshletTriangleOffset = subMesh.MeshletTrianglesLocation;
 				mesh.MeshletBoundsOffset = subMesh.MeshletBoundsLocation;
 				mesh.MeshletCount = subMesh.NumMeshlets;
+				mesh.MeshletLODOffset = subMesh.MeshletLODsLocation;
+				mesh.MeshletLODCount = subMesh.NumLODMeshlets;
 			}
 
+			uint32 materialIndex = offsets[meshIndex].Material;
 			for (const Material& material : pMesh->GetMaterials())
+				GetMaterialData(material, outData.Materials[materialIndex++]);
+		};
+
+		const uint32 numInstanceJobs = Math::DivideAndRoundUp(totals.Instance, InstancesPerFlattenJob);
+		if (parallel)
+		{
+			TaskContext taskContext;
+			TaskQueue::ExecuteMany([&](TaskDistributeArgs args) { FlattenInstances(args.JobIndex); }, taskContext, numInstanceJobs, 1);
+			TaskQueue::ExecuteMany([&](TaskDistributeArgs args) { FlattenMesh(args.JobIndex); }, taskContext, meshes.GetSize());
+			TaskQueue::Join(taskContext);
+		}
+		else
+		{
+			for (uint32 i = 0; i < numInstanceJobs; ++i)
+				FlattenInstances(i);
+			for (uint32 i = 0; i < meshes.GetSize(); ++i)
+				FlattenMesh(i);
+		}
+	}
+
+	// Flattens the meshes of the world repeatedly until there are at least 'numInstances' instances, on one thread and in parallel
+	static void BenchmarkFlattening(Span<Mesh*> worldMeshes, int numInstances)
+	{
+		uint32 numWorldInstances = 0;
+		for (Mesh* pMesh : worldMeshes)
+			numWorldInstances += pMesh->GetMeshInstances().GetSize();
+		if (numWorldInstances == 0)
+		{
+			E_LOG(Warning, "Scene flattening benchmark requires a scene with instances");
+			return;
+		}
+
+		std::vector<Mesh*> meshes;
+		uint32 instanceCount = 0;
+		while (instanceCount < (uint32)numInstances)
+		{
+			meshes.insert(meshes.end(), worldMeshes.begin(), worldMeshes.end());
+			instanceCount += numWorldInstances;
+		}
+
+		constexpr uint32 numIterations = 10;
+		FlatSceneData data;
+		float serialTime, parallelTime;
+		{
+			Utils::TimeScope timer;
+			for (uint32 i = 0; i < numIterations; ++i)
+				FlattenScene(meshes, {}, data, false);
+			serialTime = timer.Stop() / numIterations;
+		}
+		{
+			Utils::TimeScope timer;
+			for (uint32 i = 0; i < numIterations; ++i)
+				FlattenScene(meshes, {}, data, true);
+			parallelTime = timer.Stop() / numIterations;
+		}
+		E_LOG(Info, "Scene flattening of %d instances (%d meshes) - Single thread: %.3f ms - Parallel: %.3f ms (%.1fx)",
+			instanceCount, (uint32)meshes.size(), serialTime * 1000.0f, parallelTime * 1000.0f, serialTime / parallelTime);
+	}
+
+	// Animates many copies of an animated mesh, each with its own hierarchy, to measure the throughput of the animation update
+	static void BenchmarkAnimation(Mesh* pMesh, int numCharacters)
+	{
+		struct Character
+		{
+			TransformHierarchy Hierarchy;
+			Animator Animator;
+			std::vector<Matrix> JointMatrices;
+		};
+
+		srand(3);
+		std::vector<Character> characters(numCharacters);
+		for (Character& character : characters)
+		{
+			character.Hierarchy = pMesh->GetTransforms();
+			character.Animator = pMesh->GetAnimator();
+			character.JointMatrices.resize(pMesh->GetJointMatrices().GetSize());
+			// Don't have all characters in the same pose
+			character.Animator.Update(Math::RandomRange(0.0f, 10.0f), character.Hierarchy);
+		}
+
+		auto UpdateCharacter = [pMesh](Character& character)
+		{
+			character.Animator.Update(1.0f / 60.0f, character.Hierarchy);
+			character.Hierarchy.Update(false);
+			for (const Skin& skin : pMesh->GetSkins())
+				skin.ComputeJointMatrices(character.Hierarchy, &character.JointMatrices[skin.JointMatricesOffset]);
+		};
+
+		constexpr uint32 numIterations = 10;
+		float serialTime, parallelTime;
+		{
+			Utils::TimeScope timer;
+			for (uint32 i = 0; i < numIterations; ++i)
+			{
+				for (Character& character : characters)
+					UpdateCharacter(character);
+			}
+			serialTime = timer.Stop() / numIterations;
+		}
+		{
+			Utils::TimeScope timer;
+			for (uint32 i = 0; i < numIterations; ++i)
+			{
+				TaskContext context;
+				TaskQueue::ExecuteMany([&](TaskDistributeArgs args) { UpdateCharacter(characters[args.JobIndex]); }, context, numCharacters, 16);
+				TaskQueue::Join(context);
+			}
+			parallelTime = timer.Stop() / numIterations;
+		}
+
+		uint32 numKeys = 0;
+		for (const AnimationClip& clip : pMesh->GetAnimations())
+			numKeys += clip.GetNumKeys();
+		E_LOG(Info, "Animation of %d characters (%d nodes, %d joints, %d keys) - Single thread: %.3f ms (%.1f characters/ms) - Parallel: %.3f ms (%.1f characters/ms)",
+			numCharacters, pMesh->GetTransforms().GetNumNodes(), pMesh->GetJointMatrices().GetSize(), numKeys,
+			serialTime * 1000.0f, numCharacters / (serialTime * 1000.0f), parallelTime * 1000.0f, numCharacters / (parallelTime * 1000.0f));
+	}
+
+	void UpdateAnimations(const World* pWorld, float deltaTime)
+	{
+		PROFILE_CPU_SCOPE();
+
+		std::vector<Mesh*> animatedMeshes;
+		for (const auto& pMesh : pWorld->Meshes)
+		{
+			if (pMesh->IsAnimated())
+				animatedMeshes.push_back(pMesh.get());
+		}
+
+		if (Tweakables::g_BenchmarkAnimation > 0)
+		{
+			if (animatedMeshes.empty())
+				E_LOG(Warning, "Animation benchmark requires a scene with an animated mesh");
+			else
+				BenchmarkAnimation(animatedMeshes[0], Tweakables::g_BenchmarkAnimation);
+			Tweakables::g_BenchmarkAnimation = 0;
+		}
+
+		if (!Tweakables::g_UpdateAnimations || animatedMeshes.empty())
+			return;
+
+		// Each mesh updates its own hierarchy, so meshes are updated in parallel and each hierarchy on a single thread
+		TaskContext context;
+		TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+			{
+				animatedMeshes[args.JobIndex]->UpdateAnimation(deltaTime, false);
+			}, context, (uint32)animatedMeshes.size(), 1);
+		TaskQueue::Join(context);
+
+		if (Tweakables::g_DrawSkeletons)
+		{
+			for (Mesh* pMesh : animatedMeshes)
 			{
-				ShaderInterop::MaterialData& materialData = materials.emplace_back();
-				materialData.Diffuse = material.pDiffuseTexture ? material.pDiffuseTexture->GetSRVIndex() : -1;
-				materialData.Normal = material.pNormalTexture ? material.pNormalTexture->GetSRVIndex() : -1;
-				materialData.RoughnessMetalness = material.pRoughnessMetalnessTexture ? material.pRoughnessMetalnessTexture->GetSRVIndex() : -1;
-				materialData.Emissive = material.pEmissiveTexture ? material.pEmissiveTexture->GetSRVIndex() : -1;
-				materialData.BaseColorFactor = material.BaseColorFactor;
-				materialData.MetalnessFactor = material.MetalnessFactor;
-				materialData.RoughnessFactor = material.RoughnessFactor;
-				materialData.EmissiveFactor = material.EmissiveFactor;
-				materialData.AlphaCutoff = material.AlphaCutoff;
-				switch (material.AlphaMode)
+				const TransformHierarchy& hierarchy = pMesh->GetTransforms();
+				for (const Skin& skin : pMesh->GetSkins())
 				{
-				case MaterialAlphaMode::Blend:	materialData.RasterBin = 0xFFFFFFFF;	break;
-				case MaterialAlphaMode::Opaque: materialData.RasterBin = 0;				break;
-				case MaterialAlphaMode::Masked: materialData.RasterBin = 1;				break;
+					for (uint32 joint : skin.Joints)
+					{
+						uint32 parent = hierarchy.GetParent(joint);
+						if (std::find(skin.Joints.begin(), skin.Joints.end(), parent) == skin.Joints.end())
+							continue;
+
+						// AddBone draws a bone of width 2 along -Z, with a length of 2 times 'length'
+						Vector3 start = hierarchy.GetWorldMatrix(parent).Translation();
+						Vector3 end = hierarchy.GetWorldMatrix(joint).Translation();
+						Vector3 direction = end - start;
+						float boneLength = direction.Length();
+						if (boneLength <= FLT_EPSILON)
+							continue;
+						direction /= boneLength;
+						Vector3 up = fabs(direction.y) > 0.99f ? Vector3::Right : Vector3::Up;
+						Matrix boneMatrix = Matrix::CreateScale(boneLength * 0.05f) * Matrix::CreateWorld(start, direction, up);
+						DebugRenderer::Get()->AddBone(boneMatrix, 10.0f, Colors::Red);
+					}
 				}
 			}
 		}
-		sceneBatches.swap(pView->Batches);
+	}
 
-		std::vector<Matrix> lightMatrices(pView->ShadowViews.size());
-		for (uint32 i = 0; i < pView->ShadowViews.size(); ++i)
-			lightMatrices[i] = pView->ShadowViews[i].View.ViewProjection;
+	static void GetLightData(const Light& light, ShaderInterop::Light& outData)
+	{
+		outData.Position = light.Position;
+		outData.Direction = Vector3::Transform(Vector3::Forward, light.Rotation);
+		outData.SpotlightAngles.x = cos(light.PenumbraAngleDegrees * Math::DegreesToRadians / 2.0f);
+		outData.SpotlightAngles.y = cos(light.UmbraAngleDegrees * Math::DegreesToRadians / 2.0f);
+		outData.Color = Math::Pack_RGBA8_UNORM(light.Colour);
+		outData.Intensity = light.Intensity;
+		outData.Range = light.Range;
+		outData.ShadowMapIndex = light.CastShadows && light.ShadowMaps.size() ? light.ShadowMaps[0]->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+		outData.MaskTexture = light.pLightTexture ? light.pLightTexture->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+		outData.MatrixIndex = light.MatrixIndex;
+		outData.InvShadowSize = 1.0f / light.ShadowMapSize;
+		outData.IsEnabled = light.Intensity > 0 ? 1 : 0;
+		outData.IsVolumetric = light.VolumetricLighting;
+		outData.CastShadows = light.ShadowMaps.size() && light.CastShadows;
+		outData.IsPoint = light.Type == LightType::Point;
+		outData.IsSpot = light.Type == LightType::Spot;
+		outData.IsDirectional = light.Type == LightType::Directional;
+	}
+
+	// Writes the instances and materials flagged dirty by the meshes, and outputs the instances with new bounds
+	static void UpdateDirtySceneData(SceneView* pView, Span<Mesh*> meshes, std::vector<uint32>& outMovedInstances)
+	{
+		PROFILE_CPU_SCOPE();
+
+		std::vector<uint32> updatedInstances;
+
+		SceneBuffer<ShaderInterop::InstanceData>& instances = pView->InstanceBuffer;
+		SceneBuffer<ShaderInterop::MaterialData>& materials = pView->MaterialBuffer;
 
-		std::vector<ShaderInterop::DDGIVolume> ddgiVolumes;
-		if (Tweakables::g_EnableDDGI)
+		uint32 instanceOffset = 0;
+		uint32 materialOffset = 0;
+		for (Mesh* pMesh : meshes)
+		{
+			Span<SubMeshInstance> meshInstances = pMesh->GetMeshInstances();
+			pMesh->GetDirtyInstances().ForEachSetBit([&](uint32 index)
+				{
+					const SubMeshInstance& node = meshInstances[index];
+					const uint32 instanceID = instanceOffset + index;
+
+					Batch& batch = pView->Batches[pView->InstanceToBatch[instanceID]];
+					batch.WorldMatrix = node.Transform;
+					batch.pMesh->Bounds.Transform(batch.Bounds, batch.WorldMatrix);
+					batch.Radius = Vector3(batch.Bounds.Extents).Length();
+
+					ShaderInterop::InstanceData& instance = instances.Data[instanceID];
+					instance.LocalToWorldPrev = instance.LocalToWorld;
+					instance.LocalToWorld = node.Transform;
+					// The bounds of skinned copies follow the pose
+					instance.LocalBoundsOrigin = batch.pMesh->Bounds.Center;
+					instance.LocalBoundsExtents = batch.pMesh->Bounds.Extents;
+					instances.DirtyElements.SetBit(instanceID);
+					updatedInstances.push_back(instanceID);
+
+					pView->InstanceBoxes[instanceID] = batch.Bounds;
+					if (pView->InstanceBounds.Set(instanceID, batch.Bounds))
+						outMovedInstances.push_back(instanceID);
+				});
+
+			Span<Material> meshMaterials = pMesh->GetMaterials();
+			pMesh->GetDirtyMaterials().ForEachSetBit([&](uint32 index)
+				{
+					GetMaterialData(meshMaterials[index], materials.Data[materialOffset + index]);
+					materials.DirtyElements.SetBit(materialOffset + index);
+				});
+
+			pMesh->ClearDirty();
+			instanceOffset += meshInstances.GetSize();
+			materialOffset += meshMaterials.GetSize();
+		}
+
+		// The instances which stopped moving get their previous transform up to date once more
+		for (uint32 instanceID : pView->MovedInstances)
+		{
+			if (instances.DirtyElements.GetBit(instanceID))
+				continue;
+			ShaderInterop::InstanceData& instance = instances.Data[instanceID];
+			instance.LocalToWorldPrev = instance.LocalToWorld;
+			instances.DirtyElements.SetBit(instanceID);
+		}
+		pView->MovedInstances.swap(updatedInstances);
+	}
+
+	void UploadSceneData(CommandContext& context, SceneView* pView, World* pWorld)
+	{
+		PROFILE_CPU_SCOPE();
+		PROFILE_GPU_SCOPE(context.GetCommandList());
+		Utils::TimeScope timer;
+
+		std::vector<Mesh*> worldMeshes;
+		worldMeshes.reserve(pWorld->Meshes.size());
+		for (const auto& pMesh : pWorld->Meshes)
+		{
+			pMesh->UpdateTransforms();
+			worldMeshes.push_back(pMesh.get());
+		}
+
+		if (Tweakables::g_BenchmarkSceneFlattening > 0)
+		{
+			BenchmarkFlattening(worldMeshes, Tweakables::g_BenchmarkSceneFlattening);
+			Tweakables::g_BenchmarkSceneFlattening = 0;
+		}
+
+		// The whole scene is flattened when meshes are added. Otherwise only what the meshes flagged dirty is written.
+		// 'InstanceToBatch' of the last frame is needed to find the batches of the dirty instances.
+		const bool flattenScene = !Tweakables::g_IncrementalSceneUpload
+			|| worldMeshes != pView->SceneMeshes
+			|| pView->InstanceToBatch.size() != pView->Batches.size();
+
+		std::vector<uint32> movedInstances;
+		bool rebuildBVH = false;
+		if (flattenScene)
+		{
+			// Instance IDs are stable as long as the number of instances doesn't change, so the previous transforms are read from the last upload
+			FlatSceneData sceneData;
+			FlattenScene(worldMeshes, pView->InstanceBuffer.Data, sceneData, true);
+			sceneData.Batches.swap(pView->Batches);
+			pView->SceneMeshes = worldMeshes;
+
+			const uint32 numInstances = (uint32)pView->Batches.size();
+			pView->InstanceBuffer.Data.swap(sceneData.Instances);
+			pView->MeshBuffer.Data.swap(sceneData.Meshes);
+			pView->MaterialBuffer.Data.swap(sceneData.Materials);
+			for (DynamicBitField* pDirty : { &pView->InstanceBuffer.DirtyElements, &pView->MeshBuffer.DirtyElements, &pView->MaterialBuffer.DirtyElements })
+				pDirty->SetAll();
+
+			for (Mesh* pMesh : worldMeshes)
+				pMesh->ClearDirty();
+
+			// The BVH is rebuilt when instances are added or removed. Otherwise, only the instances that moved are refit.
+			rebuildBVH = pView->InstanceBounds.Count != numInstances;
+			pView->InstanceBounds.Resize(numInstances);
+			pView->InstanceBoxes.resize(numInstances);
+			for (const Batch& batch : pView->Batches)
+			{
+				pView->InstanceBoxes[batch.InstanceID] = batch.Bounds;
+				if (pView->InstanceBounds.Set(batch.InstanceID, batch.Bounds))
+					movedInstances.push_back(batch.InstanceID);
+			}
+			pView->MovedInstances = movedInstances;
+		}
+		else
+		{
+			UpdateDirtySceneData(pView, worldMeshes, movedInstances);
+		}
+		pView->InstanceBuffer.DirtyElements.Resize((uint32)pView->InstanceBuffer.Data.size());
+		pView->MeshBuffer.DirtyElements.Resize((uint32)pView->MeshBuffer.Data.size());
+		pView->MaterialBuffer.DirtyElements.Resize((uint32)pView->MaterialBuffer.Data.size());
+
+		if (rebuildBVH)
+			pView->InstanceBVH.Build(pView->InstanceBoxes);
+		else if (!movedInstances.empty())
+			pView->InstanceBVH.Refit(pView->InstanceBoxes, movedInstances);
+
+		// Instances become dynamic when they move, and static again once they haven't moved for a while
+		const uint32 numInstances = (uint32)pView->Batches.size();
+		pView->StaticInstancesChanged = rebuildBVH;
+		if (rebuildBVH)
+		{
+			pView->DynamicInstances.Resize(numInstances);
+			pView->DynamicInstances.ClearAll();
+			pView->InstanceIdleFrames.assign(numInstances, FramesUntilStatic);
+		}
+		else
 		{
-			ddgiVolumes.reserve(pWorld->DDGIVolumes.size());
-			for (const DDGIVolume& ddgiVolume : pWorld->DDGIVolumes)
+			std::vector<uint32> dynamicInstances;
+			pView->DynamicInstances.Compact(dynamicInstances);
+			for (uint32 instance : dynamicInstances)
 			{
-				ShaderInterop::DDGIVolume& ddgi = ddgiVolumes.emplace_back();
-				ddgi.BoundsMin = ddgiVolume.Origin - ddgiVolume.Extents;
-				ddgi.ProbeSize = 2 * ddgiVolume.Extents / (Vector3((float)ddgiVolume.NumProbes.x, (float)ddgiVolume.NumProbes.y, (float)ddgiVolume.NumProbes.z) - Vector3::One);
-				ddgi.ProbeVolumeDimensions = Vector3u(ddgiVolume.NumProbes.x, ddgiVolume.NumProbes.y, ddgiVolume.NumProbes.z);
-				ddgi.IrradianceIndex = ddgiVolume.pIrradianceHistory ? ddgiVolume.pIrradianceHistory->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-				ddgi.DepthIndex = ddgiVolume.pDepthHistory ? ddgiVolume.pDepthHistory->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-				ddgi.ProbeOffsetIndex = ddgiVolume.pProbeOffset ? ddgiVolume.pProbeOffset->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-				ddgi.ProbeStatesIndex = ddgiVolume.pProbeStates ? ddgiVolume.pProbeStates->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-				ddgi.NumRaysPerProbe = ddgiVolume.NumRays;
-				ddgi.MaxRaysPerProbe = ddgiVolume.MaxNumRays;
+				if (++pView->InstanceIdleFrames[instance] >= FramesUntilStatic)
+				{
+					pView->DynamicInstances.ClearBit(instance);
+					pView->StaticInstancesChanged = true;
+				}
+			}
+			for (uint32 instance : movedInstances)
+			{
+				pView->InstanceIdleFrames[instance] = 0;
+				if (!pView->DynamicInstances.GetBit(instance))
+				{
+					pView->DynamicInstances.SetBit(instance);
+					pView->StaticInstancesChanged = true;
+				}
 			}
 		}
-		pView->NumDDGIVolumes = (uint32)ddgiVolumes.size();
-
-		std::vector<ShaderInterop::Light> lightData;
-		lightData.reserve(pWorld->Lights.size());
-		for (const Light& light : pWorld->Lights)
-		{
-			ShaderInterop::Light& data = lightData.emplace_back();
-			data.Position = light.Position;
-			data.Direction = Vector3::Transform(Vector3::Forward, light.Rotation);
-			data.SpotlightAngles.x = cos(light.PenumbraAngleDegrees * Math::DegreesToRadians / 2.0f);
-			data.SpotlightAngles.y = cos(light.UmbraAngleDegrees * Math::DegreesToRadians / 2.0f);
-			data.Color = Math::Pack_RGBA8_UNORM(light.Colour);
-			data.Intensity = light.Intensity;
-			data.Range = light.Range;
-			data.ShadowMapIndex = light.CastShadows && light.ShadowMaps.size() ? light.ShadowMaps[0]->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-			data.MaskTexture = light.pLightTexture ? light.pLightTexture->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
-			data.MatrixIndex = light.MatrixIndex;
-			data.InvShadowSize = 1.0f / light.ShadowMapSize;
-			data.IsEnabled = light.Intensity > 0 ? 1 : 0;
-			data.IsVolumetric = light.VolumetricLighting;
-			data.CastShadows = light.ShadowMaps.size() && light.CastShadows;
-			data.IsPoint = light.Type == LightType::Point;
-			data.IsSpot = light.Type == LightType::Spot;
-			data.IsDirectional = light.Type == LightType::Directional;
+
+		// The light matrices and DDGI volumes are cheap to compute, so they are computed every frame and only uploaded when they changed
+		SceneBuffer<Matrix>& lightMatrices = pView->LightMatricesBuffer;
+		lightMatrices.Resize((uint32)pView->ShadowViews.size());
+		for (uint32 i = 0; i < pView->ShadowViews.size(); ++i)
+			lightMatrices.Set(i, pView->ShadowViews[i].View.ViewProjection);
+
+		SceneBuffer<ShaderInterop::DDGIVolume>& ddgiVolumes = pView->DDGIVolumesBuffer;
+		ddgiVolumes.Resize(Tweakables::g_EnableDDGI ? (uint32)pWorld->DDGIVolumes.size() : 0);
+		for (uint32 i = 0; i < (uint32)ddgiVolumes.Data.size(); ++i)
+		{
+			const DDGIVolume& ddgiVolume = pWorld->DDGIVolumes[i];
+			ShaderInterop::DDGIVolume ddgi{};
+			ddgi.BoundsMin = ddgiVolume.Origin - ddgiVolume.Extents;
+			ddgi.ProbeSize = 2 * ddgiVolume.Extents / (Vector3((float)ddgiVolume.NumProbes.x, (float)ddgiVolume.NumProbes.y, (float)ddgiVolume.NumProbes.z) - Vector3::One);
+			ddgi.ProbeVolumeDimensions = Vector3u(ddgiVolume.NumProbes.x, ddgiVolume.NumProbes.y, ddgiVolume.NumProbes.z);
+			ddgi.IrradianceIndex = ddgiVolume.pIrradianceHistory ? ddgiVolume.pIrradianceHistory->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+			ddgi.DepthIndex = ddgiVolume.pDepthHistory ? ddgiVolume.pDepthHistory->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+			ddgi.ProbeOffsetIndex = ddgiVolume.pProbeOffset ? ddgiVolume.pProbeOffset->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+			ddgi.ProbeStatesIndex = ddgiVolume.pProbeStates ? ddgiVolume.pProbeStates->GetSRVIndex() : DescriptorHandle::InvalidHeapIndex;
+			ddgi.NumRaysPerProbe = ddgiVolume.NumRays;
+			ddgi.MaxRaysPerProbe = ddgiVolume.MaxNumRays;
+			ddgiVolumes.Set(i, ddgi);
+		}
+		pView->NumDDGIVolumes = (uint32)ddgiVolumes.Data.size();
+
+		SceneBuffer<ShaderInterop::Light>& lights = pView->LightBuffer;
+		lights.Resize((uint32)pWorld->Lights.size());
+		for (uint32 i = 0; i < (uint32)pWorld->Lights.size(); ++i)
+		{
+			Light& light = pWorld->Lights[i];
+			if (light.IsDirty || lights.DirtyElements.GetBit(i))
+			{
+				GetLightData(light, lights.Data[i]);
+				lights.DirtyElements.SetBit(i);
+				light.IsDirty = false;
+			}
 		}
 		pView->NumLights = (uint32)pWorld->Lights.size();
 
-		GraphicsDevice* pDevice = context.GetParent();
-		auto CopyBufferData = [&](uint32 numElements, uint32 stride, const char* pName, const void* pSource, RefCountPtr<Buffer>& pTarget)
+		uint64 uploadedBytes = 0;
+		uploadedBytes += UploadSceneBuffer(context, "DDGI Volumes", pView->DDGIVolumesBuffer);
+		uploadedBytes += UploadSceneBuffer(context, "Meshes", pView->MeshBuffer);
+		uploadedBytes += UploadSceneBuffer(context, "Instances", pView->InstanceBuffer);
+		uploadedBytes += UploadSceneBuffer(context, "Materials", pView->MaterialBuffer);
+		uploadedBytes += UploadSceneBuffer(context, "Lights", pView->LightBuffer);
+		uploadedBytes += UploadSceneBuffer(context, "Light Matrices", pView->LightMatricesBuffer);
+
+		Tweakables::SceneUploadMeasurement& measurement = Tweakables::g_SceneUploadMeasurement;
+		if (measurement.FramesLeft > 0)
 		{
-			uint32 desiredElements = Math::AlignUp(Math::Max(1u, numElements), 8u);
-			if (!pTarget || desiredElements > pTarget->GetNumElements())
+			// Frames are split by whether any instance moved
+			Tweakables::SceneUploadMeasurement::Frames& frames = pView->MovedInstances.empty() ? measurement.Static : measurement.Animated;
+			frames.NumFrames++;
+			frames.CPUTime += timer.Stop();
+			frames.UploadedBytes += uploadedBytes;
+			measurement.SceneBytes = pView->DDGIVolumesBuffer.Data.size() * sizeof(ShaderInterop::DDGIVolume)
+				+ pView->MeshBuffer.Data.size() * sizeof(ShaderInterop::MeshData)
+				+ pView->InstanceBuffer.Data.size() * sizeof(ShaderInterop::InstanceData)
+				+ pView->MaterialBuffer.Data.size() * sizeof(ShaderInterop::MaterialData)
+				+ pView->LightBuffer.Data.size() * sizeof(ShaderInterop::Light)
+				+ pView->LightMatricesBuffer.Data.size() * sizeof(Matrix);
+
+			if (--measurement.FramesLeft == 0)
 			{
-				pTarget = pDevice->CreateBuffer(BufferDesc::CreateStructured(desiredElements, stride, BufferFlag::ShaderResource), pName);
+				E_LOG(Info, "Scene upload (%s) of %.1f KB", Tweakables::g_IncrementalSceneUpload ? "Incremental" : "Full", (float)measurement.SceneBytes / 1024.0f);
+				for (const Tweakables::SceneUploadMeasurement::Frames* pFrames : { &measurement.Static, &measurement.Animated })
+				{
+					if (pFrames->NumFrames == 0)
+						continue;
+					E_LOG(Info, "\t%s frames: %d - CPU: %.3f ms/frame - Uploaded: %.1f KB/frame",
+						pFrames == &measurement.Static ? "Static" : "Animated",
+						pFrames->NumFrames,
+						pFrames->CPUTime * 1000.0f / pFrames->NumFrames,
+						(float)pFrames->UploadedBytes / 1024.0f / pFrames->NumFrames);
+				}
 			}
-			context.WriteBuffer(pTarget, pSource, numElements * stride);
-		};
+		}
+	}
+
+	// Sort key of a batch: [63:62] blend mode, [61:32] distance to the view, [31:0] material
+	static uint64 GetSortKey(const Batch& batch, const Vector3& viewLocation)
+	{
+		uint64 blendBits = 0;
+		switch (batch.BlendMode)
+		{
+		case Batch::Blending::Opaque:		blendBits = 0; break;
+		case Batch::Blending::AlphaMask:	blendBits = 1; break;
+		case Batch::Blending::AlphaBlend:	blendBits = 2; break;
+		}
 
-		CopyBufferData((uint32)ddgiVolumes.size(), sizeof(ShaderInterop::DDGIVolume), "DDGI Volumes", ddgiVolumes.data(), pView->pDDGIVolumesBuffer);
-		CopyBufferData((uint32)meshes.size(), sizeof(ShaderInterop::MeshData), "Meshes", meshes.data(), pView->pMeshBuffer);
-		CopyBufferData((uint32)meshInstances.size(), sizeof(ShaderInterop::InstanceData), "Instances", meshInstances.data(), pView->pInstanceBuffer);
-		CopyBufferData((uint32)materials.size(), sizeof(ShaderInterop::MaterialData), "Materials", materials.data(), pView->pMaterialBuffer);
-		CopyBufferData((uint32)lightData.size(), sizeof(ShaderInterop::Light), "Lights", lightData.data(), pView->pLightBuffer);
-		CopyBufferData((uint32)lightMatrices.size(), sizeof(Matrix), "Light Matrices", lightMatrices.data(), pView->pLightMatricesBuffer);
+		// The bits of a positive float increase with its value. Dropping the sign bit and the lowest mantissa bit makes it fit in 30 bits.
+		float distance = Vector3::DistanceSquared(batch.Bounds.Center, viewLocation);
+		uint32 distanceBits;
+		memcpy(&distanceBits, &distance, sizeof(float));
+		distanceBits >>= 1;
+		if (batch.BlendMode == Batch::Blending::AlphaBlend)
+			distanceBits = ~distanceBits & 0x3FFFFFFF;
+
+		return (blendBits << 62) | ((uint64)distanceBits << 32) | batch.MaterialIndex;
+	}
+
+	void SortBatches(std::vector<Batch>& batches, const Vector3& viewLocation)
+	{
+		PROFILE_CPU_SCOPE();
+
+		std::vector<uint64> keys(batches.size());
+		std::vector<uint32> indices(batches.size());
+		for (uint32 i = 0; i < (uint32)batches.size(); ++i)
+		{
+			keys[i] = GetSortKey(batches[i], viewLocation);
+			indices[i] = i;
+		}
+
+		RadixSort::Sort(keys, indices);
+
+		std::vector<Batch> sortedBatches(batches.size());
+		for (uint32 i = 0; i < (uint32)batches.size(); ++i)
+			sortedBatches[i] = batches[indices[i]];
+		batches.swap(sortedBatches);
 	}
 
 	void DrawScene(CommandContext& context, const SceneView* pView, Batch::Blending blendModes)
 	{
-		DrawScene(context, pView->Batches, pView->VisibilityMask, blendModes);
+		DrawScene(context, pView->Batches, pView->VisibleBatches, blendModes);
+	}
+
+	void GetVisibleBatches(const SceneView* pView, const VisibilityMask& visibility, std::vector<uint32>& outBatches)
+	{
+		PROFILE_CPU_SCOPE();
+		check(pView->InstanceToBatch.size() == pView->Batches.size());
+		outBatches.clear();
+		visibility.Compact(outBatches);
+		for (uint32& index : outBatches)
+			index = pView->InstanceToBatch[index];
+		std::sort(outBatches.begin(), outBatches.end());
 	}
 
-	void DrawScene(CommandContext& context, const Span<Batch>& batches, const VisibilityMask& visibility, Batch::Blending blendModes)
+	void DrawScene(CommandContext& context, const Span<Batch>& batches, const Span<uint32>& visibleBatches, Batch::Blending blendModes)
 	{
 		PROFILE_CPU_SCOPE();
 		PROFILE_GPU_SCOPE(context.GetCommandList());
-		check(batches.GetSize() <= visibility.Size());
-		for (const Batch& b : batches)
+		for (uint32 batchIndex : visibleBatches)
 		{
-			if (EnumHasAnyFlags(b.BlendMode, blendModes) && visibility.GetBit(b.InstanceID))
+			const Batch& b = batches[batchIndex];
+			if (EnumHasAnyFlags(b.BlendMode, blendModes))
 			{
 				PROFILE_CPU_SCOPE("Draw Primitive");
 				PROFILE_GPU_SCOPE(context.GetCommandList(), "Draw Pritimive");
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "Graphics/RHI/RHI.h"
-#include "Core/BitField.h"
+#include "Core/DynamicBitField.h"
 #include "ShaderInterop.h"
 #include "AccelerationStructure.h"
 #include "RenderGraph/RenderGraphDefinitions.h"
 #include "Techniques/ShaderDebugRenderer.h"
 #include "Techniques/DDGI.h"
+#include "FrustumCulling.h"
+#include "BVH.h"
+#include "ShadowScheduler.h"
 
 class Mesh;
 class Image;
@@ -70,6 +73,7 @@ struct Batch
 		AlphaBlend = 4,
 	};
 	uint32 InstanceID;
+	uint32 MaterialIndex;
 	Blending BlendMode = Blending::Opaque;
 	SubMesh* pMesh;
 	Matrix WorldMatrix;
@@ -78,7 +82,8 @@ struct Batch
 };
 DECLARE_BITMASK_TYPE(Batch::Blending)
 
-using VisibilityMask = BitField<8192>;
+// Indexed by instance ID
+using VisibilityMask = DynamicBitField;
 
 struct ShadowView
 {
@@ -86,28 +91,91 @@ struct ShadowView
 	uint32 ViewIndex = 0;
 	ViewTransform View;
 	VisibilityMask Visibility;
+	// Indices in SceneView::Batches of the visible batches, in draw order
+	std::vector<uint32> VisibleBatches;
 	Texture* pDepthTexture = nullptr;
+
+	// Slot of the view in the shadow scheduler, which stays the same across frames
+	uint32 CacheSlot = 0;
+	ShadowUpdateMode UpdateMode = ShadowUpdateMode::Full;
+	// Depth of the static casters only. Null if static depth is not cached.
+	Texture* pStaticDepthTexture = nullptr;
+	// The visible batches split in static and dynamic casters, if static depth is cached
+	std::vector<uint32> StaticBatches;
+	std::vector<uint32> DynamicBatches;
+};
+
+/*
+	GPU buffer of scene data, with the CPU copy it is uploaded from.
+	Elements are flagged dirty where their source changes, and only the ranges of dirty elements are uploaded.
+*/
+template<typename T>
+struct SceneBuffer
+{
+	RefCountPtr<Buffer> pBuffer;
+	std::vector<T> Data;
+	DynamicBitField DirtyElements;
+
+	// All elements are dirty when the number of elements changes
+	void Resize(uint32 numElements)
+	{
+		if (numElements == (uint32)Data.size() && numElements == DirtyElements.Size())
+			return;
+		Data.resize(numElements);
+		DirtyElements.Resize(numElements);
+		DirtyElements.SetAll();
+	}
+
+	// Flags the element dirty only if the value changed. For data that is rewritten every frame.
+	void Set(uint32 index, const T& value)
+	{
+		if (!DirtyElements.GetBit(index) && memcmp(&Data[index], &value, sizeof(T)) == 0)
+			return;
+		Data[index] = value;
+		DirtyElements.SetBit(index);
+	}
+
+	uint32 GetSRVIndex() const { return pBuffer->GetSRVIndex(); }
 };
 
 struct SceneView
 {
 	const World* pWorld = nullptr;
 	std::vector<Batch> Batches;
-	RefCountPtr<Buffer> pLightBuffer;
-	RefCountPtr<Buffer> pMaterialBuffer;
-	RefCountPtr<Buffer> pMeshBuffer;
-	RefCountPtr<Buffer> pInstanceBuffer;
-	RefCountPtr<Buffer> pDDGIVolumesBuffer;
-	RefCountPtr<Buffer> pLightMatricesBuffer;
+	// World space bounds of all batches, indexed by instance ID
+	FrustumCulling::BoundsStream InstanceBounds;
+	// The same bounds, for the BVH
+	std::vector<BoundingBox> InstanceBoxes;
+	BVH InstanceBVH;
+	SceneBuffer<ShaderInterop::Light> LightBuffer;
+	SceneBuffer<ShaderInterop::MaterialData> MaterialBuffer;
+	SceneBuffer<ShaderInterop::MeshData> MeshBuffer;
+	SceneBuffer<ShaderInterop::InstanceData> InstanceBuffer;
+	SceneBuffer<ShaderInterop::DDGIVolume> DDGIVolumesBuffer;
+	SceneBuffer<Matrix> LightMatricesBuffer;
+	// Meshes the scene data was flattened from. The scene is flattened again when meshes are added or removed.
+	std::vector<Mesh*> SceneMeshes;
+	// Instances which moved in the last upload. Their previous transform catches up in the next one.
+	std::vector<uint32> MovedInstances;
 	RefCountPtr<Texture> pSky;
 	AccelerationStructure AccelerationStructure;
 	GPUDebugRenderData DebugRenderData;
 	Vector2u HZBDimensions;
 
 	VisibilityMask VisibilityMask;
+	std::vector<uint32> VisibleBatches;
+	// Index in 'Batches' of each instance, updated after sorting the batches
+	std::vector<uint32> InstanceToBatch;
 	ViewTransform MainView;
 	BoundingBox SceneAABB;
 
+	// Instances which moved in the last frames. The other instances are static, and can be cached in the shadow maps.
+	DynamicBitField DynamicInstances;
+	// Number of frames each instance hasn't moved
+	std::vector<uint32> InstanceIdleFrames;
+	// An instance was added or removed, or switched between static and dynamic this frame
+	bool StaticInstancesChanged = true;
+
 	std::vector<ShadowView> ShadowViews;
 	Vector4 ShadowCascadeDepths;
 	uint32 NumShadowCascades;
@@ -136,11 +204,18 @@ struct SceneTextures
 
 namespace Renderer
 {
-	void DrawScene(CommandContext& context, const Span<Batch>& batches, const VisibilityMask& visibility, Batch::Blending blendModes);
+	// Outputs the indices of the visible batches, in the order of 'pView->Batches'
+	void GetVisibleBatches(const SceneView* pView, const VisibilityMask& visibility, std::vector<uint32>& outBatches);
+	void DrawScene(CommandContext& context, const Span<Batch>& batches, const Span<uint32>& visibleBatches, Batch::Blending blendModes);
 	void DrawScene(CommandContext& context, const SceneView* pView, Batch::Blending blendModes);
 	ShaderInterop::ViewUniforms GetViewUniforms(const SceneView* pView, const ViewTransform* pViewTransform, Texture* pTarget = nullptr);
 	ShaderInterop::ViewUniforms GetViewUniforms(const SceneView* pView, Texture* pTarget = nullptr);
-	void UploadSceneData(CommandContext& context, SceneView* pView, const World* pWorld);
+	// Advances the animated meshes in parallel. Must be called before UploadSceneData so the animated transforms are uploaded.
+	void UpdateAnimations(const World* pWorld, float deltaTime);
+	// Uploads the instances, materials and lights flagged dirty, and clears the flags
+	void UploadSceneData(CommandContext& context, SceneView* pView, World* pWorld);
+	// Sorts by blend mode, then opaque and masked batches front to back and blended batches back to front
+	void SortBatches(std::vector<Batch>& batches, const Vector3& viewLocation);
 }
 
 enum class DefaultTexture
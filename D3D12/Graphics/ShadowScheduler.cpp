@@ -0,0 +1,109 @@
+#include "stdafx.h"
+#include "ShadowScheduler.h"
+
+void ShadowScheduler::Schedule(Span<ViewRequest> requests, std::vector<ScheduledView>& outViews)
+{
+	++m_Frame;
+	outViews.resize(requests.GetSize());
+
+	uint32 numLocalUpdates = 0;
+	std::vector<uint32> movedLocalViews;
+
+	for (uint32 i = 0; i < requests.GetSize(); ++i)
+	{
+		const ViewRequest& request = requests[i];
+		auto it = m_KeyToSlot.find(request.Key);
+		if (it == m_KeyToSlot.end())
+		{
+			it = m_KeyToSlot.emplace(request.Key, (uint32)m_Slots.size()).first;
+			m_Slots.emplace_back().Key = request.Key;
+		}
+
+		Slot& slot = m_Slots[it->second];
+		slot.LastScheduleFrame = m_Frame;
+
+		ScheduledView& view = outViews[i];
+		view.Slot = it->second;
+		view.UsePreviousView = false;
+		view.NeedsFullUpdate = false;
+
+		if (slot.IsValid && memcmp(&slot.ViewProjection, &request.ViewProjection, sizeof(Matrix)) == 0)
+			continue;
+
+		if (!slot.IsValid)
+		{
+			UpdateSlot(slot, request, view);
+			if (request.Type == ViewType::Local)
+				++numLocalUpdates;
+		}
+		else if (request.Type == ViewType::Cascade)
+		{
+			// Stagger the distant cascades so they don't all update in the same frame
+			const uint32 interval = Math::Max(m_Settings.DistantCascadeInterval, 1u);
+			if (request.CascadeIndex < m_Settings.FullRateCascades || (m_Frame + request.CascadeIndex) % interval == 0)
+				UpdateSlot(slot, request, view);
+			else
+				view.UsePreviousView = true;
+		}
+		else
+		{
+			movedLocalViews.push_back(i);
+		}
+	}
+
+	// The local views updated the longest ago go first
+	std::stable_sort(movedLocalViews.begin(), movedLocalViews.end(), [&](uint32 a, uint32 b)
+		{
+			return m_Slots[outViews[a].Slot].LastUpdateFrame < m_Slots[outViews[b].Slot].LastUpdateFrame;
+		});
+
+	for (uint32 viewIndex : movedLocalViews)
+	{
+		ScheduledView& view = outViews[viewIndex];
+		if (numLocalUpdates < m_Settings.LocalViewBudget)
+		{
+			UpdateSlot(m_Slots[view.Slot], requests[viewIndex], view);
+			++numLocalUpdates;
+		}
+		else
+		{
+			view.UsePreviousView = true;
+		}
+	}
+}
+
+ShadowUpdateMode ShadowScheduler::GetUpdateMode(const ScheduledView& view, bool hasDynamicCasters, bool staticCastersChanged)
+{
+	Slot& slot = m_Slots[view.Slot];
+	const bool drawDynamicCasters = hasDynamicCasters || slot.HasDynamicCasters;
+	slot.HasDynamicCasters = hasDynamicCasters;
+
+	if (view.NeedsFullUpdate || staticCastersChanged)
+		return ShadowUpdateMode::Full;
+	if (drawDynamicCasters)
+		return m_Settings.CacheStaticDepth ? ShadowUpdateMode::Dynamic : ShadowUpdateMode::Full;
+	return ShadowUpdateMode::None;
+}
+
+void ShadowScheduler::InvalidateStaticDepth()
+{
+	for (Slot& slot : m_Slots)
+	{
+		if (slot.LastScheduleFrame != m_Frame)
+			slot.IsValid = false;
+	}
+}
+
+void ShadowScheduler::InvalidateAll()
+{
+	for (Slot& slot : m_Slots)
+		slot.IsValid = false;
+}
+
+void ShadowScheduler::UpdateSlot(Slot& slot, const ViewRequest& request, ScheduledView& view)
+{
+	slot.ViewProjection = request.ViewProjection;
+	slot.IsValid = true;
+	slot.LastUpdateFrame = m_Frame;
+	view.NeedsFullUpdate = true;
+}
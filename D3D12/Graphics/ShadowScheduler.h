@@ -0,0 +1,90 @@
+#pragma once
+
+enum class ShadowUpdateMode : uint8
+{
+	// The shadow map is up to date
+	None,
+	// The dynamic casters are drawn over a copy of the cached static depth
+	Dynamic,
+	// The whole shadow map is drawn again
+	Full,
+};
+
+/*
+	Decides when shadow views are drawn, so shadow maps can be kept across frames.
+	Only works on keys, matrices and flags, so it can run without a device.
+
+	- A view is identified across frames by a key. Each key gets a slot for its cached data, which never changes.
+	- A view whose matrix and static casters didn't change only draws its dynamic casters, or nothing if there are none.
+	- Cascades after the first 'FullRateCascades' only follow the camera every 'DistantCascadeInterval' frames.
+	  In between, they keep the matrix of their last update.
+	- Spot and point views that moved are updated round-robin, at most 'LocalViewBudget' per frame.
+	  Views that were never drawn are always updated.
+*/
+class ShadowScheduler
+{
+public:
+	struct Settings
+	{
+		// Keep the static casters in a separate depth map, so dynamic casters can be drawn over a copy of it
+		bool CacheStaticDepth = true;
+		uint32 FullRateCascades = 2;
+		uint32 DistantCascadeInterval = 2;
+		uint32 LocalViewBudget = 4;
+	};
+
+	enum class ViewType : uint8
+	{
+		Cascade,
+		Local,
+	};
+
+	struct ViewRequest
+	{
+		uint32 Key;
+		ViewType Type;
+		uint32 CascadeIndex;
+		Matrix ViewProjection;
+	};
+
+	struct ScheduledView
+	{
+		uint32 Slot;
+		// The view is not updated this frame and keeps the matrix of its last update
+		bool UsePreviousView;
+		// The view moved or was never drawn
+		bool NeedsFullUpdate;
+	};
+
+	// Schedules this frame's views. 'outViews' gets one entry for each request.
+	void Schedule(Span<ViewRequest> requests, std::vector<ScheduledView>& outViews);
+
+	// Returns how a scheduled view is drawn, depending on what is visible in it this frame
+	ShadowUpdateMode GetUpdateMode(const ScheduledView& view, bool hasDynamicCasters, bool staticCastersChanged);
+
+	// Static casters changed. Views not scheduled this frame are fully updated the next time they are.
+	void InvalidateStaticDepth();
+	void InvalidateAll();
+
+	uint32 GetNumSlots() const { return (uint32)m_Slots.size(); }
+	Settings& GetSettings() { return m_Settings; }
+
+private:
+	struct Slot
+	{
+		uint32 Key = 0;
+		Matrix ViewProjection;
+		bool IsValid = false;
+		// Dynamic casters were drawn in the last update and need to be erased if they left the view
+		bool HasDynamicCasters = false;
+		uint32 LastUpdateFrame = 0;
+		uint32 LastScheduleFrame = 0;
+	};
+
+	void UpdateSlot(Slot& slot, const ViewRequest& request, ScheduledView& view);
+
+	Settings m_Settings;
+	std::vector<Slot> m_Slots;
+	std::unordered_map<uint32, uint32> m_KeyToSlot;
+	uint32 m_Frame = 0;
+};
@@ -53,6 +53,11 @@ namespace Tweakables
 	constexpr uint32 MaxNumMeshlets = 1 << 20u;
 	// ~ 16.000 instances x Instance (4 bytes) == 64KB
 	constexpr uint32 MaxNumInstances = 1 << 14u;
+
+	// Maximum error of a meshlet LOD, in pixels. 0 always renders full detail meshlets.
+	ConsoleVariable g_MeshletLODErrorThreshold("r.Raster.MeshletLODErrorThreshold", 1.0f);
+	// Reject meshlets which face away from the view, using their normal cone
+	ConsoleVariable g_MeshletConeCulling("r.Raster.MeshletConeCulling", true);
 }
 
 MeshletRasterizer::MeshletRasterizer(GraphicsDevice* pDevice)
@@ -246,8 +251,13 @@ void MeshletRasterizer::CullAndRasterize(RGGraph& graph, const SceneView* pView,
 				struct
 				{
 					Vector2u HZBDimensions;
+					float LODErrorThreshold;
+					uint32 EnableConeCulling;
 				} params;
 				params.HZBDimensions = pSourceHZB ? pSourceHZB->GetDesc().Size2D() : Vector2u(0, 0);
+				params.LODErrorThreshold = Math::Max(0.0f, Tweakables::g_MeshletLODErrorThreshold.Get());
+				// Depth only rasterization doesn't cull backfaces
+				params.EnableConeCulling = Tweakables::g_MeshletConeCulling && rasterContext.Mode == RasterMode::VisibilityBuffer;
 
 				context.BindRootCBV(0, params);
 				context.BindRootCBV(1, Renderer::GetViewUniforms(pView, pViewTransform));
@@ -306,8 +316,13 @@ void MeshletRasterizer::CullAndRasterize(RGGraph& graph, const SceneView* pView,
 				struct
 				{
 					Vector2u HZBDimensions;
+					float LODErrorThreshold;
+					uint32 EnableConeCulling;
 				} params;
 				params.HZBDimensions = pSourceHZB ? pSourceHZB->GetDesc().Size2D() : Vector2u(0, 0);
+				params.LODErrorThreshold = Math::Max(0.0f, Tweakables::g_MeshletLODErrorThreshold.Get());
+				// Depth only rasterization doesn't cull backfaces
+				params.EnableConeCulling = Tweakables::g_MeshletConeCulling && rasterContext.Mode == RasterMode::VisibilityBuffer;
 
 				context.BindRootCBV(0, params);
 				context.BindRootCBV(1, Renderer::GetViewUniforms(pView, pViewTransform));
@@ -509,7 +524,7 @@ void MeshletRasterizer::Render(RGGraph& graph, const SceneView* pView, const Vie
 	// Validate that we don't have more meshlets/instances than allowed.
 	uint32 numMeshlets = 0;
 	for (const Batch& b : pView->Batches)
-		numMeshlets += b.pMesh->NumMeshlets;
+		numMeshlets += b.pMesh->NumLODMeshlets;
 	check(pView->Batches.size() <= Tweakables::MaxNumInstances);
 	check(numMeshlets <= Tweakables::MaxNumMeshlets);
 #endif
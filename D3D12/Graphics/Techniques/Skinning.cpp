@@ -0,0 +1,99 @@
+#include "stdafx.h"
+#include "Skinning.h"
+#include "Graphics/RHI/PipelineState.h"
+#include "Graphics/RHI/RootSignature.h"
+#include "Graphics/RHI/Graphics.h"
+#include "Graphics/RHI/CommandContext.h"
+#include "Graphics/RHI/Buffer.h"
+#include "Graphics/SceneView.h"
+#include "Graphics/Mesh.h"
+#include "Core/Profiler.h"
+
+Skinning::Skinning(GraphicsDevice* pDevice)
+{
+	m_pSkinningRS = new RootSignature(pDevice);
+	m_pSkinningRS->AddRootConstants(0, 8);
+	m_pSkinningRS->AddRootSRV(0);
+	m_pSkinningRS->AddRootUAV(0);
+	m_pSkinningRS->Finalize("Skinning");
+
+	m_pSkinningPSO = pDevice->CreateComputePipeline(m_pSkinningRS, "Skinning.hlsl", "SkinCS");
+}
+
+void Skinning::Execute(CommandContext& context, const World* pWorld)
+{
+	PROFILE_CPU_SCOPE();
+
+	std::vector<Mesh*> meshes;
+	for (const auto& pMesh : pWorld->Meshes)
+	{
+		if (pMesh->NeedsSkinning())
+			meshes.push_back(pMesh.get());
+	}
+	if (meshes.empty())
+		return;
+
+	PROFILE_GPU_SCOPE(context.GetCommandList(), "Skinning");
+
+	context.SetComputeRootSignature(m_pSkinningRS);
+	context.SetPipelineState(m_pSkinningPSO);
+
+	for (Mesh* pMesh : meshes)
+	{
+		// The source streams are read from the same buffer, so the whole buffer is accessed as UAV
+		Buffer* pGeometryData = pMesh->GetData();
+		context.InsertResourceBarrier(pGeometryData, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		context.BindRootUAV(2, pGeometryData->GetGpuHandle());
+
+		Span<Matrix> jointMatrices = pMesh->GetJointMatrices();
+		for (const SubMeshInstance& instance : pMesh->GetMeshInstances())
+		{
+			if (instance.SkinIndex == Skin::InvalidSkin)
+				continue;
+
+			SubMesh& skinnedMesh = pMesh->GetMesh(instance.MeshIndex);
+			const SubMesh& sourceMesh = pMesh->GetMesh(skinnedMesh.SkinSourceMesh);
+			const Skin& skin = pMesh->GetSkins()[instance.SkinIndex];
+
+			// Normalized source position > bind pose > world > normalized skinned position
+			ScratchAllocation palette = context.AllocateScratch(sizeof(Matrix) * skin.Joints.size());
+			Matrix* pPalette = (Matrix*)palette.pMappedMemory;
+			const Matrix sourceScale = Matrix::CreateScale(sourceMesh.ScaleFactor);
+			const Matrix worldToInstance = instance.Transform.Invert();
+			for (uint32 joint = 0; joint < (uint32)skin.Joints.size(); ++joint)
+				pPalette[joint] = sourceScale * jointMatrices[skin.JointMatricesOffset + joint] * worldToInstance;
+
+			struct
+			{
+				uint32 NumVertices;
+				uint32 PositionsOffset;
+				uint32 NormalsOffset;
+				uint32 SkinOffset;
+				uint32 SkinnedPositionsOffset;
+				uint32 SkinnedPositionsPrevOffset;
+				uint32 SkinnedNormalsOffset;
+				uint32 HasPrevious;
+			} parameters;
+			parameters.NumVertices = sourceMesh.PositionStreamLocation.Elements;
+			parameters.PositionsOffset = sourceMesh.PositionStreamLocation.OffsetFromStart;
+			parameters.NormalsOffset = sourceMesh.NormalStreamLocation.OffsetFromStart;
+			parameters.SkinOffset = sourceMesh.SkinStreamLocation.OffsetFromStart;
+			parameters.SkinnedPositionsOffset = skinnedMesh.PositionStreamLocation.OffsetFromStart;
+			parameters.SkinnedPositionsPrevOffset = skinnedMesh.PositionPrevStreamLocation.OffsetFromStart;
+			parameters.SkinnedNormalsOffset = skinnedMesh.NormalStreamLocation.OffsetFromStart;
+			parameters.HasPrevious = skinnedMesh.IsSkinned;
+
+			context.BindRootCBV(0, parameters);
+			context.BindRootSRV(1, palette.GpuHandle);
+			context.Dispatch(ComputeUtils::GetNumThreadGroups(parameters.NumVertices, 64));
+
+			skinnedMesh.IsSkinned = true;
+			skinnedMesh.NeedsBLASUpdate = true;
+		}
+
+		// Back to the state all geometry buffers are read in
+		context.InsertResourceBarrier(pGeometryData, D3D12_RESOURCE_STATE_COMMON);
+		pMesh->OnSkinned();
+	}
+	context.FlushResourceBarriers();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Graphics/RHI/RHI.h"
+
+struct World;
+
+/*
+	Skins the vertices of the skinned instances on the GPU.
+
+	- Each skinned instance draws its own copy of the mesh (see Mesh::Load). The copy has its own positions and normals,
+	  and shares the other streams and the meshlets with the mesh it is skinned from.
+	- The joint matrices of the instance are combined with the inverse of the instance transform on the CPU,
+	  so the skinned positions are normalized like the positions of any other mesh.
+	- The positions of the previous pass are kept for the motion vectors.
+	- The skinned copies are marked so AccelerationStructure refits their BLAS.
+	Only meshes whose joints moved since the last pass are skinned.
+*/
+class Skinning
+{
+public:
+	Skinning(GraphicsDevice* pDevice);
+
+	void Execute(CommandContext& context, const World* pWorld);
+
+private:
+	RefCountPtr<RootSignature> m_pSkinningRS;
+	RefCountPtr<PipelineState> m_pSkinningPSO;
+};
@@ -0,0 +1,350 @@
+#include "stdafx.h"
+#include "TextureStreaming.h"
+#include "RHI/Graphics.h"
+#include "RHI/Texture.h"
+#include "Mesh.h"
+#include "SceneView.h"
+#include "Core/Paths.h"
+#include "Core/Profiler.h"
+#include "Core/ConsoleVariables.h"
+
+namespace Tweakables
+{
+	ConsoleVariable g_TextureStreaming("r.TextureStreaming", true);
+	ConsoleVariable g_TextureStreamingBudget("r.TextureStreaming.Budget", 512);
+	ConsoleVariable g_TextureStreamingTailSize("r.TextureStreaming.TailSize", 128);
+	ConsoleVariable g_TextureStreamingMipBias("r.TextureStreaming.MipBias", 0.0f);
+}
+
+TextureResidencyManager::Handle TextureResidencyManager::Register(Span<uint64> mipSizes, uint32 tailMip)
+{
+	check(mipSizes.GetSize() > 0 && mipSizes.GetSize() <= D3D12_REQ_MIP_LEVELS);
+
+	Handle handle;
+	if (!m_FreeHandles.empty())
+	{
+		handle = m_FreeHandles.back();
+		m_FreeHandles.pop_back();
+	}
+	else
+	{
+		handle = (Handle)m_Entries.size();
+		m_Entries.emplace_back();
+	}
+	Entry& entry = m_Entries[handle];
+	for (int mip = (int)mipSizes.GetSize() - 1; mip >= 0; --mip)
+	{
+		entry.ChainSizes[mip] = entry.ChainSizes[mip + 1] + mipSizes[mip];
+	}
+	entry.TailMip = Math::Min(tailMip, mipSizes.GetSize() - 1);
+	entry.ResidentMip = entry.TailMip;
+	entry.RequestedMip = entry.TailMip;
+	entry.DesiredMip = entry.TailMip;
+	entry.IsValid = true;
+	m_CommittedSize += entry.ChainSizes[entry.ResidentMip];
+	return handle;
+}
+
+void TextureResidencyManager::Unregister(Handle handle)
+{
+	Entry& entry = m_Entries[handle];
+	check(entry.IsValid);
+	m_CommittedSize -= entry.ChainSizes[entry.GetCommittedMip()];
+	if (entry.PendingMip != InvalidMip)
+	{
+		--m_NumPending;
+	}
+	entry = Entry();
+	m_FreeHandles.push_back(handle);
+}
+
+void TextureResidencyManager::Request(Handle handle, uint32 mip, uint32 frame)
+{
+	Entry& entry = m_Entries[handle];
+	if (!entry.IsValid)
+		return;
+
+	mip = Math::Min(mip, entry.TailMip);
+	if (entry.LastRequestFrame != frame)
+	{
+		entry.RequestedMip = mip;
+		entry.LastRequestFrame = frame;
+	}
+	else
+	{
+		entry.RequestedMip = Math::Min(entry.RequestedMip, mip);
+	}
+}
+
+void TextureResidencyManager::Update(uint32 frame, std::vector<ResidencyChange>& outChanges)
+{
+	std::vector<Handle> upgrades;
+	std::vector<Handle> evictionCandidates;
+	for (Handle handle = 0; handle < (Handle)m_Entries.size(); ++handle)
+	{
+		Entry& entry = m_Entries[handle];
+		if (!entry.IsValid || entry.PendingMip != InvalidMip)
+			continue;
+
+		bool isStale = frame - entry.LastRequestFrame > GracePeriod;
+		entry.DesiredMip = isStale ? entry.TailMip : entry.RequestedMip;
+		if (entry.DesiredMip < entry.ResidentMip)
+			upgrades.push_back(handle);
+		else if (entry.DesiredMip > entry.ResidentMip)
+			evictionCandidates.push_back(handle);
+	}
+
+	// Most recently requested first, then the ones missing the most mips
+	std::sort(upgrades.begin(), upgrades.end(), [this](Handle a, Handle b)
+		{
+			const Entry& entryA = m_Entries[a];
+			const Entry& entryB = m_Entries[b];
+			if (entryA.LastRequestFrame != entryB.LastRequestFrame)
+				return entryA.LastRequestFrame > entryB.LastRequestFrame;
+			return entryA.ResidentMip - entryA.DesiredMip > entryB.ResidentMip - entryB.DesiredMip;
+		});
+
+	// Least recently requested first
+	std::sort(evictionCandidates.begin(), evictionCandidates.end(), [this](Handle a, Handle b)
+		{
+			return m_Entries[a].LastRequestFrame < m_Entries[b].LastRequestFrame;
+		});
+
+	uint32 evictIndex = 0;
+	auto EvictNext = [&]() -> bool
+	{
+		if (evictIndex >= (uint32)evictionCandidates.size() || m_NumPending >= MaxPendingChanges)
+			return false;
+		Handle victim = evictionCandidates[evictIndex++];
+		Schedule(victim, m_Entries[victim].DesiredMip, outChanges);
+		return true;
+	};
+
+	for (Handle handle : upgrades)
+	{
+		Entry& entry = m_Entries[handle];
+		auto GetCost = [&](uint32 mip) { return entry.ChainSizes[mip] - entry.ChainSizes[entry.ResidentMip]; };
+
+		while (m_CommittedSize + GetCost(entry.DesiredMip) > m_Budget && EvictNext()) {}
+		if (m_NumPending >= MaxPendingChanges)
+			break;
+
+		// If it doesn't fit, stream in as many mips as possible
+		uint32 firstMip = entry.DesiredMip;
+		while (firstMip < entry.ResidentMip && m_CommittedSize + GetCost(firstMip) > m_Budget)
+			++firstMip;
+		if (firstMip < entry.ResidentMip)
+			Schedule(handle, firstMip, outChanges);
+	}
+
+	// Budget may have been lowered
+	while (m_CommittedSize > m_Budget && EvictNext()) {}
+}
+
+void TextureResidencyManager::Schedule(Handle handle, uint32 firstMip, std::vector<ResidencyChange>& outChanges)
+{
+	Entry& entry = m_Entries[handle];
+	check(entry.PendingMip == InvalidMip);
+	m_CommittedSize = m_CommittedSize - entry.ChainSizes[entry.ResidentMip] + entry.ChainSizes[firstMip];
+	entry.PendingMip = firstMip;
+	++m_NumPending;
+	outChanges.push_back({ handle, firstMip });
+}
+
+void TextureResidencyManager::Complete(Handle handle, bool success)
+{
+	Entry& entry = m_Entries[handle];
+	if (!entry.IsValid || entry.PendingMip == InvalidMip)
+		return;
+
+	if (success)
+	{
+		entry.ResidentMip = entry.PendingMip;
+	}
+	else
+	{
+		m_CommittedSize = m_CommittedSize - entry.ChainSizes[entry.PendingMip] + entry.ChainSizes[entry.ResidentMip];
+	}
+	entry.PendingMip = InvalidMip;
+	--m_NumPending;
+}
+
+TextureStreamer::TextureStreamer(GraphicsDevice* pDevice)
+	: m_pDevice(pDevice)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	TaskQueue::Join(m_LoadContext);
+}
+
+RefCountPtr<Texture> TextureStreamer::CreateTexture(const char* pFilePath, bool sRGB, Mesh* pOwner)
+{
+	if (!Tweakables::g_TextureStreaming)
+		return nullptr;
+
+	// Only 2D textures with a full mip chain in the file can be streamed
+	ImageInfo info;
+	if (!Image::GetInfo(pFilePath, info) || info.MipLevels <= 1 || info.IsCubemap || info.IsArray || info.Depth > 1)
+		return nullptr;
+
+	uint32 tailMip = 0;
+	while (tailMip < info.MipLevels - 1 && Math::Max(info.Width >> tailMip, info.Height >> tailMip) > (uint32)Tweakables::g_TextureStreamingTailSize)
+		++tailMip;
+
+	Image image;
+	if (!image.Load(pFilePath, tailMip, info.MipLevels - tailMip))
+		return nullptr;
+
+	RefCountPtr<Texture> pTexture = GraphicsCommon::CreateTextureFromImage(m_pDevice, image, sRGB, Paths::GetFileName(pFilePath).c_str());
+	if (!pTexture)
+		return nullptr;
+
+	std::array<uint64, D3D12_REQ_MIP_LEVELS> mipSizes;
+	for (uint32 mip = 0; mip < info.MipLevels; ++mip)
+	{
+		mipSizes[mip] = RHI::GetTextureMipByteSize(info.Format, info.Width, info.Height, 1, mip);
+	}
+
+	// Residency handles are reused once released, and so are the slots in m_Textures
+	TextureResidencyManager::Handle handle = m_Residency.Register(Span<uint64>(mipSizes.data(), info.MipLevels), tailMip);
+	if (handle == (uint32)m_Textures.size())
+		m_Textures.emplace_back();
+	StreamedTexture& texture = m_Textures[handle];
+	check(!texture.pOwner);
+	texture.FilePath = pFilePath;
+	texture.IsSRGB = sRGB;
+	texture.Info = info;
+	texture.pOwner = pOwner;
+	texture.pTexture = pTexture;
+	texture.Handle = handle;
+	m_TextureToHandle[pTexture] = handle;
+	return pTexture;
+}
+
+void TextureStreamer::UnregisterOwner(Mesh* pOwner)
+{
+	for (StreamedTexture& texture : m_Textures)
+	{
+		if (texture.pOwner != pOwner)
+			continue;
+
+		m_TextureToHandle.erase(texture.pTexture);
+		texture.pOwner = nullptr;
+		texture.pTexture = nullptr;
+
+		// A load in flight still refers to the handle. It is released when the load completes.
+		if (!m_Residency.IsPending(texture.Handle))
+			ReleaseTexture(texture.Handle);
+	}
+}
+
+void TextureStreamer::ReleaseTexture(TextureResidencyManager::Handle handle)
+{
+	m_Residency.Unregister(handle);
+	m_Textures[handle] = StreamedTexture();
+}
+
+void TextureStreamer::RequestMips(const SceneView& view, bool isViewCulled)
+{
+	PROFILE_CPU_SCOPE();
+
+	const ViewTransform& viewTransform = view.MainView;
+	const float tanHalfFoV = tanf(viewTransform.FoV * 0.5f);
+	const float viewportHeight = viewTransform.Viewport.GetHeight();
+
+	// When the main view is only culled on the GPU, find the visible batches with the BVH
+	const std::vector<uint32>* pVisibleBatches = &view.VisibleBatches;
+	if (!isViewCulled)
+	{
+		m_Visibility.Resize(view.InstanceBounds.Count);
+		m_Visibility.ClearAll();
+		view.InstanceBVH.Cull(FrustumCulling::GetPlanes(viewTransform.PerspectiveFrustum), m_Visibility.GetData());
+		Renderer::GetVisibleBatches(&view, m_Visibility, m_VisibleBatches);
+		pVisibleBatches = &m_VisibleBatches;
+	}
+
+	// Textures of batches outside of the view are not requested and drop to their tail after the grace period
+	for (uint32 batchIndex : *pVisibleBatches)
+	{
+		const Batch& batch = view.Batches[batchIndex];
+
+		// Assumes the UVs roughly map the texture once across the object
+		float distance = Math::Max(Vector3::Distance(batch.Bounds.Center, viewTransform.Position) - batch.Radius, 0.01f);
+		float screenSize = Math::Max(batch.Radius / (distance * tanHalfFoV) * viewportHeight, 1.0f);
+
+		const Material& material = batch.pMesh->pParent->GetMaterial(batch.pMesh->MaterialId);
+		for (const Texture* pTexture : { material.pDiffuseTexture, material.pNormalTexture, material.pRoughnessMetalnessTexture, material.pEmissiveTexture })
+		{
+			auto it = m_TextureToHandle.find(pTexture);
+			if (it == m_TextureToHandle.end())
+				continue;
+
+			const ImageInfo& info = m_Textures[it->second].Info;
+			float mip = log2f(Math::Max(info.Width, info.Height) / screenSize) + Tweakables::g_TextureStreamingMipBias;
+			m_Residency.Request(it->second, (uint32)Math::Max(mip, 0.0f), view.FrameIndex);
+		}
+	}
+}
+
+void TextureStreamer::Update(uint32 frame)
+{
+	PROFILE_CPU_SCOPE();
+
+	m_Residency.SetBudget((uint64)Tweakables::g_TextureStreamingBudget * 1024 * 1024);
+
+	std::vector<std::unique_ptr<LoadRequest>> completedLoads;
+	{
+		std::lock_guard lock(m_CompletedLock);
+		completedLoads.swap(m_CompletedLoads);
+	}
+
+	for (std::unique_ptr<LoadRequest>& pRequest : completedLoads)
+	{
+		StreamedTexture& texture = m_Textures[pRequest->Handle];
+		if (!texture.pOwner)
+		{
+			// The owner was unregistered while loading
+			ReleaseTexture(pRequest->Handle);
+			continue;
+		}
+
+		RefCountPtr<Texture> pNewTexture;
+		if (pRequest->Success)
+			pNewTexture = GraphicsCommon::CreateTextureFromImage(m_pDevice, pRequest->Result, texture.IsSRGB, Paths::GetFileName(texture.FilePath).c_str());
+
+		if (pNewTexture)
+		{
+			m_TextureToHandle.erase(texture.pTexture);
+			m_TextureToHandle[pNewTexture] = pRequest->Handle;
+			texture.pOwner->ReplaceTexture(texture.pTexture, pNewTexture);
+			texture.pTexture = pNewTexture;
+		}
+		else
+		{
+			E_LOG(Warning, "Failed to stream mip %d of '%s'", pRequest->FirstMip, texture.FilePath.c_str());
+		}
+		m_Residency.Complete(pRequest->Handle, pNewTexture != nullptr);
+	}
+
+	std::vector<TextureResidencyManager::ResidencyChange> changes;
+	m_Residency.Update(frame, changes);
+
+	for (const TextureResidencyManager::ResidencyChange& change : changes)
+	{
+		const StreamedTexture& texture = m_Textures[change.Texture];
+		LoadRequest* pRequest = new LoadRequest();
+		pRequest->Handle = change.Texture;
+		pRequest->FirstMip = change.FirstMip;
+
+		TaskQueue::Execute([this, pRequest, filePath = texture.FilePath, numMips = texture.Info.MipLevels - change.FirstMip](int)
+			{
+				PROFILE_CPU_SCOPE("Stream Texture");
+				pRequest->Success = pRequest->Result.Load(filePath.c_str(), pRequest->FirstMip, numMips);
+
+				std::lock_guard lock(m_CompletedLock);
+				m_CompletedLoads.emplace_back(pRequest);
+			}, m_LoadContext);
+	}
+}
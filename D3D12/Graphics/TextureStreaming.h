@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Graphics/RHI/RHI.h"
+#include "Content/Image.h"
+#include "Core/TaskQueue.h"
+#include "Core/DynamicBitField.h"
+
+class Mesh;
+struct SceneView;
+
+/*
+	Decides which mips of each streamed texture should be resident, within a memory budget.
+	Textures always keep their tail mips. Mips are requested per frame and once a texture hasn't been
+	requested for 'GracePeriod' frames, it may be dropped back to its tail when memory is needed (LRU).
+	This has no GPU dependencies so it can be driven with synthetic request traces.
+*/
+class TextureResidencyManager
+{
+public:
+	using Handle = uint32;
+	static constexpr Handle InvalidHandle = 0xFFFFFFFF;
+	static constexpr uint32 InvalidMip = 0xFFFFFFFF;
+
+	struct ResidencyChange
+	{
+		Handle Texture;
+		uint32 FirstMip;
+	};
+
+	// 'mipSizes' is the size in bytes of each mip, most detailed first.
+	Handle Register(Span<uint64> mipSizes, uint32 tailMip);
+	void Unregister(Handle handle);
+
+	// Request 'mip' to be resident. Multiple requests in the same frame keep the most detailed one.
+	void Request(Handle handle, uint32 mip, uint32 frame);
+
+	// Outputs the residency changes that should be performed. Each must be acknowledged with Complete().
+	void Update(uint32 frame, std::vector<ResidencyChange>& outChanges);
+	void Complete(Handle handle, bool success);
+
+	void SetBudget(uint64 budget) { m_Budget = budget; }
+	uint64 GetBudget() const { return m_Budget; }
+	uint64 GetCommittedSize() const { return m_CommittedSize; }
+	uint32 GetNumPending() const { return m_NumPending; }
+	uint32 GetResidentMip(Handle handle) const { return m_Entries[handle].ResidentMip; }
+	bool IsPending(Handle handle) const { return m_Entries[handle].PendingMip != InvalidMip; }
+
+	// Frames a texture keeps its requested mips without being requested again
+	uint32 GracePeriod = 30;
+	// Maximum number of changes in flight
+	uint32 MaxPendingChanges = 8;
+
+private:
+	struct Entry
+	{
+		// Size of the mip chain starting at each mip
+		std::array<uint64, D3D12_REQ_MIP_LEVELS + 1> ChainSizes{};
+		uint32 TailMip = 0;
+		uint32 ResidentMip = 0;
+		uint32 PendingMip = InvalidMip;
+		uint32 RequestedMip = 0;
+		uint32 DesiredMip = 0;
+		uint32 LastRequestFrame = 0;
+		bool IsValid = false;
+
+		uint32 GetCommittedMip() const { return PendingMip != InvalidMip ? PendingMip : ResidentMip; }
+	};
+
+	void Schedule(Handle handle, uint32 firstMip, std::vector<ResidencyChange>& outChanges);
+
+	std::vector<Entry> m_Entries;
+	// Unregistered entries, reused by Register()
+	std::vector<Handle> m_FreeHandles;
+	uint64 m_Budget = 512ull * 1024 * 1024;
+	uint64 m_CommittedSize = 0;
+	uint32 m_NumPending = 0;
+};
+
+/*
+	Streams mips of DDS textures in and out based on a CPU distance heuristic.
+	Textures are created with only their tail mips. Loads are done on the TaskQueue and read just the
+	required mips from the file. A new texture is then created and swapped into the owning Mesh.
+*/
+class TextureStreamer
+{
+public:
+	TextureStreamer(GraphicsDevice* pDevice);
+	~TextureStreamer();
+
+	// Returns nullptr if the file can't be streamed.
+	RefCountPtr<Texture> CreateTexture(const char* pFilePath, bool sRGB, Mesh* pOwner);
+	void UnregisterOwner(Mesh* pOwner);
+
+	// Requests mips for the textures of the batches visible in the main view.
+	// If the main view wasn't culled on the CPU, 'view.VisibleBatches' is not used and the view is culled here.
+	void RequestMips(const SceneView& view, bool isViewCulled);
+	void Update(uint32 frame);
+
+	const TextureResidencyManager& GetResidency() const { return m_Residency; }
+
+private:
+	struct StreamedTexture
+	{
+		std::string FilePath;
+		bool IsSRGB = false;
+		ImageInfo Info;
+		Mesh* pOwner = nullptr;
+		RefCountPtr<Texture> pTexture;
+		TextureResidencyManager::Handle Handle = TextureResidencyManager::InvalidHandle;
+	};
+
+	struct LoadRequest
+	{
+		TextureResidencyManager::Handle Handle;
+		uint32 FirstMip;
+		Image Result;
+		bool Success = false;
+	};
+
+	void ReleaseTexture(TextureResidencyManager::Handle handle);
+
+	GraphicsDevice* m_pDevice;
+	TextureResidencyManager m_Residency;
+
+	// Indexed by residency handle
+	std::vector<StreamedTexture> m_Textures;
+	std::unordered_map<const Texture*, TextureResidencyManager::Handle> m_TextureToHandle;
+
+	// Only used when the main view isn't culled on the CPU
+	DynamicBitField m_Visibility;
+	std::vector<uint32> m_VisibleBatches;
+
+	TaskContext m_LoadContext{ 0 };
+	std::mutex m_CompletedLock;
+	std::vector<std::unique_ptr<LoadRequest>> m_CompletedLoads;
+};
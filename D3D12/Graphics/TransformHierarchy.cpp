@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "TransformHierarchy.h"
+#include "Core/Profiler.h"
+#include "Core/TaskQueue.h"
+
+void TransformHierarchy::Build(Span<NodeDesc> nodes)
+{
+	PROFILE_CPU_SCOPE();
+
+	const uint32 numNodes = nodes.GetSize();
+
+	// Children of each node, in input order
+	std::vector<uint32> childOffsets(numNodes + 1, 0);
+	for (uint32 i = 0; i < numNodes; ++i)
+	{
+		uint32 parent = nodes[i].Parent;
+		check(parent == InvalidNode || parent < numNodes, "Invalid parent index");
+		if (parent != InvalidNode)
+			childOffsets[parent + 1]++;
+	}
+	for (uint32 i = 0; i < numNodes; ++i)
+		childOffsets[i + 1] += childOffsets[i];
+
+	std::vector<uint32> children(childOffsets.back());
+	std::vector<uint32> childCursors(childOffsets.begin(), childOffsets.end() - 1);
+	for (uint32 i = 0; i < numNodes; ++i)
+	{
+		if (nodes[i].Parent != InvalidNode)
+			children[childCursors[nodes[i].Parent]++] = i;
+	}
+
+	// Breadth-first traversal from the roots. Nodes in a cycle are never reached.
+	m_IndexToNode.clear();
+	m_IndexToNode.reserve(numNodes);
+	for (uint32 i = 0; i < numNodes; ++i)
+	{
+		if (nodes[i].Parent == InvalidNode)
+			m_IndexToNode.push_back(i);
+	}
+	m_ChildOffsets.resize(numNodes + 1);
+	for (uint32 index = 0; index < m_IndexToNode.size(); ++index)
+	{
+		uint32 node = m_IndexToNode[index];
+		m_ChildOffsets[index] = (uint32)m_IndexToNode.size();
+		for (uint32 child = childOffsets[node]; child < childOffsets[node + 1]; ++child)
+			m_IndexToNode.push_back(children[child]);
+	}
+	check(m_IndexToNode.size() == numNodes, "Cycle in transform hierarchy");
+	m_ChildOffsets[numNodes] = numNodes;
+
+	m_NodeToIndex.resize(numNodes);
+	for (uint32 index = 0; index < numNodes; ++index)
+		m_NodeToIndex[m_IndexToNode[index]] = index;
+
+	m_Parents.resize(numNodes);
+	m_Translations.resize(numNodes);
+	m_Rotations.resize(numNodes);
+	m_Scales.resize(numNodes);
+	m_WorldMatrices.resize(numNodes);
+	m_Dirty.assign(numNodes, 0);
+	m_Changed.assign(numNodes, 0);
+	m_LevelOffsets.clear();
+	std::vector<uint32> depths(numNodes);
+	for (uint32 index = 0; index < numNodes; ++index)
+	{
+		const NodeDesc& desc = nodes[m_IndexToNode[index]];
+		uint32 parent = desc.Parent == InvalidNode ? InvalidNode : m_NodeToIndex[desc.Parent];
+		m_Parents[index] = parent;
+		m_Translations[index] = desc.Translation;
+		m_Rotations[index] = desc.Rotation;
+		m_Scales[index] = desc.Scale;
+
+		// Depths never decrease in breadth-first order, so a new level starts whenever the depth goes up
+		depths[index] = parent == InvalidNode ? 0 : depths[parent] + 1;
+		if (depths[index] == m_LevelOffsets.size())
+			m_LevelOffsets.push_back(index);
+	}
+	m_LevelOffsets.push_back(numNodes);
+
+	m_DirtyNodes.assign(GetNumLevels(), {});
+	m_ChangedNodes.clear();
+	m_AnyDirty = false;
+
+	// Updating the roots updates everything
+	for (uint32 index = 0; index < m_ChildOffsets[0]; ++index)
+		QueueUpdate(index, 0);
+}
+
+void TransformHierarchy::SetTranslation(uint32 node, const Vector3& translation)
+{
+	uint32 index = m_NodeToIndex[node];
+	m_Translations[index] = translation;
+	MarkDirty(index);
+}
+
+void TransformHierarchy::SetRotation(uint32 node, const Quaternion& rotation)
+{
+	uint32 index = m_NodeToIndex[node];
+	m_Rotations[index] = rotation;
+	MarkDirty(index);
+}
+
+void TransformHierarchy::SetScale(uint32 node, const Vector3& scale)
+{
+	uint32 index = m_NodeToIndex[node];
+	m_Scales[index] = scale;
+	MarkDirty(index);
+}
+
+void TransformHierarchy::UpdateNodes(Span<uint32> indices)
+{
+	for (uint32 i : indices)
+	{
+		// Parents are in a previous level, so they are already up to date
+		uint32 parent = m_Parents[i];
+		Matrix localToParent = Matrix::CreateScale(m_Scales[i]) * Matrix::CreateFromQuaternion(m_Rotations[i]) * Matrix::CreateTranslation(m_Translations[i]);
+		m_WorldMatrices[i] = parent == InvalidNode ? localToParent : localToParent * m_WorldMatrices[parent];
+		m_Dirty[i] = 0;
+		m_Changed[i] = 1;
+	}
+}
+
+bool TransformHierarchy::Update(bool parallel)
+{
+	PROFILE_CPU_SCOPE();
+
+	// Reset the changes of the previous update
+	for (uint32 index : m_ChangedNodes)
+		m_Changed[index] = 0;
+	m_ChangedNodes.clear();
+
+	if (!m_AnyDirty)
+		return false;
+
+	for (uint32 level = 0; level < GetNumLevels(); ++level)
+	{
+		std::vector<uint32>& dirtyNodes = m_DirtyNodes[level];
+		if (dirtyNodes.empty())
+			continue;
+
+		const uint32 numDirty = (uint32)dirtyNodes.size();
+		const uint32 numJobs = Math::DivideAndRoundUp(numDirty, NodesPerJob);
+		if (!parallel || numJobs <= 1)
+		{
+			UpdateNodes(dirtyNodes);
+		}
+		else
+		{
+			TaskContext context;
+			TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+				{
+					uint32 jobFirst = args.JobIndex * NodesPerJob;
+					UpdateNodes(Span<uint32>(&dirtyNodes[jobFirst], Math::Min(NodesPerJob, numDirty - jobFirst)));
+				}, context, numJobs, 1);
+			TaskQueue::Join(context);
+		}
+
+		// The world matrices of the children depend on the ones just updated
+		for (uint32 index : dirtyNodes)
+		{
+			for (uint32 child = m_ChildOffsets[index]; child < m_ChildOffsets[index + 1]; ++child)
+				QueueUpdate(child, level + 1);
+		}
+		m_ChangedNodes.insert(m_ChangedNodes.end(), dirtyNodes.begin(), dirtyNodes.end());
+		dirtyNodes.clear();
+	}
+
+	m_AnyDirty = false;
+	return true;
+}
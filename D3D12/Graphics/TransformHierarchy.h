@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+	Hierarchy of transforms stored in flat arrays.
+	Nodes are stored in breadth-first order, so a parent always comes before its children, all nodes of the same depth
+	are contiguous and so are the children of a node.
+	Local transforms are stored as separate translation, rotation and scale arrays.
+
+	Only nodes whose local transform changed, and their subtrees, are visited on Update().
+	Changed nodes are queued per depth level and each updated node queues its children in the next level.
+	Nodes within a level don't depend on each other, so large levels are split in jobs on the TaskQueue.
+*/
+class TransformHierarchy
+{
+public:
+	static constexpr uint32 InvalidNode = 0xFFFFFFFF;
+	// Number of nodes of a level updated by a single job
+	static constexpr uint32 NodesPerJob = 1024;
+
+	struct NodeDesc
+	{
+		// Index of the parent in the array passed to Build(), or InvalidNode for a root
+		uint32 Parent = InvalidNode;
+		Vector3 Translation = Vector3::Zero;
+		Quaternion Rotation = Quaternion::Identity;
+		Vector3 Scale = Vector3::One;
+	};
+
+	// Nodes are referred to by their index in 'nodes'. Parents can be in any order but there can be no cycles.
+	void Build(Span<NodeDesc> nodes);
+
+	void SetTranslation(uint32 node, const Vector3& translation);
+	void SetRotation(uint32 node, const Quaternion& rotation);
+	void SetScale(uint32 node, const Vector3& scale);
+
+	const Vector3& GetTranslation(uint32 node) const { return m_Translations[m_NodeToIndex[node]]; }
+	const Quaternion& GetRotation(uint32 node) const { return m_Rotations[m_NodeToIndex[node]]; }
+	const Vector3& GetScale(uint32 node) const { return m_Scales[m_NodeToIndex[node]]; }
+
+	// Recomputes the world matrices of the changed nodes and their subtrees. Returns true if any world matrix changed.
+	bool Update(bool parallel = true);
+
+	uint32 GetParent(uint32 node) const
+	{
+		uint32 parent = m_Parents[m_NodeToIndex[node]];
+		return parent == InvalidNode ? InvalidNode : m_IndexToNode[parent];
+	}
+
+	const Matrix& GetWorldMatrix(uint32 node) const { return m_WorldMatrices[m_NodeToIndex[node]]; }
+	// True if the world matrix of the node changed in the last Update()
+	bool HasChanged(uint32 node) const { return m_Changed[m_NodeToIndex[node]] != 0; }
+
+	uint32 GetNumNodes() const { return (uint32)m_Parents.size(); }
+	uint32 GetNumLevels() const { return m_LevelOffsets.empty() ? 0 : (uint32)m_LevelOffsets.size() - 1; }
+
+private:
+	uint32 GetLevel(uint32 index) const
+	{
+		return (uint32)(std::upper_bound(m_LevelOffsets.begin(), m_LevelOffsets.end(), index) - m_LevelOffsets.begin()) - 1;
+	}
+
+	void QueueUpdate(uint32 index, uint32 level)
+	{
+		if (!m_Dirty[index])
+		{
+			m_Dirty[index] = 1;
+			m_DirtyNodes[level].push_back(index);
+			m_AnyDirty = true;
+		}
+	}
+
+	void MarkDirty(uint32 index) { QueueUpdate(index, GetLevel(index)); }
+
+	void UpdateNodes(Span<uint32> indices);
+
+	// All below are indexed in depth order. Parents are indices in depth order too.
+	std::vector<uint32> m_Parents;
+	std::vector<Vector3> m_Translations;
+	std::vector<Quaternion> m_Rotations;
+	std::vector<Vector3> m_Scales;
+	std::vector<Matrix> m_WorldMatrices;
+	// Set while the node is queued in m_DirtyNodes
+	std::vector<uint8> m_Dirty;
+	std::vector<uint8> m_Changed;
+	// Children of node i are [m_ChildOffsets[i], m_ChildOffsets[i + 1])
+	std::vector<uint32> m_ChildOffsets;
+
+	// First node of each level, followed by the number of nodes
+	std::vector<uint32> m_LevelOffsets;
+	// Nodes to update, per level
+	std::vector<std::vector<uint32>> m_DirtyNodes;
+	// Nodes updated in the last Update(), so their changed flag can be reset without visiting all nodes
+	std::vector<uint32> m_ChangedNodes;
+	// Index in depth order of each node passed to Build()
+	std::vector<uint32> m_NodeToIndex;
+	std::vector<uint32> m_IndexToNode;
+
+	bool m_AnyDirty = false;
+};
@@ -1,6 +1,11 @@
 #include "Common.hlsli"
+#include "VisibilityBuffer.hlsli"
 
 Texture2D tDepthTexture : register(t0);
+#if OBJECT_MOTION
+Texture2D<uint> tVisibilityTexture : register(t1);
+StructuredBuffer<MeshletCandidate> tVisibleMeshlets : register(t2);
+#endif
 RWTexture2D<float2> uVelocity  : register(u0);
 
 [numthreads(8, 8, 1)]
@@ -15,7 +20,21 @@ void CSMain(uint3 threadID : SV_DispatchThreadID)
 	float4 currViewPos = mul(float4(clipCurr, depth, 1.0f), cView.ProjectionInverse);
 	currViewPos.xyz /= currViewPos.w;
 	float3 currWorldPos = mul(float4(currViewPos.xyz, 1), cView.ViewInverse).xyz;
-	float4 clipPrev = mul(float4(currWorldPos.xyz, 1), cView.ViewProjectionPrev);
+	float3 prevWorldPos = currWorldPos;
+
+#if OBJECT_MOTION
+	// Moving and skinned instances: reproject the surface with its previous transform and positions
+	uint candidateIndex, primitiveID;
+	if(UnpackVisBuffer(tVisibilityTexture[threadID.xy], candidateIndex, primitiveID))
+	{
+		MeshletCandidate candidate = tVisibleMeshlets[candidateIndex];
+		InstanceData instance = GetInstance(candidate.InstanceID);
+		VisBufferVertexAttribute vertex = GetVertexAttributes(uv, instance, candidate.MeshletIndex, primitiveID);
+		prevWorldPos = GetPreviousPosition(instance, candidate.MeshletIndex, primitiveID, vertex.Barycentrics);
+	}
+#endif
+
+	float4 clipPrev = mul(float4(prevWorldPos, 1), cView.ViewProjectionPrev);
 	clipPrev.xy /= clipPrev.w;
 	float2 velocity = ((clipPrev.xy - cView.ViewJitterPrev) - (clipCurr - cView.ViewJitter)) * float2(0.5f, -0.5f);
 	uVelocity[threadID.xy] = velocity;
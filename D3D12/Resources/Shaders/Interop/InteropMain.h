@@ -26,6 +26,7 @@ struct MeshData
 {
 	uint BufferIndex;
 	uint PositionsOffset;
+	uint PositionsPrevOffset;	// Positions of the previous frame. Only differ from the positions for skinned meshes.
 	uint UVsOffset;
 	uint NormalsOffset;
 	uint ColorsOffset;
@@ -37,6 +38,8 @@ struct MeshData
 	uint MeshletTriangleOffset;
 	uint MeshletBoundsOffset;
 	uint MeshletCount;
+	uint MeshletLODOffset;
+	uint MeshletLODCount;		// Number of meshlets including all LOD levels. The first MeshletCount are full detail.
 };
 
 struct Meshlet
@@ -58,6 +61,23 @@ struct Meshlet
 	{
 		float3 LocalCenter;
 		float3 LocalExtents;
+		float3 SphereCenter;
+		float SphereRadius;
+		// Normal cone. All triangles face away from views inside the cone behind the apex.
+		float3 ConeApex;
+		float ConeCutoff;		// Cosine of the cone's half angle. 1 if the meshlet can't be backface culled.
+		float3 ConeAxis;
+	};
+
+	// Bounding spheres and simplification errors to select a LOD cut. See MeshletLOD.h
+	struct LOD
+	{
+		float3 Center;
+		float Radius;
+		float3 ParentCenter;
+		float ParentRadius;
+		float Error;
+		float ParentError;
 	};
 };
 
@@ -59,6 +59,8 @@ static const int VisibleMeshletCounter = COUNTER_PHASE2_VISIBLE_MESHLETS;	// Ind
 struct CullParams
 {
 	uint2 HZBDimensions;
+	float LODErrorThreshold;	// Maximum error of a meshlet LOD in pixels. LODs are disabled if 0.
+	uint EnableConeCulling;		// Reject backfacing meshlets. Only valid if the rasterizer culls backfaces.
 };
 
 ConstantBuffer<CullParams> cCullParams								: register(b0);
@@ -88,6 +90,66 @@ uint GetCandidateMeshletOffset(bool phase2)
 	return phase2 ? uCounter_CandidateMeshlets[COUNTER_PHASE1_CANDIDATE_MESHLETS] : 0u;
 }
 
+bool UseMeshletLODs()
+{
+	return cCullParams.LODErrorThreshold > 0.0f;
+}
+
+// Projects a simplification error on the screen, in pixels. Matches MeshletLOD::ProjectError.
+float ProjectLODError(float3 localCenter, float radius, float error, float4x4 localToWorld)
+{
+	float scale = max(length(localToWorld[0].xyz), max(length(localToWorld[1].xyz), length(localToWorld[2].xyz)));
+	float projectionScale = cView.Projection[1][1] * cView.ViewportDimensions.y * 0.5f;
+	if(cView.Projection[3][3] == 1.0f)
+		return error * scale * projectionScale;
+	float3 center = mul(float4(localCenter, 1), localToWorld).xyz;
+	float distance = max(length(center - cView.ViewLocation) - radius * scale, 1.0e-4f);
+	return error * scale * projectionScale / distance;
+}
+
+// Returns true if all triangles of the meshlet face away from the view. Matches MeshletCulling::IsBackfacing.
+// The cone axis is transformed as a direction, which assumes the transform doesn't have a non-uniform scale.
+bool IsBackfacing(Meshlet::Bounds bounds, float4x4 localToWorld)
+{
+	if(bounds.ConeCutoff >= 1.0f)
+		return false;
+	float3 apex = mul(float4(bounds.ConeApex, 1), localToWorld).xyz;
+	float3 axis = normalize(mul(bounds.ConeAxis, (float3x3)localToWorld));
+	return dot(normalize(apex - cView.ViewLocation), axis) >= bounds.ConeCutoff;
+}
+
+// Returns true if the bounding sphere of the meshlet is outside one of the side planes of the view.
+// Cheaper than projecting the box, so most meshlets outside of the view are rejected before FrustumCull.
+bool IsSphereOutsideView(float3 localCenter, float localRadius, float4x4 localToWorld, float4x4 viewProjection)
+{
+	float scale = max(length(localToWorld[0].xyz), max(length(localToWorld[1].xyz), length(localToWorld[2].xyz)));
+	float4 center = float4(mul(float4(localCenter, 1), localToWorld).xyz, 1);
+	float radius = localRadius * scale;
+
+	// Left, right, bottom and top planes of the clip space. They're not normalized, so the radius is scaled instead.
+	float4x4 m = transpose(viewProjection);
+	float4 planes[4] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1] };
+	for(uint i = 0; i < 4; ++i)
+	{
+		if(dot(planes[i], center) < -radius * length(planes[i].xyz))
+			return true;
+	}
+	return false;
+}
+
+/*
+	-- Meshlet LOD --
+
+	Each meshlet is part of a hierarchy of simplified meshlet groups (see MeshletLOD.h).
+	A meshlet is rendered when its own error is small enough on screen while its parent's error isn't.
+	All meshlets of an instance are considered and the test only involves the meshlet itself.
+*/
+bool IsInLODCut(Meshlet::LOD lod, float4x4 localToWorld)
+{
+	return ProjectLODError(lod.Center, lod.Radius, lod.Error, localToWorld) <= cCullParams.LODErrorThreshold &&
+		ProjectLODError(lod.ParentCenter, lod.ParentRadius, lod.ParentError, localToWorld) > cCullParams.LODErrorThreshold;
+}
+
 /*
 	Per-instance culling
 */
@@ -154,10 +216,13 @@ void CullInstancesCS(uint threadID : SV_DispatchThreadID)
 	// If instance is visible and wasn't occluded in the previous frame, submit it
     if(isVisible && !wasOccluded)
     {
+		// With LODs, the meshlets of all levels are candidates and the cut is selected per meshlet
+		uint meshletCount = UseMeshletLODs() ? mesh.MeshletLODCount : mesh.MeshletCount;
+
 		// Limit meshlet count to how large our buffer is
 		uint globalMeshletIndex;
-        InterlockedAdd_Varying_WaveOps(uCounter_CandidateMeshlets, COUNTER_TOTAL_CANDIDATE_MESHLETS, mesh.MeshletCount, globalMeshletIndex);
-		int clampedNumMeshlets = min(globalMeshletIndex + mesh.MeshletCount, MAX_NUM_MESHLETS);
+        InterlockedAdd_Varying_WaveOps(uCounter_CandidateMeshlets, COUNTER_TOTAL_CANDIDATE_MESHLETS, meshletCount, globalMeshletIndex);
+		int clampedNumMeshlets = min(globalMeshletIndex + meshletCount, MAX_NUM_MESHLETS);
 		int numMeshletsToAdd = max(clampedNumMeshlets - (int)globalMeshletIndex, 0);
 
 		// Add all meshlets of current instance to the candidate meshlets
@@ -212,8 +277,29 @@ void CullMeshletsCS(uint threadID : SV_DispatchThreadID)
 		InstanceData instance = GetInstance(candidate.InstanceID);
 		MeshData mesh = GetMesh(instance.MeshIndex);
 
-		// Frustum test meshlet against the current view
+		// Reject meshlets which aren't part of the LOD cut before doing any other culling
+		if(UseMeshletLODs())
+		{
+			Meshlet::LOD lod = BufferLoad<Meshlet::LOD>(mesh.BufferIndex, candidate.MeshletIndex, mesh.MeshletLODOffset);
+			if(!IsInLODCut(lod, instance.LocalToWorld))
+				return;
+		}
+
 		Meshlet::Bounds bounds = BufferLoad<Meshlet::Bounds>(mesh.BufferIndex, candidate.MeshletIndex, mesh.MeshletBoundsOffset);
+
+		// Cheap pre-test of the bounding sphere against the view
+		if(IsSphereOutsideView(bounds.SphereCenter, bounds.SphereRadius, instance.LocalToWorld, cView.ViewProjection))
+			return;
+
+		// Reject meshlets facing away from the view. Masked materials (raster bin 1) are rendered double sided.
+		if(cCullParams.EnableConeCulling)
+		{
+			MaterialData material = GetMaterial(instance.MaterialIndex);
+			if(material.RasterBin == 0 && IsBackfacing(bounds, instance.LocalToWorld))
+				return;
+		}
+
+		// Frustum test meshlet against the current view
 		FrustumCullData cullData = FrustumCull(bounds.LocalCenter, bounds.LocalExtents, instance.LocalToWorld, cView.ViewProjection);
 		bool isVisible = cullData.IsVisible;
 		bool wasOccluded = false;
@@ -80,6 +80,17 @@ float2 Unpack_RG16_SNORM(uint value)
 	return max(float2(signedV) / 32767.0f, -1.0f);
 }
 
+uint Pack_RG16_SNORM(float2 value)
+{
+	int2 packed = int2(round(clamp(value, -1.0f, 1.0f) * 32767.0f)) & 0xFFFF;
+	return uint(packed.x | (packed.y << 16));
+}
+
+uint2 Pack_RGBA16_SNORM(float4 value)
+{
+	return uint2(Pack_RG16_SNORM(value.xy), Pack_RG16_SNORM(value.zw));
+}
+
 float4 Unpack_RGBA16_SNORM(uint2 value)
 {
 	return float4(
@@ -104,6 +115,13 @@ float3 Unpack_R11G11B10_FLOAT(uint rgb)
 	return float3(r, g, b);
 }
 
+uint Pack_RGB10A2_SNORM(float4 value)
+{
+	int3 xyz = int3(round(clamp(value.xyz, -1.0f, 1.0f) * 511.0f)) & 0x3FF;
+	int w = int(round(clamp(value.w, -1.0f, 1.0f)));
+	return uint(xyz.x | (xyz.y << 10) | (xyz.z << 20) | (w << 30));
+}
+
 float4 Unpack_RGB10A2_SNORM(uint value)
 {
 	const float scaleXYZ = 1.0f / 511.0f;
@@ -0,0 +1,51 @@
+#include "Common.hlsli"
+
+struct PassParameters
+{
+	uint NumVertices;
+	uint PositionsOffset;
+	uint NormalsOffset;
+	uint SkinOffset;
+	uint SkinnedPositionsOffset;
+	uint SkinnedPositionsPrevOffset;
+	uint SkinnedNormalsOffset;
+	uint HasPrevious;			// If 0, the previous positions are not valid yet and get the current positions
+};
+
+ConstantBuffer<PassParameters> cPass : register(b0);
+StructuredBuffer<float4x4> tJointMatrices : register(t0);
+RWByteAddressBuffer uGeometryData : register(u0);
+
+[numthreads(64, 1, 1)]
+void SkinCS(uint vertexIndex : SV_DispatchThreadID)
+{
+	if(vertexIndex >= cPass.NumVertices)
+		return;
+
+	float3 position = Unpack_RGBA16_SNORM(uGeometryData.Load2(cPass.PositionsOffset + vertexIndex * 8)).xyz;
+	uint2 normalData = uGeometryData.Load2(cPass.NormalsOffset + vertexIndex * 8);
+	float3 normal = Unpack_RGB10A2_SNORM(normalData.x).xyz;
+	float4 tangent = Unpack_RGB10A2_SNORM(normalData.y);
+
+	// 4 16-bit joint indices and 4 16-bit UNORM weights
+	uint4 skinData = uGeometryData.Load4(cPass.SkinOffset + vertexIndex * 16);
+	uint4 joints = uint4(skinData.x & 0xFFFF, skinData.x >> 16, skinData.y & 0xFFFF, skinData.y >> 16);
+	float4 weights = float4(skinData.z & 0xFFFF, skinData.z >> 16, skinData.w & 0xFFFF, skinData.w >> 16) / 65535.0f;
+
+	float4x4 skinMatrix =
+		tJointMatrices[joints.x] * weights.x +
+		tJointMatrices[joints.y] * weights.y +
+		tJointMatrices[joints.z] * weights.z +
+		tJointMatrices[joints.w] * weights.w;
+
+	float3 skinnedPosition = mul(float4(position, 1), skinMatrix).xyz;
+	float3 skinnedNormal = normalize(mul(normal, (float3x3)skinMatrix));
+	float3 skinnedTangent = normalize(mul(tangent.xyz, (float3x3)skinMatrix));
+
+	uint2 packedPosition = Pack_RGBA16_SNORM(float4(skinnedPosition, 1));
+	uint positionAddress = vertexIndex * 8;
+	uint2 previousPosition = cPass.HasPrevious ? uGeometryData.Load2(cPass.SkinnedPositionsOffset + positionAddress) : packedPosition;
+	uGeometryData.Store2(cPass.SkinnedPositionsPrevOffset + positionAddress, previousPosition);
+	uGeometryData.Store2(cPass.SkinnedPositionsOffset + positionAddress, packedPosition);
+	uGeometryData.Store2(cPass.SkinnedNormalsOffset + vertexIndex * 8, uint2(Pack_RGB10A2_SNORM(float4(skinnedNormal, 0)), Pack_RGB10A2_SNORM(float4(skinnedTangent, tangent.w))));
+}
@@ -86,17 +86,22 @@ struct VisBufferVertexAttribute
 	float3 Barycentrics;
 };
 
-VisBufferVertexAttribute GetVertexAttributes(float2 screenUV, InstanceData instance, uint meshletIndex, uint primitiveID)
+uint3 GetTriangleIndices(MeshData mesh, uint meshletIndex, uint primitiveID)
 {
-	MeshData mesh = GetMesh(instance.MeshIndex);
 	Meshlet meshlet = BufferLoad<Meshlet>(mesh.BufferIndex, meshletIndex, mesh.MeshletOffset);
 	Meshlet::Triangle tri = BufferLoad<Meshlet::Triangle>(mesh.BufferIndex, primitiveID + meshlet.TriangleOffset, mesh.MeshletTriangleOffset);
 
-	uint3 indices = uint3(
+	return uint3(
 		BufferLoad<uint>(mesh.BufferIndex, tri.V0 + meshlet.VertexOffset, mesh.MeshletVertexOffset),
 		BufferLoad<uint>(mesh.BufferIndex, tri.V1 + meshlet.VertexOffset, mesh.MeshletVertexOffset),
 		BufferLoad<uint>(mesh.BufferIndex, tri.V2 + meshlet.VertexOffset, mesh.MeshletVertexOffset)
 	);
+}
+
+VisBufferVertexAttribute GetVertexAttributes(float2 screenUV, InstanceData instance, uint meshletIndex, uint primitiveID)
+{
+	MeshData mesh = GetMesh(instance.MeshIndex);
+	uint3 indices = GetTriangleIndices(mesh, meshletIndex, primitiveID);
 
 	VisBufferVertexAttribute vertices[3];
 	float3 positions[3];
@@ -135,3 +140,18 @@ VisBufferVertexAttribute GetVertexAttributes(float2 screenUV, InstanceData insta
 	outVertex.Barycentrics = bary.Barycentrics;
 	return outVertex;
 }
+
+// World space position of the previous frame, from the previous transform and skinned positions
+float3 GetPreviousPosition(InstanceData instance, uint meshletIndex, uint primitiveID, float3 barycentrics)
+{
+	MeshData mesh = GetMesh(instance.MeshIndex);
+	uint3 indices = GetTriangleIndices(mesh, meshletIndex, primitiveID);
+
+	float3 positions[3];
+	for(uint i = 0; i < 3; ++i)
+	{
+		float3 position = Unpack_RGBA16_SNORM(BufferLoad<uint2>(mesh.BufferIndex, indices[i], mesh.PositionsPrevOffset)).xyz;
+		positions[i] = mul(float4(position, 1), instance.LocalToWorldPrev).xyz;
+	}
+	return BaryInterpolate(positions[0], positions[1], positions[2], barycentrics);
+}
@@ -0,0 +1,1452 @@
+#include "stdafx.h"
+#include "Core/ConsoleVariables.h"
+#include "Core/Paths.h"
+#include "Core/TaskQueue.h"
+#include "Core/TLSFAllocator.h"
+#include "Core/Utils.h"
+#include "Graphics/BLASScheduler.h"
+#include "Graphics/BVH.h"
+#include "Graphics/FrustumCulling.h"
+#include "Graphics/MeshletLOD.h"
+#include "Graphics/SceneView.h"
+#include "Graphics/ShadowScheduler.h"
+#include "Graphics/TextureStreaming.h"
+#include "Graphics/TransformHierarchy.h"
+#include "Graphics/RHI/GraphicsResource.h"
+#include "Graphics/RHI/PipelineCache.h"
+#include "Graphics/RHI/ResourceStateTracker.h"
+#include "Graphics/RHI/StreamingUploader.h"
+
+/*
+	Self-tests and benchmarks of systems which can run without the scene, started from the console.
+	Tests drive a system with synthetic inputs and break on the first failed check.
+	Benchmarks time a system against a reference implementation and only warn when the results differ, so the timings are still logged.
+*/
+namespace SelfTests
+{
+	// Pseudo random number from an index, so inputs don't depend on the state of rand()
+	static uint32 HashIndex(uint32 index)
+	{
+		return index * 2654435761u;
+	}
+
+	// Average time of a call to 'fn' over 'numIterations' calls, in milliseconds
+	template<typename Fn>
+	static float MeasureMs(Fn&& fn, uint32 numIterations = 1)
+	{
+		Utils::TimeScope timer;
+		for (uint32 iteration = 0; iteration < numIterations; ++iteration)
+			fn();
+		return timer.Stop() * 1000.0f / numIterations;
+	}
+
+	static float Speedup(float referenceTime, float time)
+	{
+		return referenceTime / Math::Max(time, FLT_EPSILON);
+	}
+
+	// Runs 'fn' twice and checks both runs have the same result
+	template<typename Fn>
+	static auto RunTwice(const char* pName, Fn&& fn)
+	{
+		auto result = fn();
+		check(result == fn(), "%s is not deterministic", pName);
+		return result;
+	}
+
+	// Logs a warning if 'condition' fails
+	template<typename... Args>
+	static bool Expect(bool condition, const char* pFormat, Args&&... args)
+	{
+		if (!condition)
+			Console::LogFormat(LogType::Warning, pFormat, std::forward<Args>(args)...);
+		return condition;
+	}
+
+	// Box of an instance somewhere in a large, flat scene
+	static BoundingBox RandomBox()
+	{
+		BoundingBox box;
+		box.Center = Vector3(Math::RandomRange(-500.0f, 500.0f), Math::RandomRange(-50.0f, 50.0f), Math::RandomRange(-500.0f, 500.0f));
+		box.Extents = Vector3(Math::RandomRange(0.1f, 5.0f), Math::RandomRange(0.1f, 5.0f), Math::RandomRange(0.1f, 5.0f));
+		return box;
+	}
+
+	// Random allocations and frees, similar to the buffers of a scene streaming in and out.
+	// The range is about twice the size of the live allocations.
+	// Checks the allocations never overlap and measures the speed and fragmentation.
+	static void BenchmarkTLSFAllocator(int numAllocations)
+	{
+		numAllocations = Math::Max(numAllocations, 1);
+		const uint64 heapSize = (uint64)numAllocations * 512 * 1024;
+		constexpr uint32 NumFramesInFlight = 3;
+		srand(4);
+
+		auto RandomSize = []() -> uint64
+		{
+			uint32 r = rand() % 100;
+			if (r < 70)
+				return 256 + (uint64)rand() * 64 % (64 * 1024);
+			if (r < 95)
+				return 64 * 1024 + (uint64)rand() * 32 % (1024 * 1024);
+			return 1024 * 1024 + (uint64)rand() * 128 % (3 * 1024 * 1024);
+		};
+		constexpr uint32 Alignments[] = { 16, 256, 64 * 1024 };
+
+		TLSFAllocator allocator(heapSize);
+		std::vector<TLSFAllocator::Allocation> allocations;
+		uint64 frame = 0;
+		uint32 numFailed = 0;
+		const uint32 numOperations = numAllocations * 20;
+
+		float time = MeasureMs([&]()
+			{
+				for (uint32 i = 0; i < numOperations; ++i)
+				{
+					if ((uint32)allocations.size() < (uint32)numAllocations || rand() % 2)
+					{
+						uint32 alignment = Alignments[rand() % ARRAYSIZE(Alignments)];
+						TLSFAllocator::Allocation allocation = allocator.Allocate(RandomSize(), alignment);
+						if (allocation.IsValid())
+						{
+							check(allocation.Offset % alignment == 0 && allocation.Offset + allocation.Size <= heapSize);
+							allocations.push_back(allocation);
+						}
+						else
+						{
+							++numFailed;
+						}
+					}
+					else if (!allocations.empty())
+					{
+						uint32 index = rand() % (uint32)allocations.size();
+						if (rand() % 2)
+							allocator.Free(allocations[index], frame);
+						else
+							allocator.Free(allocations[index]);
+						std::swap(allocations[index], allocations.back());
+						allocations.pop_back();
+					}
+
+					if (i % 64 == 0)
+					{
+						++frame;
+						if (frame > NumFramesInFlight)
+							allocator.Recycle(frame - NumFramesInFlight);
+					}
+				}
+			});
+		check(allocator.Validate(), "TLSF allocator is corrupt");
+
+		std::sort(allocations.begin(), allocations.end(), [](const auto& a, const auto& b) { return a.Offset < b.Offset; });
+		for (size_t i = 1; i < allocations.size(); ++i)
+			check(allocations[i - 1].Offset + allocations[i - 1].Size <= allocations[i].Offset, "TLSF allocations overlap");
+
+		auto LogStats = [](const char* pName, const TLSFAllocator::Stats& stats)
+		{
+			E_LOG(Info, "\t%s: %d allocations - %.1f MB used - %d free blocks - Largest free block: %.1f MB - Fragmentation: %.1f%%",
+				pName, stats.NumAllocations, (float)stats.UsedSize / (1024 * 1024), stats.NumFreeBlocks, (float)stats.LargestFreeBlock / (1024 * 1024), stats.GetFragmentation() * 100.0f);
+		};
+
+		E_LOG(Info, "TLSF allocator: %d operations in %.3f ms (%.1f ns/operation). %d failed allocations", numOperations, time, time * 1.0e6f / numOperations, numFailed);
+		allocator.Recycle(frame);
+		LogStats("After churn", allocator.GetStats());
+
+		// Move the hinted allocations, like a defragmentation pass copying buffers to their new range would
+		std::vector<TLSFAllocator::Allocation> hints;
+		allocator.GetDefragmentationHints(256, hints);
+		uint32 numMoved = 0;
+		for (const TLSFAllocator::Allocation& hint : hints)
+		{
+			TLSFAllocator::Allocation moved = allocator.Allocate(hint.Size, 256);
+			if (moved.IsValid())
+			{
+				allocator.Free(hint);
+				++numMoved;
+			}
+		}
+		check(allocator.Validate(), "TLSF allocator is corrupt");
+		LogStats(Sprintf("After moving %d hinted allocations", numMoved).c_str(), allocator.GetStats());
+	}
+
+	// Replays the same random barriers on the flat tracker and on a map keyed by resource, like the contexts used before
+	static void BenchmarkResourceStateTracking(int numResources)
+	{
+		numResources = Math::Max(numResources, 1);
+		constexpr uint32 NumCommandLists = 64;
+		constexpr uint32 NumBarriersPerCommandList = 4096;
+		srand(3);
+
+		// A quarter of the resources are textures with barriers on single mips, the others are buffers
+		struct Barrier
+		{
+			uint32 Resource;
+			uint32 Subresource;
+			D3D12_RESOURCE_STATES State;
+		};
+		std::vector<Barrier> barriers(NumBarriersPerCommandList);
+		for (Barrier& barrier : barriers)
+		{
+			barrier.Resource = (uint32)(rand() % numResources);
+			barrier.Subresource = barrier.Resource % 4 == 0 ? (uint32)(rand() % 4) : D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+			barrier.State = rand() % 2 ? D3D12_RESOURCE_STATE_UNORDERED_ACCESS : D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+		}
+
+		std::vector<ResourceTrackingHandle> handles(numResources);
+		for (ResourceTrackingHandle& handle : handles)
+			handle = ResourceStateTracker::AllocateHandle();
+
+		uint32 numTransitionsMap = 0;
+		float mapTime = MeasureMs([&]()
+			{
+				std::unordered_map<const void*, ResourceState> states;
+				for (uint32 list = 0; list < NumCommandLists; ++list)
+				{
+					states.clear();
+					for (const Barrier& barrier : barriers)
+					{
+						ResourceState& state = states[&handles[barrier.Resource]];
+						if (state.Get(barrier.Subresource) != barrier.State)
+						{
+							state.Set(barrier.State, barrier.Subresource);
+							++numTransitionsMap;
+						}
+					}
+				}
+			});
+
+		uint32 numTransitionsFlat = 0;
+		float flatTime = MeasureMs([&]()
+			{
+				ResourceStateTracker tracker;
+				for (uint32 list = 0; list < NumCommandLists; ++list)
+				{
+					tracker.Reset();
+					for (const Barrier& barrier : barriers)
+					{
+						ResourceTrackingHandle handle = handles[barrier.Resource];
+						if (tracker.Get(handle, barrier.Subresource) != barrier.State)
+						{
+							tracker.Set(handle, barrier.State, barrier.Subresource);
+							++numTransitionsFlat;
+						}
+					}
+				}
+			});
+
+		for (ResourceTrackingHandle handle : handles)
+			ResourceStateTracker::ReleaseHandle(handle);
+
+		check(numTransitionsMap == numTransitionsFlat, "State trackers disagree (%d vs %d transitions)", numTransitionsMap, numTransitionsFlat);
+		const float numBarriers = (float)(NumCommandLists * NumBarriersPerCommandList);
+		E_LOG(Info, "Resource state tracking: %d resources, %d barriers", numResources, (int)numBarriers);
+		E_LOG(Info, "\tMap: %.2f ns/barrier - Flat: %.2f ns/barrier (%.2fx)", mapTime * 1.0e6f / numBarriers, flatTime * 1.0e6f / numBarriers, Speedup(mapTime, flatTime));
+	}
+
+	// Allocates and frees persistent descriptor indices from many threads, like loader threads registering views.
+	// Validates that no index is handed out twice or before its fence completed,
+	// and compares the FencedFreeList with a FreeList behind a lock.
+	static void BenchmarkDescriptorAllocator(int numThreads)
+	{
+		numThreads = Math::Clamp(numThreads, 1, (int)TaskQueue::ThreadCount());
+		constexpr uint32 NumDescriptors = 16384;
+		constexpr uint32 NumOperationsPerThread = 200000;
+		constexpr uint32 MaxLiveDescriptorsPerThread = 128;
+		constexpr uint32 OperationsPerFrame = 2000;
+		constexpr uint64 FramesInFlight = 2;
+
+		struct LockedFreeList
+		{
+			LockedFreeList(uint32 size) : List(size) {}
+
+			uint32 Allocate()
+			{
+				std::lock_guard lock(Lock);
+				return List.CanAllocate() ? List.Allocate() : FencedFreeList::InvalidIndex;
+			}
+			void Free(uint32 index, uint64 fenceValue)
+			{
+				std::lock_guard lock(Lock);
+				DeletionQueue.emplace(index, fenceValue);
+			}
+			void Recycle(uint64 completedFenceValue)
+			{
+				std::lock_guard lock(Lock);
+				while (!DeletionQueue.empty() && DeletionQueue.front().second <= completedFenceValue)
+				{
+					List.Free(DeletionQueue.front().first);
+					DeletionQueue.pop();
+				}
+			}
+
+			FreeList List;
+			std::mutex Lock;
+			std::queue<std::pair<uint32, uint64>> DeletionQueue;
+		};
+
+		auto Run = [&](auto& allocator, uint32& outErrors)
+		{
+			std::unique_ptr<std::atomic<uint8>[]> owned = std::make_unique<std::atomic<uint8>[]>(NumDescriptors);
+			std::unique_ptr<std::atomic<uint64>[]> freeFenceValues = std::make_unique<std::atomic<uint64>[]>(NumDescriptors);
+			for (uint32 i = 0; i < NumDescriptors; ++i)
+			{
+				owned[i] = 0;
+				freeFenceValues[i] = 0;
+			}
+			// Simulated frame fence. The GPU is 'FramesInFlight' frames behind.
+			std::atomic<uint64> currentFence = FramesInFlight + 1;
+			std::atomic<uint32> numOperations = 0;
+			std::atomic<uint32> numErrors = 0;
+
+			float time = MeasureMs([&]()
+				{
+					TaskContext context;
+					TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+						{
+							uint32 seed = args.JobIndex * 7919 + 1;
+							std::vector<uint32> live;
+							live.reserve(MaxLiveDescriptorsPerThread);
+
+							auto FreeIndex = [&](uint32 liveIndex)
+							{
+								const uint32 index = live[liveIndex];
+								live[liveIndex] = live.back();
+								live.pop_back();
+								const uint64 fenceValue = currentFence.load();
+								freeFenceValues[index] = fenceValue;
+								owned[index] = 0;
+								allocator.Free(index, fenceValue);
+							};
+
+							for (uint32 i = 0; i < NumOperationsPerThread; ++i)
+							{
+								if (numOperations.fetch_add(1) % OperationsPerFrame == 0)
+									currentFence.fetch_add(1);
+
+								seed = seed * 1664525u + 1013904223u;
+								if (!live.empty() && (live.size() == MaxLiveDescriptorsPerThread || (seed >> 16) % 2 == 0))
+								{
+									FreeIndex((seed >> 8) % (uint32)live.size());
+									continue;
+								}
+
+								uint32 index = allocator.Allocate();
+								while (index == FencedFreeList::InvalidIndex)
+								{
+									// Out of descriptors. Let the GPU catch up.
+									const uint64 completedFence = currentFence.fetch_add(1) + 1 - FramesInFlight;
+									allocator.Recycle(completedFence);
+									index = allocator.Allocate();
+								}
+
+								if (owned[index].exchange(1) != 0)
+									++numErrors;
+								// Recycled indices were freed at a fence value which completed
+								if (freeFenceValues[index] + FramesInFlight > currentFence.load() + 1)
+									++numErrors;
+								live.push_back(index);
+							}
+
+							while (!live.empty())
+								FreeIndex((uint32)live.size() - 1);
+						}, context, numThreads, 1);
+					TaskQueue::Join(context);
+				});
+
+			allocator.Recycle(~0ull);
+			outErrors = numErrors;
+			return time;
+		};
+
+		const uint32 numOperations = numThreads * NumOperationsPerThread;
+
+		uint32 lockedErrors = 0;
+		LockedFreeList lockedFreeList(NumDescriptors);
+		float lockedTime = Run(lockedFreeList, lockedErrors);
+
+		uint32 fencedErrors = 0;
+		FencedFreeList fencedFreeList(NumDescriptors);
+		float fencedTime = Run(fencedFreeList, fencedErrors);
+		if (fencedFreeList.GetNumAllocations() != 0)
+			++fencedErrors;
+
+		E_LOG(Info, "Descriptor allocation: %d threads, %d operations", numThreads, numOperations);
+		E_LOG(Info, "\tFreeList + lock: %.2f ms (%.1f Mops/s)", lockedTime, numOperations / lockedTime / 1000.0f);
+		E_LOG(Info, "\tFencedFreeList: %.2f ms (%.1f Mops/s) - %.2fx", fencedTime, numOperations / fencedTime / 1000.0f, Speedup(lockedTime, fencedTime));
+		Expect(lockedErrors == 0 && fencedErrors == 0, "Descriptor allocation validation failed: %d errors (FreeList + lock) - %d errors (FencedFreeList)", lockedErrors, fencedErrors);
+	}
+
+	// Runs sessions of the cache on the null backend with synthetic pipelines, with the index in a temporary file.
+	// Checks that keys depend on the identity and each shader hash, that the index survives a round-trip,
+	// that recompiling a shader only invalidates the pipelines using it, and that a corrupt index is discarded.
+	static void TestPipelineCache(int numPipelines)
+	{
+		numPipelines = Math::Max(numPipelines, 2);
+		const std::string indexPath = Sprintf("%sPipelineCacheTest.index", Paths::ShaderCacheDir().c_str());
+		::DeleteFileA(indexPath.c_str());
+
+		// Each pipeline has a vertex and a pixel shader. Vertex shaders are shared by a few pipelines.
+		constexpr uint32 PipelinesPerVertexShader = 4;
+		auto GetHash = [](uint32 value, uint64 seed) { return Hash::Murmur3_128(&value, sizeof(value), seed); };
+		std::vector<Hash128> identities(numPipelines);
+		std::vector<Hash128> pixelShaders(numPipelines);
+		std::vector<Hash128> vertexShaders((numPipelines + PipelinesPerVertexShader - 1) / PipelinesPerVertexShader);
+		for (uint32 i = 0; i < (uint32)numPipelines; ++i)
+		{
+			identities[i] = GetHash(i, 0);
+			pixelShaders[i] = GetHash(i, 1);
+		}
+		for (uint32 i = 0; i < (uint32)vertexShaders.size(); ++i)
+			vertexShaders[i] = GetHash(i, 2);
+
+		auto GetKey = [&](uint32 i) { return PipelineCache::ComputeKey(identities[i], { vertexShaders[i / PipelinesPerVertexShader], pixelShaders[i] }); };
+
+		const Hash128 key = RunTwice("Key", [&]() { return GetKey(0); });
+		check(key != PipelineCache::ComputeKey(identities[1], { vertexShaders[0], pixelShaders[0] }), "Key doesn't depend on the identity");
+		check(key != PipelineCache::ComputeKey(identities[0], { vertexShaders[0], pixelShaders[1] }), "Key doesn't depend on the shader hashes");
+		check(key != PipelineCache::ComputeKey(identities[0], { pixelShaders[0], vertexShaders[0] }), "Key doesn't depend on the shader order");
+		check(key != PipelineCache::ComputeKey(identities[0], { vertexShaders[0] }), "Key doesn't depend on the number of shaders");
+		std::unordered_set<Hash128> keys;
+		for (uint32 i = 0; i < (uint32)numPipelines; ++i)
+			keys.insert(GetKey(i));
+		check(keys.size() == (size_t)numPipelines, "Pipelines share keys");
+
+		// Creates all pipelines through the cache like PipelineState does, and saves it at the end.
+		// Returns which pipelines had their current key in the index.
+		auto RunSession = [&]()
+		{
+			PipelineCache cache(std::make_unique<NullPipelineCacheBackend>(), indexPath.c_str());
+			std::vector<bool> isCurrent(numPipelines);
+			for (uint32 i = 0; i < (uint32)numPipelines; ++i)
+			{
+				const Hash128 pipelineKey = GetKey(i);
+				isCurrent[i] = cache.IsCurrentKey(identities[i], pipelineKey);
+				D3D12_PIPELINE_STATE_STREAM_DESC desc{};
+				if (!cache.Load(identities[i], pipelineKey, desc))
+					cache.Store(identities[i], pipelineKey, nullptr);
+			}
+			cache.Save();
+			return isCurrent;
+		};
+		auto CountCurrent = [](const std::vector<bool>& isCurrent) { return (uint32)std::count(isCurrent.begin(), isCurrent.end(), true); };
+
+		check(CountCurrent(RunSession()) == 0, "Index has entries before it was written");
+		check(CountCurrent(RunSession()) == (uint32)numPipelines, "Index entries were lost in the round-trip");
+
+		// Recompile the first vertex shader
+		vertexShaders[0] = GetHash(0, 3);
+		std::vector<bool> isCurrent = RunSession();
+		for (uint32 i = 0; i < (uint32)numPipelines; ++i)
+			check(isCurrent[i] == (i >= PipelinesPerVertexShader), "Pipeline %d: only the pipelines using the recompiled shader must be invalidated", i);
+		check(CountCurrent(RunSession()) == (uint32)numPipelines, "Stale entries were not replaced");
+
+		// An index of another version must not be trusted. The header starts with the magic and the version.
+		FILE* pFile = nullptr;
+		if (fopen_s(&pFile, indexPath.c_str(), "r+b") == 0)
+		{
+			uint32 header[2];
+			if (fread(header, sizeof(header), 1, pFile) == 1)
+			{
+				++header[1];
+				fseek(pFile, 0, SEEK_SET);
+				fwrite(header, sizeof(header), 1, pFile);
+			}
+			fclose(pFile);
+		}
+		check(CountCurrent(RunSession()) == 0, "Corrupt index was used");
+
+		::DeleteFileA(indexPath.c_str());
+		E_LOG(Info, "Pipeline cache: %d pipelines, %d vertex shaders - Key computation, index round-trip and invalidation passed", numPipelines, (uint32)vertexShaders.size());
+	}
+
+	// Runs the copies on the CPU. A submission is only executed once it is completed,
+	// so a staging page reused too early shows up as wrong data in the targets.
+	class MockUploadBackend : public IUploadBackend
+	{
+	public:
+		struct Copy
+		{
+			uint32 PageIndex;
+			uint64 PageOffset;
+			UploadTarget Target;
+			uint64 TargetOffset;
+			uint64 Size;
+		};
+
+		struct Submission
+		{
+			uint32 Frame;
+			std::vector<Copy> Copies;
+		};
+
+		MockUploadBackend(uint32 numFramesInFlight)
+			: m_NumFramesInFlight(numFramesInFlight)
+		{}
+
+		void* CreatePage(uint32 pageIndex, uint64 size) override
+		{
+			std::scoped_lock lock(m_PagesLock);
+			check(pageIndex == (uint32)m_Pages.size());
+			return m_Pages.emplace_back(size).data();
+		}
+
+		void RecordCopy(uint32 pageIndex, uint64 pageOffset, const UploadTarget& target, uint64 targetOffset, uint64 size) override
+		{
+			check(target.pCPUMemory, "The mock backend only uploads to CPU memory");
+			m_Recorded.push_back({ pageIndex, pageOffset, target, targetOffset, size });
+		}
+
+		uint64 Submit() override
+		{
+			uint64 numBytes = 0;
+			for (const Copy& copy : m_Recorded)
+				numBytes += copy.Size;
+			MaxSubmissionBytes = Math::Max(MaxSubmissionBytes, m_Recorded.size() > 1 ? numBytes : 0);
+			++NumSubmissions;
+			m_Submissions.push({ m_Frame, std::move(m_Recorded) });
+			m_Recorded.clear();
+			return ++m_SubmittedFenceValue;
+		}
+
+		uint64 GetCompletedFenceValue() override { return m_CompletedFenceValue; }
+
+		void WaitForFence(uint64 fenceValue) override
+		{
+			while (m_CompletedFenceValue < fenceValue)
+				CompleteSubmission();
+		}
+
+		// Completes the submissions made 'numFramesInFlight' frames ago, like the GPU would
+		void AdvanceFrame()
+		{
+			++m_Frame;
+			while (!m_Submissions.empty() && m_Submissions.front().Frame + m_NumFramesInFlight <= m_Frame)
+				CompleteSubmission();
+		}
+
+		uint64 MaxSubmissionBytes = 0;
+		uint32 NumSubmissions = 0;
+
+	private:
+		void CompleteSubmission()
+		{
+			std::scoped_lock lock(m_PagesLock);
+			for (const Copy& copy : m_Submissions.front().Copies)
+				memcpy((char*)copy.Target.pCPUMemory + copy.TargetOffset, m_Pages[copy.PageIndex].data() + copy.PageOffset, copy.Size);
+			m_Submissions.pop();
+			++m_CompletedFenceValue;
+		}
+
+		std::mutex m_PagesLock;
+		std::deque<std::vector<char>> m_Pages;
+		std::vector<Copy> m_Recorded;
+		std::queue<Submission> m_Submissions;
+		uint32 m_NumFramesInFlight;
+		uint32 m_Frame = 0;
+		uint64 m_SubmittedFenceValue = 0;
+		std::atomic<uint64> m_CompletedFenceValue = 0;
+	};
+
+	// Uploads from all threads while the main thread flushes with a budget, like frames would.
+	// Checks the budget is respected and the targets end up with the right data.
+	static void TestStreamingUploader(int numUploads)
+	{
+		numUploads = Math::Max(numUploads, 1);
+		constexpr uint64 PageSize = 1024 * 1024;
+		constexpr uint64 BytesPerFrame = 4 * 1024 * 1024;
+		constexpr uint32 NumFramesInFlight = 2;
+
+		auto GetUploadSize = [](uint32 upload) -> uint64 { return 16 + HashIndex(upload) % (3 * PageSize); };
+		auto GetByte = [](uint32 upload, uint64 i) { return (char)(upload * 31 + i * 7 + (i >> 8)); };
+
+		std::vector<std::vector<char>> targets(numUploads);
+		std::vector<UploadTicket> tickets(numUploads);
+		uint64 totalSize = 0;
+		for (uint32 upload = 0; upload < (uint32)numUploads; ++upload)
+		{
+			targets[upload].resize(GetUploadSize(upload));
+			totalSize += targets[upload].size();
+		}
+
+		MockUploadBackend* pBackend = new MockUploadBackend(NumFramesInFlight);
+		StreamingUploader uploader(std::unique_ptr<IUploadBackend>(pBackend), PageSize);
+
+		uint32 numFrames = 0;
+		float stageTime = MeasureMs([&]()
+			{
+				TaskContext context;
+				TaskQueue::ExecuteMany([&](TaskDistributeArgs args)
+					{
+						std::vector<char> data(targets[args.JobIndex].size());
+						for (uint64 i = 0; i < data.size(); ++i)
+							data[i] = GetByte(args.JobIndex, i);
+						tickets[args.JobIndex] = uploader.Upload(UploadTarget(targets[args.JobIndex].data()), 0, data.data(), data.size());
+					}, context, numUploads, 1);
+
+				while (context.load() > 0)
+				{
+					uploader.Flush(BytesPerFrame);
+					pBackend->AdvanceFrame();
+					++numFrames;
+				}
+				TaskQueue::Join(context);
+			});
+
+		for (uint32 upload = 0; upload < (uint32)numUploads; ++upload)
+		{
+			while (!uploader.IsComplete(tickets[upload]))
+			{
+				uploader.Flush(BytesPerFrame);
+				pBackend->AdvanceFrame();
+				++numFrames;
+			}
+		}
+
+		uint32 numErrors = 0;
+		for (uint32 upload = 0; upload < (uint32)numUploads; ++upload)
+		{
+			for (uint64 i = 0; i < targets[upload].size(); ++i)
+			{
+				if (targets[upload][i] != GetByte(upload, i))
+				{
+					++numErrors;
+					break;
+				}
+			}
+		}
+
+		check(numErrors == 0, "%d uploads have wrong data", numErrors);
+		check(pBackend->MaxSubmissionBytes <= BytesPerFrame, "Submission of %llu bytes is over the budget", pBackend->MaxSubmissionBytes);
+		const float totalSizeMB = (float)totalSize / (1024 * 1024);
+		E_LOG(Info, "Streaming uploader: %d uploads (%.1f MB) staged in %.2f ms (%.0f MB/s) on %d threads",
+			numUploads, totalSizeMB, stageTime, totalSizeMB * 1000.0f / Math::Max(stageTime, FLT_EPSILON), TaskQueue::ThreadCount());
+		E_LOG(Info, "\t%d frames - %d submissions - %d staging pages of %d KB", numFrames, pBackend->NumSubmissions, uploader.GetNumPages(), (int)(PageSize / 1024));
+	}
+
+	// Builds a random hierarchy of the given number of nodes, moves a part of it and measures the propagation
+	static void BenchmarkTransformHierarchy(int numNodes)
+	{
+		numNodes = Math::Max(numNodes, 1);
+		srand(2);
+
+		// Wide and shallow, similar to a scene of many objects with a few levels each
+		std::vector<TransformHierarchy::NodeDesc> nodes(numNodes);
+		for (int i = 0; i < numNodes; ++i)
+		{
+			TransformHierarchy::NodeDesc& node = nodes[i];
+			node.Parent = i < 64 ? TransformHierarchy::InvalidNode : (uint32)(rand() % (i / 2 + 1) + i / 4);
+			node.Translation = Vector3(Math::RandomRange(-10.0f, 10.0f), Math::RandomRange(-10.0f, 10.0f), Math::RandomRange(-10.0f, 10.0f));
+			node.Rotation = Quaternion::CreateFromYawPitchRoll(Math::RandomRange(0.0f, Math::PI), 0, 0);
+		}
+
+		TransformHierarchy hierarchy;
+		float buildTime = MeasureMs([&]() { hierarchy.Build(nodes); });
+
+		auto MeasureUpdate = [&](uint32 numMoved, bool parallel)
+		{
+			for (uint32 i = 0; i < numMoved; ++i)
+			{
+				uint32 node = (uint32)(rand() % numNodes);
+				hierarchy.SetTranslation(node, hierarchy.GetTranslation(node) + Vector3(0, 0.1f, 0));
+			}
+			return MeasureMs([&]() { hierarchy.Update(parallel); });
+		};
+
+		// Dirty everything by moving all roots
+		auto MeasureFullUpdate = [&](bool parallel)
+		{
+			for (uint32 i = 0; i < Math::Min(64u, (uint32)numNodes); ++i)
+				hierarchy.SetTranslation(i, hierarchy.GetTranslation(i));
+			return MeasureMs([&]() { hierarchy.Update(parallel); });
+		};
+
+		E_LOG(Info, "Transform hierarchy: %d nodes, %d levels. Build: %.3f ms", numNodes, hierarchy.GetNumLevels(), buildTime);
+		E_LOG(Info, "\tFull update: %.3f ms (serial) - %.3f ms (parallel)", MeasureFullUpdate(false), MeasureFullUpdate(true));
+		E_LOG(Info, "\t1%% moved: %.3f ms (serial) - %.3f ms (parallel)", MeasureUpdate(numNodes / 100, false), MeasureUpdate(numNodes / 100, true));
+		E_LOG(Info, "\tNothing moved: %.3f ms", MeasureUpdate(0, true));
+	}
+
+	// Times the SIMD kernel against the scalar reference and BoundingFrustum::Contains on random boxes.
+	static void BenchmarkFrustumCulling(int numInstances)
+	{
+		using namespace FrustumCulling;
+		if (numInstances <= 0)
+			return;
+
+		const uint32 count = (uint32)numInstances;
+		BoundsStream bounds;
+		bounds.Resize(count);
+		std::vector<BoundingBox> boxes(count);
+		for (uint32 i = 0; i < count; ++i)
+		{
+			boxes[i] = RandomBox();
+			bounds.Set(i, boxes[i]);
+		}
+
+		BoundingFrustum frustum = Math::CreateBoundingFrustum(Math::CreatePerspectiveMatrix(Math::PI_DIV_4, 16.0f / 9.0f, 0.1f, 300.0f));
+		Planes planes = GetPlanes(frustum);
+		const uint32 numWords = Math::AlignUp(count, BatchSize) / 32 + 1;
+		std::vector<uint32> simdResult(numWords), scalarResult(numWords), referenceResult(numWords);
+
+		constexpr uint32 NumIterations = 20;
+		float referenceTime = MeasureMs([&]()
+			{
+				for (uint32 i = 0; i < count; ++i)
+				{
+					if (frustum.Contains(boxes[i]))
+						referenceResult[i / 32] |= 1u << (i % 32);
+				}
+			}, NumIterations);
+		float scalarTime = MeasureMs([&]() { CullScalar(bounds, planes, scalarResult.data()); }, NumIterations);
+		float simdTime = MeasureMs([&]() { Cull(bounds, planes, simdResult.data()); }, NumIterations);
+
+		// Multiple views culled one by one versus in a single pass, as done for the main and shadow views
+		constexpr uint32 NumViews = 8;
+		std::vector<Planes> views(NumViews, planes);
+		std::vector<std::vector<uint32>> viewResults(NumViews, std::vector<uint32>(numWords));
+		std::vector<uint32*> viewOutputs;
+		for (std::vector<uint32>& viewResult : viewResults)
+			viewOutputs.push_back(viewResult.data());
+		float perViewTime = MeasureMs([&]()
+			{
+				for (uint32 view = 0; view < NumViews; ++view)
+					Cull(bounds, views[view], viewOutputs[view]);
+			}, NumIterations);
+		float multiViewTime = MeasureMs([&]() { CullViews(bounds, views, viewOutputs); }, NumIterations);
+
+		// The plane test is conservative, so it may keep boxes which the reference culls, but never the other way around
+		uint32 numMismatches = 0;
+		uint32 numVisible = 0;
+		uint32 numMissed = 0;
+		for (uint32 i = 0; i < count; ++i)
+		{
+			bool simd = (simdResult[i / 32] >> (i % 32)) & 1;
+			bool scalar = (scalarResult[i / 32] >> (i % 32)) & 1;
+			bool reference = (referenceResult[i / 32] >> (i % 32)) & 1;
+			numVisible += simd;
+			numMismatches += simd != scalar;
+			numMissed += reference && !simd;
+			for (const std::vector<uint32>& viewResult : viewResults)
+				numMismatches += simd != (bool)((viewResult[i / 32] >> (i % 32)) & 1);
+		}
+
+		E_LOG(Info, "Frustum culling %d instances (%d visible) - Contains: %.3f ms - Scalar: %.3f ms - SIMD: %.3f ms (%.1fx)",
+			count, numVisible, referenceTime, scalarTime, simdTime, Speedup(referenceTime, simdTime));
+		E_LOG(Info, "Frustum culling %d instances in %d views - Per view: %.3f ms - Multi view: %.3f ms", count, NumViews, perViewTime, multiViewTime);
+		Expect(numMismatches == 0 && numMissed == 0, "Frustum culling mismatch - SIMD vs Scalar: %d - Missed visible: %d", numMismatches, numMissed);
+	}
+
+	// Times building, refitting and querying the BVH against the linear SIMD culling kernel and brute force queries
+	static void BenchmarkBVH(int numInstances)
+	{
+		if (numInstances <= 0)
+			return;
+
+		const uint32 count = (uint32)numInstances;
+		std::vector<BoundingBox> boxes(count);
+		FrustumCulling::BoundsStream stream;
+		stream.Resize(count);
+		for (uint32 i = 0; i < count; ++i)
+		{
+			boxes[i] = RandomBox();
+			stream.Set(i, boxes[i]);
+		}
+
+		constexpr uint32 NumIterations = 20;
+		BVH bvh;
+		float buildTime = MeasureMs([&]() { bvh.Build(boxes); }, NumIterations);
+
+		// Move all instances a bit for a full refit, and 1% of them for an incremental refit
+		for (BoundingBox& box : boxes)
+			box.Center = Vector3(box.Center) + Vector3(Math::RandomRange(-1.0f, 1.0f), 0.0f, Math::RandomRange(-1.0f, 1.0f));
+		float refitTime = MeasureMs([&]() { bvh.Refit(boxes); }, NumIterations);
+		std::vector<uint32> changed;
+		for (uint32 i = 0; i < count; i += 100)
+		{
+			boxes[i].Center = Vector3(boxes[i].Center) + Vector3(Math::RandomRange(-1.0f, 1.0f), 0.0f, Math::RandomRange(-1.0f, 1.0f));
+			changed.push_back(i);
+		}
+		float incrementalRefitTime = MeasureMs([&]() { bvh.Refit(boxes, changed); }, NumIterations);
+		for (uint32 i = 0; i < count; ++i)
+			stream.Set(i, boxes[i]);
+
+		// Frustum culling compared to the linear SIMD kernel
+		BoundingFrustum frustum = Math::CreateBoundingFrustum(Math::CreatePerspectiveMatrix(Math::PI_DIV_4, 16.0f / 9.0f, 0.1f, 300.0f));
+		FrustumCulling::Planes planes = FrustumCulling::GetPlanes(frustum);
+		const uint32 numWords = Math::AlignUp(count, FrustumCulling::BatchSize) / 32 + 1;
+		std::vector<uint32> linearResult(numWords), bvhResult(numWords);
+		float linearCullTime = MeasureMs([&]() { FrustumCulling::Cull(stream, planes, linearResult.data()); }, NumIterations);
+		float bvhCullTime = MeasureMs([&]()
+			{
+				std::fill(bvhResult.begin(), bvhResult.end(), 0u);
+				bvh.Cull(planes, bvhResult.data());
+			}, NumIterations);
+		uint32 numCullMismatches = 0;
+		for (uint32 i = 0; i < count; ++i)
+			numCullMismatches += ((linearResult[i / 32] ^ bvhResult[i / 32]) >> (i % 32)) & 1;
+
+		// Ray casts compared to testing every box
+		constexpr uint32 NumQueries = 1000;
+		std::vector<Ray> rays(NumQueries);
+		for (Ray& ray : rays)
+		{
+			ray.position = Vector3(Math::RandomRange(-500.0f, 500.0f), Math::RandomRange(-50.0f, 50.0f), Math::RandomRange(-500.0f, 500.0f));
+			ray.direction = Vector3(Math::RandomRange(-1.0f, 1.0f), Math::RandomRange(-0.2f, 0.2f), Math::RandomRange(-1.0f, 1.0f));
+			ray.direction.Normalize();
+		}
+		constexpr float MaxRayDistance = 2000.0f;
+		std::vector<float> bruteForceDistances(NumQueries), bvhDistances(NumQueries);
+		float bruteForceRayTime = MeasureMs([&]()
+			{
+				for (uint32 query = 0; query < NumQueries; ++query)
+				{
+					float closest = MaxRayDistance;
+					for (const BoundingBox& box : boxes)
+					{
+						float distance;
+						// Rays starting inside a box hit it at a distance of 0
+						if (box.Intersects(rays[query].position, rays[query].direction, distance) && Math::Max(distance, 0.0f) < closest)
+							closest = Math::Max(distance, 0.0f);
+					}
+					bruteForceDistances[query] = closest;
+				}
+			});
+		float bvhRayTime = MeasureMs([&]()
+			{
+				for (uint32 query = 0; query < NumQueries; ++query)
+					bvh.RayCast(rays[query], MaxRayDistance, bvhDistances[query]);
+			});
+		uint32 numRayMismatches = 0;
+		for (uint32 query = 0; query < NumQueries; ++query)
+			numRayMismatches += fabsf(bruteForceDistances[query] - bvhDistances[query]) > 1.0e-2f;
+
+		// Overlap queries compared to testing every box
+		std::vector<BoundingBox> queryBoxes(NumQueries);
+		for (BoundingBox& queryBox : queryBoxes)
+		{
+			queryBox = RandomBox();
+			queryBox.Extents = Vector3(queryBox.Extents) * 5.0f;
+		}
+		uint32 numBruteForceOverlaps = 0;
+		uint32 numBVHOverlaps = 0;
+		std::vector<uint32> overlaps;
+		float bruteForceOverlapTime = MeasureMs([&]()
+			{
+				for (const BoundingBox& queryBox : queryBoxes)
+				{
+					for (const BoundingBox& box : boxes)
+						numBruteForceOverlaps += queryBox.Intersects(box);
+				}
+			});
+		float bvhOverlapTime = MeasureMs([&]()
+			{
+				for (const BoundingBox& queryBox : queryBoxes)
+				{
+					overlaps.clear();
+					bvh.QueryOverlap(queryBox, overlaps);
+					numBVHOverlaps += (uint32)overlaps.size();
+				}
+			});
+
+		E_LOG(Info, "BVH over %d instances (%d nodes) - Build: %.3f ms - Refit: %.3f ms - Refit %d changed: %.3f ms",
+			count, bvh.GetNumNodes(), buildTime, refitTime, (uint32)changed.size(), incrementalRefitTime);
+		E_LOG(Info, "BVH frustum culling - Linear SIMD: %.3f ms - BVH: %.3f ms", linearCullTime, bvhCullTime);
+		E_LOG(Info, "BVH %d ray casts - Brute force: %.3f ms - BVH: %.3f ms", NumQueries, bruteForceRayTime, bvhRayTime);
+		E_LOG(Info, "BVH %d overlap queries - Brute force: %.3f ms - BVH: %.3f ms", NumQueries, bruteForceOverlapTime, bvhOverlapTime);
+		Expect(numCullMismatches == 0 && numRayMismatches == 0 && numBruteForceOverlaps == numBVHOverlaps, "BVH mismatch - Culling: %d - Ray casts: %d - Overlaps: %d vs %d",
+			numCullMismatches, numRayMismatches, numBruteForceOverlaps, numBVHOverlaps);
+	}
+
+	// Times the radix sort of the batches against the comparison based sort it replaces
+	static void BenchmarkBatchSort(int numBatches)
+	{
+		if (numBatches <= 0)
+			return;
+
+		std::vector<Batch> batches(numBatches);
+		for (uint32 i = 0; i < (uint32)numBatches; ++i)
+		{
+			Batch& batch = batches[i];
+			batch.InstanceID = i;
+			batch.MaterialIndex = Math::RandomRange(0, 255);
+			batch.BlendMode = (Batch::Blending)(1 << Math::RandomRange(0, 2));
+			batch.pMesh = nullptr;
+			batch.Bounds.Center = RandomBox().Center;
+		}
+		const Vector3 viewLocation(10.0f, 5.0f, -20.0f);
+
+		auto CompareSort = [&viewLocation](const Batch& a, const Batch& b)
+		{
+			float aDist = Vector3::DistanceSquared(a.Bounds.Center, viewLocation);
+			float bDist = Vector3::DistanceSquared(b.Bounds.Center, viewLocation);
+			if (a.BlendMode != b.BlendMode)
+				return (int)a.BlendMode < (int)b.BlendMode;
+			return EnumHasAnyFlags(a.BlendMode, Batch::Blending::AlphaBlend) ? bDist < aDist : aDist < bDist;
+		};
+
+		std::vector<Batch> comparisonSorted = batches;
+		std::vector<Batch> radixSorted = batches;
+		float comparisonTime = MeasureMs([&]() { std::sort(comparisonSorted.begin(), comparisonSorted.end(), CompareSort); });
+		float radixTime = MeasureMs([&]() { Renderer::SortBatches(radixSorted, viewLocation); });
+
+		// Distances are quantized in the key, so batches at almost the same distance may swap
+		uint32 numMisordered = 0;
+		for (uint32 i = 1; i < (uint32)radixSorted.size(); ++i)
+			numMisordered += CompareSort(radixSorted[i], radixSorted[i - 1]);
+
+		E_LOG(Info, "Sorting %d batches - std::sort: %.3f ms - Radix sort: %.3f ms (%.1fx) - Misordered: %d",
+			numBatches, comparisonTime, radixTime, Speedup(comparisonTime, radixTime), numMisordered);
+	}
+
+	// Builds the hierarchy of a noisy grid and validates it offline:
+	// - Level 0 covers the source triangles, levels are sorted and clusters respect the meshlet limits.
+	// - Every parent error refers to a group of clusters on the next level, and every cluster above level 0 has children.
+	// - Errors and bounds only grow going up, also once projected, for a range of views.
+	// - Children and the clusters of their parent group always make opposite IsInCut() decisions, so the cut has no cracks.
+	static void TestMeshletLOD(int gridSize)
+	{
+		using namespace MeshletLOD;
+		gridSize = Math::Max(gridSize, 16);
+
+		std::vector<Vector3> positions;
+		for (uint32 y = 0; y <= (uint32)gridSize; ++y)
+		{
+			for (uint32 x = 0; x <= (uint32)gridSize; ++x)
+			{
+				uint32 hash = HashIndex(y * (gridSize + 1) + x);
+				float height = sinf(x * 0.2f) * cosf(y * 0.15f) * 2.0f + (float)((hash >> 8) % 1000) * 0.0001f;
+				positions.push_back(Vector3((float)x, height, (float)y));
+			}
+		}
+		std::vector<uint32> indices;
+		for (uint32 y = 0; y < (uint32)gridSize; ++y)
+		{
+			for (uint32 x = 0; x < (uint32)gridSize; ++x)
+			{
+				uint32 v = y * (gridSize + 1) + x;
+				indices.insert(indices.end(), { v, v + gridSize + 1, v + 1, v + 1, v + gridSize + 1, v + gridSize + 2 });
+			}
+		}
+
+		BuildSettings settings;
+		std::vector<Cluster> clusters;
+		Build(positions, indices, settings, clusters);
+		check(!clusters.empty());
+
+		// Clusters of a group share the bounds and error they were simplified into
+		auto GetKey = [](const BoundingSphere& bounds, float error)
+		{
+			const float values[] = { bounds.Center.x, bounds.Center.y, bounds.Center.z, bounds.Radius, error };
+			return Hash::Murmur3_128(values, sizeof(values));
+		};
+		std::unordered_map<Hash128, std::vector<uint32>> children;
+		std::unordered_map<Hash128, std::vector<uint32>> parents;
+
+		uint32 numLevels = 0;
+		uint32 numLevel0Triangles = 0;
+		for (uint32 i = 0; i < (uint32)clusters.size(); ++i)
+		{
+			const Cluster& cluster = clusters[i];
+			check(i == 0 || cluster.Level >= clusters[i - 1].Level, "Clusters are not sorted by level");
+			check(cluster.Vertices.size() <= settings.MaxVertices && cluster.Triangles.size() <= settings.MaxTriangles * 3, "Cluster %d is over the meshlet limits", i);
+			numLevels = Math::Max(numLevels, cluster.Level + 1);
+
+			if (cluster.Level == 0)
+			{
+				check(cluster.Error == 0.0f, "Level 0 cluster %d has an error", i);
+				numLevel0Triangles += (uint32)cluster.Triangles.size() / 3;
+			}
+			else
+			{
+				parents[GetKey(cluster.Bounds, cluster.Error)].push_back(i);
+			}
+
+			if (cluster.ParentError != FLT_MAX)
+			{
+				check(cluster.ParentError >= cluster.Error, "Cluster %d has a smaller error than its parent", i);
+				const float distance = Vector3::Distance(Vector3(cluster.Bounds.Center), Vector3(cluster.ParentBounds.Center));
+				check(distance + cluster.Bounds.Radius <= cluster.ParentBounds.Radius * 1.001f + 1.0e-4f, "Bounds of cluster %d are not inside its parent's", i);
+				children[GetKey(cluster.ParentBounds, cluster.ParentError)].push_back(i);
+			}
+		}
+		check(numLevel0Triangles == indices.size() / 3, "Level 0 has %d triangles instead of %d", numLevel0Triangles, (uint32)indices.size() / 3);
+		check(numLevels > 1, "No level was simplified");
+
+		for (const auto& group : children)
+		{
+			auto it = parents.find(group.first);
+			check(it != parents.end(), "Cluster %d has a parent error that no cluster has", group.second[0]);
+			for (uint32 parent : it->second)
+			{
+				for (uint32 child : group.second)
+					check(clusters[parent].Level == clusters[child].Level + 1, "Parent %d is not on the level after child %d", parent, child);
+			}
+		}
+		for (const auto& group : parents)
+			check(children.find(group.first) != children.end(), "Cluster %d has no children", group.second[0]);
+
+		// Views from close by to far away, and from the side
+		const float projectionScale = GetProjectionScale(Math::CreatePerspectiveMatrix(Math::PI_DIV_4, 16.0f / 9.0f, 0.1f, 1000.0f), 1080.0f);
+		const Vector3 center((float)gridSize * 0.5f, 0.0f, (float)gridSize * 0.5f);
+		constexpr float Threshold = 1.0f;
+		constexpr uint32 NumViews = 8;
+		std::vector<uint32> cutTriangles(NumViews);
+		for (uint32 view = 0; view < NumViews; ++view)
+		{
+			const Vector3 viewLocation = center + Vector3(0.0f, 1.0f, -1.0f) * (float)gridSize * 0.1f * (float)(1u << view);
+			const bool isOrthographic = view == NumViews - 1;
+
+			for (uint32 i = 0; i < (uint32)clusters.size(); ++i)
+			{
+				const Cluster& cluster = clusters[i];
+				if (cluster.ParentError != FLT_MAX)
+				{
+					check(ProjectError(cluster.Bounds, cluster.Error, viewLocation, projectionScale, isOrthographic) <=
+						ProjectError(cluster.ParentBounds, cluster.ParentError, viewLocation, projectionScale, isOrthographic),
+						"Projected error of cluster %d is larger than its parent's", i);
+				}
+				if (IsInCut(cluster, viewLocation, projectionScale, isOrthographic, Threshold))
+					cutTriangles[view] += (uint32)cluster.Triangles.size() / 3;
+			}
+
+			for (const auto& group : children)
+			{
+				const Cluster& firstChild = clusters[group.second[0]];
+				const bool parentTooCoarse = ProjectError(firstChild.ParentBounds, firstChild.ParentError, viewLocation, projectionScale, isOrthographic) > Threshold;
+				for (uint32 child : group.second)
+				{
+					const Cluster& cluster = clusters[child];
+					check((ProjectError(cluster.ParentBounds, cluster.ParentError, viewLocation, projectionScale, isOrthographic) > Threshold) == parentTooCoarse,
+						"Children of a group make different decisions");
+				}
+				for (uint32 parent : parents[group.first])
+				{
+					const Cluster& cluster = clusters[parent];
+					check((ProjectError(cluster.Bounds, cluster.Error, viewLocation, projectionScale, isOrthographic) > Threshold) == parentTooCoarse,
+						"Cluster %d and the children of its group make different decisions", parent);
+					const bool parentInCut = IsInCut(cluster, viewLocation, projectionScale, isOrthographic, Threshold);
+					for (uint32 child : group.second)
+						check(!parentInCut || !IsInCut(clusters[child], viewLocation, projectionScale, isOrthographic, Threshold), "Cluster %d and its child %d are both in the cut", parent, child);
+				}
+			}
+		}
+
+		E_LOG(Info, "Meshlet LOD: %d triangles - %d clusters in %d levels", (uint32)indices.size() / 3, (uint32)clusters.size(), numLevels);
+		for (uint32 view = 0; view < NumViews; ++view)
+			E_LOG(Info, "\tView %d (%s): %d triangles in the cut", view, view == NumViews - 1 ? "orthographic" : "perspective", cutTriangles[view]);
+	}
+
+	// Replays a synthetic request trace: a window of visible textures slides over all textures and loads complete a few frames later.
+	// Halfway through, the budget is lowered. Checks that upgrades never go over budget, that evictions are least recently requested first
+	// and never drop mips that are still requested, and that the visible textures settle at their requested mips.
+	static void TestTextureResidency(int numTextures)
+	{
+		numTextures = Math::Max(numTextures, 8);
+		constexpr uint32 LoadLatency = 3;
+		constexpr uint32 FramesPerStep = 4;
+		const uint32 windowSize = numTextures / 8;
+
+		TextureResidencyManager residency;
+
+		// Square textures from 256 to 2048, one byte per texel, with mips of 64x64 and smaller in the tail
+		struct TextureInfo
+		{
+			TextureResidencyManager::Handle Handle;
+			uint32 TailMip;
+			uint32 RequestedMip;
+			uint32 LastRequestFrame = 0;
+			uint32 LoadDoneFrame = 0;
+		};
+		std::vector<TextureInfo> textures(numTextures);
+		uint64 tailSize = 0;
+		uint64 streamedSize = 0;
+		for (uint32 i = 0; i < (uint32)numTextures; ++i)
+		{
+			uint32 numMips = 9 + (HashIndex(i) >> 8) % 4;
+			std::vector<uint64> mipSizes(numMips);
+			for (uint32 mip = 0; mip < numMips; ++mip)
+			{
+				uint64 size = 1ull << (numMips - 1 - mip);
+				mipSizes[mip] = size * size;
+			}
+			TextureInfo& texture = textures[i];
+			texture.TailMip = numMips - 7;
+			texture.RequestedMip = texture.TailMip;
+			texture.Handle = residency.Register(mipSizes, texture.TailMip);
+			for (uint32 mip = 0; mip < numMips; ++mip)
+				(mip < texture.TailMip ? streamedSize : tailSize) += mipSizes[mip];
+		}
+
+		// Fits the tails and about a quarter of the textures at full detail
+		const uint64 initialBudget = tailSize + streamedSize / 4;
+		const uint64 lowBudget = tailSize + streamedSize / 6;
+		residency.SetBudget(initialBudget);
+
+		const uint32 numSteps = numTextures - windowSize;
+		const uint32 numTraceFrames = numSteps * FramesPerStep;
+		const uint32 numFrames = numTraceFrames + residency.GracePeriod + numTextures;
+
+		uint32 numUpgrades = 0;
+		uint32 numEvictions = 0;
+		uint64 peakCommitted = 0;
+		std::vector<TextureResidencyManager::ResidencyChange> changes;
+		std::vector<uint32> evictionCandidates;
+		for (uint32 frame = 1; frame <= numFrames; ++frame)
+		{
+			if (frame == numTraceFrames / 2)
+				residency.SetBudget(lowBudget);
+
+			for (TextureInfo& texture : textures)
+			{
+				if (residency.IsPending(texture.Handle) && frame >= texture.LoadDoneFrame)
+					residency.Complete(texture.Handle, true);
+			}
+
+			// The window stops at the end of the trace so the last visible textures can settle
+			const uint32 windowStart = Math::Min(frame / FramesPerStep, numSteps);
+			for (uint32 i = windowStart; i < windowStart + windowSize; ++i)
+			{
+				TextureInfo& texture = textures[i];
+				texture.RequestedMip = Math::Min((i - windowStart) / 2, texture.TailMip);
+				texture.LastRequestFrame = frame;
+				residency.Request(texture.Handle, texture.RequestedMip, frame);
+			}
+
+			// Textures that may be evicted: not pending and resident at more detail than desired
+			auto GetDesiredMip = [&](const TextureInfo& texture)
+			{
+				return frame - texture.LastRequestFrame > residency.GracePeriod ? texture.TailMip : texture.RequestedMip;
+			};
+			evictionCandidates.clear();
+			for (uint32 i = 0; i < (uint32)numTextures; ++i)
+			{
+				const TextureInfo& texture = textures[i];
+				if (!residency.IsPending(texture.Handle) && GetDesiredMip(texture) > residency.GetResidentMip(texture.Handle))
+					evictionCandidates.push_back(i);
+			}
+
+			const uint64 committedBefore = residency.GetCommittedSize();
+			changes.clear();
+			residency.Update(frame, changes);
+
+			check(residency.GetCommittedSize() <= Math::Max(residency.GetBudget(), committedBefore), "Upgrades went over budget");
+			check(residency.GetNumPending() <= residency.MaxPendingChanges, "Too many changes in flight");
+			peakCommitted = Math::Max(peakCommitted, residency.GetCommittedSize());
+
+			uint32 lastEvictedFrame = 0;
+			for (const TextureResidencyManager::ResidencyChange& change : changes)
+			{
+				TextureInfo& texture = textures[change.Texture];
+				texture.LoadDoneFrame = frame + LoadLatency;
+				if (change.FirstMip < residency.GetResidentMip(change.Texture))
+				{
+					check(change.FirstMip >= GetDesiredMip(texture), "Upgraded past the requested mip");
+					++numUpgrades;
+					continue;
+				}
+
+				check(change.FirstMip == GetDesiredMip(texture), "Evicted mips that are still requested");
+				check(texture.LastRequestFrame >= lastEvictedFrame, "Evictions are not least recently requested first");
+				lastEvictedFrame = texture.LastRequestFrame;
+				++numEvictions;
+			}
+
+			// No candidate that was left resident is less recently requested than an evicted texture
+			for (uint32 i : evictionCandidates)
+			{
+				if (!residency.IsPending(textures[i].Handle))
+					check(textures[i].LastRequestFrame >= lastEvictedFrame, "Evicted a texture before a less recently requested one");
+			}
+		}
+
+		for (uint32 i = numSteps; i < numSteps + windowSize; ++i)
+			check(residency.GetResidentMip(textures[i].Handle) == textures[i].RequestedMip, "Visible texture %d didn't settle at its requested mip", i);
+		check(residency.GetCommittedSize() <= residency.GetBudget(), "Committed size didn't settle within the budget");
+
+		E_LOG(Info, "Texture residency: %d textures over %d frames - %d upgrades, %d evictions", numTextures, numFrames, numUpgrades, numEvictions);
+		E_LOG(Info, "\tPeak committed: %.1f MB - Budget: %.1f MB, lowered to %.1f MB", (float)peakCommitted * Math::BytesToMegaBytes,
+			(float)initialBudget * Math::BytesToMegaBytes, (float)lowBudget * Math::BytesToMegaBytes);
+	}
+
+	// Streams in the given number of meshes over frames, with builds and compactions going through the scheduler like in AccelerationStructure.
+	// Checks the budgets and the order of the builds, the size of the compaction batches and that the schedule is deterministic.
+	static void TestBLASScheduler(int numMeshes)
+	{
+		numMeshes = Math::Max(numMeshes, 1);
+		constexpr uint32 CompactionLatency = 3;
+
+		struct Result
+		{
+			std::vector<uint32> BuildOrder;
+			uint32 NumFrames = 0;
+			uint32 NumBatches = 0;
+			uint32 NumCompacted = 0;
+			uint32 NumOverBudget = 0;
+			float MaxBuildTimeMs = 0.0f;
+
+			bool operator==(const Result& other) const { return BuildOrder == other.BuildOrder && NumFrames == other.NumFrames; }
+		};
+
+		Result result = RunTwice("BLAS schedule", [&]()
+			{
+				BLASScheduler scheduler;
+				const BLASScheduler::Settings& settings = scheduler.GetSettings();
+
+				// A few very large meshes, and many small ones
+				std::vector<BLASScheduler::BuildRequest> builds(numMeshes);
+				std::vector<uint32> buildMeshes(numMeshes);
+				for (uint32 mesh = 0; mesh < (uint32)numMeshes; ++mesh)
+				{
+					uint32 hash = HashIndex(mesh);
+					BLASScheduler::BuildRequest& request = builds[mesh];
+					request.NumTriangles = hash % 97 == 0 ? 2'000'000 : 100 + (hash >> 8) % 50'000;
+					request.ScratchSize = request.NumTriangles * 64ull;
+					request.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+					request.Priority = (float)((hash >> 4) % 1000) / 1000.0f;
+					buildMeshes[mesh] = mesh;
+				}
+
+				std::vector<BLASScheduler::CompactionRequest> compactions;
+				uint32 batchDoneFrame = 0;
+				bool compactionInFlight = false;
+
+				Result result;
+				BLASScheduler::Schedule schedule;
+				while (!builds.empty() || !compactions.empty() || compactionInFlight)
+				{
+					++result.NumFrames;
+					check(result.NumFrames < 100'000, "Scheduler doesn't make progress");
+					if (compactionInFlight && result.NumFrames >= batchDoneFrame)
+						compactionInFlight = false;
+
+					scheduler.Update(builds, compactions, compactionInFlight, schedule);
+
+					float previousPriority = FLT_MAX;
+					for (uint32 requestIndex : schedule.Builds)
+					{
+						check(builds[requestIndex].Priority <= previousPriority, "Builds are not in priority order");
+						previousPriority = builds[requestIndex].Priority;
+						result.BuildOrder.push_back(buildMeshes[requestIndex]);
+					}
+					if (schedule.Builds.size() > 1)
+					{
+						check(schedule.BuildTimeMs <= settings.BuildBudgetMs, "Build time over budget: %.3f ms", schedule.BuildTimeMs);
+						check(schedule.ScratchSize <= settings.ScratchBudget, "Scratch memory over budget: %llu", schedule.ScratchSize);
+					}
+					else if (schedule.BuildTimeMs > settings.BuildBudgetMs)
+					{
+						++result.NumOverBudget;
+					}
+					result.MaxBuildTimeMs = Math::Max(result.MaxBuildTimeMs, schedule.BuildTimeMs);
+
+					if (!schedule.Compactions.empty())
+					{
+						check(schedule.Compactions.size() <= settings.MaxCompactionsPerBatch, "Compaction batch too large");
+						std::vector<uint32> batch = schedule.Compactions;
+						std::sort(batch.begin(), batch.end(), std::greater<uint32>());
+						for (uint32 requestIndex : batch)
+							compactions.erase(compactions.begin() + requestIndex);
+						result.NumCompacted += (uint32)batch.size();
+						++result.NumBatches;
+						compactionInFlight = true;
+						batchDoneFrame = result.NumFrames + CompactionLatency;
+					}
+
+					std::vector<uint32> built = schedule.Builds;
+					std::sort(built.begin(), built.end(), std::greater<uint32>());
+					for (uint32 requestIndex : built)
+					{
+						compactions.push_back({ builds[requestIndex].NumTriangles * 32ull, scheduler.GetFrame() });
+						builds.erase(builds.begin() + requestIndex);
+						buildMeshes.erase(buildMeshes.begin() + requestIndex);
+					}
+				}
+				return result;
+			});
+		check(result.BuildOrder.size() == (size_t)numMeshes && result.NumCompacted == (uint32)numMeshes);
+
+		E_LOG(Info, "BLAS scheduler: %d meshes built in %d frames - %d compaction batches (%.1f per batch)",
+			numMeshes, result.NumFrames, result.NumBatches, (float)result.NumCompacted / Math::Max(result.NumBatches, 1u));
+		E_LOG(Info, "\tMax estimated build time: %.3f ms - %d frames over budget by a single large build", result.MaxBuildTimeMs, result.NumOverBudget);
+	}
+
+	// Drives the scheduler over synthetic frames: a camera moving every frame with 4 cascades, and local views that each move now and then.
+	// Static casters change halfway, while the first local view is not scheduled.
+	// Checks the cascade update rates, the local view budget and its round-robin order, the update mode given the dynamic casters,
+	// and that only the view that wasn't scheduled when the static depth was invalidated is fully updated afterwards.
+	static void TestShadowScheduler(int numLocalViews)
+	{
+		numLocalViews = Math::Max(numLocalViews, 1);
+		constexpr uint32 NumCascades = 4;
+		constexpr uint32 NumFrames = 240;
+		constexpr uint32 InvalidateFrame = NumFrames / 2;
+
+		struct Result
+		{
+			std::vector<bool> Updates;
+			uint32 NumLocalUpdates = 0;
+			uint32 NumDynamicUpdates = 0;
+			uint32 MaxLocalWait = 0;
+
+			bool operator==(const Result& other) const { return Updates == other.Updates; }
+		};
+
+		Result result = RunTwice("Shadow schedule", [&]()
+			{
+				ShadowScheduler scheduler;
+				const ShadowScheduler::Settings& settings = scheduler.GetSettings();
+
+				// A moved view can be overtaken at most once by every other local view, as they then have a more recent update
+				const uint32 maxLocalWait = numLocalViews / settings.LocalViewBudget + 2;
+
+				std::vector<ShadowScheduler::ViewRequest> requests;
+				std::vector<ShadowScheduler::ScheduledView> views;
+				std::vector<uint32> cascadeLastUpdate(NumCascades, 0);
+				std::vector<uint32> cascadeNumUpdates(NumCascades, 0);
+				std::vector<Vector3> localPositions(numLocalViews);
+				// Frame the local view moved without being updated yet, 0 if it is up to date
+				std::vector<uint32> localMovedFrame(numLocalViews, 0);
+				std::vector<bool> hadDynamicCasters(NumCascades + numLocalViews, false);
+
+				Result result;
+				for (uint32 frame = 1; frame <= NumFrames; ++frame)
+				{
+					requests.clear();
+					for (uint32 cascade = 0; cascade < NumCascades; ++cascade)
+						requests.push_back({ cascade, ShadowScheduler::ViewType::Cascade, cascade, Matrix::CreateTranslation((float)frame, 0.0f, (float)cascade) });
+					for (uint32 i = 0; i < (uint32)numLocalViews; ++i)
+					{
+						if (frame > 1 && (HashIndex(i + frame * 31) >> 8) % 8 == 0)
+						{
+							localPositions[i].x += 1.0f;
+							if (localMovedFrame[i] == 0)
+								localMovedFrame[i] = frame;
+						}
+						if (frame == InvalidateFrame && i == 0)
+							continue;
+						requests.push_back({ NumCascades + i, ShadowScheduler::ViewType::Local, 0, Matrix::CreateTranslation(localPositions[i]) });
+					}
+
+					scheduler.Schedule(requests, views);
+					check(views.size() == requests.size());
+
+					const bool staticCastersChanged = frame == InvalidateFrame;
+					if (staticCastersChanged)
+						scheduler.InvalidateStaticDepth();
+
+					uint32 numLocalUpdates = 0;
+					uint32 numNewLocalViews = 0;
+					uint32 numWaitingLocalViews = 0;
+					for (uint32 r = 0; r < (uint32)requests.size(); ++r)
+					{
+						const ShadowScheduler::ViewRequest& request = requests[r];
+						const ShadowScheduler::ScheduledView& view = views[r];
+						check(view.Slot == request.Key, "View %d changed slot", request.Key);
+						check(!view.NeedsFullUpdate || !view.UsePreviousView, "View %d is updated with its previous matrix", request.Key);
+						result.Updates.push_back(view.NeedsFullUpdate);
+
+						if (request.Type == ShadowScheduler::ViewType::Cascade)
+						{
+							const uint32 cascade = request.CascadeIndex;
+							if (frame == 1 || cascade < settings.FullRateCascades)
+								check(view.NeedsFullUpdate, "Cascade %d is not updated every frame", cascade);
+							else
+								check(frame - cascadeLastUpdate[cascade] <= settings.DistantCascadeInterval, "Cascade %d is not updated every %d frames", cascade, settings.DistantCascadeInterval);
+							check(view.UsePreviousView != view.NeedsFullUpdate, "Cascade %d follows the camera without being updated", cascade);
+							if (view.NeedsFullUpdate)
+							{
+								cascadeLastUpdate[cascade] = frame;
+								++cascadeNumUpdates[cascade];
+							}
+						}
+						else
+						{
+							const uint32 i = request.Key - NumCascades;
+							const bool isNew = frame == 1 || (frame == InvalidateFrame + 1 && i == 0);
+							if (isNew)
+							{
+								check(view.NeedsFullUpdate, "Local view %d was never drawn but is not updated", i);
+								++numNewLocalViews;
+							}
+							else if (view.NeedsFullUpdate)
+							{
+								check(localMovedFrame[i] != 0, "Local view %d is updated without moving", i);
+								++numLocalUpdates;
+							}
+
+							if (view.NeedsFullUpdate)
+							{
+								localMovedFrame[i] = 0;
+							}
+							else if (localMovedFrame[i] != 0)
+							{
+								check(view.UsePreviousView, "Local view %d moved but is not updated", i);
+								const uint32 wait = frame - localMovedFrame[i];
+								check(wait <= maxLocalWait, "Local view %d waited %d frames", i, wait);
+								result.MaxLocalWait = Math::Max(result.MaxLocalWait, wait);
+								++numWaitingLocalViews;
+							}
+							else
+							{
+								check(!view.UsePreviousView, "Local view %d didn't move but uses its previous matrix", i);
+							}
+						}
+
+						// Dynamic casters come and go every few frames
+						const bool hasDynamicCasters = (HashIndex(request.Key + frame / 8) >> 12) % 3 == 0;
+						ShadowUpdateMode expectedMode = ShadowUpdateMode::None;
+						if (view.NeedsFullUpdate || staticCastersChanged)
+							expectedMode = ShadowUpdateMode::Full;
+						else if (hasDynamicCasters || hadDynamicCasters[request.Key])
+							expectedMode = settings.CacheStaticDepth ? ShadowUpdateMode::Dynamic : ShadowUpdateMode::Full;
+						ShadowUpdateMode mode = scheduler.GetUpdateMode(view, hasDynamicCasters, staticCastersChanged);
+						check(mode == expectedMode, "View %d has update mode %d instead of %d", request.Key, (int)mode, (int)expectedMode);
+						hadDynamicCasters[request.Key] = hasDynamicCasters;
+						if (mode == ShadowUpdateMode::Dynamic)
+							++result.NumDynamicUpdates;
+					}
+
+					check(numLocalUpdates <= settings.LocalViewBudget, "%d local views updated, over the budget of %d", numLocalUpdates, settings.LocalViewBudget);
+					check(numWaitingLocalViews == 0 || numLocalUpdates + numNewLocalViews >= settings.LocalViewBudget, "Local views are waiting while the budget isn't used");
+					result.NumLocalUpdates += numLocalUpdates;
+				}
+
+				const uint32 interval = Math::Max(settings.DistantCascadeInterval, 1u);
+				for (uint32 cascade = settings.FullRateCascades; cascade < NumCascades; ++cascade)
+					check(cascadeNumUpdates[cascade] >= NumFrames / interval, "Cascade %d is updated %d times in %d frames", cascade, cascadeNumUpdates[cascade], NumFrames);
+				check(scheduler.GetNumSlots() == NumCascades + numLocalViews);
+				return result;
+			});
+
+		E_LOG(Info, "Shadow scheduler: %d cascades and %d local views over %d frames", NumCascades, numLocalViews, NumFrames);
+		E_LOG(Info, "\tLocal view updates: %d (%.1f per frame) - Max wait: %d frames - Dynamic caster updates: %d",
+			result.NumLocalUpdates, (float)result.NumLocalUpdates / NumFrames, result.MaxLocalWait, result.NumDynamicUpdates);
+	}
+}
+
+namespace Tweakables
+{
+	// Benchmarks of the scene, run by the renderer on the next frame
+	extern int g_BenchmarkSceneFlattening;
+	extern int g_BenchmarkAnimation;
+	extern bool g_BenchmarkShaderCompile;
+
+	ConsoleCommand<int> gTestTextureResidency("TestTextureResidency", [](int numTextures) { SelfTests::TestTextureResidency(numTextures); });
+	ConsoleCommand<int> gTestBLASScheduler("TestBLASScheduler", [](int numMeshes) { SelfTests::TestBLASScheduler(numMeshes); });
+	ConsoleCommand<int> gTestShadowScheduler("TestShadowScheduler", [](int numLocalViews) { SelfTests::TestShadowScheduler(numLocalViews); });
+	ConsoleCommand<int> gTestMeshletLOD("TestMeshletLOD", [](int gridSize) { SelfTests::TestMeshletLOD(gridSize); });
+	ConsoleCommand<int> gTestPipelineCache("TestPipelineCache", [](int numPipelines) { SelfTests::TestPipelineCache(numPipelines); });
+	ConsoleCommand<int> gTestStreamingUploader("TestStreamingUploader", [](int numUploads) { SelfTests::TestStreamingUploader(numUploads); });
+
+	ConsoleCommand<int> gBenchmarkFrustumCulling("BenchmarkFrustumCulling", [](int numInstances) { SelfTests::BenchmarkFrustumCulling(numInstances); });
+	ConsoleCommand<int> gBenchmarkBVH("BenchmarkBVH", [](int numInstances) { SelfTests::BenchmarkBVH(numInstances); });
+	ConsoleCommand<int> gBenchmarkBatchSort("BenchmarkBatchSort", [](int numBatches) { SelfTests::BenchmarkBatchSort(numBatches); });
+	ConsoleCommand<int> gBenchmarkTransformHierarchy("BenchmarkTransformHierarchy", [](int numNodes) { SelfTests::BenchmarkTransformHierarchy(numNodes); });
+	ConsoleCommand<int> gBenchmarkTLSFAllocator("BenchmarkTLSFAllocator", [](int numAllocations) { SelfTests::BenchmarkTLSFAllocator(numAllocations); });
+	ConsoleCommand<int> gBenchmarkResourceStateTracking("BenchmarkResourceStateTracking", [](int numResources) { SelfTests::BenchmarkResourceStateTracking(numResources); });
+	ConsoleCommand<int> gBenchmarkDescriptorAllocator("BenchmarkDescriptorAllocator", [](int numThreads) { SelfTests::BenchmarkDescriptorAllocator(numThreads); });
+
+	ConsoleCommand<int> gBenchmarkSceneFlattening("BenchmarkSceneFlattening", [](int numInstances) { g_BenchmarkSceneFlattening = numInstances; });
+	ConsoleCommand<int> gBenchmarkAnimation("BenchmarkAnimation", [](int numCharacters) { g_BenchmarkAnimation = numCharacters; });
+	ConsoleCommand<> gBenchmarkShaderCompile("BenchmarkShaderCompile", []() { g_BenchmarkShaderCompile = true; });
+}